@@ -0,0 +1,27 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "common.h"
+#include "parser.h"
+
+/**
+ * Translate a parsed program, and every module it imports, to a standalone
+ * C source file. The output includes "runtime.h" and links against
+ * bin/libgemini.a, e.g.:
+ *
+ *     gemini --emit-c job.c job.gemini
+ *     gcc -O2 -Iinclude job.c bin/libgemini.a -pthread -lm -o job
+ *
+ * Variables become C locals/globals, functions become C functions with
+ * inline int fast paths; strings, arrays, maps and builtins go through the
+ * runtime. Imports are resolved at translation time (GEMINI_PATH, then the
+ * current directory). Constructs that need the interpreter's dynamic
+ * environments (nested function definitions, imports inside functions,
+ * method calls on non-module values) are reported as errors.
+ * @param ast Root AST node of the main program
+ * @param path Path of the main program (recorded in the output header)
+ * @param out Destination for the generated C source
+ */
+void emitC(Node* ast, const char* path, FILE* out);
+
+#endif // AOT_H
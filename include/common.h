@@ -6,6 +6,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <setjmp.h>
 
 // Define token types for lexer
 typedef enum {
@@ -52,9 +53,48 @@ typedef struct {
     const char* start;
     int length;
     int line;
+    unsigned int hash;      // hashString(start, length) for identifiers, 0: not computed
 } Token;
 
 // Error reporting
 void error(const char* message, int line);
 
+/**
+ * Hash a byte string for the interpreter's hash tables (variables,
+ * functions, modules, map keys). Reads 8 bytes at a time and is seeded once
+ * per process from the OS random source (or GEMINI_HASH_SEED), so keys
+ * chosen from outside cannot be made to collide on purpose.
+ * @param key Bytes to hash
+ * @param length Number of bytes
+ * @return Hash value, never 0
+ */
+unsigned int hashString(const char* key, size_t length);
+
+/**
+ * Hash an int map key with the same per-process seed
+ * @param key Key
+ * @return Hash value, never 0
+ */
+unsigned int hashInt(int key);
+
+// Recovery point for error(). While a context is pushed on the current
+// thread, error() records the message and longjmps back to it instead of
+// printing and exiting the process (used by the embedding API).
+typedef struct ErrorContext {
+    jmp_buf jump;
+    char message[256];
+    int line;
+    struct ErrorContext* previous;
+} ErrorContext;
+
+/**
+ * Make error() on this thread return to ctx (call setjmp(ctx->jump) first)
+ */
+void pushErrorContext(ErrorContext* ctx);
+
+/**
+ * Remove the innermost error context of this thread
+ */
+void popErrorContext(ErrorContext* ctx);
+
 #endif // COMMON_H
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include "vm.h"
+
+// CSV and TSV for the csvRead() built-in.
+//
+// Fields are separated by one character; a field in double quotes may
+// contain the separator, newlines and doubled quotes (""), as in RFC 4180.
+// "\r\n" line ends are accepted.
+//
+// Row mode reads a file record by record through a CSV reader handle
+// (fileio.h) and splits each record into an array of strings. Column mode
+// maps the whole file and walks it once to learn each column's type,
+// parsing numbers as it goes: a column whose fields are all ints becomes
+// an array of ints, all numbers an array of floats (empty fields are NaN),
+// anything else an array of strings, filled by a second walk. Plain fields
+// are found 8 bytes at a time.
+
+/**
+ * Split one record into its fields
+ * @param text Record text, without its line terminator
+ * @param length Record length
+ * @param separator Field separator
+ * @param line Line for error messages
+ * @return Array of strings (empty for an empty record)
+ */
+Value csvSplitRecord(const char* text, size_t length, char separator, int line);
+
+/**
+ * Load a CSV file column by column
+ * @param path File path ("-" reads standard input)
+ * @param separator Field separator
+ * @param header Take column names from the first record; otherwise the
+ *               columns are keyed 0, 1, 2, ...
+ * @param line Line for error messages
+ * @return Map from column name (or index) to array of the column's values
+ */
+Value csvReadColumns(const char* path, char separator, bool header, int line);
+
+#endif // CSV_H
@@ -0,0 +1,146 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include "common.h"
+
+// Open file handle (Gemini `file` value).
+//
+// Readers created by readLines() map regular files with mmap and scan them
+// with memchr; pipes and other non-seekable inputs are read in large
+// blocks. Either way memory use stays constant however large the file is.
+// Writers collect output in a 64KB buffer; writers still open at exit are
+// flushed automatically.
+typedef struct FileHandle FileHandle;
+
+// Size of the block buffer used by writers and non-mmap readers
+#define FILE_BUFFER_SIZE (64 * 1024)
+
+// Mapped input already consumed is dropped from the page cache mapping in
+// chunks of this size, keeping resident memory flat on multi-GB files
+#define FILE_RELEASE_CHUNK (16 * 1024 * 1024)
+
+/**
+ * Open a file for line-by-line reading
+ * @param path File path ("-" reads standard input)
+ * @return Handle, or NULL if the file cannot be opened
+ */
+FileHandle* fileOpenLines(const char* path);
+
+/**
+ * Open a CSV file for record-by-record reading. Records are read like
+ * lines, except that newlines inside double-quoted fields do not end them
+ * and blank lines are skipped.
+ * @param path File path ("-" reads standard input)
+ * @param separator Field separator
+ * @return Handle, or NULL if the file cannot be opened
+ */
+FileHandle* fileOpenCsv(const char* path, char separator);
+
+/**
+ * Open a file for writing
+ * @param path File path
+ * @param append Append to an existing file instead of truncating it
+ * @return Handle, or NULL if the file cannot be opened
+ */
+FileHandle* fileOpenWrite(const char* path, bool append);
+
+/**
+ * Whether another line can be read
+ */
+bool fileHasNext(FileHandle* file);
+
+/**
+ * Read the next line (without its "\n" or "\r\n" terminator)
+ * @param file Reader handle
+ * @param length Receives the line length
+ * @return Pointer to the line text, valid until the next call on this
+ *         handle; NULL at end of input
+ */
+const char* fileNextLine(FileHandle* file, size_t* length);
+
+/**
+ * Append bytes to a writer
+ * @return false on write error
+ */
+bool fileWrite(FileHandle* file, const char* chars, size_t length);
+
+/**
+ * Flush a writer's buffer to disk
+ * @return false on write error
+ */
+bool fileFlush(FileHandle* file);
+
+/**
+ * Flush and release a handle's resources (the handle itself stays valid
+ * and reports closed)
+ */
+void fileClose(FileHandle* file);
+
+/**
+ * Field separator of a CSV reader (0 for other handles)
+ */
+char fileSeparator(FileHandle* file);
+
+/**
+ * Flush every open writer (also done at exit)
+ */
+void fileFlushAll(void);
+
+/**
+ * Close every open handle of the process, e.g. those a served run left
+ * open (handles stay valid and report closed)
+ */
+void fileCloseAll(void);
+
+/**
+ * Whether the handle reads (readLines) rather than writes
+ */
+bool fileIsReader(FileHandle* file);
+
+/**
+ * Whether the handle has been closed
+ */
+bool fileIsClosed(FileHandle* file);
+
+/**
+ * Path the handle was opened with
+ */
+const char* filePath(FileHandle* file);
+
+// Whole input file held in memory: mapped for regular files, read into a
+// buffer for pipes and standard input
+typedef struct {
+    char* data;
+    size_t size;
+    bool mapped;
+    size_t released;        // prefix already dropped with fileReleaseBefore
+} FileContents;
+
+/**
+ * Load a whole file for reading
+ * @param path File path ("-" reads standard input)
+ * @param contents Receives the data; release it with fileReleaseAll
+ * @return false if the file cannot be opened
+ */
+bool fileLoadAll(const char* path, FileContents* contents);
+
+/**
+ * Tell the kernel that the mapped data before offset will not be read
+ * again, keeping resident memory flat while a large file is scanned. Acts
+ * in FILE_RELEASE_CHUNK steps; does nothing for buffered contents.
+ */
+void fileReleaseBefore(FileContents* contents, size_t offset);
+
+/**
+ * Unmap or free loaded contents
+ */
+void fileReleaseAll(FileContents* contents);
+
+/**
+ * Replace a file's contents. The data goes to a temporary file next to it
+ * that is renamed over the target, so readers never see a partial file.
+ * @return false if the file cannot be written
+ */
+bool fileSaveAll(const char* path, const char* data, size_t length);
+
+#endif // FILEIO_H
@@ -0,0 +1,102 @@
+#ifndef GEMINI_H
+#define GEMINI_H
+
+// Embedding API (bin/libgemini.a, bin/libgemini.so).
+//
+// Each GeminiVM is fully isolated: it owns its globals, functions, module
+// cache and loaded programs, so any number of VMs can live in one process
+// and VMs on different threads run independently. Errors never exit the
+// process; they are reported through GeminiStatus and geminiErrorMessage().
+//
+//     GeminiVM* vm = geminiNewVM();
+//     if (geminiLoadFile(vm, "pricing.gemini") != GEMINI_OK) {
+//         fprintf(stderr, "%s\n", geminiErrorMessage(vm));
+//     }
+//     Value args[2] = {INT_VAL(3), geminiString("gold")};
+//     Value result;
+//     if (geminiCall(vm, "price", args, 2, &result) == GEMINI_OK && IS_INT(result)) {
+//         printf("%d\n", AS_INT(result));
+//     }
+//     geminiFreeVM(vm);
+
+#include "vm.h"
+
+typedef struct GeminiVM GeminiVM;
+
+typedef enum {
+    GEMINI_OK = 0,
+    GEMINI_ERROR = 1
+} GeminiStatus;
+
+/**
+ * Create a VM. Modules are searched under the current directory (see
+ * geminiSetProjectRoot) after GEMINI_PATH.
+ * @return New VM, or NULL if out of memory
+ */
+GeminiVM* geminiNewVM(void);
+
+/**
+ * Destroy a VM and everything it loaded
+ */
+void geminiFreeVM(GeminiVM* vm);
+
+/**
+ * Parse a program and run its top-level code (defining its functions)
+ * @param vm VM
+ * @param source Program text (copied)
+ * @return GEMINI_OK, or GEMINI_ERROR with the message in geminiErrorMessage()
+ */
+GeminiStatus geminiLoad(GeminiVM* vm, const char* source);
+
+/**
+ * Read, parse and run a program file
+ * @param vm VM
+ * @param path Path of the .gemini file
+ */
+GeminiStatus geminiLoadFile(GeminiVM* vm, const char* path);
+
+/**
+ * Call a function defined by a loaded program
+ * @param vm VM
+ * @param name Function name
+ * @param args Arguments (string arguments become owned by the VM; create
+ *             them with geminiString)
+ * @param argCount Number of arguments
+ * @param result Receives the return value (may be NULL)
+ */
+GeminiStatus geminiCall(GeminiVM* vm, const char* name, Value* args, int argCount, Value* result);
+
+/**
+ * Message of the last error ("" if none)
+ */
+const char* geminiErrorMessage(GeminiVM* vm);
+
+/**
+ * Source line of the last error (0 if unknown)
+ */
+int geminiErrorLine(GeminiVM* vm);
+
+/**
+ * Redirect print output of this VM (NULL restores buffered stdout)
+ * @param vm VM
+ * @param output Called once per printed line, including its "\n"
+ * @param user Passed to output
+ */
+void geminiSetOutput(GeminiVM* vm, OutputFn output, void* user);
+
+/**
+ * Directory searched recursively for imported modules
+ */
+void geminiSetProjectRoot(GeminiVM* vm, const char* directory);
+
+/**
+ * Enable the baseline JIT for this VM (ignored where unsupported)
+ */
+void geminiEnableJit(GeminiVM* vm, bool enabled);
+
+/**
+ * Create a heap string value to pass as an argument
+ */
+Value geminiString(const char* text);
+
+#endif // GEMINI_H
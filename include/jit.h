@@ -0,0 +1,54 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "common.h"
+#include "parser.h"
+
+// Invocations plus loop back-edges after which a function is compiled
+#define JIT_HOT_THRESHOLD 1000
+
+// Parameters plus locals of a compiled function (more is not compilable)
+#define JIT_MAX_LOCALS 64
+
+/**
+ * Native entry point of a compiled function.
+ * @param args Integer arguments (one per parameter)
+ * @param result Receives the integer return value on success
+ * @param depth Current call depth (compiled code deopts past CALL_STACK_MAX)
+ * @return 0 on success, non-zero if the caller must deoptimize and re-run
+ *         the call in the interpreter
+ */
+typedef int (*JitEntry)(const int* args, int* result, int depth);
+
+// Compiled machine code for one function
+typedef struct {
+    JitEntry entry;     // Start of executable code
+    void* memory;       // mmap'd region holding the code
+    size_t size;        // Size of the mapping
+} JitCode;
+
+/**
+ * Whether the baseline JIT is supported on this platform (x86-64 Linux)
+ */
+bool jitAvailable(void);
+
+/**
+ * Compile a function body to native code.
+ * Only pure integer functions are supported: int parameters and locals,
+ * arithmetic and comparisons, if/while/for, return, and calls to the
+ * function itself. Anything else makes the function non-compilable.
+ * @param name Function name (used to recognise self-recursive calls)
+ * @param params Parameter names
+ * @param paramCount Number of parameters
+ * @param body Function body block
+ * @return Compiled code, or NULL if the function cannot be compiled
+ */
+JitCode* jitCompile(Token name, Token* params, int paramCount, Node* body);
+
+/**
+ * Release compiled code
+ * @param code Code returned by jitCompile
+ */
+void jitFree(JitCode* code);
+
+#endif // JIT_H
@@ -0,0 +1,58 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "vm.h"
+
+// JSON for the jsonParse(), jsonStringify() and jsonEach() built-ins.
+//
+// Objects become maps (keys in document order) and arrays become arrays.
+// Numbers without a fraction or exponent that fit in an int become ints,
+// all others floats. true/false become bools, and null becomes a null
+// string, which jsonStringify writes back as null.
+//
+// The parser is a single recursive-descent pass that builds values
+// directly. String bodies are scanned 8 bytes at a time for the next quote,
+// backslash or control character, and unescaped strings are copied with one
+// memcpy. jsonEach() parses a file mapped with mmap, materializes only the
+// elements of the selected array, and releases the mapping behind the
+// cursor, so the document is never held in memory as a whole.
+
+/**
+ * Parse a JSON document. Syntax errors are reported with error().
+ * @param text Document bytes
+ * @param length Document length
+ * @param line Line for error messages
+ * @return The document's value
+ */
+Value jsonParse(const char* text, size_t length, int line);
+
+/**
+ * Encode a value as JSON. Int map keys are written as strings; modules,
+ * files, pmaps and nesting deeper than JSON_MAX_DEPTH (e.g. a cycle) are
+ * errors.
+ * @param value Value to encode
+ * @param indent Spaces per nesting level (0: compact, on one line)
+ * @param line Line for error messages
+ * @return malloc'd NUL-terminated text
+ */
+char* jsonStringify(Value value, int indent, int line);
+
+// Deepest nesting of arrays and objects accepted by the parser and encoder
+#define JSON_MAX_DEPTH 512
+
+// Called by jsonEachFile for each element of the selected array
+typedef void (*JsonItemFn)(void* user, Value item);
+
+/**
+ * Stream the elements of an array inside a JSON file
+ * @param path File path ("-" reads standard input)
+ * @param selector Dot-separated object keys leading from the root to the
+ *                 array ("" selects the root itself)
+ * @param fn Called with each element, in order
+ * @param user Passed to fn
+ * @param line Line for error messages
+ * @return Number of elements
+ */
+int jsonEachFile(const char* path, const char* selector, JsonItemFn fn, void* user, int line);
+
+#endif // JSON_H
@@ -0,0 +1,52 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "vm.h"
+
+// Standard modules implemented in C.
+//
+// `import math as m;` and `import stats as s;` bind these modules; their
+// names are resolved before GEMINI_PATH and the project tree are searched,
+// so a script file with the same name is never loaded. Calls such as
+// m.sqrt(x) go straight to the C function, without an environment or call
+// frame.
+//
+//  math   sqrt(x), pow(x, y), floor(x), abs(x), min(...), max(...)
+//  stats  sum(arr), mean(arr), variance(arr), stddev(arr),
+//         percentile(arr, p), histogram(arr, bins [, lo, hi])
+//
+// min/max take two or more numbers or one array. The stats functions take
+// an array of ints and floats and walk it once, keeping several independent
+// accumulators so the loop is not serialized on one running total.
+
+// Native function: called with the evaluated arguments
+typedef Value (*NativeFn)(Value* args, int argc, int line);
+
+typedef struct {
+    const char* name;
+    NativeFn fn;
+} NativeFunction;
+
+struct NativeModule {
+    const char* name;
+    const NativeFunction* functions;    // terminated by a NULL name
+};
+
+/**
+ * Find a native module by import name
+ * @param name Module name (not NUL-terminated)
+ * @param length Name length
+ * @return The module, or NULL if there is no native module of that name
+ */
+const NativeModule* findNativeModule(const char* name, int length);
+
+/**
+ * Find a function of a native module
+ * @param module Module returned by findNativeModule
+ * @param name Function name (not NUL-terminated)
+ * @param length Name length
+ * @return The function, or NULL if the module has none of that name
+ */
+NativeFn findNativeFunction(const NativeModule* module, const char* name, int length);
+
+#endif // NATIVE_H
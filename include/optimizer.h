@@ -0,0 +1,66 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "parser.h"
+
+// AST optimizer run between parsing and execution.
+//
+//  -O0  no changes
+//  -O1  constant folding of numeric literals, removal of branches and loops
+//       whose condition is constant, removal of statements after `return`,
+//       counted `for` loops run with a native counter, chains of `+` with a
+//       string literal operand built as one concatenation
+//  -O2  also loop-invariant code motion out of loop conditions and removal
+//       of unused computations that cannot fail
+//
+// Every transformation preserves the program's output and errors.
+// Invariant expressions are hoisted into hidden variables named $licmN,
+// declared just before the loop. A hoisted `s.length` is guarded: it is
+// reused only while `s` still holds a string (strings are immutable) and is
+// recomputed otherwise.
+//
+// Type inference (-O1 and above) runs on every function: a local declared
+// with `var` whose writes all have the same numeric type gets that type,
+// and expressions over such locals are marked (Node.staticType) so the VM
+// evaluates them unboxed. Parameters, globals and module variables stay
+// untyped. Index expressions a[i] in counted loops over length(a) are
+// marked in bounds when the loop cannot shrink the array.
+//
+// A left-nested chain `a + b + c + ...` of three or more operands, one of
+// them a string literal, whose operands call nothing but built-ins that
+// cannot run user code, is marked on its root (Node.binary.concatCount).
+// The VM then evaluates the operands left to right, adds any leading
+// non-string operands as before, and writes the text of the rest into one
+// buffer sized by a first pass, instead of allocating every intermediate
+// string.
+//
+// Inlining happens when functions are defined (at -O1 and above): a
+// function whose body is `return <expr>;`, with expr a small calculation
+// over its parameters only (no calls, no other variables), is run at its
+// call sites by evaluating expr directly, without creating an environment
+// or call frame. Call resolution is unchanged, so this also applies to
+// `module.fn(...)` calls and always runs the function the call names.
+
+#define OPT_LEVEL_DEFAULT 1
+#define OPT_LEVEL_MAX 2
+// Size budget (expression nodes) for inlined function bodies
+#define INLINE_MAX_NODES 24
+
+/**
+ * Optimize a parsed program in place
+ * @param ast Program returned by parse()
+ * @param level Optimization level (0 to OPT_LEVEL_MAX)
+ * @param dump Report each transformation on stderr
+ */
+void optimize(Node* ast, int level, bool dump);
+
+/**
+ * Inline form of a function definition
+ * @param function NODE_STMT_FUNCTION node
+ * @param dump Report the function on stderr when it is inlinable
+ * @return Copy of the returned expression with parameters replaced by
+ *         NODE_EXPR_PARAM nodes (caller frees with freeAST), or NULL
+ */
+Node* inlineBody(Node* function, bool dump);
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,66 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "common.h"
+
+// Buffered program output (stdout).
+//
+// print writes into a 64KB user-space buffer that is written to file
+// descriptor 1 when full, on flush(), on error and at exit. When stdout is
+// a terminal the buffer is flushed after every print, like a line-buffered
+// stream; `--unbuffered` forces that behaviour for pipes and files too.
+
+// Output buffer size in bytes
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Longest text produced by formatInt/formatDouble (including the NUL)
+#define FORMAT_NUMBER_MAX 32
+
+/**
+ * Configure output buffering
+ * @param unbuffered Flush after every print even when stdout is not a terminal
+ */
+void outInit(bool unbuffered);
+
+/**
+ * Append bytes to the output buffer
+ * @param chars Bytes to write
+ * @param length Number of bytes
+ */
+void outWrite(const char* chars, size_t length);
+
+/**
+ * Append a NUL-terminated string to the output buffer
+ */
+void outString(const char* s);
+
+/**
+ * Append a single character to the output buffer
+ */
+void outChar(char c);
+
+/**
+ * End of a print statement: flushes when output is line-buffered
+ */
+void outEndPrint(void);
+
+/**
+ * Write buffered output to stdout
+ */
+void outFlush(void);
+
+/**
+ * Format an int in decimal (same text as printf "%d")
+ * @param buf Destination of at least FORMAT_NUMBER_MAX bytes
+ * @return Length of the text written (NUL-terminated)
+ */
+int formatInt(char* buf, int value);
+
+/**
+ * Format a double (same text as printf "%.6g")
+ * @param buf Destination of at least FORMAT_NUMBER_MAX bytes
+ * @return Length of the text written (NUL-terminated)
+ */
+int formatDouble(char* buf, double value);
+
+#endif // OUTPUT_H
@@ -0,0 +1,50 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "vm.h"
+
+// Data-parallel built-ins: parallelMap, parallelFor, parallelReduce.
+//
+// The work is split into chunks that are spread over one worker VM per
+// core (the calling thread is one of them); a worker that runs out of
+// chunks steals from the back of another worker's queue. Worker VMs share
+// the program's functions, globals and modules read-only.
+//
+// Value rules for the function being run:
+//  - string elements are copied for each call, and a task never frees the
+//    old string of a variable it reassigns (it may be shared with another
+//    thread), so the function may freely reassign its parameters and locals;
+//  - arrays and maps (as elements, globals or captured module state) are
+//    shared and must not be modified while the parallel call runs;
+//  - variables declared inside the function are locals as usual, but
+//    assigning a global or module variable, defining functions or
+//    importing modules is an error.
+// The first error raised by any task stops the remaining chunks and is
+// reported by the calling thread.
+
+// Thread count override (default: online CPUs)
+#define PARALLEL_THREADS_ENV "GEMINI_THREADS"
+
+/**
+ * parallelMap(arr, fn): new array of fn(x) for each element, in order
+ * @param vm Calling VM
+ * @param args Built-in arguments (array, function name)
+ * @param argc Argument count
+ * @param line Source line for error messages
+ */
+Value parallelMap(VM* vm, Value* args, int argc, int line);
+
+/**
+ * parallelFor(start, end, fn): call fn(i) for start <= i < end
+ * @return 0
+ */
+Value parallelFor(VM* vm, Value* args, int argc, int line);
+
+/**
+ * parallelReduce(arr, fn, init): fold with fn(acc, x). Each chunk is
+ * reduced starting from its first element and the chunk results are then
+ * folded in order starting from init, so fn must be associative.
+ */
+Value parallelReduce(VM* vm, Value* args, int argc, int line);
+
+#endif // PARALLEL_H
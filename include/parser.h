@@ -12,6 +12,8 @@ typedef enum {
     NODE_EXPR_CALL,        // function calls
     NODE_EXPR_GET,         // object.property
     NODE_EXPR_INDEX,       // target[index]
+    NODE_EXPR_INVARIANT,   // loop-invariant value hoisted by the optimizer
+    NODE_EXPR_PARAM,       // argument of an inlined function call
     NODE_STMT_VAR_DECL,
     NODE_STMT_ASSIGN,
     NODE_STMT_INDEX_ASSIGN,
@@ -19,28 +21,78 @@ typedef enum {
     NODE_STMT_IF,
     NODE_STMT_WHILE,
     NODE_STMT_FOR,
+    NODE_STMT_FOR_IN,      // for (x in coll) / for (k, v in coll)
     NODE_STMT_BLOCK,
     NODE_STMT_FUNCTION,
     NODE_STMT_RETURN,
     NODE_STMT_IMPORT
 } NodeType;
 
+// Specialized forms of a binary expression. A site starts out as
+// BIN_UNSEEN; after the VM observes its operand types it is rewritten to a
+// type-specialized form guarded by a cheap tag check, and falls back to
+// BIN_GENERIC if the guard keeps failing.
+typedef enum {
+    BIN_UNSEEN,
+    BIN_GENERIC,
+    // int op int
+    BIN_ADD_INT_INT,
+    BIN_SUB_INT_INT,
+    BIN_MUL_INT_INT,
+    BIN_DIV_INT_INT,
+    BIN_MOD_INT_INT,
+    BIN_LT_INT_INT,
+    BIN_LE_INT_INT,
+    BIN_GT_INT_INT,
+    BIN_GE_INT_INT,
+    BIN_EQ_INT_INT,
+    BIN_NE_INT_INT,
+    // float op float
+    BIN_ADD_FLOAT_FLOAT,
+    BIN_SUB_FLOAT_FLOAT,
+    BIN_MUL_FLOAT_FLOAT,
+    BIN_DIV_FLOAT_FLOAT,
+    BIN_LT_FLOAT_FLOAT,
+    BIN_LE_FLOAT_FLOAT,
+    BIN_GT_FLOAT_FLOAT,
+    BIN_GE_FLOAT_FLOAT,
+    BIN_EQ_FLOAT_FLOAT,
+    BIN_NE_FLOAT_FLOAT
+} BinaryQuick;
+
+// Type of an expression proven by the optimizer's type inference. Typed
+// expressions are evaluated without boxing or tag checks.
+typedef enum {
+    TYPE_ANY,       // unknown: evaluate generically
+    TYPE_INT,
+    TYPE_FLOAT,
+    TYPE_BOOL       // result of a numeric comparison
+} StaticType;
+
 // Forward declaration for AST Node
 typedef struct Node Node;
 
 // AST Node structure
 struct Node {
     NodeType type;
+    StaticType staticType;  // inferred type (expressions), TYPE_ANY if unknown
     union {
         // Literals
         struct {
             Token token;  // For numbers/strings
+            bool isFloat;       // number literal parsed as float
+            int intValue;       // pre-parsed number value
+            double floatValue;
         } literal;
         // Binary expr
         struct {
             Node* left;
             Token op;
             Node* right;
+            BinaryQuick quick;  // specialized form (quickening)
+            int deopts;         // guard failures at this site
+            int concatCount;    // operands of the string `+` chain rooted here
+                                // (optimizer), 0 if not fused
         } binary;
         // Unary
         struct {
@@ -56,6 +108,7 @@ struct Node {
             Node* callee;
             Node* arguments; // linked list via next
             int argumentCount;
+            bool inlined;    // inlining reported (--dump-opt)
         } call;
         // Member access: object.name
         struct {
@@ -66,7 +119,20 @@ struct Node {
         struct {
             Node* target;
             Node* index;
+            Token bracket;  // closing ']' (error line)
+            bool inBounds;  // int index proven within an array's bounds
         } index;
+        // Hoisted `object.length`: read slot while the object is a string,
+        // evaluate expr otherwise
+        struct {
+            Node* expr;
+            Token slot;     // hidden variable set before the loop
+        } invariant;
+        // Parameter read in an inlined function body
+        struct {
+            Token name;
+            int index;      // position in the call's arguments
+        } param;
         // Var decl
         struct {
             Token name;
@@ -82,6 +148,7 @@ struct Node {
             Node* target;
             Node* index;
             Node* value;
+            Token bracket;  // closing ']' (error line)
         } index_assign;
         // Print
         struct {
@@ -104,7 +171,15 @@ struct Node {
             Node* condition;
             Node* increment;
             Node* body;
+            bool counted;   // canonical int loop (optimizer): native counter
         } for_stmt;
+        // For-in: for (key in iterable) / for (key, value in iterable)
+        struct {
+            Token key;      // array element or map key (index/key with value)
+            Token value;    // array element or map value (length 0: absent)
+            Node* iterable;
+            Node* body;
+        } for_in;
         // Block { statements }
         struct {
             Node** statements;
@@ -151,4 +226,7 @@ void addToken(Parser* parser, Token token);
 // Parse tokens into AST
 Node* parse(Parser* parser);
 
+// Free an AST and all of its nodes
+void freeAST(Node* node);
+
 #endif // PARSER_H
\ No newline at end of file
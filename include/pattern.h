@@ -0,0 +1,81 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include "common.h"
+
+// Regular expressions for the match(), search(), findAll() and replaceAll()
+// built-ins.
+//
+// Syntax: literal bytes, `.` (any byte except newline), classes `[a-z_]` and
+// `[^...]`, `\d \w \s` and their negations `\D \W \S`, `^` and `$` (start and
+// end of the string), groups `(...)` and `(?:...)`, alternation `|`, and the
+// quantifiers `*`, `+`, `?`, `{m}`, `{m,}` and `{m,n}`. Matches are
+// leftmost-longest, as in POSIX and grep. There are no capture groups,
+// backreferences or lazy quantifiers.
+//
+// A pattern compiles to a Thompson NFA, plus one for the reversed pattern.
+// Matching runs DFAs whose states are built from the NFA the first time they
+// are reached and kept with the pattern, so after warm-up each input byte
+// costs one table lookup. Nothing backtracks: time is linear in the input.
+// While no partial match is in progress, the search skips ahead with memchr
+// to the next occurrence of the pattern's literal prefix, if it has one.
+
+typedef struct Pattern Pattern;
+
+// Compiled patterns of one VM, most recently used first
+typedef struct PatternCache PatternCache;
+
+// A match: text[start..end)
+typedef struct {
+    size_t start;
+    size_t end;
+} PatternMatch;
+
+/**
+ * Get the compiled form of a pattern, compiling it on a cache miss. The
+ * cache holds the most recently used patterns and evicts the least recently
+ * used one when full. A syntax error is reported with error().
+ * @param cache Cache slot (created on first use)
+ * @param source Pattern text
+ * @param line Line for error messages
+ * @return Compiled pattern, owned by the cache
+ */
+Pattern* patternLookup(PatternCache** cache, const char* source, int line);
+
+/**
+ * Check whether the pattern matches anywhere in the text
+ * @param pattern Compiled pattern
+ * @param text Input bytes
+ * @param length Input length
+ * @return true if some substring matches
+ */
+bool patternTest(Pattern* pattern, const char* text, size_t length);
+
+/**
+ * Find the leftmost-longest match
+ * @param pattern Compiled pattern
+ * @param text Input bytes
+ * @param length Input length
+ * @param match Receives the match
+ * @return false if nothing matches
+ */
+bool patternSearch(Pattern* pattern, const char* text, size_t length, PatternMatch* match);
+
+/**
+ * Find all non-overlapping leftmost-longest matches, left to right. After an
+ * empty match the next one starts at least one byte later.
+ * @param pattern Compiled pattern
+ * @param text Input bytes
+ * @param length Input length
+ * @param matches Receives a malloc'd array (NULL when there are none)
+ * @return Number of matches
+ */
+size_t patternFindAll(Pattern* pattern, const char* text, size_t length, PatternMatch** matches);
+
+/**
+ * Free a pattern cache and every pattern in it
+ * @param cache Cache (may be NULL)
+ */
+void freePatternCache(PatternCache* cache);
+
+#endif // PATTERN_H
@@ -0,0 +1,92 @@
+#ifndef PMAP_H
+#define PMAP_H
+
+#include "vm.h"
+
+// Disk-backed hash map (Gemini `pmap` value, pmap() built-in).
+//
+// A pmap at PATH is two files. PATH.log is an append-only log of records
+// (set key to value, delete key), each with a checksum; values are stored
+// in the saveValue() binary format (serialize.h). PATH is the index: a
+// header page followed by a page-aligned, open-addressed table of
+// (key hash, log offset) buckets with linear probing. Both files are
+// memory-mapped, so only the pages a lookup touches need to be in RAM.
+//
+// The log is the source of truth. The header records whether the index
+// was closed cleanly, the log length and generation it matches, and a
+// checksum. The first change after opening clears the clean flag on disk;
+// close() (or exit) syncs both files and sets it again. Opening a pmap
+// whose header is not clean, corrupt or out of date rebuilds the index by
+// replaying the log, dropping a torn record at its end. compact() rewrites
+// the log with only the live records under a new generation and renames
+// it into place.
+//
+// Files use the host byte order. A pmap is locked (flock) while open, so
+// another process cannot open it at the same time; opening the same files
+// twice in one process returns the same pmap.
+
+/**
+ * Open a pmap, creating its files if they do not exist
+ * @param path Index file path (the log is path + ".log")
+ * @param line Line for error messages
+ */
+PMap* pmapOpen(const char* path, int line);
+
+/**
+ * Look up a key (int or string)
+ * @param out Receives a fresh copy of the stored value
+ * @return false if the key is absent
+ */
+bool pmapGet(PMap* pm, Value key, Value* out, int line);
+
+/**
+ * Store a copy of a value under a key
+ */
+void pmapSet(PMap* pm, Value key, Value value, int line);
+
+/**
+ * Whether a key is present
+ */
+bool pmapHas(PMap* pm, Value key, int line);
+
+/**
+ * Remove a key
+ * @return false if the key was absent
+ */
+bool pmapDelete(PMap* pm, Value key, int line);
+
+/**
+ * Keys in table order
+ * @param intKeys Return int keys as ints (as for-in gives them) rather than
+ *        as decimal strings (as keys() does)
+ */
+Array* pmapKeys(PMap* pm, bool intKeys, int line);
+
+/**
+ * Number of keys
+ */
+int pmapCount(PMap* pm);
+
+/**
+ * Rewrite the log without overwritten and deleted records
+ * @return Bytes reclaimed
+ */
+size_t pmapCompact(PMap* pm, int line);
+
+/**
+ * Sync both files, mark the index clean and release the pmap (the handle
+ * stays valid and reports closed)
+ */
+void pmapClose(PMap* pm);
+
+/**
+ * Close every open pmap (also done at exit)
+ */
+void pmapCloseAll(void);
+
+/**
+ * Whether the pmap has been closed
+ */
+bool pmapIsClosed(PMap* pm);
+
+#endif // PMAP_H
@@ -0,0 +1,148 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+// Runtime support for Gemini scripts compiled ahead of time with
+// `gemini --emit-c`. Generated C includes this header and links against
+// bin/libgemini.a; operations that are not inlined by the generated code
+// (string concatenation, mixed-type arithmetic, builtins, indexing) call
+// into the same implementation the interpreter uses.
+
+#include "vm.h"
+
+// Current depth of compiled Gemini calls (bounded by CALL_STACK_MAX)
+extern int gemCallDepth;
+
+// Command-line arguments after the program name, returned by args()
+extern char** gemArgs;
+extern int gemArgCount;
+
+/**
+ * Create a fresh heap string value
+ * @param chars Characters to copy
+ * @param length Number of characters
+ */
+Value gemString(const char* chars, int length);
+
+/**
+ * Create a module value for an imported module
+ * @param name Import alias (shown when the module is printed)
+ */
+Value gemModule(const char* name);
+
+/**
+ * Generic binary operation (concatenation, equality, coercions, arithmetic)
+ * @param op Operator token type
+ * @param left Left operand
+ * @param right Right operand
+ * @param line Source line for error messages
+ */
+Value gemBinary(TokenType op, Value left, Value right, int line);
+
+/**
+ * Unary minus
+ */
+Value gemNegate(Value value, int line);
+
+/**
+ * Truthiness of a condition value
+ */
+bool gemTruthy(Value value);
+
+/**
+ * Print a value followed by a newline
+ */
+void gemPrint(Value value);
+
+/**
+ * Call a built-in function by name (array, map, length, push, ...)
+ * @param name Built-in name
+ * @param args Evaluated arguments
+ * @param argc Number of arguments
+ * @param line Source line for error messages
+ * @return Result value; reports "Undefined function." for unknown names
+ */
+Value gemCallBuiltin(const char* name, Value* args, int argc, int line);
+
+/**
+ * Call a function of a native module (math, stats; see native.h)
+ * @param module Native module name
+ * @param name Function name
+ * @param args Evaluated arguments
+ * @param argc Number of arguments
+ * @param line Source line for error messages
+ */
+Value gemCallNative(const char* module, const char* name, Value* args, int argc, int line);
+
+/**
+ * Read target[idx]
+ */
+Value gemIndex(Value target, Value idx, int line);
+
+/**
+ * Store target[idx] = value
+ */
+void gemIndexAssign(Value target, Value idx, Value value, int line);
+
+/**
+ * Property access on a non-module value (string length)
+ */
+Value gemGet(Value object, const char* name, int line);
+
+/**
+ * Report a runtime error and exit
+ */
+void gemFail(const char* message, int line);
+
+// State of a for-in loop over an array, map, pmap or reader. The
+// interpreter runs its for-in loops with the same functions.
+typedef struct {
+    Value collection;
+    int index;              // iterations started so far
+    MapEntry* entry;        // next map entry
+    Array* keys;            // pmap keys when the loop started
+    unsigned int version;   // map version when the loop started
+    char* ownedKey;         // string this loop made and last stored in the
+    char* ownedValue;       // key (value) variable; freed when replaced
+    int line;
+} GemForIn;
+
+/**
+ * Start a for-in loop
+ * @param it Loop state to initialize
+ * @param collection Array, map, pmap or reader (anything else is an error)
+ * @param line Source line for error messages
+ */
+void gemForInStart(GemForIn* it, Value collection, int line);
+
+/**
+ * Advance a for-in loop. Raises an error if a map was modified by the
+ * previous iteration; a pmap loop visits the keys present when it started
+ * and skips those deleted since.
+ * @param key Receives the element, or the index (key) of a two-variable loop
+ * @param value Receives the element of a two-variable loop; NULL otherwise
+ * @return false when the loop is done
+ */
+bool gemForInNext(GemForIn* it, Value* key, Value* value);
+
+// Store into a variable slot, releasing a previously held string
+// (same ownership rule as variable assignment in the interpreter)
+static inline void gemStore(Value* slot, Value value) {
+    if (IS_STRING(*slot) && AS_STRING(*slot) && !isCharString(AS_STRING(*slot))) free(AS_STRING(*slot));
+    *slot = value;
+}
+
+// Condition test with the common bool case inlined
+static inline bool gemTest(Value value) {
+    return IS_BOOL(value) ? AS_BOOL(value) : gemTruthy(value);
+}
+
+// Indexing with the in-bounds array case inlined
+static inline Value gemIndexFast(Value target, Value idx, int line) {
+    if (IS_ARRAY(target) && IS_INT(idx) && AS_ARRAY(target) &&
+        AS_INT(idx) >= 0 && AS_INT(idx) < AS_ARRAY(target)->count) {
+        return AS_ARRAY(target)->items[AS_INT(idx)];
+    }
+    return gemIndex(target, idx, line);
+}
+
+#endif // RUNTIME_H
@@ -0,0 +1,67 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include "vm.h"
+
+// Binary value format for saveValue()/loadValue() and serialize()/
+// deserialize().
+//
+// A header (magic "GEMV", a version byte and the 8-byte payload length)
+// is followed by the root value. Each value starts with a tag byte; ints
+// and lengths are varints, floats 8 little-endian bytes, strings and
+// containers are prefixed with their length. Every array and map gets an
+// id in the order it is first written, and later occurrences are written
+// as a reference to that id, so shared sub-values stay shared and cycles
+// load back as cycles. Arrays holding only ints or only floats are written
+// as one block of fixed-width numbers.
+//
+// Both directions walk the value with an explicit stack, so nesting depth
+// is limited only by memory. loadValue() maps the file and releases pages
+// behind the cursor as it decodes. Strings cannot hold NUL bytes, so
+// serialize() returns the same bytes in base64.
+
+// Current format version; loading data with a different version is an error
+#define SERIAL_VERSION 1
+
+/**
+ * Encode a value in the binary format
+ * @param value Value to encode (modules, files and pmaps are errors)
+ * @param length Receives the encoded length
+ * @param line Line for error messages
+ * @return malloc'd bytes
+ */
+char* serializeValue(Value value, size_t* length, int line);
+
+/**
+ * Decode a value. Malformed or truncated data is reported with error().
+ * @param data Encoded bytes
+ * @param length Encoded length
+ * @param line Line for error messages
+ * @return The decoded value
+ */
+Value deserializeValue(const char* data, size_t length, int line);
+
+/**
+ * Encode a value as base64 text (serialize())
+ * @return malloc'd NUL-terminated text
+ */
+char* serializeText(Value value, int line);
+
+/**
+ * Decode base64 text made by serializeText (deserialize())
+ */
+Value deserializeText(const char* text, size_t length, int line);
+
+/**
+ * Write a value to a file, replacing it only once the write is complete
+ * @return Number of bytes written
+ */
+size_t saveValueFile(const char* path, Value value, int line);
+
+/**
+ * Read a value written by saveValueFile
+ * @param path File path ("-" reads standard input)
+ */
+Value loadValueFile(const char* path, int line);
+
+#endif // SERIALIZE_H
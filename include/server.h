@@ -0,0 +1,52 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "common.h"
+
+// Warm interpreter daemon (gemini --serve) and its client (gemini --client).
+//
+// The server listens on a Unix socket and runs one script per connection in
+// a fresh VM. Parsed scripts, parsed modules and module path resolutions
+// are cached across runs and revalidated against the file's size and mtime,
+// so a repeated run skips reading, lexing, parsing and the project-tree
+// search. The client forwards its working directory, script path and
+// arguments, and replays the streamed stdout/stderr and exit status, so it
+// behaves like running `gemini` directly.
+//
+// Wire format: every message is a frame of one type byte, a 4-byte length
+// (host byte order; the socket is local) and the payload.
+
+#define FRAME_RUN    'r'    // client -> server: flags byte, then NUL-terminated
+                            // script path, working directory and arguments
+#define FRAME_STDOUT 'o'    // server -> client: program output
+#define FRAME_STDERR 'e'    // server -> client: error message
+#define FRAME_EXIT   'x'    // server -> client: 4-byte exit status, last frame
+
+#define RUN_FLAG_JIT        0x01
+#define RUN_FLAG_UNBUFFERED 0x02
+
+// Largest request accepted by the server
+#define FRAME_MAX_REQUEST (1024 * 1024)
+
+/**
+ * Serve script runs on a Unix socket until SIGINT or SIGTERM. A signal
+ * during a run takes effect when the run has finished (a second one stops
+ * the server at once).
+ * @param socketPath Socket file to create (an existing socket is replaced)
+ * @param level Optimizer level for the scripts and modules it parses
+ * @return 0 after a signal during a run, 1 when the socket cannot be set up
+ */
+int runServer(const char* socketPath, int level);
+
+/**
+ * Run a script on a server and replay its output
+ * @param socketPath Server socket
+ * @param script Script path (resolved against the current directory)
+ * @param args Arguments passed to the script (args())
+ * @param argCount Number of arguments
+ * @param flags RUN_FLAG_* options
+ * @return The script's exit status
+ */
+int runClient(const char* socketPath, const char* script, char** args, int argCount, int flags);
+
+#endif // SERVER_H
@@ -3,6 +3,9 @@
 
 #include "common.h"
 #include "parser.h"
+#include "jit.h"
+#include "fileio.h"
+#include <stdint.h>
 
 // Value types for VM
 typedef enum {
@@ -12,15 +15,91 @@ typedef enum {
     VAL_BOOL,
     VAL_MODULE,
     VAL_ARRAY,
-    VAL_MAP
+    VAL_MAP,
+    VAL_FILE,
+    VAL_PMAP
 } ValueType;
 
 // Value structure for runtime values
 typedef struct Module Module;
 typedef struct Array Array;
 typedef struct Map Map;
+typedef struct NativeModule NativeModule;
+typedef struct PMap PMap;
 
-// Value structure for runtime values
+#ifdef GEMINI_NAN_BOXING
+// NaN-boxed value (build with -DGEMINI_NAN_BOXING, see `make NAN_BOXING=1`).
+//
+// Every value fits in 8 bytes. Doubles are stored unboxed; NaNs are
+// canonicalized to a positive quiet NaN so that the negative quiet-NaN space
+// is free for tagged values:
+//
+//   sign | exponent (all 1) | quiet | tag (4 bits, 47..50) | payload (47 bits)
+//
+// The tag is the ValueType of the boxed value. Pointers use the low 47 bits
+// (user-space addresses on x86-64/AArch64 Linux); ints and bools use the low
+// 32 bits.
+typedef uint64_t Value;
+
+#define NB_SIGN       ((uint64_t)0x8000000000000000ull)
+#define NB_QNAN       ((uint64_t)0x7ff8000000000000ull)
+#define NB_BOXED      (NB_SIGN | NB_QNAN)
+#define NB_TAG_SHIFT  47
+#define NB_TAG_MASK   ((uint64_t)0xf << NB_TAG_SHIFT)
+#define NB_PAYLOAD    (((uint64_t)1 << NB_TAG_SHIFT) - 1)
+
+static inline Value nbBox(ValueType type, uint64_t payload) {
+    return NB_BOXED | ((uint64_t)type << NB_TAG_SHIFT) | (payload & NB_PAYLOAD);
+}
+
+static inline Value nbFromDouble(double d) {
+    Value v;
+    if (d != d) return NB_QNAN; // canonical NaN
+    memcpy(&v, &d, sizeof(v));
+    return v;
+}
+
+static inline double nbToDouble(Value v) {
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+#define IS_BOXED(v)     (((v) & NB_BOXED) == NB_BOXED)
+#define VALUE_TYPE(v)   (IS_BOXED(v) ? (ValueType)(((v) & NB_TAG_MASK) >> NB_TAG_SHIFT) : VAL_FLOAT)
+
+#define IS_FLOAT(v)     (!IS_BOXED(v))
+#define IS_INT(v)       (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_INT, 0))
+#define IS_STRING(v)    (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_STRING, 0))
+#define IS_BOOL(v)      (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_BOOL, 0))
+#define IS_MODULE(v)    (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_MODULE, 0))
+#define IS_ARRAY(v)     (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_ARRAY, 0))
+#define IS_MAP(v)       (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_MAP, 0))
+#define IS_FILE(v)      (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_FILE, 0))
+#define IS_PMAP(v)      (((v) & (NB_BOXED | NB_TAG_MASK)) == nbBox(VAL_PMAP, 0))
+
+#define AS_INT(v)       ((int)(uint32_t)((v) & 0xffffffffu))
+#define AS_FLOAT(v)     nbToDouble(v)
+#define AS_STRING(v)    ((char*)(uintptr_t)((v) & NB_PAYLOAD))
+#define AS_BOOL(v)      ((bool)((v) & 1))
+#define AS_MODULE(v)    ((Module*)(uintptr_t)((v) & NB_PAYLOAD))
+#define AS_ARRAY(v)     ((Array*)(uintptr_t)((v) & NB_PAYLOAD))
+#define AS_MAP(v)       ((Map*)(uintptr_t)((v) & NB_PAYLOAD))
+#define AS_FILE(v)      ((FileHandle*)(uintptr_t)((v) & NB_PAYLOAD))
+#define AS_PMAP(v)      ((PMap*)(uintptr_t)((v) & NB_PAYLOAD))
+
+#define INT_VAL(i)      nbBox(VAL_INT, (uint32_t)(int)(i))
+#define FLOAT_VAL(d)    nbFromDouble(d)
+#define STRING_VAL(p)   nbBox(VAL_STRING, (uintptr_t)(p))
+#define BOOL_VAL(b)     nbBox(VAL_BOOL, (b) ? 1 : 0)
+#define MODULE_VAL(p)   nbBox(VAL_MODULE, (uintptr_t)(p))
+#define ARRAY_VAL(p)    nbBox(VAL_ARRAY, (uintptr_t)(p))
+#define MAP_VAL(p)      nbBox(VAL_MAP, (uintptr_t)(p))
+#define FILE_VAL(p)     nbBox(VAL_FILE, (uintptr_t)(p))
+#define PMAP_VAL(p)     nbBox(VAL_PMAP, (uintptr_t)(p))
+
+#else
+// Tagged-union value (default): 4-byte tag plus 8-byte payload.
 typedef struct {
     ValueType type;
     union {
@@ -31,9 +110,52 @@ typedef struct {
         Module* moduleVal;
         Array* arrayVal;
         Map* mapVal;
+        FileHandle* fileVal;
+        PMap* pmapVal;
     };
 } Value;
 
+#define VALUE_TYPE(v)   ((v).type)
+
+#define IS_INT(v)       ((v).type == VAL_INT)
+#define IS_FLOAT(v)     ((v).type == VAL_FLOAT)
+#define IS_STRING(v)    ((v).type == VAL_STRING)
+#define IS_BOOL(v)      ((v).type == VAL_BOOL)
+#define IS_MODULE(v)    ((v).type == VAL_MODULE)
+#define IS_ARRAY(v)     ((v).type == VAL_ARRAY)
+#define IS_MAP(v)       ((v).type == VAL_MAP)
+#define IS_FILE(v)      ((v).type == VAL_FILE)
+#define IS_PMAP(v)      ((v).type == VAL_PMAP)
+
+#define AS_INT(v)       ((v).intVal)
+#define AS_FLOAT(v)     ((v).floatVal)
+#define AS_STRING(v)    ((v).stringVal)
+#define AS_BOOL(v)      ((v).boolVal)
+#define AS_MODULE(v)    ((v).moduleVal)
+#define AS_ARRAY(v)     ((v).arrayVal)
+#define AS_MAP(v)       ((v).mapVal)
+#define AS_FILE(v)      ((v).fileVal)
+#define AS_PMAP(v)      ((v).pmapVal)
+
+#define INT_VAL(i)      ((Value){.type = VAL_INT, .intVal = (i)})
+#define FLOAT_VAL(d)    ((Value){.type = VAL_FLOAT, .floatVal = (d)})
+#define STRING_VAL(p)   ((Value){.type = VAL_STRING, .stringVal = (p)})
+#define BOOL_VAL(b)     ((Value){.type = VAL_BOOL, .boolVal = (b)})
+#define MODULE_VAL(p)   ((Value){.type = VAL_MODULE, .moduleVal = (p)})
+#define ARRAY_VAL(p)    ((Value){.type = VAL_ARRAY, .arrayVal = (p)})
+#define MAP_VAL(p)      ((Value){.type = VAL_MAP, .mapVal = (p)})
+#define FILE_VAL(p)     ((Value){.type = VAL_FILE, .fileVal = (p)})
+#define PMAP_VAL(p)     ((Value){.type = VAL_PMAP, .pmapVal = (p)})
+#endif
+
+// One-character strings (string indexing, split(s, "")) point into this
+// table instead of being allocated; they are never freed or modified
+extern char charStrings[256][2];
+
+static inline bool isCharString(const char* s) {
+    return s >= charStrings[0] && s < charStrings[0] + sizeof(charStrings);
+}
+
 // Forward declarations
 typedef struct VarEntry VarEntry;
 typedef struct FuncEntry FuncEntry;
@@ -42,10 +164,12 @@ typedef struct Environment Environment;
 typedef struct CallFrame CallFrame;
 typedef struct VM VM;
 typedef struct ModuleEntry ModuleEntry;
+typedef struct PatternCache PatternCache;
 
 // Variable entry structure for hash table
 struct VarEntry {
     char* key;              // Variable name
+    unsigned int hash;      // hashString(key)
     Value value;            // Variable value
     struct VarEntry* next;  // Next entry in hash bucket
 };
@@ -53,6 +177,7 @@ struct VarEntry {
 // Function entry structure for hash table
 struct FuncEntry {
     char* key;              // Function name
+    unsigned int hash;      // hashString(key)
     Function* function;     // Function definition
     struct FuncEntry* next; // Next entry in hash bucket
 };
@@ -73,6 +198,8 @@ struct Module {
     // Keep the module source buffer alive for the lifetime of the module,
     // because AST Tokens point into this buffer.
     char* source;
+    Node* ast;              // Parsed module (function bodies point into it)
+    const NativeModule* native; // Built-in module implemented in C (native.h)
 };
 
 // Minimal dynamic array implementation
@@ -82,23 +209,37 @@ struct Array {
     int capacity;
 };
 
-// Minimal map (hash table) implementation supporting string and int keys
+// Map (hash table) supporting string and int keys. The bucket array grows
+// with the number of entries; entries are also linked in insertion order,
+// which is the order keys() and for-in visit them.
 typedef struct MapEntry MapEntry;
 struct MapEntry {
     bool isIntKey;          // true: use intKey; false: use key (string)
-    char* key;              // string key (owned)
+    char* key;              // string key (stored after the entry)
     int intKey;             // int key
+    unsigned int hash;      // hashString(key) or hashInt(intKey)
     Value value;            // stored value
     MapEntry* next;         // chaining in bucket
+    MapEntry* before;       // previous entry in insertion order
+    MapEntry* after;        // next entry in insertion order
 };
 
+// Initial bucket count of a map (a power of two)
+#define MAP_MIN_BUCKETS 8
+
 struct Map {
-    MapEntry* buckets[TABLE_SIZE];
+    MapEntry** buckets;
+    int bucketCount;        // power of two, >= count
+    int count;              // number of entries
+    unsigned int version;   // bumped on insert/delete (for-in iterators)
+    MapEntry* first;        // oldest entry
+    MapEntry* last;         // newest entry
 };
 
 // Module cache entry structure
 struct ModuleEntry {
     char* key;                 // Module name (logical name from import, not alias)
+    unsigned int hash;         // hashString(key)
     Module* module;            // Loaded module object
     struct ModuleEntry* next;  // Next entry in hash bucket
 };
@@ -110,14 +251,35 @@ struct Function {
     int paramCount;         // Number of parameters
     Node* body;             // Function body (AST node)
     Environment* closure;   // Closure environment (for lexical scoping)
+    int hotness;            // Invocations + loop back-edges (JIT trigger)
+    bool jitFailed;         // Body cannot be compiled by the JIT
+    JitCode* jit;           // Compiled native code, if any
+    Node* inlineExpr;       // Body run directly at call sites (optimizer.h)
 };
 
+// Program loaded into a VM (see vmLoad); kept alive for the VM's lifetime
+typedef struct ScriptEntry ScriptEntry;
+struct ScriptEntry {
+    char* source;              // Source text (tokens point into it)
+    Node* ast;                 // Parsed program
+    struct ScriptEntry* next;
+};
+
+// Destination for print output when it should not go to stdout
+typedef void (*OutputFn)(void* user, const char* text, size_t length);
+
+// Supplies parsed modules from outside the VM, e.g. the cache kept warm by
+// `gemini --serve`. Returns NULL when the module file cannot be found; the
+// returned AST stays owned by the loader and must outlive the VM.
+typedef Node* (*ModuleLoaderFn)(void* user, const char* projectRoot, const char* fileName, int line);
+
 // VM constants
 #define STACK_MAX 256           // Maximum stack size
 #define CALL_STACK_MAX 64       // Maximum call stack depth
 
 // Call frame structure for function calls
 struct CallFrame {
+    Function* function;     // Function being executed
     Environment* env;       // Previous environment
     Value returnValue;      // Function return value
     bool hasReturned;       // Whether function has returned
@@ -134,6 +296,21 @@ struct VM {
     int callStackTop;               // Call stack pointer
     char projectRoot[1024];         // Project root directory for module search
     ModuleEntry* moduleBuckets[TABLE_SIZE]; // Module cache by name
+    bool jitEnabled;                // Compile hot functions to native code (--jit)
+    int optLevel;                   // AST optimizer level for loaded code (-O)
+    bool optDump;                   // Report optimizations on stderr (--dump-opt)
+    Value* inlineArgs;              // Arguments of the inlined call being evaluated
+    ScriptEntry* scripts;           // Programs loaded with vmLoad
+    OutputFn output;                // print destination (NULL: buffered stdout)
+    void* outputUser;               // Passed to output
+    OutputFn warningOutput;         // warning destination (NULL: stderr); gets outputUser
+    ModuleLoaderFn moduleLoader;    // Import source (NULL: read and parse files)
+    void* moduleLoaderUser;         // Passed to moduleLoader
+    char** scriptArgs;              // Command-line arguments returned by args()
+    int scriptArgCount;
+    bool parallelWorker;            // Runs shared code on a parallel pool thread
+    const char* lentString;         // Argument buffer reused across calls (--each-line); never freed
+    PatternCache* patterns;         // Compiled regular expressions (pattern.c)
 };
 
 // VM function prototypes
@@ -157,4 +334,108 @@ void freeVM(VM* vm);
  */
 void interpret(VM* vm, Node* ast);
 
+/**
+ * Parse a program and run its top-level code. The VM keeps the source and
+ * AST alive until freeVM. Errors are raised through error().
+ * @param vm Pointer to VM structure
+ * @param source Program text (copied)
+ */
+void vmLoad(VM* vm, const char* source);
+
+/**
+ * Whether the main program defines a function
+ * @param vm VM that has run the program
+ * @param name Function name
+ */
+bool vmHasFunction(VM* vm, const char* name);
+
+/**
+ * Call a function defined by the main program
+ * @param vm VM that has run the program
+ * @param name Function name
+ * @param args Arguments
+ * @param argCount Number of arguments
+ * @param result Receives the return value
+ * @return false if no such function is defined
+ */
+bool vmCall(VM* vm, const char* name, Value* args, int argCount, Value* result);
+
+/**
+ * Find a function by name as a call site would: the main program, the
+ * current module, or "alias.name" for a function of an imported module
+ * @return NULL if there is no such function
+ */
+Function* vmFindFunction(VM* vm, const char* name);
+
+/**
+ * Call a function with already evaluated arguments
+ */
+Value vmCallFunction(VM* vm, Function* func, Value* args, int argCount);
+
+/**
+ * Set up a VM that runs functions of parent on another thread. It shares
+ * parent's environments, functions and modules read-only, never compiles
+ * or re-specializes code, and must not be passed to freeVM.
+ */
+void vmInitWorker(VM* worker, VM* parent);
+
+/**
+ * Resolve an imported module file: GEMINI_PATH entries first, then a
+ * recursive search under projectRoot
+ * @param projectRoot Directory searched when GEMINI_PATH has no match
+ * @param fileName Module file name (e.g. "math.gemini")
+ * @return malloc'd path, or NULL if not found
+ */
+char* resolveModulePath(const char* projectRoot, const char* fileName);
+
+/**
+ * Find a module file that importing the native module `name` hides: one of
+ * the same name (name.gemini) in a GEMINI_PATH entry or directly in
+ * projectRoot. Only those directories are checked, not the recursive
+ * search of resolveModulePath.
+ * @param name Module name (not NUL-terminated)
+ * @param length Length of name
+ * @param path Receives the hidden file's path
+ * @return Whether such a file exists
+ */
+bool findShadowedModule(const char* projectRoot, const char* name, int length, char* path, size_t size);
+
+/**
+ * Read a whole file into a NUL-terminated buffer
+ * @param path File path
+ * @return malloc'd contents, or NULL on failure
+ */
+char* readFileAll(const char* path);
+
+// Building arrays and maps from C (json.c)
+
+/**
+ * Create an empty array
+ */
+Array* newArray(void);
+
+/**
+ * Append a value to an array
+ */
+void arrayPush(Array* a, Value v);
+
+/**
+ * Create an empty map
+ */
+Map* newMap(void);
+
+/**
+ * Set the value of a string key, adding the key if it is new
+ * @param m Map
+ * @param key Key bytes (copied)
+ * @param len Key length
+ * @param v Value
+ */
+void mapSetStr(Map* m, const char* key, int len, Value v);
+
+/**
+ * Set the value of an int key, adding the key if it is new
+ */
+void mapSetInt(Map* m, int ikey, Value v);
+
 #endif // VM_H
\ No newline at end of file
@@ -0,0 +1,911 @@
+#include "aot.h"
+#include "lexer.h"
+#include "vm.h"
+#include "native.h"
+#include <stdarg.h>
+#include <unistd.h>
+
+// Ahead-of-time translation of Gemini to C.
+//
+// Naming in the generated code:
+//   g<m>_<name>   top-level variable of module m (0 is the main program)
+//   f<m>_<name>   function defined in module m
+//   l_<name>      parameter or local of the function being emitted
+//   d<m>_<name>   whether g<m>_<name> has been declared (its `var` has run)
+//   d_<name>      whether local l_<name> has been declared
+//   t<n>          expression temporary (keeps evaluation order explicit)
+//   m<m>_init     runs the top-level code of module m (once)
+
+// Growable list of identifier tokens
+typedef struct {
+    Token* items;
+    int count;
+    int capacity;
+} NameList;
+
+// Import alias bound to a module
+typedef struct {
+    Token alias;
+    int module;
+} AotAlias;
+
+// A translated module (the main program is module 0)
+typedef struct {
+    int id;
+    char* key;              // logical module name (import name)
+    char* alias;            // alias of the first import (module print name)
+    char* source;           // kept alive: tokens point into it
+    Node* ast;              // NULL for native modules
+    const NativeModule* native; // built-in module (native.h): calls go to gemCallNative
+    NameList globals;       // top-level variables, including import aliases
+    AotAlias* aliases;
+    int aliasCount;
+    int aliasCapacity;
+    Node** functions;
+    int funcCount;
+    int funcCapacity;
+} AotModule;
+
+typedef struct {
+    FILE* out;
+    char projectRoot[1024];
+    AotModule** modules;
+    int moduleCount;
+    int moduleCapacity;
+    // Current emission context
+    AotModule* module;      // module being emitted
+    Node* function;         // function being emitted (NULL at top level)
+    NameList locals;        // parameters and locals of the function
+    NameList declared;      // definitely declared here: locals in a function,
+                            // the module's globals at top level
+    int temp;               // next temporary id
+    int indent;
+    bool usesReturn;        // function body jumps to its epilogue
+} AotCompiler;
+
+static bool sameName(Token a, Token b) {
+    return a.length == b.length && memcmp(a.start, b.start, a.length) == 0;
+}
+
+static bool hasName(NameList* list, Token name) {
+    for (int i = 0; i < list->count; i++) {
+        if (sameName(list->items[i], name)) return true;
+    }
+    return false;
+}
+
+static void addName(NameList* list, Token name) {
+    if (hasName(list, name)) return;
+    if (list->count >= list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, list->capacity * sizeof(Token));
+        if (!list->items) error("Memory allocation failed.", name.line);
+    }
+    list->items[list->count++] = name;
+}
+
+// Write one indented line of generated code
+static void emitLine(AotCompiler* c, const char* format, ...) {
+    for (int i = 0; i < c->indent; i++) fputs("    ", c->out);
+    va_list args;
+    va_start(args, format);
+    vfprintf(c->out, format, args);
+    va_end(args);
+    fputc('\n', c->out);
+}
+
+// Write a C string literal for raw source characters
+static void emitStringLiteral(FILE* out, const char* chars, int length) {
+    fputc('"', out);
+    for (int i = 0; i < length; i++) {
+        unsigned char ch = (unsigned char)chars[i];
+        if (ch == '"' || ch == '\\') {
+            fputc('\\', out);
+            fputc(ch, out);
+        } else if (ch < 0x20 || ch >= 0x7f) {
+            fprintf(out, "\\%03o", ch);
+        } else {
+            fputc(ch, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static const char* tokenTypeName(TokenType type) {
+    switch (type) {
+        case TOKEN_PLUS: return "TOKEN_PLUS";
+        case TOKEN_MINUS: return "TOKEN_MINUS";
+        case TOKEN_STAR: return "TOKEN_STAR";
+        case TOKEN_SLASH: return "TOKEN_SLASH";
+        case TOKEN_PERCENT: return "TOKEN_PERCENT";
+        case TOKEN_EQUAL_EQUAL: return "TOKEN_EQUAL_EQUAL";
+        case TOKEN_BANG_EQUAL: return "TOKEN_BANG_EQUAL";
+        case TOKEN_GREATER: return "TOKEN_GREATER";
+        case TOKEN_GREATER_EQUAL: return "TOKEN_GREATER_EQUAL";
+        case TOKEN_LESS: return "TOKEN_LESS";
+        case TOKEN_LESS_EQUAL: return "TOKEN_LESS_EQUAL";
+        default: return NULL;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Module discovery
+// ---------------------------------------------------------------------------
+
+static AotModule* loadModule(AotCompiler* c, Token name);
+
+static Node* findModuleFunction(AotModule* m, Token name) {
+    for (int i = 0; i < m->funcCount; i++) {
+        if (sameName(m->functions[i]->function.name, name)) return m->functions[i];
+    }
+    return NULL;
+}
+
+// Record variables, imports and functions defined by top-level code
+// (function bodies excluded: their names are locals).
+static void collectTopLevel(AotCompiler* c, AotModule* m, Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL:
+            addName(&m->globals, node->var_decl.name);
+            break;
+        case NODE_STMT_IMPORT: {
+            addName(&m->globals, node->import_stmt.alias);
+            AotModule* target = loadModule(c, node->import_stmt.module);
+            if (!target->alias) {
+                target->alias = strndup(node->import_stmt.alias.start, node->import_stmt.alias.length);
+            }
+            if (m->aliasCount >= m->aliasCapacity) {
+                m->aliasCapacity = m->aliasCapacity ? m->aliasCapacity * 2 : 8;
+                m->aliases = realloc(m->aliases, m->aliasCapacity * sizeof(AotAlias));
+                if (!m->aliases) error("Memory allocation failed.", 0);
+            }
+            m->aliases[m->aliasCount].alias = node->import_stmt.alias;
+            m->aliases[m->aliasCount].module = target->id;
+            m->aliasCount++;
+            break;
+        }
+        case NODE_STMT_FUNCTION:
+            if (findModuleFunction(m, node->function.name)) {
+                error("Function already defined.", node->function.name.line);
+            }
+            if (m->funcCount >= m->funcCapacity) {
+                m->funcCapacity = m->funcCapacity ? m->funcCapacity * 2 : 16;
+                m->functions = realloc(m->functions, m->funcCapacity * sizeof(Node*));
+                if (!m->functions) error("Memory allocation failed.", 0);
+            }
+            m->functions[m->funcCount++] = node;
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                collectTopLevel(c, m, node->block.statements[i]);
+            }
+            break;
+        case NODE_STMT_IF:
+            collectTopLevel(c, m, node->if_stmt.thenBranch);
+            collectTopLevel(c, m, node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            collectTopLevel(c, m, node->while_stmt.body);
+            break;
+        case NODE_STMT_FOR:
+            collectTopLevel(c, m, node->for_stmt.initializer);
+            collectTopLevel(c, m, node->for_stmt.body);
+            break;
+        case NODE_STMT_FOR_IN:
+            addName(&m->globals, node->for_in.key);
+            if (node->for_in.value.length > 0) addName(&m->globals, node->for_in.value);
+            collectTopLevel(c, m, node->for_in.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static AotModule* newModule(AotCompiler* c, const char* key, char* source, Node* ast) {
+    AotModule* m = calloc(1, sizeof(AotModule));
+    if (!m) error("Memory allocation failed.", 0);
+    m->id = c->moduleCount;
+    m->key = strdup(key);
+    m->source = source;
+    m->ast = ast;
+    if (c->moduleCount >= c->moduleCapacity) {
+        c->moduleCapacity = c->moduleCapacity ? c->moduleCapacity * 2 : 8;
+        c->modules = realloc(c->modules, c->moduleCapacity * sizeof(AotModule*));
+        if (!c->modules) error("Memory allocation failed.", 0);
+    }
+    c->modules[c->moduleCount++] = m;
+    return m;
+}
+
+// Resolve, parse and scan an imported module (once per logical name)
+static AotModule* loadModule(AotCompiler* c, Token name) {
+    char key[256];
+    snprintf(key, sizeof(key), "%.*s", name.length, name.start);
+    for (int i = 1; i < c->moduleCount; i++) {
+        if (strcmp(c->modules[i]->key, key) == 0) return c->modules[i];
+    }
+
+    // Native modules take precedence over files, as in the interpreter
+    const NativeModule* native = findNativeModule(name.start, name.length);
+    if (native) {
+        char hidden[2048];
+        if (findShadowedModule(c->projectRoot, name.start, name.length, hidden, sizeof(hidden))) {
+            fprintf(stderr, "[line %d] Warning: native module '%.*s' is imported instead of %s.\n",
+                    name.line, name.length, name.start, hidden);
+        }
+        AotModule* m = newModule(c, key, NULL, NULL);
+        m->native = native;
+        return m;
+    }
+
+    char fileName[300];
+    snprintf(fileName, sizeof(fileName), "%s.gemini", key);
+    char* fullPath = resolveModulePath(c->projectRoot, fileName);
+    if (!fullPath) error("Module file not found in project.", name.line);
+    char* source = readFileAll(fullPath);
+    free(fullPath);
+    if (!source) error("Failed to read module file.", name.line);
+
+    Lexer lexer;
+    initLexer(&lexer, source);
+    Parser parser;
+    initParser(&parser);
+    while (true) {
+        Token token = scanToken(&lexer);
+        addToken(&parser, token);
+        if (token.type == TOKEN_EOF) break;
+    }
+    Node* ast = parse(&parser);
+    freeParser(&parser);
+
+    // Register before scanning so import cycles terminate
+    AotModule* m = newModule(c, key, source, ast);
+    collectTopLevel(c, m, ast);
+    return m;
+}
+
+// ---------------------------------------------------------------------------
+// Name resolution
+// ---------------------------------------------------------------------------
+
+// A place a variable reference may resolve to: the C variable and the flag
+// saying whether it has been declared (empty when it definitely has)
+typedef struct {
+    char slot[300];
+    char flag[300];
+} AotSlot;
+
+// Places a variable reference may resolve to, in the interpreter's lookup
+// order: function locals, then the defining module, then the main program.
+// A `var` only takes effect once it has run, so the lookup moves on while a
+// candidate may still be undeclared and stops at one that definitely is.
+// Returns the number of candidates (0 if the name is never declared).
+static int resolveVar(AotCompiler* c, Token name, AotSlot* out) {
+    int n = 0;
+    if (c->function && hasName(&c->locals, name)) {
+        snprintf(out[n].slot, sizeof(out[n].slot), "l_%.*s", name.length, name.start);
+        if (hasName(&c->declared, name)) out[n].flag[0] = '\0';
+        else snprintf(out[n].flag, sizeof(out[n].flag), "d_%.*s", name.length, name.start);
+        if (!out[n++].flag[0]) return n;
+    }
+    AotModule* scopes[2] = {c->module, c->modules[0]};
+    for (int s = 0; s < 2; s++) {
+        AotModule* m = scopes[s];
+        if (s == 1 && m == c->module) break;
+        if (!hasName(&m->globals, name)) continue;
+        snprintf(out[n].slot, sizeof(out[n].slot), "g%d_%.*s", m->id, name.length, name.start);
+        if (!c->function && m == c->module && hasName(&c->declared, name)) out[n].flag[0] = '\0';
+        else snprintf(out[n].flag, sizeof(out[n].flag), "d%d_%.*s", m->id, name.length, name.start);
+        if (!out[n++].flag[0]) return n;
+    }
+    return n;
+}
+
+// Module statically bound to a variable name, if it is an import alias
+static AotModule* resolveModule(AotCompiler* c, Token name) {
+    if (c->function && hasName(&c->locals, name)) return NULL;
+    AotModule* scopes[2] = {c->module, c->modules[0]};
+    for (int s = 0; s < 2; s++) {
+        AotModule* m = scopes[s];
+        for (int i = m->aliasCount - 1; i >= 0; i--) {
+            if (sameName(m->aliases[i].alias, name)) return c->modules[m->aliases[i].module];
+        }
+        if (hasName(&m->globals, name)) return NULL;
+    }
+    return NULL;
+}
+
+// Collect the locals of a function body (every `var` it declares)
+static void collectLocals(AotCompiler* c, Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL:
+            addName(&c->locals, node->var_decl.name);
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                collectLocals(c, node->block.statements[i]);
+            }
+            break;
+        case NODE_STMT_IF:
+            collectLocals(c, node->if_stmt.thenBranch);
+            collectLocals(c, node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            collectLocals(c, node->while_stmt.body);
+            break;
+        case NODE_STMT_FOR:
+            collectLocals(c, node->for_stmt.initializer);
+            collectLocals(c, node->for_stmt.body);
+            break;
+        case NODE_STMT_FOR_IN:
+            addName(&c->locals, node->for_in.key);
+            if (node->for_in.value.length > 0) addName(&c->locals, node->for_in.value);
+            collectLocals(c, node->for_in.body);
+            break;
+        case NODE_STMT_FUNCTION:
+            error("--emit-c: nested function definitions are not supported.", node->function.name.line);
+            break;
+        case NODE_STMT_IMPORT:
+            error("--emit-c: imports inside functions are not supported.", node->import_stmt.module.line);
+            break;
+        default:
+            break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Code generation
+// ---------------------------------------------------------------------------
+
+static void emitStmt(AotCompiler* c, Node* node);
+static int emitCall(AotCompiler* c, Node* node);
+
+// Emit an expression into a fresh temporary and return its number
+static int emitExpr(AotCompiler* c, Node* node) {
+    int t;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: {
+            Token tok = node->literal.token;
+            t = c->temp++;
+            if (tok.type == TOKEN_NUMBER) {
+                if (node->literal.isFloat) {
+                    emitLine(c, "Value t%d = FLOAT_VAL(%.17g);", t, node->literal.floatValue);
+                } else {
+                    emitLine(c, "Value t%d = INT_VAL(%d);", t, node->literal.intValue);
+                }
+            } else {
+                // Fresh copy per evaluation: variables own their strings
+                int length = tok.length >= 2 ? tok.length - 2 : 0;
+                for (int i = 0; i < c->indent; i++) fputs("    ", c->out);
+                fprintf(c->out, "Value t%d = gemString(", t);
+                emitStringLiteral(c->out, tok.length >= 2 ? tok.start + 1 : "", length);
+                fprintf(c->out, ", %d);\n", length);
+            }
+            return t;
+        }
+        case NODE_EXPR_VAR: {
+            AotSlot slots[3];
+            int n = resolveVar(c, node->var.name, slots);
+            t = c->temp++;
+            for (int i = 0; i < c->indent; i++) fputs("    ", c->out);
+            fprintf(c->out, "Value t%d = ", t);
+            for (int i = 0; i < n && slots[i].flag[0]; i++) fprintf(c->out, "%s ? %s : ", slots[i].flag, slots[i].slot);
+            if (n > 0 && !slots[n - 1].flag[0]) {
+                fprintf(c->out, "%s;\n", slots[n - 1].slot);
+            } else {
+                fprintf(c->out, "(gemFail(\"Undefined variable.\", %d), INT_VAL(0));\n", node->var.name.line);
+            }
+            return t;
+        }
+        case NODE_EXPR_UNARY: {
+            int operand = emitExpr(c, node->unary.expr);
+            if (node->unary.op.type != TOKEN_MINUS) return operand;
+            t = c->temp++;
+            emitLine(c, "Value t%d = IS_INT(t%d) ? INT_VAL(-AS_INT(t%d)) : gemNegate(t%d, %d);",
+                     t, operand, operand, operand, node->unary.op.line);
+            return t;
+        }
+        case NODE_EXPR_BINARY: {
+            int left = emitExpr(c, node->binary.left);
+            int right = emitExpr(c, node->binary.right);
+            Token op = node->binary.op;
+            const char* name = tokenTypeName(op.type);
+            t = c->temp++;
+            if (!name) {
+                emitLine(c, "gemFail(\"Invalid binary operator.\", %d);", op.line);
+                emitLine(c, "Value t%d = INT_VAL(0);", t);
+                return t;
+            }
+            // Inline int fast path, generic runtime operation otherwise
+            const char* cop = "+";
+            const char* wrap = "INT_VAL";
+            const char* guard = "";
+            switch (op.type) {
+                case TOKEN_PLUS: cop = "+"; break;
+                case TOKEN_MINUS: cop = "-"; break;
+                case TOKEN_STAR: cop = "*"; break;
+                case TOKEN_SLASH: cop = "/"; guard = " && AS_INT(t%d) != 0 && AS_INT(t%d) != -1"; break;
+                case TOKEN_PERCENT: cop = "%"; guard = " && AS_INT(t%d) != 0 && AS_INT(t%d) != -1"; break;
+                case TOKEN_LESS: cop = "<"; wrap = "BOOL_VAL"; break;
+                case TOKEN_LESS_EQUAL: cop = "<="; wrap = "BOOL_VAL"; break;
+                case TOKEN_GREATER: cop = ">"; wrap = "BOOL_VAL"; break;
+                case TOKEN_GREATER_EQUAL: cop = ">="; wrap = "BOOL_VAL"; break;
+                case TOKEN_EQUAL_EQUAL: cop = "=="; wrap = "BOOL_VAL"; break;
+                case TOKEN_BANG_EQUAL: cop = "!="; wrap = "BOOL_VAL"; break;
+                default: break;
+            }
+            // Divisors 0 and -1 go to the runtime, which reports zero and
+            // INT_MIN / -1 like the interpreter
+            char divisorGuard[96] = "";
+            if (*guard) snprintf(divisorGuard, sizeof(divisorGuard), guard, right, right);
+            emitLine(c, "Value t%d = (IS_INT(t%d) && IS_INT(t%d)%s) ? %s(AS_INT(t%d) %s AS_INT(t%d)) : gemBinary(%s, t%d, t%d, %d);",
+                     t, left, right, divisorGuard, wrap, left, cop, right, name, left, right, op.line);
+            return t;
+        }
+        case NODE_EXPR_CALL:
+            return emitCall(c, node);
+        case NODE_EXPR_GET: {
+            Node* object = node->get.object;
+            Token member = node->get.name;
+            AotModule* m = object->type == NODE_EXPR_VAR ? resolveModule(c, object->var.name) : NULL;
+            t = c->temp++;
+            if (m) {
+                if (hasName(&m->globals, member)) {
+                    emitLine(c, "Value t%d = g%d_%.*s;", t, m->id, member.length, member.start);
+                } else {
+                    emitLine(c, "gemFail(\"Unknown module member.\", %d);", member.line);
+                    emitLine(c, "Value t%d = INT_VAL(0);", t);
+                }
+                return t;
+            }
+            int obj = emitExpr(c, object);
+            t = c->temp++;
+            emitLine(c, "Value t%d = gemGet(t%d, \"%.*s\", %d);", t, obj, member.length, member.start, member.line);
+            return t;
+        }
+        case NODE_EXPR_INDEX: {
+            int target = emitExpr(c, node->index.target);
+            int index = emitExpr(c, node->index.index);
+            t = c->temp++;
+            emitLine(c, "Value t%d = gemIndexFast(t%d, t%d, %d);", t, target, index, node->index.bracket.line);
+            return t;
+        }
+        default:
+            t = c->temp++;
+            emitLine(c, "gemFail(\"Invalid expression type.\", 0);");
+            emitLine(c, "Value t%d = INT_VAL(0);", t);
+            return t;
+    }
+}
+
+// Emit a call: direct C call for user functions, runtime call for builtins
+static int emitCall(AotCompiler* c, Node* node) {
+    Node* callee = node->call.callee;
+    Node* func = NULL;
+    AotModule* owner = NULL;
+    int line = 0;
+    bool builtin = false;
+    if (callee->type == NODE_EXPR_VAR) {
+        // Main program functions first, then the current module's
+        line = callee->var.name.line;
+        owner = c->modules[0];
+        func = findModuleFunction(owner, callee->var.name);
+        if (!func) {
+            owner = c->module;
+            func = findModuleFunction(owner, callee->var.name);
+        }
+        builtin = !func;
+        // Parallel built-ins need interpreter worker VMs
+        if (builtin && callee->var.name.length > 8 && strncmp(callee->var.name.start, "parallel", 8) == 0) {
+            error("--emit-c: parallel built-ins are not supported.", line);
+        }
+        // Functions called back by name (a sort() comparator, jsonEach()) need the interpreter
+        if (builtin && callee->var.name.length == 4 && strncmp(callee->var.name.start, "sort", 4) == 0 &&
+            node->call.arguments && node->call.arguments->next) {
+            error("--emit-c: sort() with a comparator is not supported.", line);
+        }
+        if (builtin && callee->var.name.length == 8 && strncmp(callee->var.name.start, "jsonEach", 8) == 0) {
+            error("--emit-c: jsonEach() is not supported.", line);
+        }
+    } else if (callee->type == NODE_EXPR_GET) {
+        Node* object = callee->get.object;
+        line = callee->get.name.line;
+        owner = object->type == NODE_EXPR_VAR ? resolveModule(c, object->var.name) : NULL;
+        if (!owner) error("--emit-c: method calls are only supported on imported modules.", line);
+        if (owner->native) {
+            builtin = findNativeFunction(owner->native, callee->get.name.start, callee->get.name.length) != NULL;
+        } else {
+            func = findModuleFunction(owner, callee->get.name);
+        }
+    } else {
+        error("Invalid call target.", 0);
+    }
+
+    int t;
+    if (!func && !builtin) {
+        t = c->temp++;
+        emitLine(c, "gemFail(\"Undefined function.\", %d);", line);
+        emitLine(c, "Value t%d = INT_VAL(0);", t);
+        return t;
+    }
+
+    int args[16];
+    int argCount = 0;
+    for (Node* arg = node->call.arguments; arg; arg = arg->next) {
+        if (argCount >= 16) error("Too many arguments (max 16).", line);
+        args[argCount++] = emitExpr(c, arg);
+    }
+
+    t = c->temp++;
+    if (builtin && owner && owner->native) {
+        Token name = callee->get.name;
+        const char* module = owner->native->name;
+        if (argCount == 0) {
+            emitLine(c, "Value t%d = gemCallNative(\"%s\", \"%.*s\", NULL, 0, %d);", t, module, name.length, name.start, line);
+            return t;
+        }
+        for (int i = 0; i < c->indent; i++) fputs("    ", c->out);
+        fprintf(c->out, "Value a%d[] = {", t);
+        for (int i = 0; i < argCount; i++) fprintf(c->out, "%st%d", i ? ", " : "", args[i]);
+        fprintf(c->out, "};\n");
+        emitLine(c, "Value t%d = gemCallNative(\"%s\", \"%.*s\", a%d, %d, %d);", t, module, name.length, name.start, t, argCount, line);
+        return t;
+    }
+    if (builtin) {
+        Token name = callee->var.name;
+        if (argCount == 0) {
+            emitLine(c, "Value t%d = gemCallBuiltin(\"%.*s\", NULL, 0, %d);", t, name.length, name.start, line);
+            return t;
+        }
+        for (int i = 0; i < c->indent; i++) fputs("    ", c->out);
+        fprintf(c->out, "Value a%d[] = {", t);
+        for (int i = 0; i < argCount; i++) fprintf(c->out, "%st%d", i ? ", " : "", args[i]);
+        fprintf(c->out, "};\n");
+        emitLine(c, "Value t%d = gemCallBuiltin(\"%.*s\", a%d, %d, %d);", t, name.length, name.start, t, argCount, line);
+        return t;
+    }
+
+    if (argCount != func->function.paramCount) {
+        emitLine(c, "gemFail(\"Expected %d arguments but got %d.\", 0);", func->function.paramCount, argCount);
+        emitLine(c, "Value t%d = INT_VAL(0);", t);
+        return t;
+    }
+    Token name = func->function.name;
+    for (int i = 0; i < c->indent; i++) fputs("    ", c->out);
+    fprintf(c->out, "Value t%d = f%d_%.*s(", t, owner->id, name.length, name.start);
+    for (int i = 0; i < argCount; i++) fprintf(c->out, "%st%d", i ? ", " : "", args[i]);
+    fprintf(c->out, ");\n");
+    return t;
+}
+
+// Emit a loop/if body without an extra brace level for blocks
+static void emitBody(AotCompiler* c, Node* node) {
+    if (node->type == NODE_STMT_BLOCK) {
+        for (int i = 0; i < node->block.count; i++) {
+            emitStmt(c, node->block.statements[i]);
+        }
+    } else {
+        emitStmt(c, node);
+    }
+}
+
+// C variable of a name declared by the statement being emitted (var, for-in)
+static void declaredSlot(AotCompiler* c, Token name, char* buf, size_t size) {
+    if (c->function) {
+        snprintf(buf, size, "l_%.*s", name.length, name.start);
+    } else {
+        snprintf(buf, size, "g%d_%.*s", c->module->id, name.length, name.start);
+    }
+}
+
+// Record that the statement being emitted declares name (sets its flag
+// unless it is already definitely declared)
+static void markDeclared(AotCompiler* c, Token name) {
+    if (hasName(&c->declared, name)) return;
+    if (c->function) {
+        emitLine(c, "d_%.*s = true;", name.length, name.start);
+    } else {
+        emitLine(c, "d%d_%.*s = true;", c->module->id, name.length, name.start);
+    }
+    addName(&c->declared, name);
+}
+
+// Emit a nested statement; declarations made inside it are not definitely
+// declared afterwards (same rule as the JIT)
+static void emitScoped(AotCompiler* c, Node* node) {
+    int saved = c->declared.count;
+    emitBody(c, node);
+    c->declared.count = saved;
+}
+
+static void emitStmt(AotCompiler* c, Node* node) {
+    switch (node->type) {
+        case NODE_STMT_FOR_IN: {
+            // Same iteration as the interpreter: gemForInNext stores the
+            // loop variables and frees the strings it made itself
+            int iterable = emitExpr(c, node->for_in.iterable);
+            int it = c->temp++;
+            char key[300], value[300];
+            declaredSlot(c, node->for_in.key, key, sizeof(key));
+            bool pair = node->for_in.value.length > 0;
+            if (pair) declaredSlot(c, node->for_in.value, value, sizeof(value));
+            emitLine(c, "{");
+            c->indent++;
+            emitLine(c, "GemForIn t%d;", it);
+            emitLine(c, "gemForInStart(&t%d, t%d, %d);", it, iterable, node->for_in.key.line);
+            markDeclared(c, node->for_in.key);
+            if (pair) markDeclared(c, node->for_in.value);
+            emitLine(c, "while (gemForInNext(&t%d, &%s, %s%s)) {", it, key, pair ? "&" : "", pair ? value : "NULL");
+            c->indent++;
+            emitScoped(c, node->for_in.body);
+            c->indent--;
+            emitLine(c, "}");
+            c->indent--;
+            emitLine(c, "}");
+            break;
+        }
+        case NODE_STMT_VAR_DECL: {
+            Token name = node->var_decl.name;
+            int value = node->var_decl.initializer ? emitExpr(c, node->var_decl.initializer) : -1;
+            char slot[300];
+            declaredSlot(c, name, slot, sizeof(slot));
+            if (value >= 0) {
+                emitLine(c, "gemStore(&%s, t%d);", slot, value);
+            } else {
+                emitLine(c, "gemStore(&%s, INT_VAL(0));", slot);
+            }
+            markDeclared(c, name);
+            break;
+        }
+        case NODE_STMT_ASSIGN: {
+            int value = emitExpr(c, node->assign.value);
+            AotSlot slots[3];
+            int n = resolveVar(c, node->assign.name, slots);
+            for (int i = 0; i < n; i++) {
+                if (slots[i].flag[0]) {
+                    emitLine(c, "%sif (%s) gemStore(&%s, t%d);", i ? "else " : "", slots[i].flag, slots[i].slot, value);
+                } else {
+                    emitLine(c, "%sgemStore(&%s, t%d);", i ? "else " : "", slots[i].slot, value);
+                }
+            }
+            if (n == 0 || slots[n - 1].flag[0]) {
+                emitLine(c, "%sgemFail(\"Undefined variable.\", %d);", n ? "else " : "", node->assign.name.line);
+            }
+            break;
+        }
+        case NODE_STMT_INDEX_ASSIGN: {
+            int target = emitExpr(c, node->index_assign.target);
+            int index = emitExpr(c, node->index_assign.index);
+            int value = emitExpr(c, node->index_assign.value);
+            emitLine(c, "gemIndexAssign(t%d, t%d, t%d, %d);", target, index, value, node->index_assign.bracket.line);
+            break;
+        }
+        case NODE_STMT_PRINT: {
+            int value = emitExpr(c, node->print.expr);
+            emitLine(c, "gemPrint(t%d);", value);
+            break;
+        }
+        case NODE_STMT_IF: {
+            emitLine(c, "{");
+            c->indent++;
+            int cond = emitExpr(c, node->if_stmt.condition);
+            emitLine(c, "if (gemTest(t%d)) {", cond);
+            c->indent++;
+            emitScoped(c, node->if_stmt.thenBranch);
+            c->indent--;
+            if (node->if_stmt.elseBranch) {
+                emitLine(c, "} else {");
+                c->indent++;
+                emitScoped(c, node->if_stmt.elseBranch);
+                c->indent--;
+            }
+            emitLine(c, "}");
+            c->indent--;
+            emitLine(c, "}");
+            break;
+        }
+        case NODE_STMT_WHILE: {
+            emitLine(c, "for (;;) {");
+            c->indent++;
+            int cond = emitExpr(c, node->while_stmt.condition);
+            emitLine(c, "if (!gemTest(t%d)) break;", cond);
+            emitScoped(c, node->while_stmt.body);
+            c->indent--;
+            emitLine(c, "}");
+            break;
+        }
+        case NODE_STMT_FOR: {
+            emitLine(c, "{");
+            c->indent++;
+            if (node->for_stmt.initializer) emitStmt(c, node->for_stmt.initializer);
+            emitLine(c, "for (;;) {");
+            c->indent++;
+            int saved = c->declared.count;
+            if (node->for_stmt.condition) {
+                int cond = emitExpr(c, node->for_stmt.condition);
+                emitLine(c, "if (!gemTest(t%d)) break;", cond);
+            }
+            emitBody(c, node->for_stmt.body);
+            if (node->for_stmt.increment) emitStmt(c, node->for_stmt.increment);
+            c->declared.count = saved;
+            c->indent--;
+            emitLine(c, "}");
+            c->indent--;
+            emitLine(c, "}");
+            break;
+        }
+        case NODE_STMT_BLOCK:
+            emitLine(c, "{");
+            c->indent++;
+            emitBody(c, node);
+            c->indent--;
+            emitLine(c, "}");
+            break;
+        case NODE_STMT_FUNCTION:
+            // Hoisted: emitted as a C function by emitFunction
+            if (c->function) {
+                error("--emit-c: nested function definitions are not supported.", node->function.name.line);
+            }
+            break;
+        case NODE_STMT_RETURN: {
+            if (!c->function) {
+                emitLine(c, "gemFail(\"Return statement outside function.\", 0);");
+                break;
+            }
+            if (node->return_stmt.value) {
+                int value = emitExpr(c, node->return_stmt.value);
+                emitLine(c, "ret = t%d;", value);
+            }
+            emitLine(c, "goto done;");
+            c->usesReturn = true;
+            break;
+        }
+        case NODE_STMT_IMPORT: {
+            if (c->function) {
+                error("--emit-c: imports inside functions are not supported.", node->import_stmt.module.line);
+            }
+            AotModule* m = resolveModule(c, node->import_stmt.alias);
+            Token alias = node->import_stmt.alias;
+            emitLine(c, "m%d_init();", m->id);
+            emitLine(c, "g%d_%.*s = m%d_value;", c->module->id, alias.length, alias.start, m->id);
+            markDeclared(c, alias);
+            break;
+        }
+        default: {
+            int value = emitExpr(c, node);
+            emitLine(c, "(void)t%d;", value);
+            break;
+        }
+    }
+}
+
+static void emitSignature(AotCompiler* c, AotModule* m, Node* func, const char* end) {
+    Token name = func->function.name;
+    fprintf(c->out, "static Value f%d_%.*s(", m->id, name.length, name.start);
+    if (func->function.paramCount == 0) fputs("void", c->out);
+    for (int i = 0; i < func->function.paramCount; i++) {
+        Token param = func->function.params[i];
+        fprintf(c->out, "%sValue l_%.*s", i ? ", " : "", param.length, param.start);
+    }
+    fprintf(c->out, ")%s\n", end);
+}
+
+static void emitFunction(AotCompiler* c, AotModule* m, Node* func) {
+    c->module = m;
+    c->function = func;
+    c->locals.count = 0;
+    c->declared.count = 0;
+    c->temp = 0;
+    c->usesReturn = false;
+    for (int i = 0; i < func->function.paramCount; i++) {
+        addName(&c->locals, func->function.params[i]);
+        addName(&c->declared, func->function.params[i]);
+    }
+    int paramCount = c->locals.count;
+    collectLocals(c, func->function.body);
+
+    emitSignature(c, m, func, " {");
+    c->indent = 1;
+    emitLine(c, "Value ret = INT_VAL(0);");
+    emitLine(c, "if (gemCallDepth >= CALL_STACK_MAX) gemFail(\"Call stack overflow.\", 0);");
+    emitLine(c, "gemCallDepth++;");
+    for (int i = paramCount; i < c->locals.count; i++) {
+        Token local = c->locals.items[i];
+        emitLine(c, "Value l_%.*s = INT_VAL(0);", local.length, local.start);
+        emitLine(c, "bool d_%.*s = false;", local.length, local.start);
+        emitLine(c, "(void)d_%.*s;", local.length, local.start);
+    }
+    emitBody(c, func->function.body);
+    if (c->usesReturn) fputs("done:\n", c->out);
+    emitLine(c, "gemCallDepth--;");
+    emitLine(c, "return ret;");
+    c->indent = 0;
+    fputs("}\n\n", c->out);
+    c->function = NULL;
+}
+
+static void emitModuleInit(AotCompiler* c, AotModule* m) {
+    c->module = m;
+    c->function = NULL;
+    c->declared.count = 0;
+    c->temp = 0;
+    fprintf(c->out, "static void m%d_init(void) {\n", m->id);
+    c->indent = 1;
+    if (m->id != 0) {
+        emitLine(c, "if (m%d_loaded) return;", m->id);
+        emitLine(c, "m%d_loaded = true;", m->id);
+    }
+    if (m->ast) emitBody(c, m->ast);
+    if (m->id != 0) {
+        emitLine(c, "m%d_value = gemModule(\"%s\");", m->id, m->alias ? m->alias : m->key);
+    }
+    c->indent = 0;
+    fputs("}\n\n", c->out);
+}
+
+void emitC(Node* ast, const char* path, FILE* out) {
+    AotCompiler compiler;
+    memset(&compiler, 0, sizeof(compiler));
+    AotCompiler* c = &compiler;
+    c->out = out;
+    if (!getcwd(c->projectRoot, sizeof(c->projectRoot))) {
+        strcpy(c->projectRoot, ".");
+    }
+
+    AotModule* program = newModule(c, "", NULL, ast);
+    collectTopLevel(c, program, ast);
+
+    fprintf(out, "// Generated by `gemini --emit-c` from %s. Do not edit.\n", path);
+    fprintf(out, "// Build: gcc -O2 -Iinclude <this file> bin/libgemini.a -pthread -lm\n");
+#ifdef GEMINI_NAN_BOXING
+    fprintf(out, "#define GEMINI_NAN_BOXING\n");
+#endif
+    fprintf(out, "#include \"runtime.h\"\n\n");
+
+    // Declarations
+    for (int i = 0; i < c->moduleCount; i++) {
+        AotModule* m = c->modules[i];
+        fprintf(out, "// module %d: %s\n", m->id, m->id == 0 ? path : m->key);
+        for (int j = 0; j < m->globals.count; j++) {
+            Token g = m->globals.items[j];
+            fprintf(out, "static Value g%d_%.*s;\n", m->id, g.length, g.start);
+            fprintf(out, "static bool d%d_%.*s;\n", m->id, g.length, g.start);
+        }
+        if (m->id != 0) {
+            fprintf(out, "static bool m%d_loaded;\n", m->id);
+            fprintf(out, "static Value m%d_value;\n", m->id);
+        }
+        fprintf(out, "static void m%d_init(void);\n", m->id);
+        for (int j = 0; j < m->funcCount; j++) {
+            emitSignature(c, m, m->functions[j], ";");
+        }
+        fputc('\n', out);
+    }
+
+    // Definitions
+    for (int i = 0; i < c->moduleCount; i++) {
+        AotModule* m = c->modules[i];
+        for (int j = 0; j < m->funcCount; j++) {
+            emitFunction(c, m, m->functions[j]);
+        }
+        emitModuleInit(c, m);
+    }
+
+    fputs("int main(int argc, char** argv) {\n", out);
+    c->indent = 1;
+    emitLine(c, "gemArgs = argv + 1;");
+    emitLine(c, "gemArgCount = argc - 1;");
+    for (int i = 0; i < c->moduleCount; i++) {
+        AotModule* m = c->modules[i];
+        for (int j = 0; j < m->globals.count; j++) {
+            Token g = m->globals.items[j];
+            emitLine(c, "g%d_%.*s = INT_VAL(0);", m->id, g.length, g.start);
+        }
+        if (m->id != 0) emitLine(c, "m%d_value = INT_VAL(0);", m->id);
+    }
+    emitLine(c, "m0_init();");
+    emitLine(c, "return 0;");
+    fputs("}\n", out);
+}
@@ -0,0 +1,100 @@
+#include "common.h"
+#include "output.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// Innermost recovery point of the current thread (NULL: errors exit)
+static _Thread_local ErrorContext* currentContext = NULL;
+
+void pushErrorContext(ErrorContext* ctx) {
+    ctx->previous = currentContext;
+    currentContext = ctx;
+}
+
+void popErrorContext(ErrorContext* ctx) {
+    currentContext = ctx->previous;
+}
+
+// Error function
+void error(const char* message, int line) {
+    if (currentContext) {
+        ErrorContext* ctx = currentContext;
+        snprintf(ctx->message, sizeof(ctx->message), "%s", message);
+        ctx->line = line;
+        longjmp(ctx->jump, 1);
+    }
+    outFlush(); // program output so far precedes the error
+    fprintf(stderr, "[line %d] Error: %s\n", line, message);
+    exit(1);
+}
+
+// ---- Hashing ----
+
+static uint64_t hashSeed;
+static pthread_once_t hashSeedOnce = PTHREAD_ONCE_INIT;
+
+static void initHashSeed(void) {
+    const char* fixed = getenv("GEMINI_HASH_SEED");
+    if (fixed && *fixed) {
+        hashSeed = strtoull(fixed, NULL, 0);
+        return;
+    }
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, &hashSeed, sizeof(hashSeed));
+        close(fd);
+        if (n == (ssize_t)sizeof(hashSeed)) return;
+    }
+    // No random source: fall back to values that differ between runs
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    hashSeed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^ ((uint64_t)getpid() << 16) ^ (uint64_t)(uintptr_t)&ts;
+}
+
+// 64x64 -> 128-bit multiply folded to 64 bits (wyhash's mixing step)
+static uint64_t hashMix(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t lo = a * b;
+    uint64_t hi = (a >> 32) * (b >> 32) + (((a & 0xffffffffu) * (b >> 32) + (a >> 32) * (b & 0xffffffffu)) >> 32);
+    return lo ^ hi;
+#endif
+}
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+
+static unsigned int hashFinish(uint64_t h) {
+    unsigned int r = (unsigned int)(h ^ (h >> 32));
+    return r ? r : 1;
+}
+
+unsigned int hashString(const char* key, size_t length) {
+    pthread_once(&hashSeedOnce, initHashSeed);
+    const unsigned char* p = (const unsigned char*)key;
+    uint64_t h = hashSeed ^ (length * HASH_P0);
+    size_t left = length;
+    uint64_t word;
+    while (left > 8) {
+        memcpy(&word, p, 8);
+        h = hashMix(h ^ word, HASH_P1);
+        p += 8;
+        left -= 8;
+    }
+    // Last 1..8 bytes (an overlapping word when the key is long enough)
+    word = 0;
+    if (length >= 8) memcpy(&word, key + length - 8, 8);
+    else memcpy(&word, p, left);
+    return hashFinish(hashMix(h ^ word, HASH_P2));
+}
+
+unsigned int hashInt(int key) {
+    pthread_once(&hashSeedOnce, initHashSeed);
+    return hashFinish(hashMix(hashSeed ^ (uint64_t)(unsigned int)key, HASH_P1));
+}
@@ -0,0 +1,413 @@
+#include "csv.h"
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+
+// Column types, in the order a column is widened
+typedef enum {
+    COLUMN_EMPTY,           // only empty fields so far
+    COLUMN_INT,
+    COLUMN_FLOAT,
+    COLUMN_STRING
+} ColumnKind;
+
+typedef struct {
+    const char* p;          // next field
+    const char* end;        // end of input
+    char separator;
+    char terminator;        // ends a record ('\n'; the separator in row mode)
+    bool recordEnd;         // the last field read was the last of its record
+    char* scratch;          // unquoted text of the last quoted field
+    size_t scratchCap;
+    int line;               // script line for errors
+} CsvCursor;
+
+// First byte in [p, end) that is the separator or the terminator. Whole
+// words without one are skipped 8 bytes at a time.
+static const char* scanPlain(const char* p, const char* end, char separator, char terminator) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    const uint64_t sep = ones * (unsigned char)separator;
+    const uint64_t term = ones * (unsigned char)terminator;
+    while (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        uint64_t a = w ^ sep;
+        uint64_t b = w ^ term;
+        if ((((a - ones) & ~a) | ((b - ones) & ~b)) & highs) break;
+        p += 8;
+    }
+    while (p < end && *p != separator && *p != terminator) p++;
+    return p;
+}
+
+static void scratchAppend(CsvCursor* c, size_t* used, const char* bytes, size_t length) {
+    if (length == 0) return;
+    if (*used + length > c->scratchCap) {
+        size_t cap = c->scratchCap ? c->scratchCap * 2 : 64;
+        while (cap < *used + length) cap *= 2;
+        char* grown = realloc(c->scratch, cap);
+        if (!grown) error("Memory allocation failed.", c->line);
+        c->scratch = grown;
+        c->scratchCap = cap;
+    }
+    memcpy(c->scratch + *used, bytes, length);
+    *used += length;
+}
+
+// Read the field at the cursor. Plain fields point into the input; quoted
+// ones are unquoted into the cursor's scratch buffer (valid until the next
+// field). Text after a closing quote is kept, and a "\r" before the line
+// end is dropped.
+static const char* readField(CsvCursor* c, size_t* length) {
+    const char* p = c->p;
+    const char* end = c->end;
+    const char* field;
+    const char* stop;
+    bool lineEnd;
+    if (p < end && *p == '"') {
+        size_t used = 0;
+        p++;
+        while (true) {
+            const char* q = memchr(p, '"', (size_t)(end - p));
+            if (!q) {
+                // Unterminated: the field runs to the end of the input
+                scratchAppend(c, &used, p, (size_t)(end - p));
+                p = end;
+                break;
+            }
+            scratchAppend(c, &used, p, (size_t)(q - p));
+            p = q + 1;
+            if (p < end && *p == '"') {
+                scratchAppend(c, &used, "\"", 1);
+                p++;
+                continue;
+            }
+            break;
+        }
+        stop = scanPlain(p, end, c->separator, c->terminator);
+        lineEnd = stop == end || *stop != c->separator;
+        size_t tail = (size_t)(stop - p);
+        if (lineEnd && tail > 0 && stop[-1] == '\r') tail--;
+        scratchAppend(c, &used, p, tail);
+        field = c->scratch;
+        *length = used;
+    } else {
+        stop = scanPlain(p, end, c->separator, c->terminator);
+        lineEnd = stop == end || *stop != c->separator;
+        field = p;
+        *length = (size_t)(stop - p);
+        if (lineEnd && *length > 0 && p[*length - 1] == '\r') (*length)--;
+    }
+    c->p = stop < end ? stop + 1 : end;
+    c->recordEnd = lineEnd;
+    return field;
+}
+
+static Value fieldString(const char* field, size_t length, int line) {
+    if (length <= 1) return STRING_VAL(charStrings[length ? (unsigned char)field[0] : 0]);
+    char* s = malloc(length + 1);
+    if (!s) error("Memory allocation failed.", line);
+    memcpy(s, field, length);
+    s[length] = '\0';
+    return STRING_VAL(s);
+}
+
+Value csvSplitRecord(const char* text, size_t length, char separator, int line) {
+    Array* fields = newArray();
+    if (length == 0) return ARRAY_VAL(fields);
+    // The reader has already found the record's end, so newlines here are
+    // inside quotes or are part of a field
+    CsvCursor c = { text, text + length, separator, separator, false, NULL, 0, line };
+    do {
+        size_t n;
+        const char* field = readField(&c, &n);
+        arrayPush(fields, fieldString(field, n, line));
+    } while (!c.recordEnd);
+    free(c.scratch);
+    return ARRAY_VAL(fields);
+}
+
+// ---- Column mode ----
+
+// Powers of ten that are exact doubles
+static const double exactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Parse a whole non-empty field (surrounding spaces allowed) as a number.
+// Returns COLUMN_INT or COLUMN_FLOAT with the value in *out, or
+// COLUMN_STRING if the field is not a number. Digits that fit in 53 bits
+// with a small exponent are one exact multiply or divide; the rest go
+// through strtod.
+static ColumnKind parseNumberField(const char* s, size_t n, double* out) {
+    const char* p = s;
+    const char* end = s + n;
+    while (p < end && *p == ' ') p++;
+    while (end > p && end[-1] == ' ') end--;
+    const char* begin = p;
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    uint64_t mantissa = 0;
+    int digits = 0;         // significant digits in mantissa
+    int exponent = 0;
+    bool truncated = false; // digits beyond the 19 kept in mantissa
+    bool any = false;
+    bool integral = true;
+    while (p < end && isDigit(*p)) {
+        any = true;
+        if (digits < 19) {
+            if (mantissa != 0 || *p != '0') { mantissa = mantissa * 10 + (uint64_t)(*p - '0'); digits++; }
+        } else {
+            exponent++;
+            truncated = true;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        integral = false;
+        p++;
+        while (p < end && isDigit(*p)) {
+            any = true;
+            if (digits < 19) {
+                if (mantissa != 0 || *p != '0') { mantissa = mantissa * 10 + (uint64_t)(*p - '0'); digits++; }
+                exponent--;
+            } else {
+                truncated = true;
+            }
+            p++;
+        }
+    }
+    if (!any) return COLUMN_STRING;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integral = false;
+        p++;
+        bool negativeExp = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) p++;
+        if (p >= end || !isDigit(*p)) return COLUMN_STRING;
+        int e = 0;
+        while (p < end && isDigit(*p)) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+            p++;
+        }
+        exponent += negativeExp ? -e : e;
+    }
+    if (p != end) return COLUMN_STRING;
+
+    if (integral && digits <= 10) {
+        int64_t v = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+        if (v >= INT_MIN && v <= INT_MAX) {
+            *out = (double)v;
+            return COLUMN_INT;
+        }
+    }
+    if (!truncated && mantissa <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / exactPowers[-exponent] : d * exactPowers[exponent];
+        *out = negative ? -d : d;
+        return COLUMN_FLOAT;
+    }
+    char small[64];
+    size_t length = (size_t)(end - begin);
+    char* text = length < sizeof(small) ? small : malloc(length + 1);
+    if (!text) error("Memory allocation failed.", 0);
+    memcpy(text, begin, length);
+    text[length] = '\0';
+    *out = strtod(text, NULL);
+    if (text != small) free(text);
+    return COLUMN_FLOAT;
+}
+
+typedef struct {
+    ColumnKind kind;
+    bool blank;             // some row has no value in this column
+    double* numbers;        // one per row while the column is numeric
+    int capacity;
+    Array* strings;         // string column, filled by the second walk
+} Column;
+
+typedef struct {
+    Column* items;
+    int count;
+    int capacity;
+    int rows;               // records after the header
+    int line;
+} ColumnSet;
+
+// Store a number for a row of a numeric column
+static void columnStore(Column* col, int row, double v, int line) {
+    if (col->kind == COLUMN_STRING) return;
+    if (row >= col->capacity) {
+        int cap = col->capacity < 1024 ? 1024 : col->capacity * 2;
+        double* grown = realloc(col->numbers, sizeof(double) * (size_t)cap);
+        if (!grown) error("Memory allocation failed.", line);
+        col->numbers = grown;
+        col->capacity = cap;
+    }
+    col->numbers[row] = v;
+}
+
+// Add a column; in earlier rows it was empty
+static void addColumn(ColumnSet* set) {
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 16;
+        Column* grown = realloc(set->items, sizeof(Column) * (size_t)set->capacity);
+        if (!grown) error("Memory allocation failed.", set->line);
+        set->items = grown;
+    }
+    Column* col = &set->items[set->count++];
+    memset(col, 0, sizeof(Column));
+    for (int row = 0; row < set->rows; row++) columnStore(col, row, NAN, set->line);
+    col->blank = set->rows > 0;
+}
+
+// Start of the next record, skipping blank lines; NULL at end of input
+static const char* nextRecord(const char* p, const char* end) {
+    while (p < end && (*p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n'))) p += *p == '\n' ? 1 : 2;
+    return p < end ? p : NULL;
+}
+
+Value csvReadColumns(const char* path, char separator, bool header, int line) {
+    FileContents input;
+    if (!fileLoadAll(path, &input)) error("Could not open file.", line);
+    const char* end = input.data + input.size;
+    CsvCursor c = { input.data, end, separator, '\n', false, NULL, 0, line };
+    ColumnSet set = { NULL, 0, 0, 0, line };
+
+    // Column names
+    Array* names = NULL;
+    const char* body = nextRecord(c.p, end);
+    if (header && body) {
+        names = newArray();
+        c.p = body;
+        do {
+            size_t n;
+            const char* field = readField(&c, &n);
+            arrayPush(names, fieldString(field, n, line));
+            addColumn(&set);
+        } while (!c.recordEnd);
+        body = nextRecord(c.p, end);
+    }
+
+    // First walk: types, numbers and the row count
+    bool anyStrings = false;
+    for (c.p = body; c.p && (c.p = nextRecord(c.p, end)); ) {
+        if (set.rows == INT_MAX) error("csvRead(): too many rows.", line);
+        int i = 0;
+        do {
+            size_t n;
+            const char* field = readField(&c, &n);
+            if (i == set.count) {
+                if (names) {
+                    char msg[96];
+                    snprintf(msg, sizeof(msg), "csvRead(): record %d has more fields than the header.", set.rows + 1);
+                    error(msg, line);
+                }
+                addColumn(&set);
+            }
+            Column* col = &set.items[i++];
+            if (col->kind == COLUMN_STRING) continue;
+            double v = NAN;
+            if (n == 0) {
+                col->blank = true;
+            } else {
+                ColumnKind kind = parseNumberField(field, n, &v);
+                if (kind > col->kind) col->kind = kind;
+                if (kind == COLUMN_STRING) {
+                    free(col->numbers);
+                    col->numbers = NULL;
+                    anyStrings = true;
+                    continue;
+                }
+            }
+            columnStore(col, set.rows, v, line);
+        } while (!c.recordEnd);
+        for (; i < set.count; i++) {
+            set.items[i].blank = true;
+            columnStore(&set.items[i], set.rows, NAN, line);
+        }
+        set.rows++;
+        fileReleaseBefore(&input, (size_t)(c.p - input.data));
+    }
+
+    // Columns of only empty fields hold empty strings
+    for (int i = 0; i < set.count; i++) {
+        Column* col = &set.items[i];
+        if (col->kind == COLUMN_EMPTY && set.rows > 0) {
+            col->kind = COLUMN_STRING;
+            anyStrings = true;
+        }
+        if (col->kind == COLUMN_STRING) {
+            free(col->numbers);
+            col->numbers = NULL;
+            col->strings = newArray();
+            col->strings->items = malloc(sizeof(Value) * (size_t)(set.rows > 0 ? set.rows : 1));
+            if (!col->strings->items) error("Memory allocation failed.", line);
+            col->strings->capacity = set.rows;
+        }
+    }
+
+    // Second walk: text of the string columns
+    if (anyStrings) {
+        input.released = 0;
+        for (c.p = body; c.p && (c.p = nextRecord(c.p, end)); ) {
+            int i = 0;
+            do {
+                size_t n;
+                const char* field = readField(&c, &n);
+                Array* strings = set.items[i++].strings;
+                if (strings) strings->items[strings->count++] = fieldString(field, n, line);
+            } while (!c.recordEnd);
+            for (; i < set.count; i++) {
+                Array* strings = set.items[i].strings;
+                if (strings) strings->items[strings->count++] = STRING_VAL(charStrings[0]);
+            }
+            fileReleaseBefore(&input, (size_t)(c.p - input.data));
+        }
+    }
+    free(c.scratch);
+    fileReleaseAll(&input);
+
+    Map* result = newMap();
+    for (int i = 0; i < set.count; i++) {
+        Column* col = &set.items[i];
+        Array* values = col->strings;
+        if (!values) {
+            // Numbers: one exactly sized array; an int column with empty
+            // fields becomes a float column (NaN where empty)
+            bool ints = col->kind == COLUMN_INT && !col->blank;
+            values = newArray();
+            if (set.rows > 0) {
+                values->items = malloc(sizeof(Value) * (size_t)set.rows);
+                if (!values->items) error("Memory allocation failed.", line);
+            }
+            for (int r = 0; r < set.rows; r++) {
+                values->items[r] = ints ? INT_VAL((int)col->numbers[r]) : FLOAT_VAL(col->numbers[r]);
+            }
+            values->count = values->capacity = set.rows;
+            free(col->numbers);
+        }
+        if (names) {
+            const char* name = AS_STRING(names->items[i]);
+            mapSetStr(result, name, (int)strlen(name), ARRAY_VAL(values));
+        } else {
+            mapSetInt(result, i, ARRAY_VAL(values));
+        }
+    }
+    free(set.items);
+    if (names) {
+        for (int i = 0; i < names->count; i++) {
+            if (!isCharString(AS_STRING(names->items[i]))) free(AS_STRING(names->items[i]));
+        }
+        free(names->items);
+        free(names);
+    }
+    if (result->count != set.count) error("csvRead(): duplicate column name.", line);
+    return MAP_VAL(result);
+}
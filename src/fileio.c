@@ -0,0 +1,398 @@
+#define _DEFAULT_SOURCE // madvise
+#include "fileio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct FileHandle {
+    char* path;
+    bool reader;
+    bool closed;
+    char separator;         // CSV reader: field separator (0: plain lines)
+    int fd;
+    // mmap'd reader
+    char* map;
+    size_t mapSize;
+    size_t pos;
+    size_t released;        // prefix of the mapping already madvise'd away
+    // Block buffer: pending input for non-mmap readers, pending output for writers
+    char* buffer;
+    size_t bufferCap;
+    size_t start;           // reader: first unread byte
+    size_t length;          // bytes in buffer
+    bool eof;
+    FileHandle* nextOpen;   // open handles; writers are flushed at exit
+};
+
+// Process-wide registry of open handles (shared by all VMs)
+static FileHandle* openHandles = NULL;
+static bool exitHookInstalled = false;
+static pthread_mutex_t handlesLock = PTHREAD_MUTEX_INITIALIZER;
+
+void fileFlushAll(void) {
+    pthread_mutex_lock(&handlesLock);
+    for (FileHandle* f = openHandles; f; f = f->nextOpen) {
+        fileFlush(f);
+    }
+    pthread_mutex_unlock(&handlesLock);
+}
+
+void fileCloseAll(void) {
+    pthread_mutex_lock(&handlesLock);
+    FileHandle* list = openHandles;
+    openHandles = NULL;
+    pthread_mutex_unlock(&handlesLock);
+    while (list) {
+        FileHandle* next = list->nextOpen;
+        list->nextOpen = NULL;
+        fileClose(list);
+        list = next;
+    }
+}
+
+static FileHandle* newHandle(const char* path, bool reader, int fd) {
+    FileHandle* file = calloc(1, sizeof(FileHandle));
+    if (!file) error("Memory allocation failed.", 0);
+    file->path = strdup(path);
+    if (!file->path) error("Memory allocation failed.", 0);
+    file->reader = reader;
+    file->fd = fd;
+    pthread_mutex_lock(&handlesLock);
+    file->nextOpen = openHandles;
+    openHandles = file;
+    if (!exitHookInstalled) {
+        exitHookInstalled = true;
+        atexit(fileFlushAll);
+    }
+    pthread_mutex_unlock(&handlesLock);
+    return file;
+}
+
+static void allocBuffer(FileHandle* file) {
+    file->buffer = malloc(FILE_BUFFER_SIZE);
+    if (!file->buffer) error("Memory allocation failed.", 0);
+    file->bufferCap = FILE_BUFFER_SIZE;
+}
+
+FileHandle* fileOpenLines(const char* path) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    FileHandle* file = newHandle(path, true, fd);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            file->eof = true; // nothing to map
+            return file;
+        }
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            file->map = map;
+            file->mapSize = (size_t)st.st_size;
+            return file;
+        }
+    }
+    // Pipes, character devices, or mmap failure: large-block reads
+    allocBuffer(file);
+    return file;
+}
+
+FileHandle* fileOpenCsv(const char* path, char separator) {
+    FileHandle* file = fileOpenLines(path);
+    if (file) file->separator = separator;
+    return file;
+}
+
+FileHandle* fileOpenWrite(const char* path, bool append) {
+    int flags = O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC);
+    int fd = open(path, flags, 0644);
+    if (fd < 0) return NULL;
+    FileHandle* file = newHandle(path, false, fd);
+    allocBuffer(file);
+    return file;
+}
+
+// Read more input into the block buffer; returns false at end of input
+static bool fillBuffer(FileHandle* file) {
+    if (file->eof) return false;
+    // Move the unread tail to the front, growing for lines longer than the buffer
+    if (file->start > 0) {
+        memmove(file->buffer, file->buffer + file->start, file->length - file->start);
+        file->length -= file->start;
+        file->start = 0;
+    }
+    if (file->length == file->bufferCap) {
+        file->bufferCap *= 2;
+        file->buffer = realloc(file->buffer, file->bufferCap);
+        if (!file->buffer) error("Memory allocation failed.", 0);
+    }
+    while (true) {
+        ssize_t n = read(file->fd, file->buffer + file->length, file->bufferCap - file->length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            file->eof = true;
+            return false;
+        }
+        file->length += (size_t)n;
+        return true;
+    }
+}
+
+// Skip blank records ("\n" or "\r\n") ahead of a CSV reader's position, so
+// hasNext and the next record agree on what is left
+static void skipBlankRecords(FileHandle* file) {
+    if (!file->separator) return;
+    if (file->map) {
+        const char* p = file->map + file->pos;
+        const char* end = file->map + file->mapSize;
+        while (p < end && (*p == '\n' || (*p == '\r' && (p + 1 == end || p[1] == '\n')))) p += (*p == '\n' || p + 1 == end) ? 1 : 2;
+        file->pos = (size_t)(p - file->map);
+        return;
+    }
+    if (!file->buffer) return;
+    while (true) {
+        size_t available = file->length - file->start;
+        if (available < 2 && fillBuffer(file)) continue;
+        if (available == 0) return;
+        const char* p = file->buffer + file->start;
+        if (*p == '\n') file->start++;
+        else if (*p == '\r' && (available == 1 || p[1] == '\n')) file->start += available == 1 ? 1 : 2;
+        else return;
+    }
+}
+
+bool fileHasNext(FileHandle* file) {
+    if (!file->reader || file->closed) return false;
+    skipBlankRecords(file);
+    if (file->map) return file->pos < file->mapSize;
+    if (!file->buffer) return false;
+    if (file->start < file->length) return true;
+    return fillBuffer(file) && file->start < file->length;
+}
+
+// End of the line starting at p: the next newline, or for CSV readers the
+// next one outside double quotes. NULL if [p, end) holds no such newline.
+static const char* lineEnd(const FileHandle* file, const char* p, const char* end) {
+    const char* nl = memchr(p, '\n', (size_t)(end - p));
+    if (!file->separator) return nl;
+    bool quoted = false;
+    while (true) {
+        const char* stop = nl ? nl : end;
+        for (const char* q = memchr(p, '"', (size_t)(stop - p)); q; q = memchr(q + 1, '"', (size_t)(stop - q - 1))) {
+            quoted = !quoted;
+        }
+        if (!nl || !quoted) return nl;
+        p = nl + 1;
+        nl = memchr(p, '\n', (size_t)(end - p));
+    }
+}
+
+// Drop the "\r" of a "\r\n" terminator
+static size_t trimCarriageReturn(const char* line, size_t length) {
+    return (length > 0 && line[length - 1] == '\r') ? length - 1 : length;
+}
+
+const char* fileNextLine(FileHandle* file, size_t* length) {
+    if (!file->reader || file->closed) return NULL;
+    skipBlankRecords(file);
+
+    if (file->map) {
+        if (file->pos >= file->mapSize) return NULL;
+        const char* line = file->map + file->pos;
+        size_t remaining = file->mapSize - file->pos;
+        const char* nl = lineEnd(file, line, line + remaining);
+        size_t len = nl ? (size_t)(nl - line) : remaining;
+        file->pos += nl ? len + 1 : len;
+        if (file->pos - file->released >= FILE_RELEASE_CHUNK) {
+            // Release whole pages strictly before the current line
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t upto = ((size_t)(line - file->map) / page) * page;
+            if (upto > file->released) {
+                madvise(file->map + file->released, upto - file->released, MADV_DONTNEED);
+                file->released = upto;
+            }
+        }
+        *length = trimCarriageReturn(line, len);
+        return line;
+    }
+
+    if (!file->buffer) return NULL;
+    while (true) {
+        char* line = file->buffer + file->start;
+        size_t available = file->length - file->start;
+        const char* nl = lineEnd(file, line, line + available);
+        if (nl) {
+            size_t len = (size_t)(nl - line);
+            file->start += len + 1;
+            *length = trimCarriageReturn(line, len);
+            return line;
+        }
+        if (!fillBuffer(file)) {
+            // Final line without a terminator
+            line = file->buffer + file->start;
+            available = file->length - file->start;
+            if (available == 0) return NULL;
+            file->start = file->length;
+            *length = trimCarriageReturn(line, available);
+            return line;
+        }
+    }
+}
+
+bool fileFlush(FileHandle* file) {
+    if (file->reader || file->closed) return true;
+    const char* p = file->buffer;
+    size_t left = file->length;
+    while (left > 0) {
+        ssize_t n = write(file->fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    file->length = 0;
+    return true;
+}
+
+bool fileWrite(FileHandle* file, const char* chars, size_t length) {
+    if (file->reader || file->closed) return false;
+    if (file->length + length > file->bufferCap) {
+        if (!fileFlush(file)) return false;
+        if (length >= file->bufferCap) {
+            // Large writes go straight to the file
+            while (length > 0) {
+                ssize_t n = write(file->fd, chars, length);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                chars += n;
+                length -= (size_t)n;
+            }
+            return true;
+        }
+    }
+    memcpy(file->buffer + file->length, chars, length);
+    file->length += length;
+    return true;
+}
+
+void fileClose(FileHandle* file) {
+    if (file->closed) return;
+    fileFlush(file);
+    pthread_mutex_lock(&handlesLock);
+    for (FileHandle** link = &openHandles; *link; link = &(*link)->nextOpen) {
+        if (*link == file) { *link = file->nextOpen; break; }
+    }
+    pthread_mutex_unlock(&handlesLock);
+    if (file->map) munmap(file->map, file->mapSize);
+    file->map = NULL;
+    free(file->buffer);
+    file->buffer = NULL;
+    if (file->fd != STDIN_FILENO) close(file->fd);
+    file->closed = true;
+}
+
+char fileSeparator(FileHandle* file) {
+    return file->separator;
+}
+
+bool fileIsReader(FileHandle* file) {
+    return file->reader;
+}
+
+bool fileIsClosed(FileHandle* file) {
+    return file->closed;
+}
+
+const char* filePath(FileHandle* file) {
+    return file->path;
+}
+
+bool fileLoadAll(const char* path, FileContents* contents) {
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) return false;
+    contents->data = NULL;
+    contents->size = 0;
+    contents->mapped = false;
+    contents->released = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            contents->data = map;
+            contents->size = (size_t)st.st_size;
+            contents->mapped = true;
+        }
+    }
+    if (!contents->mapped) {
+        // Pipes, empty files, or mmap failure: read everything
+        size_t cap = FILE_BUFFER_SIZE;
+        char* buf = malloc(cap);
+        if (!buf) error("Memory allocation failed.", 0);
+        size_t length = 0;
+        while (true) {
+            if (length == cap) {
+                cap *= 2;
+                buf = realloc(buf, cap);
+                if (!buf) error("Memory allocation failed.", 0);
+            }
+            ssize_t n = read(fd, buf + length, cap - length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            length += (size_t)n;
+        }
+        contents->data = buf;
+        contents->size = length;
+    }
+    if (fd != STDIN_FILENO) close(fd);
+    return true;
+}
+
+void fileReleaseBefore(FileContents* contents, size_t offset) {
+    if (!contents->mapped || offset - contents->released < FILE_RELEASE_CHUNK) return;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t upto = offset / page * page;
+    madvise(contents->data + contents->released, upto - contents->released, MADV_DONTNEED);
+    contents->released = upto;
+}
+
+void fileReleaseAll(FileContents* contents) {
+    if (contents->mapped) munmap(contents->data, contents->size);
+    else free(contents->data);
+    contents->data = NULL;
+    contents->size = 0;
+}
+
+bool fileSaveAll(const char* path, const char* data, size_t length) {
+    size_t pathLength = strlen(path);
+    char* temp = malloc(pathLength + 32);
+    if (!temp) error("Memory allocation failed.", 0);
+    snprintf(temp, pathLength + 32, "%s.tmp%ld", path, (long)getpid());
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { free(temp); return false; }
+    bool ok = true;
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    if (close(fd) != 0) ok = false;
+    // The old file stays in place until the new one is complete
+    if (ok && rename(temp, path) != 0) ok = false;
+    if (!ok) unlink(temp);
+    free(temp);
+    return ok;
+}
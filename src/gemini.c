@@ -0,0 +1,121 @@
+#include "gemini.h"
+
+struct GeminiVM {
+    VM vm;
+    char message[256];      // last error
+    int line;
+};
+
+// VM state to restore when an error unwinds out of the interpreter
+typedef struct {
+    Environment* env;
+    Environment* defEnv;
+    int callStackTop;
+} SavedState;
+
+static SavedState saveState(VM* vm) {
+    SavedState state = {vm->env, vm->defEnv, vm->callStackTop};
+    return state;
+}
+
+// Record the error caught by ctx and put the VM back in a callable state
+static GeminiStatus recover(GeminiVM* g, ErrorContext* ctx, SavedState state) {
+    popErrorContext(ctx);
+    snprintf(g->message, sizeof(g->message), "%s", ctx->message);
+    g->line = ctx->line;
+    g->vm.env = state.env;
+    g->vm.defEnv = state.defEnv;
+    g->vm.callStackTop = state.callStackTop;
+    return GEMINI_ERROR;
+}
+
+static void clearError(GeminiVM* g) {
+    g->message[0] = '\0';
+    g->line = 0;
+}
+
+GeminiVM* geminiNewVM(void) {
+    GeminiVM* g = malloc(sizeof(GeminiVM));
+    if (!g) return NULL;
+    ErrorContext ctx;
+    if (setjmp(ctx.jump) != 0) {
+        popErrorContext(&ctx);
+        free(g);
+        return NULL;
+    }
+    pushErrorContext(&ctx);
+    initVM(&g->vm);
+    popErrorContext(&ctx);
+    clearError(g);
+    return g;
+}
+
+void geminiFreeVM(GeminiVM* g) {
+    if (!g) return;
+    freeVM(&g->vm);
+    free(g);
+}
+
+GeminiStatus geminiLoad(GeminiVM* g, const char* source) {
+    clearError(g);
+    SavedState state = saveState(&g->vm);
+    ErrorContext ctx;
+    if (setjmp(ctx.jump) != 0) return recover(g, &ctx, state);
+    pushErrorContext(&ctx);
+    vmLoad(&g->vm, source);
+    popErrorContext(&ctx);
+    return GEMINI_OK;
+}
+
+GeminiStatus geminiLoadFile(GeminiVM* g, const char* path) {
+    char* source = readFileAll(path);
+    if (!source) {
+        snprintf(g->message, sizeof(g->message), "Could not open file \"%s\".", path);
+        g->line = 0;
+        return GEMINI_ERROR;
+    }
+    GeminiStatus status = geminiLoad(g, source);
+    free(source);
+    return status;
+}
+
+GeminiStatus geminiCall(GeminiVM* g, const char* name, Value* args, int argCount, Value* result) {
+    clearError(g);
+    SavedState state = saveState(&g->vm);
+    ErrorContext ctx;
+    if (setjmp(ctx.jump) != 0) return recover(g, &ctx, state);
+    pushErrorContext(&ctx);
+    Value value;
+    if (!vmCall(&g->vm, name, args, argCount, &value)) {
+        error("Undefined function.", 0);
+    }
+    popErrorContext(&ctx);
+    if (result) *result = value;
+    return GEMINI_OK;
+}
+
+const char* geminiErrorMessage(GeminiVM* g) {
+    return g->message;
+}
+
+int geminiErrorLine(GeminiVM* g) {
+    return g->line;
+}
+
+void geminiSetOutput(GeminiVM* g, OutputFn output, void* user) {
+    g->vm.output = output;
+    g->vm.outputUser = user;
+}
+
+void geminiSetProjectRoot(GeminiVM* g, const char* directory) {
+    snprintf(g->vm.projectRoot, sizeof(g->vm.projectRoot), "%s", directory);
+}
+
+void geminiEnableJit(GeminiVM* g, bool enabled) {
+    g->vm.jitEnabled = enabled && jitAvailable();
+}
+
+Value geminiString(const char* text) {
+    char* s = strdup(text ? text : "");
+    return STRING_VAL(s);
+}
@@ -0,0 +1,448 @@
+// Baseline template JIT for x86-64 Linux.
+//
+// Hot functions whose bodies only use integers are translated, one AST node
+// at a time, into fixed machine-code templates. Expression results live in
+// eax, intermediate operands are kept on the machine stack, and every local
+// variable gets an 8-byte slot below rbp. Anything the templates cannot
+// handle exactly like the interpreter (division by zero, call depth limit)
+// makes the compiled code return non-zero so that the VM re-runs the call
+// in the interpreter. Because compiled functions are pure, re-running them
+// is always safe.
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include "vm.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Static type of a compiled expression
+typedef enum {
+    JIT_BAD,    // not compilable
+    JIT_INT,    // int in eax
+    JIT_BOOL    // bool (0/1) in eax
+} JitType;
+
+// Growable list of rel32 fields waiting for a label address
+typedef struct {
+    int* offsets;
+    int count;
+    int capacity;
+} PatchList;
+
+typedef struct {
+    unsigned char* code;
+    int count;
+    int capacity;
+    bool failed;
+
+    Token name;                     // Function being compiled
+    int paramCount;
+
+    Token locals[JIT_MAX_LOCALS];   // Parameters followed by declared locals
+    bool declared[JIT_MAX_LOCALS];  // Definitely declared at this point
+    int localCount;
+    int frameBytes;                 // Bytes used below rbp (incl. saved regs)
+
+    PatchList deopts;               // Jumps to the deopt exit
+    PatchList returns;              // Jumps to the return exit
+} JitCompiler;
+
+// ---- Code buffer ----
+static void emit(JitCompiler* jc, unsigned char byte) {
+    if (jc->count == jc->capacity) {
+        jc->capacity = jc->capacity < 256 ? 256 : jc->capacity * 2;
+        jc->code = realloc(jc->code, jc->capacity);
+        if (!jc->code) error("Memory allocation failed.", 0);
+    }
+    jc->code[jc->count++] = byte;
+}
+static void emitBytes(JitCompiler* jc, const char* bytes, int n) {
+    for (int i = 0; i < n; i++) emit(jc, (unsigned char)bytes[i]);
+}
+static void emit32(JitCompiler* jc, int v) {
+    unsigned int u = (unsigned int)v;
+    emit(jc, u & 0xff); emit(jc, (u >> 8) & 0xff); emit(jc, (u >> 16) & 0xff); emit(jc, (u >> 24) & 0xff);
+}
+static void patch32(JitCompiler* jc, int at, int v) {
+    unsigned int u = (unsigned int)v;
+    jc->code[at] = u & 0xff; jc->code[at + 1] = (u >> 8) & 0xff;
+    jc->code[at + 2] = (u >> 16) & 0xff; jc->code[at + 3] = (u >> 24) & 0xff;
+}
+// Point the rel32 at `at` to `target`
+static void patchJump(JitCompiler* jc, int at, int target) {
+    patch32(jc, at, target - (at + 4));
+}
+static void addPatch(PatchList* list, int at) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity < 16 ? 16 : list->capacity * 2;
+        list->offsets = realloc(list->offsets, list->capacity * sizeof(int));
+        if (!list->offsets) error("Memory allocation failed.", 0);
+    }
+    list->offsets[list->count++] = at;
+}
+
+// Emit a jump opcode with a rel32 placeholder; returns the placeholder offset
+static int emitJump(JitCompiler* jc, const char* opcode, int n) {
+    emitBytes(jc, opcode, n);
+    int at = jc->count;
+    emit32(jc, 0);
+    return at;
+}
+#define JMP(jc)  emitJump(jc, "\xE9", 1)
+#define JZ(jc)   emitJump(jc, "\x0F\x84", 2)
+#define JNZ(jc)  emitJump(jc, "\x0F\x85", 2)
+#define JGE(jc)  emitJump(jc, "\x0F\x8D", 2)
+
+// ---- Frame layout ----
+// Allocate `bytes` below rbp and return the (negative) displacement
+static int allocFrame(JitCompiler* jc, int bytes) {
+    jc->frameBytes += (bytes + 7) & ~7;
+    return -jc->frameBytes;
+}
+static int localDisp(int index) {
+    return -(24 + 8 * index);
+}
+static int findLocal(JitCompiler* jc, Token name) {
+    for (int i = 0; i < jc->localCount; i++) {
+        if (jc->locals[i].length == name.length && memcmp(jc->locals[i].start, name.start, name.length) == 0) return i;
+    }
+    return -1;
+}
+static int addLocal(JitCompiler* jc, Token name) {
+    int i = findLocal(jc, name);
+    if (i >= 0) return i;
+    if (jc->localCount == JIT_MAX_LOCALS) { jc->failed = true; return 0; }
+    jc->locals[jc->localCount] = name;
+    jc->declared[jc->localCount] = false;
+    return jc->localCount++;
+}
+static void loadLocal(JitCompiler* jc, int index) {
+    emitBytes(jc, "\x8B\x85", 2); emit32(jc, localDisp(index));     // mov eax, [rbp+disp]
+}
+static void storeLocal(JitCompiler* jc, int index) {
+    emitBytes(jc, "\x89\x85", 2); emit32(jc, localDisp(index));     // mov [rbp+disp], eax
+}
+
+// ---- Expressions ----
+static JitType genExpr(JitCompiler* jc, Node* node);
+
+static JitType genBinary(JitCompiler* jc, Node* node) {
+    JitType lt = genExpr(jc, node->binary.left);
+    emit(jc, 0x50);                                                 // push rax
+    JitType rt = genExpr(jc, node->binary.right);
+    emitBytes(jc, "\x89\xC1", 2);                                   // mov ecx, eax
+    emit(jc, 0x58);                                                 // pop rax
+    if (lt == JIT_BAD || rt == JIT_BAD) return JIT_BAD;
+
+    TokenType op = node->binary.op.type;
+    if (op == TOKEN_EQUAL_EQUAL || op == TOKEN_BANG_EQUAL) {
+        // int == int and bool == bool; mixed types are left to the interpreter
+        if (lt != rt) return JIT_BAD;
+        emitBytes(jc, "\x39\xC8", 2);                               // cmp eax, ecx
+        emitBytes(jc, op == TOKEN_EQUAL_EQUAL ? "\x0F\x94\xC0" : "\x0F\x95\xC0", 3); // sete/setne al
+        emitBytes(jc, "\x0F\xB6\xC0", 3);                           // movzx eax, al
+        return JIT_BOOL;
+    }
+    if (lt != JIT_INT || rt != JIT_INT) return JIT_BAD;
+
+    switch (op) {
+        case TOKEN_PLUS:  emitBytes(jc, "\x01\xC8", 2); return JIT_INT;         // add eax, ecx
+        case TOKEN_MINUS: emitBytes(jc, "\x29\xC8", 2); return JIT_INT;         // sub eax, ecx
+        case TOKEN_STAR:  emitBytes(jc, "\x0F\xAF\xC1", 3); return JIT_INT;     // imul eax, ecx
+        case TOKEN_SLASH:
+        case TOKEN_PERCENT: {
+            emitBytes(jc, "\x85\xC9", 2);                           // test ecx, ecx
+            addPatch(&jc->deopts, JZ(jc));                          // division by zero: let the interpreter report it
+            emitBytes(jc, "\x83\xF9\xFF", 3);                       // cmp ecx, -1
+            emitBytes(jc, "\x75", 1);                               // jne idiv
+            // x / -1 == -x and x % -1 == 0 (idiv would trap on INT_MIN)
+            if (op == TOKEN_SLASH) {
+                emit(jc, 15);
+                emitBytes(jc, "\x3D\x00\x00\x00\x80", 5);           // cmp eax, INT_MIN
+                addPatch(&jc->deopts, JZ(jc));                      // overflow: let the interpreter report it
+                emitBytes(jc, "\xF7\xD8", 2);                       // neg eax
+            } else {
+                emit(jc, 4);
+                emitBytes(jc, "\x31\xC0", 2);                       // xor eax, eax
+            }
+            emitBytes(jc, "\xEB", 1);                               // jmp done
+            emit(jc, op == TOKEN_SLASH ? 3 : 5);
+            emit(jc, 0x99);                                         // cdq
+            emitBytes(jc, "\xF7\xF9", 2);                           // idiv ecx
+            if (op == TOKEN_PERCENT) emitBytes(jc, "\x89\xD0", 2);  // mov eax, edx
+            return JIT_INT;
+        }
+        case TOKEN_LESS:          emitBytes(jc, "\x39\xC8\x0F\x9C\xC0", 5); break; // cmp; setl
+        case TOKEN_LESS_EQUAL:    emitBytes(jc, "\x39\xC8\x0F\x9E\xC0", 5); break; // cmp; setle
+        case TOKEN_GREATER:       emitBytes(jc, "\x39\xC8\x0F\x9F\xC0", 5); break; // cmp; setg
+        case TOKEN_GREATER_EQUAL: emitBytes(jc, "\x39\xC8\x0F\x9D\xC0", 5); break; // cmp; setge
+        default: return JIT_BAD;
+    }
+    emitBytes(jc, "\x0F\xB6\xC0", 3);                               // movzx eax, al
+    return JIT_BOOL;
+}
+
+static JitType genCall(JitCompiler* jc, Node* node) {
+    Node* callee = node->call.callee;
+    // Only self-recursive calls are compiled
+    if (callee->type != NODE_EXPR_VAR) return JIT_BAD;
+    if (callee->var.name.length != jc->name.length ||
+        memcmp(callee->var.name.start, jc->name.start, jc->name.length) != 0) return JIT_BAD;
+    if (node->call.argumentCount != jc->paramCount) return JIT_BAD;
+
+    // Each call site owns its argument area so nested calls don't clobber it
+    int argsDisp = allocFrame(jc, 4 * (jc->paramCount > 0 ? jc->paramCount : 1));
+    int resultDisp = allocFrame(jc, 8);
+    int i = 0;
+    for (Node* arg = node->call.arguments; arg; arg = arg->next, i++) {
+        if (genExpr(jc, arg) != JIT_INT) return JIT_BAD;
+        emitBytes(jc, "\x89\x85", 2); emit32(jc, argsDisp + 4 * i); // mov [rbp+disp], eax
+    }
+    emitBytes(jc, "\x48\x8D\xBD", 3); emit32(jc, argsDisp);         // lea rdi, [rbp+args]
+    emitBytes(jc, "\x48\x8D\xB5", 3); emit32(jc, resultDisp);       // lea rsi, [rbp+result]
+    emitBytes(jc, "\x8D\x53\x01", 3);                               // lea edx, [rbx+1]
+    emit(jc, 0xE8); emit32(jc, -(jc->count + 4));                   // call entry
+    emitBytes(jc, "\x85\xC0", 2);                                   // test eax, eax
+    addPatch(&jc->deopts, JNZ(jc));                                 // callee deopted
+    emitBytes(jc, "\x8B\x85", 2); emit32(jc, resultDisp);           // mov eax, [rbp+result]
+    return JIT_INT;
+}
+
+static JitType genExpr(JitCompiler* jc, Node* node) {
+    if (!node || jc->failed) return JIT_BAD;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+            if (node->literal.token.type != TOKEN_NUMBER || node->literal.isFloat) return JIT_BAD;
+            emit(jc, 0xB8); emit32(jc, node->literal.intValue);     // mov eax, imm32
+            return JIT_INT;
+        case NODE_EXPR_VAR: {
+            int i = findLocal(jc, node->var.name);
+            // Names not definitely declared here would resolve to globals
+            if (i < 0 || !jc->declared[i]) return JIT_BAD;
+            loadLocal(jc, i);
+            return JIT_INT;
+        }
+        case NODE_EXPR_UNARY:
+            if (node->unary.op.type != TOKEN_MINUS && node->unary.op.type != TOKEN_PLUS) return JIT_BAD;
+            if (genExpr(jc, node->unary.expr) != JIT_INT) return JIT_BAD;
+            if (node->unary.op.type == TOKEN_MINUS) emitBytes(jc, "\xF7\xD8", 2); // neg eax
+            return JIT_INT;                                                     // unary + is the identity
+        case NODE_EXPR_BINARY:
+            return genBinary(jc, node);
+        case NODE_EXPR_CALL:
+            return genCall(jc, node);
+        default:
+            return JIT_BAD;
+    }
+}
+
+// ---- Statements ----
+static bool genStmt(JitCompiler* jc, Node* node);
+
+// Condition: ints and bools are both truthy when non-zero
+static int genCondJump(JitCompiler* jc, Node* cond) {
+    JitType t = genExpr(jc, cond);
+    if (t == JIT_BAD) jc->failed = true;
+    emitBytes(jc, "\x85\xC0", 2);                                   // test eax, eax
+    return JZ(jc);
+}
+
+// Compile a nested statement; declarations made inside it are not
+// definitely declared afterwards.
+static bool genScoped(JitCompiler* jc, Node* node) {
+    bool saved[JIT_MAX_LOCALS];
+    memcpy(saved, jc->declared, sizeof(saved));
+    bool ok = genStmt(jc, node);
+    memcpy(jc->declared, saved, sizeof(saved));
+    return ok;
+}
+
+static bool genStmt(JitCompiler* jc, Node* node) {
+    if (!node || jc->failed) return false;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL: {
+            if (node->var_decl.initializer) {
+                if (genExpr(jc, node->var_decl.initializer) != JIT_INT) return false;
+            } else {
+                emitBytes(jc, "\x31\xC0", 2);                       // xor eax, eax
+            }
+            int i = addLocal(jc, node->var_decl.name);
+            storeLocal(jc, i);
+            jc->declared[i] = true;
+            return !jc->failed;
+        }
+        case NODE_STMT_ASSIGN: {
+            if (genExpr(jc, node->assign.value) != JIT_INT) return false;
+            int i = findLocal(jc, node->assign.name);
+            if (i < 0 || !jc->declared[i]) return false;
+            storeLocal(jc, i);
+            return true;
+        }
+        case NODE_STMT_IF: {
+            int elseJump = genCondJump(jc, node->if_stmt.condition);
+            if (!genScoped(jc, node->if_stmt.thenBranch)) return false;
+            if (node->if_stmt.elseBranch) {
+                int endJump = JMP(jc);
+                patchJump(jc, elseJump, jc->count);
+                if (!genScoped(jc, node->if_stmt.elseBranch)) return false;
+                patchJump(jc, endJump, jc->count);
+            } else {
+                patchJump(jc, elseJump, jc->count);
+            }
+            return !jc->failed;
+        }
+        case NODE_STMT_WHILE: {
+            int top = jc->count;
+            int exitJump = genCondJump(jc, node->while_stmt.condition);
+            if (!genScoped(jc, node->while_stmt.body)) return false;
+            int back = JMP(jc);
+            patchJump(jc, back, top);
+            patchJump(jc, exitJump, jc->count);
+            return !jc->failed;
+        }
+        case NODE_STMT_FOR: {
+            if (node->for_stmt.initializer && !genStmt(jc, node->for_stmt.initializer)) return false;
+            bool saved[JIT_MAX_LOCALS];
+            memcpy(saved, jc->declared, sizeof(saved));
+            int top = jc->count;
+            int exitJump = -1;
+            if (node->for_stmt.condition) exitJump = genCondJump(jc, node->for_stmt.condition);
+            bool ok = genStmt(jc, node->for_stmt.body);
+            if (ok && node->for_stmt.increment) ok = genStmt(jc, node->for_stmt.increment);
+            memcpy(jc->declared, saved, sizeof(saved));
+            if (!ok) return false;
+            int back = JMP(jc);
+            patchJump(jc, back, top);
+            if (exitJump >= 0) patchJump(jc, exitJump, jc->count);
+            return !jc->failed;
+        }
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                if (!genStmt(jc, node->block.statements[i])) return false;
+            }
+            return true;
+        case NODE_STMT_RETURN:
+            if (node->return_stmt.value) {
+                if (genExpr(jc, node->return_stmt.value) != JIT_INT) return false;
+            } else {
+                emitBytes(jc, "\x31\xC0", 2);                       // xor eax, eax
+            }
+            addPatch(&jc->returns, JMP(jc));
+            return true;
+        case NODE_EXPR_LITERAL:
+        case NODE_EXPR_VAR:
+        case NODE_EXPR_UNARY:
+        case NODE_EXPR_BINARY:
+        case NODE_EXPR_CALL:
+            // Expression statement; the value is discarded
+            return genExpr(jc, node) != JIT_BAD;
+        default:
+            // print, imports, indexing, nested functions, ... stay interpreted
+            return false;
+    }
+}
+
+bool jitAvailable(void) {
+    return true;
+}
+
+JitCode* jitCompile(Token name, Token* params, int paramCount, Node* body) {
+    if (paramCount > JIT_MAX_LOCALS) return NULL;
+    JitCompiler jc;
+    memset(&jc, 0, sizeof(jc));
+    jc.name = name;
+    jc.paramCount = paramCount;
+    jc.frameBytes = 16; // saved rbx, r12
+
+    // Prologue
+    emit(&jc, 0x55);                                                // push rbp
+    emitBytes(&jc, "\x48\x89\xE5", 3);                              // mov rbp, rsp
+    emit(&jc, 0x53);                                                // push rbx
+    emitBytes(&jc, "\x41\x54", 2);                                  // push r12
+    emitBytes(&jc, "\x48\x81\xEC", 3);                              // sub rsp, frame
+    int frameAt = jc.count;
+    emit32(&jc, 0);
+    emitBytes(&jc, "\x89\xD3", 2);                                  // mov ebx, edx (depth)
+    emitBytes(&jc, "\x49\x89\xF4", 3);                              // mov r12, rsi (result)
+    emitBytes(&jc, "\x81\xFB", 2); emit32(&jc, CALL_STACK_MAX);     // cmp ebx, CALL_STACK_MAX
+    addPatch(&jc.deopts, JGE(&jc));                                 // let the interpreter report overflow
+
+    // Parameters occupy the first local slots
+    for (int i = 0; i < paramCount; i++) {
+        int slot = addLocal(&jc, params[i]);
+        jc.declared[slot] = true;
+        emitBytes(&jc, "\x8B\x87", 2); emit32(&jc, 4 * i);          // mov eax, [rdi+4*i]
+        storeLocal(&jc, slot);
+    }
+    jc.frameBytes += 8 * JIT_MAX_LOCALS;
+
+    bool ok = genStmt(&jc, body) && !jc.failed;
+
+    // Falling off the end returns 0
+    emitBytes(&jc, "\x31\xC0", 2);                                  // xor eax, eax
+    int returnLabel = jc.count;
+    emitBytes(&jc, "\x41\x89\x04\x24", 4);                          // mov [r12], eax
+    emitBytes(&jc, "\x31\xC0", 2);                                  // xor eax, eax
+    int exitLabel = jc.count;
+    emitBytes(&jc, "\x48\x8D\x65\xF0", 4);                          // lea rsp, [rbp-16]
+    emitBytes(&jc, "\x41\x5C", 2);                                  // pop r12
+    emit(&jc, 0x5B);                                                // pop rbx
+    emit(&jc, 0x5D);                                                // pop rbp
+    emit(&jc, 0xC3);                                                // ret
+    int deoptLabel = jc.count;
+    emit(&jc, 0xB8); emit32(&jc, 1);                                // mov eax, 1
+    int toExit = JMP(&jc);
+    patchJump(&jc, toExit, exitLabel);
+
+    for (int i = 0; i < jc.returns.count; i++) patchJump(&jc, jc.returns.offsets[i], returnLabel);
+    for (int i = 0; i < jc.deopts.count; i++) patchJump(&jc, jc.deopts.offsets[i], deoptLabel);
+    patch32(&jc, frameAt, ((jc.frameBytes - 16) + 15) & ~15);
+
+    JitCode* result = NULL;
+    if (ok) {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t size = ((size_t)jc.count + page - 1) & ~((size_t)page - 1);
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem != MAP_FAILED) {
+            memcpy(mem, jc.code, jc.count);
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC) == 0) {
+                result = malloc(sizeof(JitCode));
+                if (!result) error("Memory allocation failed.", 0);
+                result->memory = mem;
+                result->size = size;
+                result->entry = (JitEntry)mem;
+            } else {
+                munmap(mem, size);
+            }
+        }
+    }
+    free(jc.code);
+    free(jc.deopts.offsets);
+    free(jc.returns.offsets);
+    return result;
+}
+
+void jitFree(JitCode* code) {
+    if (!code) return;
+    munmap(code->memory, code->size);
+    free(code);
+}
+
+#else // unsupported platform: everything stays interpreted
+
+bool jitAvailable(void) {
+    return false;
+}
+
+JitCode* jitCompile(Token name, Token* params, int paramCount, Node* body) {
+    (void)name; (void)params; (void)paramCount; (void)body;
+    return NULL;
+}
+
+void jitFree(JitCode* code) {
+    (void)code;
+}
+
+#endif
@@ -0,0 +1,629 @@
+#include "json.h"
+#include "output.h"
+#include <math.h>
+#include <stdint.h>
+
+typedef struct {
+    const char* start;      // document
+    const char* p;          // cursor
+    const char* end;
+    int line;               // script line for errors
+    int depth;              // open arrays and objects
+    char* scratch;          // unescaped text of the current string
+    size_t scratchCap;
+} JsonParser;
+
+static void jsonFail(JsonParser* jp, const char* what) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Invalid JSON: %s at offset %zu.", what, (size_t)(jp->p - jp->start));
+    free(jp->scratch);
+    jp->scratch = NULL;
+    error(msg, jp->line);
+}
+
+// The document is well-formed but does not have the selected array
+static void selectorFail(JsonParser* jp, const char* what) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "jsonEach(): %s at offset %zu.", what, (size_t)(jp->p - jp->start));
+    free(jp->scratch);
+    jp->scratch = NULL;
+    error(msg, jp->line);
+}
+
+static inline void skipSpace(JsonParser* jp) {
+    const char* p = jp->p;
+    while (p < jp->end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) p++;
+    jp->p = p;
+}
+
+// First byte at or after p that ends a run of plain string text: a quote,
+// a backslash or a control character. Whole words without one are skipped
+// 8 bytes at a time.
+static const char* scanString(const char* p, const char* end) {
+    const uint64_t ones = 0x0101010101010101ull;
+    const uint64_t highs = 0x8080808080808080ull;
+    while (end - p >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        uint64_t quote = w ^ (ones * '"');
+        uint64_t slash = w ^ (ones * '\\');
+        // Nonzero iff some byte is zero (quote/slash) or below 0x20 (w)
+        uint64_t hit = ((quote - ones) & ~quote) | ((slash - ones) & ~slash) | ((w - ones * 0x20) & ~w);
+        if (hit & highs) break;
+        p += 8;
+    }
+    while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) p++;
+    return p;
+}
+
+static void scratchAppend(JsonParser* jp, size_t* used, const char* bytes, size_t length) {
+    if (length == 0) return;
+    if (*used + length > jp->scratchCap) {
+        size_t cap = jp->scratchCap ? jp->scratchCap * 2 : 64;
+        while (cap < *used + length) cap *= 2;
+        char* grown = realloc(jp->scratch, cap);
+        if (!grown) error("Memory allocation failed.", jp->line);
+        jp->scratch = grown;
+        jp->scratchCap = cap;
+    }
+    memcpy(jp->scratch + *used, bytes, length);
+    *used += length;
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Four hex digits of a \u escape at the cursor
+static unsigned int parseHex4(JsonParser* jp) {
+    if (jp->end - jp->p < 4) jsonFail(jp, "truncated \\u escape");
+    unsigned int code = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = hexDigit(jp->p[i]);
+        if (d < 0) jsonFail(jp, "invalid \\u escape");
+        code = code * 16 + (unsigned int)d;
+    }
+    jp->p += 4;
+    return code;
+}
+
+static size_t encodeUtf8(unsigned int code, char* out) {
+    if (code < 0x80) { out[0] = (char)code; return 1; }
+    if (code < 0x800) {
+        out[0] = (char)(0xC0 | (code >> 6));
+        out[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    }
+    if (code < 0x10000) {
+        out[0] = (char)(0xE0 | (code >> 12));
+        out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+// Parse a string whose opening quote has been consumed. Returns its bytes:
+// inside the document when it has no escapes, otherwise in jp->scratch
+// (valid until the next string is parsed).
+static const char* parseStringBody(JsonParser* jp, size_t* length) {
+    const char* run = jp->p;
+    const char* p = scanString(run, jp->end);
+    if (p < jp->end && *p == '"') {
+        jp->p = p + 1;
+        *length = (size_t)(p - run);
+        return run;
+    }
+    size_t used = 0;
+    while (true) {
+        scratchAppend(jp, &used, run, (size_t)(p - run));
+        jp->p = p;
+        if (p >= jp->end) jsonFail(jp, "unterminated string");
+        if (*p == '"') break;
+        if (*p != '\\') jsonFail(jp, "control character in string");
+        if (++jp->p >= jp->end) jsonFail(jp, "unterminated string");
+        char c = *jp->p++;
+        char utf8[4];
+        size_t n = 1;
+        switch (c) {
+            case '"': case '\\': case '/': utf8[0] = c; break;
+            case 'b': utf8[0] = '\b'; break;
+            case 'f': utf8[0] = '\f'; break;
+            case 'n': utf8[0] = '\n'; break;
+            case 'r': utf8[0] = '\r'; break;
+            case 't': utf8[0] = '\t'; break;
+            case 'u': {
+                unsigned int code = parseHex4(jp);
+                if (code >= 0xD800 && code <= 0xDBFF) {
+                    // High surrogate: must be followed by a low one
+                    if (jp->end - jp->p < 2 || jp->p[0] != '\\' || jp->p[1] != 'u') jsonFail(jp, "unpaired surrogate");
+                    jp->p += 2;
+                    unsigned int low = parseHex4(jp);
+                    if (low < 0xDC00 || low > 0xDFFF) jsonFail(jp, "unpaired surrogate");
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                } else if (code >= 0xDC00 && code <= 0xDFFF) {
+                    jsonFail(jp, "unpaired surrogate");
+                } else if (code == 0) {
+                    jsonFail(jp, "\\u0000 cannot appear in a string");
+                }
+                n = encodeUtf8(code, utf8);
+                break;
+            }
+            default:
+                jp->p--;
+                jsonFail(jp, "invalid escape");
+        }
+        scratchAppend(jp, &used, utf8, n);
+        run = jp->p;
+        p = scanString(run, jp->end);
+    }
+    jp->p = p + 1;
+    *length = used;
+    return jp->scratch;
+}
+
+static Value stringValue(JsonParser* jp, const char* bytes, size_t length) {
+    if (length == 1) return STRING_VAL(charStrings[(unsigned char)bytes[0]]);
+    char* s = malloc(length + 1);
+    if (!s) error("Memory allocation failed.", jp->line);
+    memcpy(s, bytes, length);
+    s[length] = '\0';
+    return STRING_VAL(s);
+}
+
+// Powers of ten that are exact doubles
+static const double exactPowers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Integers that fit become ints. Other numbers whose digits fit in 53 bits
+// and whose exponent is small are one multiply or divide of two exact
+// doubles, which is correctly rounded; the rest go through strtod.
+static Value parseNumber(JsonParser* jp) {
+    const char* begin = jp->p;
+    const char* p = begin;
+    const char* end = jp->end;
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+    if (p >= end || !isDigit(*p)) jsonFail(jp, "invalid number");
+
+    uint64_t mantissa = 0;
+    int digits = 0;         // significant digits in mantissa
+    int exponent = 0;
+    bool truncated = false; // digits beyond the 19 kept in mantissa
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < end && isDigit(*p)) {
+            if (digits < 19) { mantissa = mantissa * 10 + (uint64_t)(*p - '0'); digits++; }
+            else { exponent++; truncated = true; }
+            p++;
+        }
+    }
+    bool integral = true;
+    if (p < end && *p == '.') {
+        integral = false;
+        p++;
+        if (p >= end || !isDigit(*p)) { jp->p = p; jsonFail(jp, "invalid number"); }
+        while (p < end && isDigit(*p)) {
+            if (digits < 19) {
+                if (mantissa != 0 || *p != '0') { mantissa = mantissa * 10 + (uint64_t)(*p - '0'); digits++; }
+                exponent--;
+            } else {
+                truncated = true;
+            }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integral = false;
+        p++;
+        bool negativeExp = p < end && *p == '-';
+        if (p < end && (*p == '-' || *p == '+')) p++;
+        if (p >= end || !isDigit(*p)) { jp->p = p; jsonFail(jp, "invalid number"); }
+        int e = 0;
+        while (p < end && isDigit(*p)) {
+            if (e < 100000) e = e * 10 + (*p - '0');
+            p++;
+        }
+        exponent += negativeExp ? -e : e;
+    }
+    jp->p = p;
+
+    if (integral && digits <= 10) {
+        int64_t v = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+        if (v >= INT32_MIN && v <= INT32_MAX) return INT_VAL((int)v);
+    }
+    if (!truncated && mantissa <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+        double d = (double)mantissa;
+        d = exponent < 0 ? d / exactPowers[-exponent] : d * exactPowers[exponent];
+        return FLOAT_VAL(negative ? -d : d);
+    }
+    char small[64];
+    size_t length = (size_t)(p - begin);
+    char* text = length < sizeof(small) ? small : malloc(length + 1);
+    if (!text) error("Memory allocation failed.", jp->line);
+    memcpy(text, begin, length);
+    text[length] = '\0';
+    double d = strtod(text, NULL);
+    if (text != small) free(text);
+    return FLOAT_VAL(d);
+}
+
+static bool matchWord(JsonParser* jp, const char* word, size_t length) {
+    if ((size_t)(jp->end - jp->p) < length || memcmp(jp->p, word, length) != 0) return false;
+    jp->p += length;
+    return true;
+}
+
+static Value parseValue(JsonParser* jp, bool build);
+
+static void enterNesting(JsonParser* jp) {
+    if (++jp->depth > JSON_MAX_DEPTH) jsonFail(jp, "nesting too deep");
+}
+
+// After an element or member: consume ',' (returns true) or the closer
+static bool nextItem(JsonParser* jp, char closer, const char* expected) {
+    skipSpace(jp);
+    if (jp->p < jp->end && *jp->p == ',') { jp->p++; return true; }
+    if (jp->p < jp->end && *jp->p == closer) { jp->p++; return false; }
+    jsonFail(jp, expected);
+    return false;
+}
+
+// Array whose '[' has been consumed
+static Value parseArray(JsonParser* jp, bool build) {
+    enterNesting(jp);
+    Array* a = build ? newArray() : NULL;
+    skipSpace(jp);
+    if (jp->p < jp->end && *jp->p == ']') {
+        jp->p++;
+    } else {
+        do {
+            Value item = parseValue(jp, build);
+            if (build) arrayPush(a, item);
+        } while (nextItem(jp, ']', "expected ',' or ']'"));
+    }
+    jp->depth--;
+    return build ? ARRAY_VAL(a) : INT_VAL(0);
+}
+
+// Object member name and ':' at the cursor; see parseStringBody for
+// where the returned bytes live
+static const char* parseMemberName(JsonParser* jp, size_t* length) {
+    skipSpace(jp);
+    if (jp->p >= jp->end || *jp->p != '"') jsonFail(jp, "expected a member name");
+    jp->p++;
+    const char* name = parseStringBody(jp, length);
+    skipSpace(jp);
+    if (jp->p >= jp->end || *jp->p != ':') jsonFail(jp, "expected ':'");
+    jp->p++;
+    return name;
+}
+
+// Object whose '{' has been consumed
+static Value parseObject(JsonParser* jp, bool build) {
+    enterNesting(jp);
+    Map* m = build ? newMap() : NULL;
+    skipSpace(jp);
+    if (jp->p < jp->end && *jp->p == '}') {
+        jp->p++;
+    } else {
+        do {
+            size_t length;
+            const char* name = parseMemberName(jp, &length);
+            // An escaped name is in scratch, which the value may reuse
+            char* copy = NULL;
+            if (build && name == jp->scratch) {
+                copy = malloc(length + 1);
+                if (!copy) error("Memory allocation failed.", jp->line);
+                memcpy(copy, name, length);
+                name = copy;
+            }
+            Value v = parseValue(jp, build);
+            if (build) mapSetStr(m, name, (int)length, v);
+            free(copy);
+        } while (nextItem(jp, '}', "expected ',' or '}'"));
+    }
+    jp->depth--;
+    return build ? MAP_VAL(m) : INT_VAL(0);
+}
+
+// Parse (build) or only validate and skip (!build) the value at the cursor
+static Value parseValue(JsonParser* jp, bool build) {
+    skipSpace(jp);
+    if (jp->p >= jp->end) jsonFail(jp, "unexpected end of input");
+    switch (*jp->p) {
+        case '{':
+            jp->p++;
+            return parseObject(jp, build);
+        case '[':
+            jp->p++;
+            return parseArray(jp, build);
+        case '"': {
+            jp->p++;
+            size_t length;
+            const char* s = parseStringBody(jp, &length);
+            return build ? stringValue(jp, s, length) : INT_VAL(0);
+        }
+        case 't':
+            if (matchWord(jp, "true", 4)) return BOOL_VAL(true);
+            break;
+        case 'f':
+            if (matchWord(jp, "false", 5)) return BOOL_VAL(false);
+            break;
+        case 'n':
+            if (matchWord(jp, "null", 4)) return STRING_VAL(NULL);
+            break;
+        default:
+            if (*jp->p == '-' || isDigit(*jp->p)) return parseNumber(jp);
+            break;
+    }
+    jsonFail(jp, "unexpected character");
+    return INT_VAL(0);
+}
+
+Value jsonParse(const char* text, size_t length, int line) {
+    JsonParser jp = { text, text, text + length, line, 0, NULL, 0 };
+    Value v = parseValue(&jp, true);
+    skipSpace(&jp);
+    if (jp.p != jp.end) jsonFail(&jp, "unexpected text after the document");
+    free(jp.scratch);
+    return v;
+}
+
+// ---- Encoding ----
+
+typedef struct {
+    char* chars;
+    size_t length;
+    size_t capacity;
+    int indent;
+    int line;
+} JsonWriter;
+
+static void writerReserve(JsonWriter* w, size_t extra) {
+    if (w->length + extra <= w->capacity) return;
+    size_t cap = w->capacity * 2;
+    if (cap < w->length + extra) cap = w->length + extra;
+    char* grown = realloc(w->chars, cap);
+    if (!grown) error("Memory allocation failed.", w->line);
+    w->chars = grown;
+    w->capacity = cap;
+}
+
+static void writeBytes(JsonWriter* w, const char* bytes, size_t length) {
+    writerReserve(w, length);
+    memcpy(w->chars + w->length, bytes, length);
+    w->length += length;
+}
+
+static void writeChar(JsonWriter* w, char c) {
+    writerReserve(w, 1);
+    w->chars[w->length++] = c;
+}
+
+// Line break and indentation before an element (pretty-printing only)
+static void writeBreak(JsonWriter* w, int depth) {
+    if (w->indent == 0) return;
+    size_t spaces = (size_t)depth * (size_t)w->indent;
+    writerReserve(w, spaces + 1);
+    w->chars[w->length++] = '\n';
+    memset(w->chars + w->length, ' ', spaces);
+    w->length += spaces;
+}
+
+static void writeString(JsonWriter* w, const char* s, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    const char* end = s + length;
+    writeChar(w, '"');
+    while (s < end) {
+        const char* stop = scanString(s, end);
+        writeBytes(w, s, (size_t)(stop - s));
+        if (stop == end) break;
+        char c = *stop;
+        char escape[6] = { '\\', c, 0, 0, 0, 0 };
+        size_t n = 2;
+        switch (c) {
+            case '"': case '\\': break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[(unsigned char)c >> 4];
+                escape[5] = hex[c & 0xF];
+                n = 6;
+                break;
+        }
+        writeBytes(w, escape, n);
+        s = stop + 1;
+    }
+    writeChar(w, '"');
+}
+
+// Fewest digits (15 to 17) that read back as the same double; a fraction
+// is kept so that the value parses back as a float
+static void writeFloat(JsonWriter* w, double d) {
+    if (!isfinite(d)) {
+        writeBytes(w, "null", 4);
+        return;
+    }
+    char buf[FORMAT_NUMBER_MAX + 2];
+    int n = 0;
+    for (int precision = 15; precision <= 17; precision++) {
+        n = snprintf(buf, sizeof(buf), "%.*g", precision, d);
+        if (strtod(buf, NULL) == d) break;
+    }
+    if (!strpbrk(buf, ".e")) {
+        buf[n++] = '.';
+        buf[n++] = '0';
+    }
+    writeBytes(w, buf, (size_t)n);
+}
+
+static void writeValue(JsonWriter* w, Value v, int depth) {
+    char buf[FORMAT_NUMBER_MAX];
+    switch (VALUE_TYPE(v)) {
+        case VAL_INT:
+            writeBytes(w, buf, (size_t)formatInt(buf, AS_INT(v)));
+            return;
+        case VAL_FLOAT:
+            writeFloat(w, AS_FLOAT(v));
+            return;
+        case VAL_STRING:
+            if (!AS_STRING(v)) writeBytes(w, "null", 4);
+            else writeString(w, AS_STRING(v), strlen(AS_STRING(v)));
+            return;
+        case VAL_BOOL:
+            if (AS_BOOL(v)) writeBytes(w, "true", 4);
+            else writeBytes(w, "false", 5);
+            return;
+        case VAL_MODULE:
+            free(w->chars);
+            error("jsonStringify() cannot encode a module.", w->line);
+            return;
+        case VAL_FILE:
+            free(w->chars);
+            error("jsonStringify() cannot encode a file.", w->line);
+            return;
+        case VAL_PMAP:
+            free(w->chars);
+            error("jsonStringify() cannot encode a pmap.", w->line);
+            return;
+        case VAL_ARRAY:
+        case VAL_MAP:
+            break;
+    }
+    if (depth >= JSON_MAX_DEPTH) {
+        free(w->chars);
+        error("jsonStringify(): nesting too deep (does the value contain itself?).", w->line);
+    }
+    if (IS_ARRAY(v)) {
+        Array* a = AS_ARRAY(v);
+        writeChar(w, '[');
+        int count = a ? a->count : 0;
+        for (int i = 0; i < count; i++) {
+            if (i > 0) writeChar(w, ',');
+            writeBreak(w, depth + 1);
+            writeValue(w, a->items[i], depth + 1);
+        }
+        if (count > 0) writeBreak(w, depth);
+        writeChar(w, ']');
+        return;
+    }
+    Map* m = AS_MAP(v);
+    writeChar(w, '{');
+    for (MapEntry* e = m ? m->first : NULL; e; e = e->after) {
+        if (e != m->first) writeChar(w, ',');
+        writeBreak(w, depth + 1);
+        if (e->isIntKey) {
+            writeChar(w, '"');
+            writeBytes(w, buf, (size_t)formatInt(buf, e->intKey));
+            writeChar(w, '"');
+        } else {
+            writeString(w, e->key, strlen(e->key));
+        }
+        writeChar(w, ':');
+        if (w->indent > 0) writeChar(w, ' ');
+        writeValue(w, e->value, depth + 1);
+    }
+    if (m && m->count > 0) writeBreak(w, depth);
+    writeChar(w, '}');
+}
+
+char* jsonStringify(Value value, int indent, int line) {
+    JsonWriter w = { NULL, 0, 0, indent, line };
+    writerReserve(&w, 64);
+    writeValue(&w, value, 0);
+    writeChar(&w, '\0');
+    return w.chars;
+}
+
+// ---- Streaming ----
+
+// Skip the rest of an object whose selected member has just been parsed
+static void skipMembers(JsonParser* jp) {
+    while (nextItem(jp, '}', "expected ',' or '}'")) {
+        size_t length;
+        parseMemberName(jp, &length);
+        parseValue(jp, false);
+    }
+    jp->depth--;
+}
+
+int jsonEachFile(const char* path, const char* selector, JsonItemFn fn, void* user, int line) {
+    FileContents input;
+    if (!fileLoadAll(path, &input)) error("jsonEach() cannot open file.", line);
+    JsonParser jp = { input.data, input.data, input.data + input.size, line, 0, NULL, 0 };
+
+    // Follow the selector's member names down to the array
+    int levels = 0;
+    for (const char* key = selector; *key; ) {
+        const char* dot = strchr(key, '.');
+        size_t keyLength = dot ? (size_t)(dot - key) : strlen(key);
+        skipSpace(&jp);
+        if (jp.p >= jp.end) jsonFail(&jp, "unexpected end of input");
+        if (*jp.p != '{') selectorFail(&jp, "selector needs an object here");
+        jp.p++;
+        enterNesting(&jp);
+        levels++;
+        skipSpace(&jp);
+        if (jp.p < jp.end && *jp.p == '}') selectorFail(&jp, "selector key not found");
+        while (true) {
+            size_t length;
+            const char* name = parseMemberName(&jp, &length);
+            if (length == keyLength && memcmp(name, key, keyLength) == 0) break;
+            parseValue(&jp, false);
+            if (!nextItem(&jp, '}', "expected ',' or '}'")) {
+                jp.p--;
+                selectorFail(&jp, "selector key not found");
+            }
+        }
+        key += dot ? keyLength + 1 : keyLength;
+    }
+
+    skipSpace(&jp);
+    if (jp.p >= jp.end) jsonFail(&jp, "unexpected end of input");
+    if (*jp.p != '[') selectorFail(&jp, "selector does not name an array");
+    jp.p++;
+    enterNesting(&jp);
+    int count = 0;
+    skipSpace(&jp);
+    if (jp.p < jp.end && *jp.p == ']') {
+        jp.p++;
+    } else {
+        do {
+            Value item = parseValue(&jp, true);
+            fn(user, item);
+            count++;
+            fileReleaseBefore(&input, (size_t)(jp.p - input.data));
+        } while (nextItem(&jp, ']', "expected ',' or ']'"));
+    }
+    jp.depth--;
+
+    // The rest of the document must still be well-formed
+    for (int i = 0; i < levels; i++) skipMembers(&jp);
+    skipSpace(&jp);
+    if (jp.p != jp.end) jsonFail(&jp, "unexpected text after the document");
+
+    free(jp.scratch);
+    fileReleaseAll(&input);
+    return count;
+}
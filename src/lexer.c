@@ -17,6 +17,7 @@ static Token makeToken(Lexer* lexer, TokenType type) {
     token.start = lexer->start;
     token.length = (int)(lexer->current - lexer->start);
     token.line = lexer->line;
+    token.hash = 0;
     return token;
 }
 
@@ -27,6 +28,7 @@ static Token errorToken(Lexer* lexer, const char* message) {
     token.start = message;
     token.length = (int)strlen(message);
     token.line = lexer->line;
+    token.hash = 0;
     return token;
 }
 
@@ -73,7 +75,8 @@ static TokenType checkKeyword(Lexer* lexer, int start, int length, const char* r
 static TokenType identifierType(Lexer* lexer) {
     switch (*lexer->start) {
         case 'i': {
-            // import, if
+            // import, if ("in" is an identifier: only for-in headers treat
+            // it as a keyword)
             if (lexer->current - lexer->start > 1) {
                 if (*(lexer->start + 1) == 'm') {
                     return checkKeyword(lexer, 1, 5, "mport", TOKEN_IMPORT);
@@ -106,7 +109,10 @@ static Token identifier(Lexer* lexer) {
     while (isAlpha(*lexer->current) || isDigit(*lexer->current)) {
         lexer->current++;
     }
-    return makeToken(lexer, identifierType(lexer));
+    Token token = makeToken(lexer, identifierType(lexer));
+    // Hashed once here; every variable/function lookup by this name reuses it
+    if (token.type == TOKEN_IDENTIFIER) token.hash = hashString(token.start, (size_t)token.length);
+    return token;
 }
 
 // Scan number
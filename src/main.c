@@ -2,12 +2,10 @@
 #include "lexer.h"
 #include "parser.h"
 #include "vm.h"
-
-// Error function
-void error(const char* message, int line) {
-    fprintf(stderr, "[line %d] Error: %s\n", line, message);
-    exit(1);
-}
+#include "aot.h"
+#include "output.h"
+#include "server.h"
+#include "optimizer.h"
 
 // Read file
 static char* readFile(const char* path) {
@@ -40,126 +38,123 @@ static char* readFile(const char* path) {
     return buffer;
 }
 
-// Initialize parser
-void initParser(Parser* parser) {
-    parser->tokens = malloc(64 * sizeof(Token));  // Start with 64 tokens
-    if (!parser->tokens) {
-        error("Memory allocation failed.", 0);
-    }
-    parser->current = 0;
-    parser->count = 0;
-    parser->capacity = 64;
-}
-
-// Free parser resources
-void freeParser(Parser* parser) {
-    if (parser->tokens) {
-        free(parser->tokens);
-        parser->tokens = NULL;
+// Stream mode: call onLine(line) for every input line, bracketed by the
+// optional onBegin() and onEnd(). Inputs are files ("-" or none: stdin).
+static void runEachLine(VM* vm, char** inputs, int inputCount) {
+    if (!vmHasFunction(vm, "onLine")) {
+        error("--each-line requires a function onLine(line).", 0);
     }
-}
-
-// Add token to parser (grows array as needed)
-void addToken(Parser* parser, Token token) {
-    // Grow array if needed
-    if (parser->count >= parser->capacity) {
-        parser->capacity *= 2;
-        parser->tokens = realloc(parser->tokens, parser->capacity * sizeof(Token));
-        if (!parser->tokens) {
-            error("Memory allocation failed.", token.line);
+    Value result;
+    vmCall(vm, "onBegin", NULL, 0, &result);
+
+    char* line = NULL;
+    size_t capacity = 0;
+    int count = inputCount > 0 ? inputCount : 1;
+    for (int i = 0; i < count; i++) {
+        const char* input = inputCount > 0 ? inputs[i] : "-";
+        FileHandle* file = fileOpenLines(input);
+        if (!file) {
+            fprintf(stderr, "Could not open file \"%s\".\n", input);
+            exit(1);
         }
-    }
-    
-    parser->tokens[parser->count++] = token;
-}
-
-// Free AST
-static void freeAST(Node* node) {
-    if (!node) return;
-    switch (node->type) {
-        case NODE_EXPR_LITERAL:
-            if (node->literal.token.type == TOKEN_STRING) {
-                // No need to free token.start, it's from source
+        size_t length;
+        const char* text;
+        while ((text = fileNextLine(file, &length)) != NULL) {
+            // The reader splits lines in place; strings need a terminator,
+            // so each line is copied into one buffer lent to every call.
+            // The VM never frees it, and a line the script keeps is
+            // overwritten by the next one.
+            if (length + 1 > capacity) {
+                // An outgrown buffer is left to the script, which may still
+                // point at it (at most one per doubling)
+                size_t grown = capacity > 128 ? 2 * capacity : 256;
+                capacity = length + 1 > grown ? length + 1 : grown;
+                line = malloc(capacity);
+                if (!line) error("Memory allocation failed.", 0);
+                vm->lentString = line;
             }
-            break;
-        case NODE_EXPR_BINARY:
-            freeAST(node->binary.left);
-            freeAST(node->binary.right);
-            break;
-        case NODE_EXPR_UNARY:
-            freeAST(node->unary.expr);
-            break;
-        case NODE_EXPR_VAR:
-            break;
-        case NODE_EXPR_GET:
-            // object.property -> free object
-            freeAST(node->get.object);
-            break;
-        case NODE_EXPR_INDEX:
-            // target[index] -> free both
-            freeAST(node->index.target);
-            freeAST(node->index.index);
-            break;
-        case NODE_EXPR_CALL:
-            freeAST(node->call.arguments);
-            break;
-        case NODE_STMT_VAR_DECL:
-            freeAST(node->var_decl.initializer);
-            break;
-        case NODE_STMT_ASSIGN:
-            freeAST(node->assign.value);
-            break;
-        case NODE_STMT_INDEX_ASSIGN:
-            // target[index] = value
-            freeAST(node->index_assign.target);
-            freeAST(node->index_assign.index);
-            freeAST(node->index_assign.value);
-            break;
-        case NODE_STMT_PRINT:
-            freeAST(node->print.expr);
-            break;
-        case NODE_STMT_IF:
-            freeAST(node->if_stmt.condition);
-            freeAST(node->if_stmt.thenBranch);
-            freeAST(node->if_stmt.elseBranch);
-            break;
-        case NODE_STMT_WHILE:
-            freeAST(node->while_stmt.condition);
-            freeAST(node->while_stmt.body);
-            break;
-        case NODE_STMT_FOR:
-            freeAST(node->for_stmt.initializer);
-            freeAST(node->for_stmt.condition);
-            freeAST(node->for_stmt.increment);
-            freeAST(node->for_stmt.body);
-            break;
-        case NODE_STMT_BLOCK:
-            for (int i = 0; i < node->block.count; i++) {
-                freeAST(node->block.statements[i]);
-            }
-            free(node->block.statements);
-            break;
-        case NODE_STMT_FUNCTION:
-            freeAST(node->function.body);
-            free(node->function.params);
-            break;
-        case NODE_STMT_RETURN:
-            freeAST(node->return_stmt.value);
-            break;
-        case NODE_STMT_IMPORT:
-            // tokens only; nothing to free
-            break;
+            memcpy(line, text, length);
+            line[length] = '\0';
+            Value arg = STRING_VAL(line);
+            vmCall(vm, "onLine", &arg, 1, &result);
+        }
+        fileClose(file);
     }
-    free(node);
+
+    vmCall(vm, "onEnd", NULL, 0, &result);
+    vm->lentString = NULL;
+    free(line);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <file.gemini>\n", argv[0]);
+    const char* path = NULL;
+    const char* emitPath = NULL;
+    const char* servePath = NULL;
+    const char* clientPath = NULL;
+    bool jit = false;
+    bool unbuffered = false;
+    bool eachLine = false;
+    int optLevel = OPT_LEVEL_DEFAULT;
+    bool optSet = false;
+    bool optDump = false;
+    // Arguments after the script: args() values, and inputs in stream mode
+    char** inputs = NULL;
+    int inputCount = 0;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        if (path) {
+            inputs = &argv[i];
+            inputCount = argc - i;
+            break;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else if (strcmp(argv[i], "--unbuffered") == 0) {
+            unbuffered = true;
+        } else if (strcmp(argv[i], "--each-line") == 0) {
+            eachLine = true;
+        } else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' &&
+                   argv[i][2] <= '0' + OPT_LEVEL_MAX && argv[i][3] == '\0') {
+            optLevel = argv[i][2] - '0';
+            optSet = true;
+        } else if (strcmp(argv[i], "--dump-opt") == 0) {
+            optDump = true;
+        } else if (strcmp(argv[i], "--emit-c") == 0 && i + 1 < argc) {
+            emitPath = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            clientPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage = true;
+            break;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (servePath && !usage && !path && !optDump) {
+        return runServer(servePath, optLevel);
+    }
+    // The server's -O level applies to client runs
+    if (!path || usage || servePath || (clientPath && (eachLine || emitPath || optSet || optDump))) {
+        fprintf(stderr, "Usage: %s [--jit] [--unbuffered] [-O0|-O1|-O2] [--dump-opt] [--emit-c <out.c>] <file.gemini> [arg...]\n", argv[0]);
+        fprintf(stderr, "       %s [--jit] [--unbuffered] [-O0|-O1|-O2] --each-line <file.gemini> [input...]\n", argv[0]);
+        fprintf(stderr, "       %s --serve <socket> [-O0|-O1|-O2]\n", argv[0]);
+        fprintf(stderr, "       %s --client <socket> [--jit] [--unbuffered] <file.gemini> [arg...]\n", argv[0]);
         return 1;
     }
+    if (clientPath) {
+        int flags = (jit ? RUN_FLAG_JIT : 0) | (unbuffered ? RUN_FLAG_UNBUFFERED : 0);
+        outInit(unbuffered);
+        return runClient(clientPath, path, inputs, inputCount, flags);
+    }
+    if (jit && !jitAvailable()) {
+        fprintf(stderr, "Warning: --jit is not supported on this platform; running interpreted.\n");
+        jit = false;
+    }
+
+    outInit(unbuffered);
 
-    char* source = readFile(argv[1]);
+    char* source = readFile(path);
 
     // Lexer
     Lexer lexer;
@@ -176,21 +171,49 @@ int main(int argc, char* argv[]) {
         if (token.type == TOKEN_EOF) break;
     }
 
-    printf("Tokenized %d tokens successfully.\n", parser.count);
+    // Stream mode output is the script's alone
+    if (!eachLine) {
+        char count[FORMAT_NUMBER_MAX];
+        outString("Tokenized ");
+        outWrite(count, formatInt(count, parser.count));
+        outString(" tokens successfully.\n");
+    }
 
     // Parse
     Node* ast = parse(&parser);
 
+    // Ahead-of-time: translate to C instead of running
+    if (emitPath) {
+        FILE* out = fopen(emitPath, "w");
+        if (!out) {
+            fprintf(stderr, "Could not open file \"%s\".\n", emitPath);
+            exit(1);
+        }
+        emitC(ast, path, out);
+        fclose(out);
+        return 0;
+    }
+
+    // The C compiler optimizes emitted code; the VM runs the optimized AST
+    optimize(ast, optLevel, optDump);
+
     // VM
     VM vm;
     initVM(&vm);
+    vm.jitEnabled = jit;
+    vm.optLevel = optLevel;
+    vm.optDump = optDump;
+    vm.scriptArgs = inputs;
+    vm.scriptArgCount = inputCount;
     interpret(&vm, ast);
+    if (eachLine) runEachLine(&vm, inputs, inputCount);
 
     // Cleanup
     freeAST(ast);
     freeParser(&parser);
     freeVM(&vm);
     free(source);
+    outFlush();
 
     return 0;
 }
\ No newline at end of file
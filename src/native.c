@@ -0,0 +1,402 @@
+#include "native.h"
+#include <limits.h>
+#include <math.h>
+
+// Accumulator lanes: consecutive elements go to different lanes so the
+// additions do not wait on each other
+#define LANES 4
+
+static bool toNumber(Value v, double* out) {
+    if (IS_INT(v)) { *out = (double)AS_INT(v); return true; }
+    if (IS_FLOAT(v)) { *out = AS_FLOAT(v); return true; }
+    return false;
+}
+
+static double numberArg(Value v, const char* fn, int line) {
+    double x;
+    if (!toNumber(v, &x)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s() requires a number.", fn);
+        error(msg, line);
+    }
+    return x;
+}
+
+static void checkArgs(int argc, int expected, const char* usage, int line) {
+    if (argc != expected) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s takes %d argument%s.", usage, expected, expected == 1 ? "" : "s");
+        error(msg, line);
+    }
+}
+
+static Array* arrayArg(Value v, const char* fn, int line) {
+    if (!IS_ARRAY(v) || !AS_ARRAY(v)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s() requires an array of numbers.", fn);
+        error(msg, line);
+    }
+    return AS_ARRAY(v);
+}
+
+static double elementNumber(Value v, const char* fn, int line) {
+    double x;
+    if (!toNumber(v, &x)) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s() requires an array of numbers.", fn);
+        error(msg, line);
+    }
+    return x;
+}
+
+static void checkNotEmpty(Array* a, const char* fn, int line) {
+    if (a->count == 0) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s() of an empty array.", fn);
+        error(msg, line);
+    }
+}
+
+// Int result when the value is integral and fits, float otherwise
+static Value integralValue(double x) {
+    if (x >= (double)INT_MIN && x <= (double)INT_MAX) return INT_VAL((int)x);
+    return FLOAT_VAL(x);
+}
+
+static Value newIntArray(const int* counts, int n, int line) {
+    Array* out = malloc(sizeof(Array));
+    if (!out) error("Memory allocation failed.", line);
+    out->items = malloc(sizeof(Value) * (n > 0 ? n : 1));
+    if (!out->items) error("Memory allocation failed.", line);
+    for (int i = 0; i < n; i++) out->items[i] = INT_VAL(counts[i]);
+    out->count = n;
+    out->capacity = n > 0 ? n : 1;
+    return ARRAY_VAL(out);
+}
+
+// ---------------------------------------------------------------------------
+// math
+// ---------------------------------------------------------------------------
+
+static Value mathSqrt(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "sqrt(x)", line);
+    return FLOAT_VAL(sqrt(numberArg(args[0], "sqrt", line)));
+}
+
+// int ** int stays an int while the result fits, like the VM's int
+// arithmetic would compute it by repeated multiplication
+static Value mathPow(Value* args, int argc, int line) {
+    checkArgs(argc, 2, "pow(x, y)", line);
+    double x = numberArg(args[0], "pow", line);
+    double y = numberArg(args[1], "pow", line);
+    if (IS_INT(args[0]) && IS_INT(args[1]) && AS_INT(args[1]) >= 0) {
+        long long base = AS_INT(args[0]);
+        long long result = 1;
+        int exp = AS_INT(args[1]);
+        bool fits = true;
+        while (exp > 0 && fits) {
+            if (exp & 1) {
+                result *= base;
+                fits = result >= INT_MIN && result <= INT_MAX;
+            }
+            exp >>= 1;
+            if (exp > 0 && fits) {
+                if (base > 46341 || base < -46341) fits = false;   // base * base would not fit
+                else base *= base;
+            }
+        }
+        if (fits) return INT_VAL((int)result);
+    }
+    return FLOAT_VAL(pow(x, y));
+}
+
+static Value mathFloor(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "floor(x)", line);
+    if (IS_INT(args[0])) return args[0];
+    return integralValue(floor(numberArg(args[0], "floor", line)));
+}
+
+static Value mathAbs(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "abs(x)", line);
+    if (IS_INT(args[0])) {
+        int x = AS_INT(args[0]);
+        return x < 0 ? INT_VAL((int)(0u - (unsigned int)x)) : args[0];   // wraps like int negation
+    }
+    return FLOAT_VAL(fabs(numberArg(args[0], "abs", line)));
+}
+
+// Smallest or largest of the arguments, or of one array argument; the
+// value is returned as it was given (int or float)
+static Value extreme(Value* args, int argc, int line, const char* fn, bool largest) {
+    Value* items = args;
+    int count = argc;
+    if (argc == 1 && IS_ARRAY(args[0]) && AS_ARRAY(args[0])) {
+        Array* a = AS_ARRAY(args[0]);
+        checkNotEmpty(a, fn, line);
+        items = a->items;
+        count = a->count;
+    } else if (argc < 2) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%s() takes an array or at least 2 numbers.", fn);
+        error(msg, line);
+    }
+    Value best = items[0];
+    double bestX = elementNumber(best, fn, line);
+    for (int i = 1; i < count; i++) {
+        double x = elementNumber(items[i], fn, line);
+        if (largest ? x > bestX : x < bestX) {
+            best = items[i];
+            bestX = x;
+        }
+    }
+    return best;
+}
+
+static Value mathMin(Value* args, int argc, int line) {
+    return extreme(args, argc, line, "min", false);
+}
+
+static Value mathMax(Value* args, int argc, int line) {
+    return extreme(args, argc, line, "max", true);
+}
+
+static const NativeFunction mathFunctions[] = {
+    {"sqrt", mathSqrt},
+    {"pow", mathPow},
+    {"floor", mathFloor},
+    {"abs", mathAbs},
+    {"min", mathMin},
+    {"max", mathMax},
+    {NULL, NULL}
+};
+
+// ---------------------------------------------------------------------------
+// stats
+// ---------------------------------------------------------------------------
+
+// Sums of (x - shift) and (x - shift)^2 over an array. Shifting by the
+// first element keeps the variance formula accurate for data far from 0
+// (the "shifted data" algorithm) without a second pass.
+typedef struct {
+    int count;
+    double shift;
+    double sum;
+    double sumSquares;
+} Moments;
+
+static Moments arrayMoments(Array* a, const char* fn, int line) {
+    Moments m = {a->count, 0.0, 0.0, 0.0};
+    if (a->count == 0) return m;
+    m.shift = elementNumber(a->items[0], fn, line);
+    double sum[LANES] = {0.0};
+    double squares[LANES] = {0.0};
+    int i = 0;
+    for (; i + LANES <= a->count; i += LANES) {
+        for (int lane = 0; lane < LANES; lane++) {
+            double d = elementNumber(a->items[i + lane], fn, line) - m.shift;
+            sum[lane] += d;
+            squares[lane] += d * d;
+        }
+    }
+    for (; i < a->count; i++) {
+        double d = elementNumber(a->items[i], fn, line) - m.shift;
+        sum[0] += d;
+        squares[0] += d * d;
+    }
+    for (int lane = 0; lane < LANES; lane++) {
+        m.sum += sum[lane];
+        m.sumSquares += squares[lane];
+    }
+    return m;
+}
+
+static double momentsVariance(const Moments* m) {
+    double v = (m->sumSquares - m->sum * m->sum / m->count) / m->count;
+    return v > 0.0 ? v : 0.0;   // rounding can leave a tiny negative
+}
+
+// All-int arrays sum exactly (as an int while it fits)
+static Value statsSum(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "sum(arr)", line);
+    Array* a = arrayArg(args[0], "sum", line);
+    long long ints[LANES] = {0};
+    double floats[LANES] = {0.0};
+    bool anyFloat = false;
+    int i = 0;
+    for (; i + LANES <= a->count; i += LANES) {
+        for (int lane = 0; lane < LANES; lane++) {
+            Value v = a->items[i + lane];
+            if (IS_INT(v)) ints[lane] += AS_INT(v);
+            else { floats[lane] += elementNumber(v, "sum", line); anyFloat = true; }
+        }
+    }
+    for (; i < a->count; i++) {
+        Value v = a->items[i];
+        if (IS_INT(v)) ints[0] += AS_INT(v);
+        else { floats[0] += elementNumber(v, "sum", line); anyFloat = true; }
+    }
+    long long intSum = 0;
+    double floatSum = 0.0;
+    for (int lane = 0; lane < LANES; lane++) {
+        intSum += ints[lane];
+        floatSum += floats[lane];
+    }
+    if (!anyFloat && intSum >= INT_MIN && intSum <= INT_MAX) return INT_VAL((int)intSum);
+    return FLOAT_VAL((double)intSum + floatSum);
+}
+
+static Value statsMean(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "mean(arr)", line);
+    Array* a = arrayArg(args[0], "mean", line);
+    checkNotEmpty(a, "mean", line);
+    Moments m = arrayMoments(a, "mean", line);
+    return FLOAT_VAL(m.shift + m.sum / m.count);
+}
+
+// Population variance (divides by the number of elements)
+static Value statsVariance(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "variance(arr)", line);
+    Array* a = arrayArg(args[0], "variance", line);
+    checkNotEmpty(a, "variance", line);
+    Moments m = arrayMoments(a, "variance", line);
+    return FLOAT_VAL(momentsVariance(&m));
+}
+
+static Value statsStddev(Value* args, int argc, int line) {
+    checkArgs(argc, 1, "stddev(arr)", line);
+    Array* a = arrayArg(args[0], "stddev", line);
+    checkNotEmpty(a, "stddev", line);
+    Moments m = arrayMoments(a, "stddev", line);
+    return FLOAT_VAL(sqrt(momentsVariance(&m)));
+}
+
+// Move the k-th smallest value to x[k], smaller ones before it and larger
+// ones after it (quickselect, expected linear time)
+static void selectKth(double* x, int n, int k) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        // Median of three as pivot
+        int mid = lo + (hi - lo) / 2;
+        double a = x[lo], b = x[mid], c = x[hi];
+        double pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (x[i] < pivot) i++;
+            while (x[j] > pivot) j--;
+            if (i <= j) {
+                double t = x[i]; x[i] = x[j]; x[j] = t;
+                i++; j--;
+            }
+        }
+        if (k <= j) hi = j;
+        else if (k >= i) lo = i;
+        else return;
+    }
+}
+
+// percentile(arr, p), 0 <= p <= 100, interpolating linearly between the
+// two closest ranks (p = 50 is the median)
+static Value statsPercentile(Value* args, int argc, int line) {
+    checkArgs(argc, 2, "percentile(arr, p)", line);
+    Array* a = arrayArg(args[0], "percentile", line);
+    double p = numberArg(args[1], "percentile", line);
+    if (!(p >= 0.0 && p <= 100.0)) error("percentile() p must be between 0 and 100.", line);
+    checkNotEmpty(a, "percentile", line);
+    double* x = malloc(sizeof(double) * a->count);
+    if (!x) error("Memory allocation failed.", line);
+    for (int i = 0; i < a->count; i++) {
+        if (!toNumber(a->items[i], &x[i]) || x[i] != x[i]) {
+            free(x);
+            error("percentile() requires an array of numbers.", line);
+        }
+    }
+    double rank = p / 100.0 * (a->count - 1);
+    int k = (int)rank;
+    double frac = rank - k;
+    selectKth(x, a->count, k);
+    double result = x[k];
+    if (frac > 0.0 && k + 1 < a->count) {
+        // Next rank: smallest value after position k
+        double next = x[k + 1];
+        for (int i = k + 2; i < a->count; i++) {
+            if (x[i] < next) next = x[i];
+        }
+        result += (next - result) * frac;
+    }
+    free(x);
+    return FLOAT_VAL(result);
+}
+
+// histogram(arr, bins [, lo, hi]): counts of values in `bins` equal-width
+// bins over [lo, hi] (default: the array's min and max); the last bin
+// includes hi and values outside the range are not counted
+static Value statsHistogram(Value* args, int argc, int line) {
+    if (argc != 2 && argc != 4) error("histogram(arr, bins [, lo, hi]) takes 2 or 4 arguments.", line);
+    Array* a = arrayArg(args[0], "histogram", line);
+    if (!IS_INT(args[1]) || AS_INT(args[1]) < 1) error("histogram() bins must be a positive int.", line);
+    int bins = AS_INT(args[1]);
+    double lo, hi;
+    if (argc == 4) {
+        lo = numberArg(args[2], "histogram", line);
+        hi = numberArg(args[3], "histogram", line);
+        if (!(lo <= hi)) error("histogram() range must have lo <= hi.", line);
+    } else {
+        if (a->count == 0) return newIntArray(NULL, 0, line);
+        lo = hi = elementNumber(a->items[0], "histogram", line);
+        for (int i = 1; i < a->count; i++) {
+            double x = elementNumber(a->items[i], "histogram", line);
+            if (x < lo) lo = x;
+            if (x > hi) hi = x;
+        }
+    }
+    int* counts = calloc((size_t)bins, sizeof(int));
+    if (!counts) error("Memory allocation failed.", line);
+    double scale = hi > lo ? bins / (hi - lo) : 0.0;
+    for (int i = 0; i < a->count; i++) {
+        double x;
+        if (!toNumber(a->items[i], &x)) {
+            free(counts);
+            error("histogram() requires an array of numbers.", line);
+        }
+        if (!(x >= lo && x <= hi)) continue;
+        int bin = (int)((x - lo) * scale);
+        if (bin >= bins) bin = bins - 1;
+        counts[bin]++;
+    }
+    Value result = newIntArray(counts, bins, line);
+    free(counts);
+    return result;
+}
+
+static const NativeFunction statsFunctions[] = {
+    {"sum", statsSum},
+    {"mean", statsMean},
+    {"variance", statsVariance},
+    {"stddev", statsStddev},
+    {"percentile", statsPercentile},
+    {"histogram", statsHistogram},
+    {NULL, NULL}
+};
+
+static const NativeModule nativeModules[] = {
+    {"math", mathFunctions},
+    {"stats", statsFunctions},
+};
+
+static bool sameName(const char* name, const char* text, int length) {
+    return strncmp(name, text, (size_t)length) == 0 && name[length] == '\0';
+}
+
+const NativeModule* findNativeModule(const char* name, int length) {
+    for (size_t i = 0; i < sizeof(nativeModules) / sizeof(nativeModules[0]); i++) {
+        if (sameName(nativeModules[i].name, name, length)) return &nativeModules[i];
+    }
+    return NULL;
+}
+
+NativeFn findNativeFunction(const NativeModule* module, const char* name, int length) {
+    for (const NativeFunction* f = module->functions; f->name; f++) {
+        if (sameName(f->name, name, length)) return f->fn;
+    }
+    return NULL;
+}
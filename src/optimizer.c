@@ -0,0 +1,1605 @@
+#include "optimizer.h"
+
+// Hidden variables for hoisted loop invariants. The names cannot be written
+// in Gemini source, so they never collide with user variables.
+static const char* const licmSlots[] = {
+    "$licm0", "$licm1", "$licm2", "$licm3", "$licm4", "$licm5", "$licm6", "$licm7",
+    "$licm8", "$licm9", "$licm10", "$licm11", "$licm12", "$licm13", "$licm14", "$licm15"
+};
+#define LICM_MAX_SLOTS ((int)(sizeof(licmSlots) / sizeof(licmSlots[0])))
+
+// Built-ins that never call back into Gemini code, so they cannot assign
+// variables. Any other call may run user code.
+static const char* const safeBuiltins[] = {
+    "array", "map", "length", "push", "pop", "has", "delete", "keys", "flush", "args",
+    "slice", "concat", "indexOf", "reverse", "fill", "join",
+    "split", "find", "contains", "replace", "trim", "upper", "lower", "startsWith", "endsWith",
+    "parseInt", "parseFloat",
+    "match", "search", "findAll", "replaceAll", "jsonParse", "jsonStringify",
+    "serialize", "deserialize", "saveValue", "loadValue", "pmap", "compact",
+    "open", "readLines", "csvRead", "readAll", "hasNext", "next", "write", "writeLine", "close"
+};
+
+// Small set of names (linear search; sets stay tiny)
+typedef struct {
+    Token* items;
+    int count;
+    int capacity;
+} NameSet;
+
+typedef struct {
+    int level;
+    bool dump;
+    NameSet functions;      // every function name defined in the program
+    int folded;
+    int branches;
+    int unreachable;
+    int hoisted;
+    int unused;
+    int typed;
+    int bounds;
+    int counted;
+    int concats;
+} Optimizer;
+
+// Per-function state
+typedef struct {
+    bool inFunction;
+    NameSet locals;         // definitely declared locals at this point
+    int slots;              // $licm variables used
+} Scope;
+
+static bool sameName(Token a, Token b) {
+    return a.length == b.length && memcmp(a.start, b.start, (size_t)a.length) == 0;
+}
+
+static bool nameSetHas(NameSet* set, Token name) {
+    for (int i = 0; i < set->count; i++) {
+        if (sameName(set->items[i], name)) return true;
+    }
+    return false;
+}
+
+static void nameSetAdd(NameSet* set, Token name) {
+    if (nameSetHas(set, name)) return;
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity < 8 ? 8 : set->capacity * 2;
+        set->items = realloc(set->items, sizeof(Token) * set->capacity);
+        if (!set->items) error("Memory allocation failed.", name.line);
+    }
+    set->items[set->count++] = name;
+}
+
+static Node* newNode(NodeType type) {
+    Node* node = calloc(1, sizeof(Node));
+    if (!node) error("Memory allocation failed.", 0);
+    node->type = type;
+    return node;
+}
+
+// Turn a statement into an empty block
+static void makeEmpty(Node* node) {
+    Node* next = node->next;
+    memset(node, 0, sizeof(Node));
+    node->type = NODE_STMT_BLOCK;
+    node->next = next;
+}
+
+// Replace node with the contents of other (which is consumed)
+static void replaceWith(Node* node, Node* other) {
+    Node* next = node->next;
+    *node = *other;
+    node->next = next;
+    free(other);
+}
+
+// ---------------------------------------------------------------------------
+// Dump helpers
+// ---------------------------------------------------------------------------
+
+static int nodeLine(Node* node) {
+    if (!node) return 0;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: return node->literal.token.line;
+        case NODE_EXPR_BINARY: return node->binary.op.line;
+        case NODE_EXPR_UNARY: return node->unary.op.line;
+        case NODE_EXPR_VAR: return node->var.name.line;
+        case NODE_EXPR_CALL: return nodeLine(node->call.callee);
+        case NODE_EXPR_GET: return node->get.name.line;
+        case NODE_EXPR_INDEX: return node->index.bracket.line;
+        case NODE_EXPR_INVARIANT: return nodeLine(node->invariant.expr);
+        case NODE_EXPR_PARAM: return node->param.name.line;
+        case NODE_STMT_VAR_DECL: return node->var_decl.name.line;
+        case NODE_STMT_ASSIGN: return node->assign.name.line;
+        case NODE_STMT_INDEX_ASSIGN: return node->index_assign.bracket.line;
+        case NODE_STMT_PRINT: return nodeLine(node->print.expr);
+        case NODE_STMT_IF: return nodeLine(node->if_stmt.condition);
+        case NODE_STMT_WHILE: return nodeLine(node->while_stmt.condition);
+        case NODE_STMT_FOR:
+            return nodeLine(node->for_stmt.condition ? node->for_stmt.condition : node->for_stmt.initializer);
+        case NODE_STMT_FOR_IN: return node->for_in.key.line;
+        case NODE_STMT_BLOCK: return node->block.count > 0 ? nodeLine(node->block.statements[0]) : 0;
+        case NODE_STMT_FUNCTION: return node->function.name.line;
+        case NODE_STMT_RETURN: return nodeLine(node->return_stmt.value);
+        case NODE_STMT_IMPORT: return node->import_stmt.module.line;
+    }
+    return 0;
+}
+
+typedef struct {
+    char* chars;
+    size_t size;
+    size_t length;
+} TextBuffer;
+
+static void appendText(TextBuffer* out, const char* text, size_t length) {
+    if (out->length + length + 1 > out->size) {
+        length = out->size - out->length - 1;   // truncate long expressions
+    }
+    memcpy(out->chars + out->length, text, length);
+    out->length += length;
+    out->chars[out->length] = '\0';
+}
+
+static void appendToken(TextBuffer* out, Token token) {
+    appendText(out, token.start, (size_t)token.length);
+}
+
+// Source-like rendering of an expression for the dump
+static void formatExpr(TextBuffer* out, Node* node) {
+    char number[64];
+    if (!node) return;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+            if (node->literal.token.type == TOKEN_STRING) {
+                appendToken(out, node->literal.token);
+            } else if (node->literal.isFloat) {
+                int n = snprintf(number, sizeof(number), "%.17g", node->literal.floatValue);
+                if (!strpbrk(number, ".en")) n += snprintf(number + n, sizeof(number) - (size_t)n, ".0");
+                appendText(out, number, (size_t)n);
+            } else {
+                appendText(out, number, (size_t)snprintf(number, sizeof(number), "%d", node->literal.intValue));
+            }
+            break;
+        case NODE_EXPR_BINARY:
+            appendText(out, "(", 1);
+            formatExpr(out, node->binary.left);
+            appendText(out, " ", 1);
+            appendToken(out, node->binary.op);
+            appendText(out, " ", 1);
+            formatExpr(out, node->binary.right);
+            appendText(out, ")", 1);
+            break;
+        case NODE_EXPR_UNARY:
+            appendToken(out, node->unary.op);
+            formatExpr(out, node->unary.expr);
+            break;
+        case NODE_EXPR_VAR:
+            appendToken(out, node->var.name);
+            break;
+        case NODE_EXPR_CALL:
+            formatExpr(out, node->call.callee);
+            appendText(out, "(", 1);
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) {
+                formatExpr(out, arg);
+                if (arg->next) appendText(out, ", ", 2);
+            }
+            appendText(out, ")", 1);
+            break;
+        case NODE_EXPR_GET:
+            formatExpr(out, node->get.object);
+            appendText(out, ".", 1);
+            appendToken(out, node->get.name);
+            break;
+        case NODE_EXPR_INDEX:
+            formatExpr(out, node->index.target);
+            appendText(out, "[", 1);
+            formatExpr(out, node->index.index);
+            appendText(out, "]", 1);
+            break;
+        case NODE_EXPR_INVARIANT:
+            appendToken(out, node->invariant.slot);
+            break;
+        case NODE_EXPR_PARAM:
+            appendToken(out, node->param.name);
+            break;
+        default:
+            appendText(out, "...", 3);
+            break;
+    }
+}
+
+static void report(Optimizer* o, Node* node, const char* what, Node* expr, const char* detail) {
+    if (!o->dump) return;
+    char text[160];
+    TextBuffer out = {text, sizeof(text), 0};
+    text[0] = '\0';
+    if (expr) formatExpr(&out, expr);
+    fprintf(stderr, "[opt] line %d: %s%s%s%s\n", nodeLine(node), what,
+            expr ? " " : "", text, detail ? detail : "");
+}
+
+// ---------------------------------------------------------------------------
+// Constant folding
+// ---------------------------------------------------------------------------
+
+static bool isNumberLiteral(Node* node) {
+    return node && node->type == NODE_EXPR_LITERAL && node->literal.token.type == TOKEN_NUMBER;
+}
+
+static void makeIntLiteral(Node* node, int value, int line) {
+    Node* next = node->next;
+    memset(node, 0, sizeof(Node));
+    node->type = NODE_EXPR_LITERAL;
+    node->literal.token = (Token){TOKEN_NUMBER, "", 0, line, 0};
+    node->literal.intValue = value;
+    node->next = next;
+}
+
+static void makeFloatLiteral(Node* node, double value, int line) {
+    makeIntLiteral(node, 0, line);
+    node->literal.isFloat = true;
+    node->literal.floatValue = value;
+}
+
+// Fold arithmetic on two numeric literals of the same kind, exactly as the
+// VM's specialized paths compute it. Division by zero is left to runtime.
+static bool foldBinary(Node* node) {
+    Node* l = node->binary.left;
+    Node* r = node->binary.right;
+    if (!isNumberLiteral(l) || !isNumberLiteral(r) || l->literal.isFloat != r->literal.isFloat) return false;
+    int line = node->binary.op.line;
+    TokenType op = node->binary.op.type;
+    if (!l->literal.isFloat) {
+        int a = l->literal.intValue, b = r->literal.intValue, v;
+        switch (op) {
+            case TOKEN_PLUS: v = a + b; break;
+            case TOKEN_MINUS: v = a - b; break;
+            case TOKEN_STAR: v = a * b; break;
+            case TOKEN_SLASH:
+                if (b == 0 || (a == -2147483647 - 1 && b == -1)) return false;
+                v = a / b;
+                break;
+            case TOKEN_PERCENT:
+                if (b == 0 || (a == -2147483647 - 1 && b == -1)) return false;
+                v = a % b;
+                break;
+            default: return false;
+        }
+        freeAST(l);
+        freeAST(r);
+        makeIntLiteral(node, v, line);
+        return true;
+    }
+    double a = l->literal.floatValue, b = r->literal.floatValue, v;
+    switch (op) {
+        case TOKEN_PLUS: v = a + b; break;
+        case TOKEN_MINUS: v = a - b; break;
+        case TOKEN_STAR: v = a * b; break;
+        case TOKEN_SLASH:
+            if (b == 0.0) return false;
+            v = a / b;
+            break;
+        default: return false;
+    }
+    freeAST(l);
+    freeAST(r);
+    makeFloatLiteral(node, v, line);
+    return true;
+}
+
+static void fuseConcat(Optimizer* o, Node* node);
+
+static void optimizeExpr(Optimizer* o, Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_EXPR_BINARY:
+            optimizeExpr(o, node->binary.left);
+            optimizeExpr(o, node->binary.right);
+            if (o->dump) {
+                char text[160];
+                TextBuffer out = {text, sizeof(text), 0};
+                text[0] = '\0';
+                formatExpr(&out, node);
+                if (foldBinary(node)) {
+                    o->folded++;
+                    report(o, node, "folded ", NULL, text);
+                }
+            } else if (foldBinary(node)) {
+                o->folded++;
+            }
+            if (node->type == NODE_EXPR_BINARY) fuseConcat(o, node);
+            break;
+        case NODE_EXPR_UNARY: {
+            optimizeExpr(o, node->unary.expr);
+            Node* operand = node->unary.expr;
+            if (node->unary.op.type == TOKEN_MINUS && isNumberLiteral(operand) &&
+                (operand->literal.isFloat || operand->literal.intValue != -2147483647 - 1)) {
+                int line = node->unary.op.line;
+                if (operand->literal.isFloat) {
+                    double v = -operand->literal.floatValue;
+                    free(operand);
+                    makeFloatLiteral(node, v, line);
+                } else {
+                    int v = -operand->literal.intValue;
+                    free(operand);
+                    makeIntLiteral(node, v, line);
+                }
+                o->folded++;
+            }
+            break;
+        }
+        case NODE_EXPR_CALL:
+            optimizeExpr(o, node->call.callee);
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) optimizeExpr(o, arg);
+            break;
+        case NODE_EXPR_GET:
+            optimizeExpr(o, node->get.object);
+            break;
+        case NODE_EXPR_INDEX:
+            optimizeExpr(o, node->index.target);
+            optimizeExpr(o, node->index.index);
+            break;
+        default:
+            break;
+    }
+}
+
+// Truthiness of a constant condition (after folding)
+static bool constTruth(Node* node, bool* truth) {
+    if (!node) return false;
+    if (isNumberLiteral(node)) {
+        *truth = node->literal.isFloat ? node->literal.floatValue != 0.0 : node->literal.intValue != 0;
+        return true;
+    }
+    if (node->type == NODE_EXPR_LITERAL && node->literal.token.type == TOKEN_STRING) {
+        *truth = node->literal.token.length > 2;   // non-empty between the quotes
+        return true;
+    }
+    if (node->type == NODE_EXPR_BINARY && isNumberLiteral(node->binary.left) && isNumberLiteral(node->binary.right)) {
+        Node* l = node->binary.left;
+        Node* r = node->binary.right;
+        if (l->literal.isFloat != r->literal.isFloat) return false;
+        double a = l->literal.isFloat ? l->literal.floatValue : l->literal.intValue;
+        double b = r->literal.isFloat ? r->literal.floatValue : r->literal.intValue;
+        switch (node->binary.op.type) {
+            case TOKEN_LESS: *truth = a < b; return true;
+            case TOKEN_LESS_EQUAL: *truth = a <= b; return true;
+            case TOKEN_GREATER: *truth = a > b; return true;
+            case TOKEN_GREATER_EQUAL: *truth = a >= b; return true;
+            case TOKEN_EQUAL_EQUAL: *truth = a == b; return true;
+            case TOKEN_BANG_EQUAL: *truth = a != b; return true;
+            default: return false;
+        }
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Loop-invariant code motion
+// ---------------------------------------------------------------------------
+
+// What a loop may change
+typedef struct {
+    NameSet assigned;       // variables declared or assigned anywhere in it
+    bool runsUserCode;      // calls something that may assign globals
+} LoopEffects;
+
+static bool isSafeBuiltin(Optimizer* o, Token name) {
+    if (nameSetHas(&o->functions, name)) return false;  // user code shadows it
+    for (size_t i = 0; i < sizeof(safeBuiltins) / sizeof(safeBuiltins[0]); i++) {
+        if ((size_t)name.length == strlen(safeBuiltins[i]) && memcmp(name.start, safeBuiltins[i], (size_t)name.length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void collectEffects(Optimizer* o, Node* node, LoopEffects* fx) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+        case NODE_EXPR_VAR:
+        case NODE_EXPR_PARAM:
+            break;
+        case NODE_EXPR_BINARY:
+            collectEffects(o, node->binary.left, fx);
+            collectEffects(o, node->binary.right, fx);
+            break;
+        case NODE_EXPR_UNARY:
+            collectEffects(o, node->unary.expr, fx);
+            break;
+        case NODE_EXPR_CALL:
+            if (node->call.callee->type != NODE_EXPR_VAR || !isSafeBuiltin(o, node->call.callee->var.name)) {
+                fx->runsUserCode = true;
+            }
+            collectEffects(o, node->call.callee, fx);
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) collectEffects(o, arg, fx);
+            break;
+        case NODE_EXPR_GET:
+            collectEffects(o, node->get.object, fx);
+            break;
+        case NODE_EXPR_INDEX:
+            collectEffects(o, node->index.target, fx);
+            collectEffects(o, node->index.index, fx);
+            break;
+        case NODE_EXPR_INVARIANT:
+            collectEffects(o, node->invariant.expr, fx);
+            break;
+        case NODE_STMT_VAR_DECL:
+            nameSetAdd(&fx->assigned, node->var_decl.name);
+            collectEffects(o, node->var_decl.initializer, fx);
+            break;
+        case NODE_STMT_ASSIGN:
+            nameSetAdd(&fx->assigned, node->assign.name);
+            collectEffects(o, node->assign.value, fx);
+            break;
+        case NODE_STMT_INDEX_ASSIGN:
+            collectEffects(o, node->index_assign.target, fx);
+            collectEffects(o, node->index_assign.index, fx);
+            collectEffects(o, node->index_assign.value, fx);
+            break;
+        case NODE_STMT_PRINT:
+            collectEffects(o, node->print.expr, fx);
+            break;
+        case NODE_STMT_IF:
+            collectEffects(o, node->if_stmt.condition, fx);
+            collectEffects(o, node->if_stmt.thenBranch, fx);
+            collectEffects(o, node->if_stmt.elseBranch, fx);
+            break;
+        case NODE_STMT_WHILE:
+            collectEffects(o, node->while_stmt.condition, fx);
+            collectEffects(o, node->while_stmt.body, fx);
+            break;
+        case NODE_STMT_FOR:
+            collectEffects(o, node->for_stmt.initializer, fx);
+            collectEffects(o, node->for_stmt.condition, fx);
+            collectEffects(o, node->for_stmt.increment, fx);
+            collectEffects(o, node->for_stmt.body, fx);
+            break;
+        case NODE_STMT_FOR_IN:
+            nameSetAdd(&fx->assigned, node->for_in.key);
+            if (node->for_in.value.length > 0) nameSetAdd(&fx->assigned, node->for_in.value);
+            collectEffects(o, node->for_in.iterable, fx);
+            collectEffects(o, node->for_in.body, fx);
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) collectEffects(o, node->block.statements[i], fx);
+            break;
+        case NODE_STMT_FUNCTION:
+            // Defined, not run, here; scanning it only adds caution
+            collectEffects(o, node->function.body, fx);
+            break;
+        case NODE_STMT_RETURN:
+            collectEffects(o, node->return_stmt.value, fx);
+            break;
+        case NODE_STMT_IMPORT:
+            nameSetAdd(&fx->assigned, node->import_stmt.alias);
+            fx->runsUserCode = true;    // module top-level code
+            break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// String concatenation chains
+// ---------------------------------------------------------------------------
+
+// Mark node as the root of a fused `+` chain (see optimizer.h). Chains are
+// marked bottom-up, so a longer chain takes over the mark of the chain in
+// its left operand. Operands must not run user code: the VM holds the
+// strings they return until the end of the chain, and user code could free
+// one by reassigning the variable it came from.
+static void fuseConcat(Optimizer* o, Node* node) {
+    if (node->binary.op.type != TOKEN_PLUS) return;
+    int count = 1;
+    bool string = false;
+    Node* cur = node;
+    for (; cur->type == NODE_EXPR_BINARY && cur->binary.op.type == TOKEN_PLUS; cur = cur->binary.left) {
+        Node* right = cur->binary.right;
+        if (right->type == NODE_EXPR_LITERAL && right->literal.token.type == TOKEN_STRING) string = true;
+        count++;
+    }
+    if (cur->type == NODE_EXPR_LITERAL && cur->literal.token.type == TOKEN_STRING) string = true;
+    if (count < 3 || !string) return;
+
+    LoopEffects fx;
+    memset(&fx, 0, sizeof(fx));
+    collectEffects(o, node, &fx);
+    free(fx.assigned.items);
+    if (fx.runsUserCode) return;
+
+    Node* left = node->binary.left;
+    if (left->binary.concatCount > 0) {
+        left->binary.concatCount = 0;
+    } else {
+        o->concats++;
+    }
+    node->binary.concatCount = count;
+}
+
+// A variable keeps its value for the whole loop: nothing in the loop
+// assigns it, and if the loop runs user code the variable is a local of the
+// current function (callees can only assign globals).
+static bool invariantVar(Scope* scope, LoopEffects* fx, Token name) {
+    if (nameSetHas(&fx->assigned, name)) return false;
+    if (!fx->runsUserCode) return true;
+    return scope->inFunction && nameSetHas(&scope->locals, name);
+}
+
+// Arithmetic/comparison over literals and invariant variables
+static bool invariantPure(Scope* scope, LoopEffects* fx, Node* node) {
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: return true;
+        case NODE_EXPR_VAR: return invariantVar(scope, fx, node->var.name);
+        case NODE_EXPR_UNARY: return invariantPure(scope, fx, node->unary.expr);
+        case NODE_EXPR_BINARY:
+            return invariantPure(scope, fx, node->binary.left) && invariantPure(scope, fx, node->binary.right);
+        default: return false;
+    }
+}
+
+static bool isLengthOfInvariantVar(Scope* scope, LoopEffects* fx, Node* node) {
+    return node->type == NODE_EXPR_GET && node->get.name.length == 6 &&
+           memcmp(node->get.name.start, "length", 6) == 0 &&
+           node->get.object->type == NODE_EXPR_VAR &&
+           invariantVar(scope, fx, node->get.object->var.name);
+}
+
+typedef struct {
+    Node** decls;           // pre-header declarations
+    int count;
+} PreHeader;
+
+static Token slotToken(Scope* scope, int line) {
+    const char* name = licmSlots[scope->slots++];
+    return (Token){TOKEN_IDENTIFIER, name, (int)strlen(name), line, hashString(name, strlen(name))};
+}
+
+static void addDecl(PreHeader* pre, Token slot, Node* initializer) {
+    Node* decl = newNode(NODE_STMT_VAR_DECL);
+    decl->var_decl.name = slot;
+    decl->var_decl.initializer = initializer;
+    pre->decls = realloc(pre->decls, sizeof(Node*) * (pre->count + 1));
+    if (!pre->decls) error("Memory allocation failed.", slot.line);
+    pre->decls[pre->count++] = decl;
+}
+
+// Evaluating node can neither fail nor have any effect: literals,
+// variables declared on every path to this point (and hidden ones), and
+// ==/!= over them
+static bool quietExpr(Scope* scope, Node* node) {
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: return true;
+        case NODE_EXPR_VAR: return node->var.name.start[0] == '$' || nameSetHas(&scope->locals, node->var.name);
+        case NODE_EXPR_BINARY:
+            return (node->binary.op.type == TOKEN_EQUAL_EQUAL || node->binary.op.type == TOKEN_BANG_EQUAL) &&
+                   quietExpr(scope, node->binary.left) && quietExpr(scope, node->binary.right);
+        default: return false;
+    }
+}
+
+// Hoist invariant parts of a loop condition. Unguarded values are only
+// taken from operator operands, where the result is consumed and never
+// stored, so the shared hidden value cannot be aliased. The condition is
+// walked in evaluation order, and *quiet says whether everything evaluated
+// so far is quiet (quietExpr). A hoisted value that may fail is computed
+// before the whole condition, so it is only taken while *quiet holds;
+// otherwise a call or error earlier in the condition would come after it.
+static void hoistFrom(Optimizer* o, Scope* scope, LoopEffects* fx, PreHeader* pre, Node* node, bool operand,
+                      bool* quiet) {
+    if (!node || scope->slots >= LICM_MAX_SLOTS) return;
+    int line = nodeLine(node);
+
+    if (operand && *quiet && (node->type == NODE_EXPR_BINARY || node->type == NODE_EXPR_UNARY) &&
+        invariantPure(scope, fx, node)) {
+        Token slot = slotToken(scope, line);
+        Node* moved = newNode(node->type);
+        *moved = *node;
+        moved->next = NULL;
+        Node* next = node->next;
+        memset(node, 0, sizeof(Node));
+        node->type = NODE_EXPR_VAR;
+        node->var.name = slot;
+        node->next = next;
+        addDecl(pre, slot, moved);
+        o->hoisted++;
+        report(o, node, "hoisted", moved, NULL);
+        if (o->dump) fprintf(stderr, "[opt]   -> %s, computed before the loop\n", slot.start);
+        return;
+    }
+    if (isLengthOfInvariantVar(scope, fx, node) && (*quiet || quietExpr(scope, node->get.object))) {
+        Token slot = slotToken(scope, line);
+        // The original stays as the fallback. The pre-header reads the
+        // length only if the object is a string (empty slot), so it never
+        // fails and never shares a value it does not own.
+        Node* original = newNode(NODE_EXPR_GET);
+        original->get = node->get;
+        Node* object = newNode(NODE_EXPR_VAR);
+        object->var = node->get.object->var;
+        Node* get = newNode(NODE_EXPR_GET);
+        get->get.object = object;
+        get->get.name = node->get.name;
+        Node* copy = newNode(NODE_EXPR_INVARIANT);
+        copy->invariant.expr = get;
+        copy->invariant.slot = (Token){TOKEN_IDENTIFIER, "", 0, line, 0};
+        Node* next = node->next;
+        memset(node, 0, sizeof(Node));
+        node->type = NODE_EXPR_INVARIANT;
+        node->invariant.expr = original;
+        node->invariant.slot = slot;
+        node->next = next;
+        addDecl(pre, slot, copy);
+        o->hoisted++;
+        report(o, node, "hoisted", get, NULL);
+        if (o->dump) fprintf(stderr, "[opt]   -> %s, reused while the object is a string\n", slot.start);
+        *quiet = false;     // the fallback reads the length in place
+        return;
+    }
+
+    switch (node->type) {
+        case NODE_EXPR_BINARY:
+            hoistFrom(o, scope, fx, pre, node->binary.left, true, quiet);
+            hoistFrom(o, scope, fx, pre, node->binary.right, true, quiet);
+            break;
+        case NODE_EXPR_UNARY:
+            hoistFrom(o, scope, fx, pre, node->unary.expr, true, quiet);
+            break;
+        case NODE_EXPR_CALL:
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) {
+                hoistFrom(o, scope, fx, pre, arg, false, quiet);
+            }
+            break;
+        case NODE_EXPR_GET:
+            hoistFrom(o, scope, fx, pre, node->get.object, false, quiet);
+            break;
+        case NODE_EXPR_INDEX:
+            hoistFrom(o, scope, fx, pre, node->index.target, false, quiet);
+            hoistFrom(o, scope, fx, pre, node->index.index, false, quiet);
+            break;
+        default:
+            break;
+    }
+    if (!quietExpr(scope, node)) *quiet = false;
+}
+
+// Move invariant condition parts of a loop into declarations just before
+// it. The condition runs at least once per loop entry and nothing observable
+// in it comes before them (see hoistFrom), so computing them up front
+// raises no error the loop would not have raised, at the same point.
+static void hoistLoop(Optimizer* o, Scope* scope, Node* loop) {
+    Node* condition = loop->type == NODE_STMT_WHILE ? loop->while_stmt.condition : loop->for_stmt.condition;
+    if (!condition) return;
+    LoopEffects fx = {{NULL, 0, 0}, false};
+    collectEffects(o, loop, &fx);
+    PreHeader pre = {NULL, 0};
+    bool quiet = true;
+    hoistFrom(o, scope, &fx, &pre, condition, true, &quiet);
+    free(fx.assigned.items);
+    if (pre.count == 0) return;
+
+    // { init; var $licmN = ...; loop }  (blocks do not open a scope). A for
+    // initializer moves in front so the pre-header sees its effects.
+    Node* init = NULL;
+    if (loop->type == NODE_STMT_FOR) {
+        init = loop->for_stmt.initializer;
+        loop->for_stmt.initializer = NULL;
+    }
+    Node* moved = newNode(loop->type);
+    Node* next = loop->next;
+    *moved = *loop;
+    moved->next = NULL;
+    memset(loop, 0, sizeof(Node));
+    loop->type = NODE_STMT_BLOCK;
+    loop->next = next;
+    loop->block.capacity = pre.count + 2;
+    loop->block.statements = malloc(sizeof(Node*) * loop->block.capacity);
+    if (!loop->block.statements) error("Memory allocation failed.", 0);
+    if (init) loop->block.statements[loop->block.count++] = init;
+    for (int i = 0; i < pre.count; i++) loop->block.statements[loop->block.count++] = pre.decls[i];
+    loop->block.statements[loop->block.count++] = moved;
+    free(pre.decls);
+}
+
+// Canonical counted loop: for (...; i OP bound; i = i +/- k) with k > 0 an
+// int literal, `<`/`<=` counting up or `>`/`>=` counting down, a bound
+// that stays the same for the whole loop and a body that never writes i.
+// The VM then keeps i in a C int (see the for_stmt.counted flag).
+static bool countedLoop(Optimizer* o, Scope* scope, Node* loop) {
+    Node* cond = loop->for_stmt.condition;
+    Node* incr = loop->for_stmt.increment;
+    if (!cond || !incr || cond->type != NODE_EXPR_BINARY || cond->binary.left->type != NODE_EXPR_VAR) return false;
+    Token index = cond->binary.left->var.name;
+    if (incr->type != NODE_STMT_ASSIGN || !sameName(incr->assign.name, index)) return false;
+    Node* step = incr->assign.value;
+    if (step->type != NODE_EXPR_BINARY || step->binary.left->type != NODE_EXPR_VAR ||
+        !sameName(step->binary.left->var.name, index) || !isNumberLiteral(step->binary.right) ||
+        step->binary.right->literal.isFloat || step->binary.right->literal.intValue <= 0) {
+        return false;
+    }
+    TokenType op = cond->binary.op.type;
+    TokenType dir = step->binary.op.type;
+    bool up = (op == TOKEN_LESS || op == TOKEN_LESS_EQUAL) && dir == TOKEN_PLUS;
+    bool down = (op == TOKEN_GREATER || op == TOKEN_GREATER_EQUAL) && dir == TOKEN_MINUS;
+    if (!up && !down) return false;
+
+    LoopEffects fx = {{NULL, 0, 0}, false};
+    collectEffects(o, loop->for_stmt.body, &fx);
+    collectEffects(o, cond, &fx);
+    // Only the increment may write i, and nothing else may (callees write globals)
+    bool counted = !nameSetHas(&fx.assigned, index) &&
+                   (!fx.runsUserCode || (scope->inFunction && nameSetHas(&scope->locals, index))) &&
+                   invariantPure(scope, &fx, cond->binary.right);
+    free(fx.assigned.items);
+    return counted;
+}
+
+// ---------------------------------------------------------------------------
+// Type inference
+// ---------------------------------------------------------------------------
+
+// Not known yet: the variable's writes have not been typed (fixpoint start)
+#define TYPE_PENDING (-1)
+
+// Type of a local variable: the join of the types of every write to it
+typedef struct {
+    Token name;
+    int type;               // TYPE_PENDING until a write is typed
+} LocalType;
+
+typedef struct {
+    Optimizer* o;
+    Node* function;
+    LocalType* locals;      // variables declared with `var` in the function
+    int count;
+    NameSet definite;       // declared on every path to the current point
+    NameSet excluded;       // params and import aliases: never typed
+    bool changed;
+    bool annotate;          // final pass: record types on the nodes
+    int typed;              // expressions annotated
+    int bounds;             // index checks removed
+} TypeState;
+
+static LocalType* findLocalType(TypeState* ts, Token name) {
+    for (int i = 0; i < ts->count; i++) {
+        if (sameName(ts->locals[i].name, name)) return &ts->locals[i];
+    }
+    return NULL;
+}
+
+static void collectLocals(TypeState* ts, Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL:
+            if (!findLocalType(ts, node->var_decl.name)) {
+                ts->locals = realloc(ts->locals, sizeof(LocalType) * (ts->count + 1));
+                if (!ts->locals) error("Memory allocation failed.", node->var_decl.name.line);
+                ts->locals[ts->count++] = (LocalType){node->var_decl.name, TYPE_PENDING};
+            }
+            break;
+        case NODE_STMT_IMPORT:
+            nameSetAdd(&ts->excluded, node->import_stmt.alias);
+            break;
+        case NODE_STMT_IF:
+            collectLocals(ts, node->if_stmt.thenBranch);
+            collectLocals(ts, node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            collectLocals(ts, node->while_stmt.body);
+            break;
+        case NODE_STMT_FOR:
+            collectLocals(ts, node->for_stmt.initializer);
+            collectLocals(ts, node->for_stmt.body);
+            break;
+        case NODE_STMT_FOR_IN:
+            // Bound to elements, keys and values of any type
+            nameSetAdd(&ts->excluded, node->for_in.key);
+            if (node->for_in.value.length > 0) nameSetAdd(&ts->excluded, node->for_in.value);
+            collectLocals(ts, node->for_in.body);
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) collectLocals(ts, node->block.statements[i]);
+            break;
+        default:
+            // Nested functions run in their own environment
+            break;
+    }
+}
+
+static bool isNumeric(int type) {
+    return type == TYPE_INT || type == TYPE_FLOAT;
+}
+
+// Local whose reads here are proven to see one of its typed writes
+static LocalType* typedLocal(TypeState* ts, Token name) {
+    if (nameSetHas(&ts->excluded, name) || !nameSetHas(&ts->definite, name)) return NULL;
+    return findLocalType(ts, name);
+}
+
+static bool isLengthCall(TypeState* ts, Node* node) {
+    return node->type == NODE_EXPR_CALL && node->call.callee->type == NODE_EXPR_VAR &&
+           node->call.argumentCount == 1 && node->call.callee->var.name.length == 6 &&
+           memcmp(node->call.callee->var.name.start, "length", 6) == 0 &&
+           !nameSetHas(&ts->o->functions, node->call.callee->var.name);
+}
+
+// Type of an expression, following the VM's arithmetic rules: int op int
+// stays int, float or mixed operands give float (except %), comparisons
+// give bool (== and != only for equal types; mixed values are never equal)
+static int inferExpr(TypeState* ts, Node* node) {
+    if (!node) return TYPE_ANY;
+    int type = TYPE_ANY;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+            if (node->literal.token.type == TOKEN_NUMBER) type = node->literal.isFloat ? TYPE_FLOAT : TYPE_INT;
+            break;
+        case NODE_EXPR_VAR: {
+            LocalType* local = typedLocal(ts, node->var.name);
+            if (local) type = local->type;
+            break;
+        }
+        case NODE_EXPR_UNARY: {
+            int operand = inferExpr(ts, node->unary.expr);
+            if (operand == TYPE_PENDING || isNumeric(operand)) type = operand;
+            break;
+        }
+        case NODE_EXPR_BINARY: {
+            int l = inferExpr(ts, node->binary.left);
+            int r = inferExpr(ts, node->binary.right);
+            if (l == TYPE_PENDING || r == TYPE_PENDING) {
+                type = TYPE_PENDING;
+                break;
+            }
+            if (!isNumeric(l) || !isNumeric(r)) break;
+            switch (node->binary.op.type) {
+                case TOKEN_PLUS:
+                case TOKEN_MINUS:
+                case TOKEN_STAR:
+                case TOKEN_SLASH:
+                    type = (l == TYPE_INT && r == TYPE_INT) ? TYPE_INT : TYPE_FLOAT;
+                    break;
+                case TOKEN_PERCENT:
+                    if (l == TYPE_INT && r == TYPE_INT) type = TYPE_INT;
+                    break;
+                case TOKEN_LESS:
+                case TOKEN_LESS_EQUAL:
+                case TOKEN_GREATER:
+                case TOKEN_GREATER_EQUAL:
+                    type = TYPE_BOOL;
+                    break;
+                case TOKEN_EQUAL_EQUAL:
+                case TOKEN_BANG_EQUAL:
+                    if (l == r) type = TYPE_BOOL;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case NODE_EXPR_CALL:
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) inferExpr(ts, arg);
+            if (isLengthCall(ts, node)) type = TYPE_INT;  // errors unless it returns an int
+            break;
+        case NODE_EXPR_GET:
+            inferExpr(ts, node->get.object);
+            break;
+        case NODE_EXPR_INDEX:
+            inferExpr(ts, node->index.target);
+            inferExpr(ts, node->index.index);
+            break;
+        case NODE_EXPR_INVARIANT:
+            inferExpr(ts, node->invariant.expr);
+            break;
+        default:
+            break;
+    }
+    if (ts->annotate && (type == TYPE_INT || type == TYPE_FLOAT || type == TYPE_BOOL)) {
+        node->staticType = (StaticType)type;
+        if (node->type == NODE_EXPR_BINARY || node->type == NODE_EXPR_UNARY) ts->typed++;
+    }
+    return type;
+}
+
+static void recordWrite(TypeState* ts, Token name, int type) {
+    if (nameSetHas(&ts->excluded, name)) return;
+    LocalType* local = findLocalType(ts, name);
+    if (!local || type == TYPE_PENDING || local->type == type || local->type == TYPE_ANY) return;
+    local->type = local->type == TYPE_PENDING ? type : TYPE_ANY;
+    ts->changed = true;
+}
+
+// Names written anywhere in a statement
+static bool writes(Node* node, Token name) {
+    if (!node) return false;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL: return sameName(node->var_decl.name, name);
+        case NODE_STMT_ASSIGN: return sameName(node->assign.name, name);
+        case NODE_STMT_IMPORT: return sameName(node->import_stmt.alias, name);
+        case NODE_STMT_IF: return writes(node->if_stmt.thenBranch, name) || writes(node->if_stmt.elseBranch, name);
+        case NODE_STMT_WHILE: return writes(node->while_stmt.body, name);
+        case NODE_STMT_FOR:
+            return writes(node->for_stmt.initializer, name) || writes(node->for_stmt.increment, name) ||
+                   writes(node->for_stmt.body, name);
+        case NODE_STMT_FOR_IN:
+            return sameName(node->for_in.key, name) ||
+                   (node->for_in.value.length > 0 && sameName(node->for_in.value, name)) ||
+                   writes(node->for_in.body, name);
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                if (writes(node->block.statements[i], name)) return true;
+            }
+            return false;
+        default: return false;
+    }
+}
+
+// Calls that may remove array elements: pop/delete, and anything that can
+// run user code (which could call them on an alias)
+static bool mayShrinkArrays(Optimizer* o, Node* node) {
+    if (!node) return false;
+    switch (node->type) {
+        case NODE_EXPR_CALL: {
+            Node* callee = node->call.callee;
+            if (callee->type != NODE_EXPR_VAR || !isSafeBuiltin(o, callee->var.name)) return true;
+            Token name = callee->var.name;
+            if ((name.length == 3 && memcmp(name.start, "pop", 3) == 0) ||
+                (name.length == 6 && memcmp(name.start, "delete", 6) == 0)) {
+                return true;
+            }
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) {
+                if (mayShrinkArrays(o, arg)) return true;
+            }
+            return false;
+        }
+        case NODE_EXPR_BINARY: return mayShrinkArrays(o, node->binary.left) || mayShrinkArrays(o, node->binary.right);
+        case NODE_EXPR_UNARY: return mayShrinkArrays(o, node->unary.expr);
+        case NODE_EXPR_GET: return mayShrinkArrays(o, node->get.object);
+        case NODE_EXPR_INDEX: return mayShrinkArrays(o, node->index.target) || mayShrinkArrays(o, node->index.index);
+        case NODE_EXPR_INVARIANT: return mayShrinkArrays(o, node->invariant.expr);
+        case NODE_STMT_VAR_DECL: return mayShrinkArrays(o, node->var_decl.initializer);
+        case NODE_STMT_ASSIGN: return mayShrinkArrays(o, node->assign.value);
+        case NODE_STMT_INDEX_ASSIGN:
+            return mayShrinkArrays(o, node->index_assign.target) || mayShrinkArrays(o, node->index_assign.index) ||
+                   mayShrinkArrays(o, node->index_assign.value);
+        case NODE_STMT_PRINT: return mayShrinkArrays(o, node->print.expr);
+        case NODE_STMT_IF:
+            return mayShrinkArrays(o, node->if_stmt.condition) || mayShrinkArrays(o, node->if_stmt.thenBranch) ||
+                   mayShrinkArrays(o, node->if_stmt.elseBranch);
+        case NODE_STMT_WHILE: return mayShrinkArrays(o, node->while_stmt.condition) || mayShrinkArrays(o, node->while_stmt.body);
+        case NODE_STMT_FOR:
+            return mayShrinkArrays(o, node->for_stmt.initializer) || mayShrinkArrays(o, node->for_stmt.condition) ||
+                   mayShrinkArrays(o, node->for_stmt.increment) || mayShrinkArrays(o, node->for_stmt.body);
+        case NODE_STMT_FOR_IN: return mayShrinkArrays(o, node->for_in.iterable) || mayShrinkArrays(o, node->for_in.body);
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                if (mayShrinkArrays(o, node->block.statements[i])) return true;
+            }
+            return false;
+        case NODE_STMT_RETURN: return mayShrinkArrays(o, node->return_stmt.value);
+        case NODE_STMT_IMPORT: return true;
+        default: return false;
+    }
+}
+
+static void markInBounds(TypeState* ts, Node* node, Token array, Token index) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_EXPR_INDEX:
+            if (node->index.target->type == NODE_EXPR_VAR && sameName(node->index.target->var.name, array) &&
+                node->index.index->type == NODE_EXPR_VAR && sameName(node->index.index->var.name, index)) {
+                node->index.inBounds = true;
+                ts->bounds++;
+            }
+            markInBounds(ts, node->index.target, array, index);
+            markInBounds(ts, node->index.index, array, index);
+            break;
+        case NODE_EXPR_BINARY:
+            markInBounds(ts, node->binary.left, array, index);
+            markInBounds(ts, node->binary.right, array, index);
+            break;
+        case NODE_EXPR_UNARY: markInBounds(ts, node->unary.expr, array, index); break;
+        case NODE_EXPR_CALL:
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) markInBounds(ts, arg, array, index);
+            break;
+        case NODE_EXPR_GET: markInBounds(ts, node->get.object, array, index); break;
+        case NODE_STMT_VAR_DECL: markInBounds(ts, node->var_decl.initializer, array, index); break;
+        case NODE_STMT_ASSIGN: markInBounds(ts, node->assign.value, array, index); break;
+        case NODE_STMT_INDEX_ASSIGN:
+            markInBounds(ts, node->index_assign.target, array, index);
+            markInBounds(ts, node->index_assign.index, array, index);
+            markInBounds(ts, node->index_assign.value, array, index);
+            break;
+        case NODE_STMT_PRINT: markInBounds(ts, node->print.expr, array, index); break;
+        case NODE_STMT_IF:
+            markInBounds(ts, node->if_stmt.condition, array, index);
+            markInBounds(ts, node->if_stmt.thenBranch, array, index);
+            markInBounds(ts, node->if_stmt.elseBranch, array, index);
+            break;
+        case NODE_STMT_WHILE:
+            markInBounds(ts, node->while_stmt.condition, array, index);
+            markInBounds(ts, node->while_stmt.body, array, index);
+            break;
+        case NODE_STMT_FOR:
+            markInBounds(ts, node->for_stmt.initializer, array, index);
+            markInBounds(ts, node->for_stmt.condition, array, index);
+            markInBounds(ts, node->for_stmt.increment, array, index);
+            markInBounds(ts, node->for_stmt.body, array, index);
+            break;
+        case NODE_STMT_FOR_IN:
+            markInBounds(ts, node->for_in.iterable, array, index);
+            markInBounds(ts, node->for_in.body, array, index);
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) markInBounds(ts, node->block.statements[i], array, index);
+            break;
+        case NODE_STMT_RETURN: markInBounds(ts, node->return_stmt.value, array, index); break;
+        default: break;
+    }
+}
+
+// for (var i = <int >= 0>; i < length(a); i = i + <int > 0>) body
+// where the body writes neither i nor a and cannot shrink arrays: every
+// a[i] in the body is within bounds whenever a is an array.
+static void inferBounds(TypeState* ts, Node* loop) {
+    Node* init = loop->for_stmt.initializer;
+    Node* cond = loop->for_stmt.condition;
+    Node* incr = loop->for_stmt.increment;
+    if (!init || !cond || !incr || init->type != NODE_STMT_VAR_DECL) return;
+    Token index = init->var_decl.name;
+    LocalType* local = findLocalType(ts, index);
+    if (!local || local->type != TYPE_INT || nameSetHas(&ts->excluded, index)) return;
+    Node* start = init->var_decl.initializer;
+    if (!start || !isNumberLiteral(start) || start->literal.isFloat || start->literal.intValue < 0) return;
+
+    if (cond->type != NODE_EXPR_BINARY || cond->binary.op.type != TOKEN_LESS ||
+        cond->binary.left->type != NODE_EXPR_VAR || !sameName(cond->binary.left->var.name, index) ||
+        !isLengthCall(ts, cond->binary.right) || cond->binary.right->call.arguments->type != NODE_EXPR_VAR) {
+        return;
+    }
+    Token array = cond->binary.right->call.arguments->var.name;
+
+    if (incr->type != NODE_STMT_ASSIGN || !sameName(incr->assign.name, index)) return;
+    Node* step = incr->assign.value;
+    if (step->type != NODE_EXPR_BINARY || step->binary.op.type != TOKEN_PLUS ||
+        step->binary.left->type != NODE_EXPR_VAR || !sameName(step->binary.left->var.name, index) ||
+        !isNumberLiteral(step->binary.right) || step->binary.right->literal.isFloat ||
+        step->binary.right->literal.intValue <= 0) {
+        return;
+    }
+    if (writes(loop->for_stmt.body, index) || writes(loop->for_stmt.body, array) ||
+        mayShrinkArrays(ts->o, loop->for_stmt.body)) {
+        return;
+    }
+    int before = ts->bounds;
+    markInBounds(ts, loop->for_stmt.body, array, index);
+    if (ts->o->dump && ts->bounds > before) {
+        fprintf(stderr, "[opt] line %d: bounds checks removed for %.*s[%.*s]\n", nodeLine(loop),
+                array.length, array.start, index.length, index.start);
+    }
+}
+
+static void inferStmt(TypeState* ts, Node* node);
+
+static void inferNested(TypeState* ts, Node* node) {
+    int saved = ts->definite.count;
+    inferStmt(ts, node);
+    ts->definite.count = saved;
+}
+
+static void inferStmt(TypeState* ts, Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL:
+            // A declaration without initializer holds 0
+            recordWrite(ts, node->var_decl.name,
+                        node->var_decl.initializer ? inferExpr(ts, node->var_decl.initializer) : TYPE_INT);
+            nameSetAdd(&ts->definite, node->var_decl.name);
+            break;
+        case NODE_STMT_ASSIGN:
+            recordWrite(ts, node->assign.name, inferExpr(ts, node->assign.value));
+            break;
+        case NODE_STMT_INDEX_ASSIGN:
+            inferExpr(ts, node->index_assign.target);
+            inferExpr(ts, node->index_assign.index);
+            inferExpr(ts, node->index_assign.value);
+            break;
+        case NODE_STMT_PRINT:
+            inferExpr(ts, node->print.expr);
+            break;
+        case NODE_STMT_RETURN:
+            inferExpr(ts, node->return_stmt.value);
+            break;
+        case NODE_STMT_IF:
+            inferExpr(ts, node->if_stmt.condition);
+            inferNested(ts, node->if_stmt.thenBranch);
+            inferNested(ts, node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            inferExpr(ts, node->while_stmt.condition);
+            inferNested(ts, node->while_stmt.body);
+            break;
+        case NODE_STMT_FOR: {
+            int saved = ts->definite.count;
+            inferStmt(ts, node->for_stmt.initializer);
+            inferExpr(ts, node->for_stmt.condition);
+            inferNested(ts, node->for_stmt.body);
+            inferNested(ts, node->for_stmt.increment);
+            if (ts->annotate) inferBounds(ts, node);
+            ts->definite.count = saved;
+            break;
+        }
+        case NODE_STMT_FOR_IN:
+            inferExpr(ts, node->for_in.iterable);
+            inferNested(ts, node->for_in.body);
+            break;
+        case NODE_STMT_BLOCK: {
+            int saved = ts->definite.count;
+            for (int i = 0; i < node->block.count; i++) inferStmt(ts, node->block.statements[i]);
+            ts->definite.count = saved;
+            break;
+        }
+        case NODE_STMT_FUNCTION:
+        case NODE_STMT_IMPORT:
+            break;
+        default:
+            inferExpr(ts, node);
+            break;
+    }
+}
+
+// Infer the types of a function's locals (a fixpoint over all writes) and
+// annotate the expressions whose type is proven
+static void inferTypes(Optimizer* o, Node* function) {
+    TypeState ts;
+    memset(&ts, 0, sizeof(ts));
+    ts.o = o;
+    ts.function = function;
+    for (int i = 0; i < function->function.paramCount; i++) nameSetAdd(&ts.excluded, function->function.params[i]);
+    collectLocals(&ts, function->function.body);
+
+    // Types only move up (pending -> type -> any), so this terminates
+    do {
+        ts.changed = false;
+        ts.definite.count = 0;
+        inferStmt(&ts, function->function.body);
+    } while (ts.changed);
+    for (int i = 0; i < ts.count; i++) {
+        if (ts.locals[i].type == TYPE_PENDING) ts.locals[i].type = TYPE_ANY;
+    }
+    ts.annotate = true;
+    ts.definite.count = 0;
+    inferStmt(&ts, function->function.body);
+
+    if (o->dump && ts.typed > 0) {
+        char text[160];
+        TextBuffer out = {text, sizeof(text), 0};
+        static const char* const names[] = {"any", "int", "float", "bool"};
+        text[0] = '\0';
+        for (int i = 0; i < ts.count; i++) {
+            if (ts.locals[i].type == TYPE_ANY || nameSetHas(&ts.excluded, ts.locals[i].name)) continue;
+            if (out.length > 0) appendText(&out, ", ", 2);
+            appendToken(&out, ts.locals[i].name);
+            appendText(&out, ": ", 2);
+            appendText(&out, names[ts.locals[i].type], strlen(names[ts.locals[i].type]));
+        }
+        fprintf(stderr, "[opt] line %d: %.*s(): %d typed operations%s%s\n", function->function.name.line,
+                function->function.name.length, function->function.name.start, ts.typed,
+                out.length > 0 ? "; " : "", text);
+    }
+    o->typed += ts.typed;
+    o->bounds += ts.bounds;
+    free(ts.locals);
+    free(ts.definite.items);
+    free(ts.excluded.items);
+}
+
+// ---------------------------------------------------------------------------
+// Statements
+// ---------------------------------------------------------------------------
+
+static void optimizeStmt(Optimizer* o, Scope* scope, Node* node);
+
+// Optimize a nested statement; declarations inside it are not definitely
+// made afterwards
+static void optimizeNested(Optimizer* o, Scope* scope, Node* node) {
+    int saved = scope->locals.count;
+    optimizeStmt(o, scope, node);
+    scope->locals.count = saved;
+}
+
+// Cannot raise an error: literals and reads of definitely declared locals,
+// compared with == / != (equality is defined for every pair of types)
+static bool cannotFail(Scope* scope, Node* node) {
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: return true;
+        case NODE_EXPR_VAR: return scope->inFunction && nameSetHas(&scope->locals, node->var.name);
+        case NODE_EXPR_BINARY:
+            return (node->binary.op.type == TOKEN_EQUAL_EQUAL || node->binary.op.type == TOKEN_BANG_EQUAL) &&
+                   cannotFail(scope, node->binary.left) && cannotFail(scope, node->binary.right);
+        default: return false;
+    }
+}
+
+static bool isExpression(Node* node) {
+    return node->type <= NODE_EXPR_PARAM;
+}
+
+static void optimizeBlock(Optimizer* o, Scope* scope, Node* node) {
+    int saved = scope->locals.count;
+    int kept = 0;
+    for (int i = 0; i < node->block.count; i++) {
+        Node* stmt = node->block.statements[i];
+        optimizeStmt(o, scope, stmt);
+        if (o->level >= 2 && isExpression(stmt) && cannotFail(scope, stmt)) {
+            // Value computed and thrown away
+            o->unused++;
+            report(o, stmt, "removed unused", stmt, NULL);
+            freeAST(stmt);
+            continue;
+        }
+        if (stmt->type == NODE_STMT_BLOCK && stmt->block.count == 0) {
+            freeAST(stmt);   // left over from a removed statement
+            continue;
+        }
+        node->block.statements[kept++] = stmt;
+        if (stmt->type == NODE_STMT_VAR_DECL) nameSetAdd(&scope->locals, stmt->var_decl.name);
+        if (stmt->type == NODE_STMT_RETURN && i + 1 < node->block.count) {
+            int dropped = node->block.count - i - 1;
+            o->unreachable += dropped;
+            if (o->dump) {
+                fprintf(stderr, "[opt] line %d: removed %d unreachable statement%s after return\n",
+                        nodeLine(node->block.statements[i + 1]), dropped, dropped == 1 ? "" : "s");
+            }
+            for (int j = i + 1; j < node->block.count; j++) freeAST(node->block.statements[j]);
+            break;
+        }
+    }
+    node->block.count = kept;
+    scope->locals.count = saved;
+}
+
+// Remove local variables that are declared but never read or assigned,
+// when their initial values cannot fail
+static bool readsOrAssigns(Node* node, Token name) {
+    if (!node) return false;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: return false;
+        case NODE_EXPR_PARAM: return false;
+        case NODE_EXPR_VAR: return sameName(node->var.name, name);
+        case NODE_EXPR_BINARY: return readsOrAssigns(node->binary.left, name) || readsOrAssigns(node->binary.right, name);
+        case NODE_EXPR_UNARY: return readsOrAssigns(node->unary.expr, name);
+        case NODE_EXPR_CALL: {
+            if (readsOrAssigns(node->call.callee, name)) return true;
+            for (Node* arg = node->call.arguments; arg; arg = arg->next) {
+                if (readsOrAssigns(arg, name)) return true;
+            }
+            return false;
+        }
+        case NODE_EXPR_GET: return readsOrAssigns(node->get.object, name);
+        case NODE_EXPR_INDEX: return readsOrAssigns(node->index.target, name) || readsOrAssigns(node->index.index, name);
+        case NODE_EXPR_INVARIANT:
+            return sameName(node->invariant.slot, name) || readsOrAssigns(node->invariant.expr, name);
+        case NODE_STMT_VAR_DECL: return readsOrAssigns(node->var_decl.initializer, name);
+        case NODE_STMT_ASSIGN: return sameName(node->assign.name, name) || readsOrAssigns(node->assign.value, name);
+        case NODE_STMT_INDEX_ASSIGN:
+            return readsOrAssigns(node->index_assign.target, name) || readsOrAssigns(node->index_assign.index, name) ||
+                   readsOrAssigns(node->index_assign.value, name);
+        case NODE_STMT_PRINT: return readsOrAssigns(node->print.expr, name);
+        case NODE_STMT_IF:
+            return readsOrAssigns(node->if_stmt.condition, name) || readsOrAssigns(node->if_stmt.thenBranch, name) ||
+                   readsOrAssigns(node->if_stmt.elseBranch, name);
+        case NODE_STMT_WHILE: return readsOrAssigns(node->while_stmt.condition, name) || readsOrAssigns(node->while_stmt.body, name);
+        case NODE_STMT_FOR:
+            return readsOrAssigns(node->for_stmt.initializer, name) || readsOrAssigns(node->for_stmt.condition, name) ||
+                   readsOrAssigns(node->for_stmt.increment, name) || readsOrAssigns(node->for_stmt.body, name);
+        case NODE_STMT_FOR_IN:
+            return sameName(node->for_in.key, name) ||
+                   (node->for_in.value.length > 0 && sameName(node->for_in.value, name)) ||
+                   readsOrAssigns(node->for_in.iterable, name) || readsOrAssigns(node->for_in.body, name);
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                if (readsOrAssigns(node->block.statements[i], name)) return true;
+            }
+            return false;
+        case NODE_STMT_FUNCTION: return readsOrAssigns(node->function.body, name);
+        case NODE_STMT_RETURN: return readsOrAssigns(node->return_stmt.value, name);
+        case NODE_STMT_IMPORT: return sameName(node->import_stmt.alias, name);
+    }
+    return false;
+}
+
+// Drop `var name = <cannot fail>;` statements directly inside blocks of a
+// function whose variable is otherwise unused
+static void removeUnusedLocals(Optimizer* o, Scope* scope, Node* body, Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_STMT_BLOCK: {
+            int kept = 0;
+            for (int i = 0; i < node->block.count; i++) {
+                Node* stmt = node->block.statements[i];
+                if (stmt->type == NODE_STMT_VAR_DECL &&
+                    (!stmt->var_decl.initializer || cannotFail(scope, stmt->var_decl.initializer)) &&
+                    stmt->var_decl.name.start[0] != '$' && !readsOrAssigns(body, stmt->var_decl.name)) {
+                    o->unused++;
+                    Node name = {.type = NODE_EXPR_VAR, .var = {stmt->var_decl.name}};
+                    report(o, stmt, "removed unused variable", &name, NULL);
+                    freeAST(stmt);
+                    continue;
+                }
+                removeUnusedLocals(o, scope, body, stmt);
+                node->block.statements[kept++] = stmt;
+            }
+            node->block.count = kept;
+            break;
+        }
+        case NODE_STMT_IF:
+            removeUnusedLocals(o, scope, body, node->if_stmt.thenBranch);
+            removeUnusedLocals(o, scope, body, node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            removeUnusedLocals(o, scope, body, node->while_stmt.body);
+            break;
+        case NODE_STMT_FOR:
+            removeUnusedLocals(o, scope, body, node->for_stmt.body);
+            break;
+        case NODE_STMT_FOR_IN:
+            removeUnusedLocals(o, scope, body, node->for_in.body);
+            break;
+        default:
+            break;
+    }
+}
+
+static void optimizeFunction(Optimizer* o, Node* node) {
+    Scope scope = {true, {NULL, 0, 0}, 0};
+    for (int i = 0; i < node->function.paramCount; i++) nameSetAdd(&scope.locals, node->function.params[i]);
+    optimizeStmt(o, &scope, node->function.body);
+    if (o->level >= 2) {
+        // Only parameters count as definitely declared here
+        scope.locals.count = node->function.paramCount;
+        removeUnusedLocals(o, &scope, node->function.body, node->function.body);
+    }
+    inferTypes(o, node);
+    free(scope.locals.items);
+}
+
+static void optimizeStmt(Optimizer* o, Scope* scope, Node* node) {
+    if (!node) return;
+    bool truth;
+    switch (node->type) {
+        case NODE_STMT_VAR_DECL:
+            optimizeExpr(o, node->var_decl.initializer);
+            break;
+        case NODE_STMT_ASSIGN:
+            optimizeExpr(o, node->assign.value);
+            break;
+        case NODE_STMT_INDEX_ASSIGN:
+            optimizeExpr(o, node->index_assign.target);
+            optimizeExpr(o, node->index_assign.index);
+            optimizeExpr(o, node->index_assign.value);
+            break;
+        case NODE_STMT_PRINT:
+            optimizeExpr(o, node->print.expr);
+            break;
+        case NODE_STMT_RETURN:
+            optimizeExpr(o, node->return_stmt.value);
+            break;
+        case NODE_STMT_IF:
+            optimizeExpr(o, node->if_stmt.condition);
+            if (constTruth(node->if_stmt.condition, &truth)) {
+                Node* taken = truth ? node->if_stmt.thenBranch : node->if_stmt.elseBranch;
+                Node* dropped = truth ? node->if_stmt.elseBranch : node->if_stmt.thenBranch;
+                o->branches++;
+                report(o, node, truth ? "condition always true:" : "condition always false:",
+                       node->if_stmt.condition, dropped ? ", removed the other branch" : "");
+                freeAST(node->if_stmt.condition);
+                freeAST(dropped);
+                if (taken) {
+                    replaceWith(node, taken);
+                    optimizeNested(o, scope, node);
+                } else {
+                    makeEmpty(node);
+                }
+                break;
+            }
+            optimizeNested(o, scope, node->if_stmt.thenBranch);
+            optimizeNested(o, scope, node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            optimizeExpr(o, node->while_stmt.condition);
+            if (constTruth(node->while_stmt.condition, &truth) && !truth) {
+                o->branches++;
+                report(o, node, "removed loop that never runs:", node->while_stmt.condition, NULL);
+                freeAST(node->while_stmt.condition);
+                freeAST(node->while_stmt.body);
+                makeEmpty(node);
+                break;
+            }
+            optimizeNested(o, scope, node->while_stmt.body);
+            if (o->level >= 2) hoistLoop(o, scope, node);
+            break;
+        case NODE_STMT_FOR: {
+            int saved = scope->locals.count;
+            optimizeStmt(o, scope, node->for_stmt.initializer);
+            if (node->for_stmt.initializer && node->for_stmt.initializer->type == NODE_STMT_VAR_DECL) {
+                nameSetAdd(&scope->locals, node->for_stmt.initializer->var_decl.name);
+            }
+            optimizeExpr(o, node->for_stmt.condition);
+            if (constTruth(node->for_stmt.condition, &truth) && !truth) {
+                // Only the initializer runs
+                o->branches++;
+                report(o, node, "removed loop that never runs:", node->for_stmt.condition, NULL);
+                Node* init = node->for_stmt.initializer;
+                freeAST(node->for_stmt.condition);
+                freeAST(node->for_stmt.increment);
+                freeAST(node->for_stmt.body);
+                if (init) replaceWith(node, init); else makeEmpty(node);
+                scope->locals.count = saved;
+                break;
+            }
+            optimizeNested(o, scope, node->for_stmt.increment);
+            optimizeNested(o, scope, node->for_stmt.body);
+            node->for_stmt.counted = countedLoop(o, scope, node);
+            scope->locals.count = saved;
+            if (node->for_stmt.counted) {
+                o->counted++;
+                report(o, node, "counted loop over", node->for_stmt.condition->binary.left, NULL);
+            } else if (o->level >= 2) {
+                hoistLoop(o, scope, node);
+            }
+            break;
+        }
+        case NODE_STMT_FOR_IN: {
+            int saved = scope->locals.count;
+            optimizeExpr(o, node->for_in.iterable);
+            nameSetAdd(&scope->locals, node->for_in.key);
+            if (node->for_in.value.length > 0) nameSetAdd(&scope->locals, node->for_in.value);
+            optimizeNested(o, scope, node->for_in.body);
+            scope->locals.count = saved;
+            break;
+        }
+        case NODE_STMT_BLOCK:
+            optimizeBlock(o, scope, node);
+            break;
+        case NODE_STMT_FUNCTION:
+            optimizeFunction(o, node);
+            break;
+        case NODE_STMT_IMPORT:
+            break;
+        default:
+            // Expression statement
+            optimizeExpr(o, node);
+            break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Inlining
+// ---------------------------------------------------------------------------
+
+static int paramIndex(Node* function, Token name) {
+    for (int i = 0; i < function->function.paramCount; i++) {
+        if (sameName(function->function.params[i], name)) return i;
+    }
+    return -1;
+}
+
+// Leaf expression over the parameters: no calls (the callee would resolve
+// names in the function's module) and no other variables (they would
+// resolve in the caller's scope)
+static bool inlinable(Node* function, Node* node, int* budget) {
+    if (!node || --*budget < 0) return false;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL: return true;
+        case NODE_EXPR_VAR: return paramIndex(function, node->var.name) >= 0;
+        case NODE_EXPR_UNARY: return inlinable(function, node->unary.expr, budget);
+        case NODE_EXPR_BINARY:
+            return inlinable(function, node->binary.left, budget) && inlinable(function, node->binary.right, budget);
+        case NODE_EXPR_GET: return inlinable(function, node->get.object, budget);
+        case NODE_EXPR_INDEX:
+            return inlinable(function, node->index.target, budget) && inlinable(function, node->index.index, budget);
+        default: return false;
+    }
+}
+
+// Copy of an inlinable expression with parameters turned into argument reads
+static Node* cloneInline(Node* function, Node* node) {
+    Node* copy = newNode(node->type);
+    *copy = *node;
+    copy->next = NULL;
+    switch (node->type) {
+        case NODE_EXPR_VAR:
+            copy->type = NODE_EXPR_PARAM;
+            copy->param.name = node->var.name;
+            copy->param.index = paramIndex(function, node->var.name);
+            break;
+        case NODE_EXPR_UNARY:
+            copy->unary.expr = cloneInline(function, node->unary.expr);
+            break;
+        case NODE_EXPR_BINARY:
+            copy->binary.left = cloneInline(function, node->binary.left);
+            copy->binary.right = cloneInline(function, node->binary.right);
+            copy->binary.quick = BIN_UNSEEN;
+            copy->binary.deopts = 0;
+            break;
+        case NODE_EXPR_GET:
+            copy->get.object = cloneInline(function, node->get.object);
+            break;
+        case NODE_EXPR_INDEX:
+            copy->index.target = cloneInline(function, node->index.target);
+            copy->index.index = cloneInline(function, node->index.index);
+            break;
+        default:
+            break;
+    }
+    return copy;
+}
+
+Node* inlineBody(Node* function, bool dump) {
+    Node* body = function->function.body;
+    if (!body || body->type != NODE_STMT_BLOCK || body->block.count != 1) return NULL;
+    Node* ret = body->block.statements[0];
+    if (ret->type != NODE_STMT_RETURN || !ret->return_stmt.value) return NULL;
+    int budget = INLINE_MAX_NODES;
+    if (!inlinable(function, ret->return_stmt.value, &budget)) return NULL;
+
+    Node* expr = cloneInline(function, ret->return_stmt.value);
+    if (dump) {
+        char text[160];
+        TextBuffer out = {text, sizeof(text), 0};
+        text[0] = '\0';
+        formatExpr(&out, expr);
+        fprintf(stderr, "[opt] line %d: %.*s() will be inlined as %s\n", function->function.name.line,
+                function->function.name.length, function->function.name.start, text);
+    }
+    return expr;
+}
+
+static void collectFunctions(Node* node, NameSet* names) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_STMT_FUNCTION:
+            nameSetAdd(names, node->function.name);
+            collectFunctions(node->function.body, names);
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) collectFunctions(node->block.statements[i], names);
+            break;
+        case NODE_STMT_IF:
+            collectFunctions(node->if_stmt.thenBranch, names);
+            collectFunctions(node->if_stmt.elseBranch, names);
+            break;
+        case NODE_STMT_WHILE:
+            collectFunctions(node->while_stmt.body, names);
+            break;
+        case NODE_STMT_FOR:
+            collectFunctions(node->for_stmt.body, names);
+            break;
+        case NODE_STMT_FOR_IN:
+            collectFunctions(node->for_in.body, names);
+            break;
+        default:
+            break;
+    }
+}
+
+void optimize(Node* ast, int level, bool dump) {
+    if (!ast || level <= 0) return;
+    Optimizer o;
+    memset(&o, 0, sizeof(o));
+    o.level = level > OPT_LEVEL_MAX ? OPT_LEVEL_MAX : level;
+    o.dump = dump;
+    collectFunctions(ast, &o.functions);
+
+    Scope top = {false, {NULL, 0, 0}, 0};
+    optimizeStmt(&o, &top, ast);
+    free(top.locals.items);
+    free(o.functions.items);
+
+    if (dump) {
+        fprintf(stderr, "[opt] -O%d: %d folded, %d branches/loops removed, %d unreachable statements removed, "
+                "%d invariants hoisted, %d unused computations removed, %d typed operations, "
+                "%d bounds checks removed, %d counted loops, %d concatenations fused\n",
+                o.level, o.folded, o.branches, o.unreachable, o.hoisted, o.unused, o.typed, o.bounds, o.counted,
+                o.concats);
+    }
+}
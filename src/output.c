@@ -0,0 +1,112 @@
+#include "output.h"
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+static char buffer[OUTPUT_BUFFER_SIZE];
+static size_t bufferLength = 0;
+static bool initialized = false;
+static bool lineBuffered = false;
+// stdout is shared by every VM in the process
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Lazily pick the buffering mode and make sure output is flushed at exit
+static void ensureInit(void) {
+    if (initialized) return;
+    initialized = true;
+    lineBuffered = isatty(STDOUT_FILENO);
+    atexit(outFlush);
+}
+
+void outInit(bool unbuffered) {
+    pthread_mutex_lock(&outputLock);
+    ensureInit();
+    if (unbuffered) lineBuffered = true;
+    pthread_mutex_unlock(&outputLock);
+}
+
+// Write all bytes to stdout, retrying on partial writes
+static void writeAll(const char* chars, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(STDOUT_FILENO, chars, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return; // stdout closed: drop output like stdio would
+        }
+        chars += n;
+        length -= (size_t)n;
+    }
+}
+
+// Write out the buffer; caller holds outputLock
+static void flushLocked(void) {
+    if (bufferLength > 0) {
+        writeAll(buffer, bufferLength);
+        bufferLength = 0;
+    }
+}
+
+void outFlush(void) {
+    pthread_mutex_lock(&outputLock);
+    flushLocked();
+    pthread_mutex_unlock(&outputLock);
+}
+
+void outWrite(const char* chars, size_t length) {
+    pthread_mutex_lock(&outputLock);
+    ensureInit();
+    if (bufferLength + length > OUTPUT_BUFFER_SIZE) {
+        flushLocked();
+    }
+    if (length >= OUTPUT_BUFFER_SIZE) {
+        // Large writes bypass the buffer
+        writeAll(chars, length);
+    } else {
+        memcpy(buffer + bufferLength, chars, length);
+        bufferLength += length;
+    }
+    pthread_mutex_unlock(&outputLock);
+}
+
+void outString(const char* s) {
+    outWrite(s, strlen(s));
+}
+
+void outChar(char c) {
+    outWrite(&c, 1);
+}
+
+void outEndPrint(void) {
+    pthread_mutex_lock(&outputLock);
+    if (lineBuffered) flushLocked();
+    pthread_mutex_unlock(&outputLock);
+}
+
+int formatInt(char* buf, int value) {
+    char digits[12];
+    int n = 0;
+    // Work in unsigned so INT_MIN does not overflow
+    unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    int length = 0;
+    if (value < 0) buf[length++] = '-';
+    while (n > 0) buf[length++] = digits[--n];
+    buf[length] = '\0';
+    return length;
+}
+
+int formatDouble(char* buf, double value) {
+    // Integral values below 1e6 print as plain integers under %.6g
+    if (value > -1e6 && value < 1e6 && value == (double)(int)value) {
+        if (value == 0.0 && signbit(value)) {
+            strcpy(buf, "-0");
+            return 2;
+        }
+        return formatInt(buf, (int)value);
+    }
+    return snprintf(buf, FORMAT_NUMBER_MAX, "%.6g", value);
+}
@@ -0,0 +1,283 @@
+#include "parallel.h"
+#include "pattern.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// Chunks per worker: enough slack for stealing to even out uneven tasks
+#define CHUNKS_PER_WORKER 8
+// Most worker threads started for one call
+#define PARALLEL_MAX_THREADS 256
+
+typedef enum {
+    TASK_MAP,
+    TASK_FOR,
+    TASK_REDUCE
+} TaskKind;
+
+// Range of chunk indices owned by one worker. The owner takes chunks from
+// the front; thieves take them from the back.
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} ChunkQueue;
+
+typedef struct {
+    TaskKind kind;
+    Function* fn;
+    Value* items;           // map/reduce input
+    int start;              // for: first index
+    int count;              // number of elements (or indices)
+    int chunkSize;
+    int chunkCount;
+    Value* results;         // map: one per element; reduce: one per chunk
+    ChunkQueue* queues;
+    int workerCount;
+    atomic_bool failed;
+    pthread_mutex_t errorLock;
+    char message[256];      // first error
+    int line;
+} ParallelJob;
+
+typedef struct {
+    ParallelJob* job;
+    int id;
+    VM* vm;
+    pthread_t thread;
+} Worker;
+
+// Elements are passed as they are, strings included: worker VMs never free
+// strings and cannot assign globals, so tasks can share them with each
+// other and with the caller.
+static void runChunk(VM* vm, ParallelJob* job, int chunk) {
+    int lo = chunk * job->chunkSize;
+    int hi = lo + job->chunkSize;
+    if (hi > job->count) hi = job->count;
+    switch (job->kind) {
+        case TASK_MAP:
+            for (int i = lo; i < hi; i++) {
+                job->results[i] = vmCallFunction(vm, job->fn, &job->items[i], 1);
+            }
+            break;
+        case TASK_FOR:
+            for (int i = lo; i < hi; i++) {
+                Value arg = INT_VAL(job->start + i);
+                vmCallFunction(vm, job->fn, &arg, 1);
+            }
+            break;
+        case TASK_REDUCE: {
+            Value acc = job->items[lo];
+            for (int i = lo + 1; i < hi; i++) {
+                Value pair[2] = {acc, job->items[i]};
+                acc = vmCallFunction(vm, job->fn, pair, 2);
+            }
+            job->results[chunk] = acc;
+            break;
+        }
+    }
+}
+
+// Next chunk for a worker: its own queue first, then steal; -1 when done
+static int takeChunk(ParallelJob* job, int id) {
+    ChunkQueue* own = &job->queues[id];
+    int chunk = -1;
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end) chunk = own->next++;
+    pthread_mutex_unlock(&own->lock);
+    for (int i = 1; chunk < 0 && i < job->workerCount; i++) {
+        ChunkQueue* victim = &job->queues[(id + i) % job->workerCount];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next < victim->end) chunk = --victim->end;
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return chunk;
+}
+
+static void* workerMain(void* arg) {
+    Worker* worker = arg;
+    ParallelJob* job = worker->job;
+    ErrorContext ctx;
+    if (setjmp(ctx.jump) != 0) {
+        popErrorContext(&ctx);
+        // Keep the first error and stop everyone else
+        pthread_mutex_lock(&job->errorLock);
+        if (!atomic_load(&job->failed)) {
+            snprintf(job->message, sizeof(job->message), "%s", ctx.message);
+            job->line = ctx.line;
+            atomic_store(&job->failed, true);
+        }
+        pthread_mutex_unlock(&job->errorLock);
+        return NULL;
+    }
+    pushErrorContext(&ctx);
+    int chunk;
+    while (!atomic_load(&job->failed) && (chunk = takeChunk(job, worker->id)) >= 0) {
+        runChunk(worker->vm, job, chunk);
+    }
+    popErrorContext(&ctx);
+    return NULL;
+}
+
+static int threadCount(void) {
+    const char* env = getenv(PARALLEL_THREADS_ENV);
+    long n = env ? strtol(env, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > PARALLEL_MAX_THREADS) n = PARALLEL_MAX_THREADS;
+    return (int)n;
+}
+
+// Run every chunk of the job, in parallel when there is more than one
+// worker, and raise the first task error on the calling thread
+static void runJob(VM* vm, ParallelJob* job, int line) {
+    int workers = threadCount();
+    if (workers > job->chunkCount) workers = job->chunkCount;
+    if (vm->parallelWorker) {
+        // Nested parallel calls run inline on their worker
+        for (int c = 0; c < job->chunkCount; c++) runChunk(vm, job, c);
+        return;
+    }
+    if (workers <= 1) {
+        // Still on a worker VM, so tasks follow the same rules on one core
+        VM solo;
+        vmInitWorker(&solo, vm);
+        for (int c = 0; c < job->chunkCount; c++) runChunk(&solo, job, c);
+        freePatternCache(solo.patterns);
+        return;
+    }
+
+    // Hot code will run on every worker: compile it once up front
+    Function* fn = job->fn;
+    if (vm->jitEnabled && !fn->jit && !fn->jitFailed) {
+        fn->jit = jitCompile(fn->name, fn->params, fn->paramCount, fn->body);
+        if (!fn->jit) fn->jitFailed = true;
+    }
+
+    job->workerCount = workers;
+    job->queues = malloc(sizeof(ChunkQueue) * workers);
+    Worker* pool = malloc(sizeof(Worker) * workers);
+    VM* vms = malloc(sizeof(VM) * workers);
+    if (!job->queues || !pool || !vms) error("Memory allocation failed.", line);
+    atomic_init(&job->failed, false);
+    pthread_mutex_init(&job->errorLock, NULL);
+
+    // Deal out contiguous runs of chunks so neighbours stay on one core
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_init(&job->queues[w].lock, NULL);
+        job->queues[w].next = (int)((long)job->chunkCount * w / workers);
+        job->queues[w].end = (int)((long)job->chunkCount * (w + 1) / workers);
+        vmInitWorker(&vms[w], vm);
+        pool[w].job = job;
+        pool[w].id = w;
+        pool[w].vm = &vms[w];
+    }
+    // The calling thread is worker 0
+    int started = 1;
+    for (int w = 1; w < workers; w++) {
+        if (pthread_create(&pool[w].thread, NULL, workerMain, &pool[w]) != 0) break;
+        started++;
+    }
+    workerMain(&pool[0]);
+    for (int w = 1; w < started; w++) pthread_join(pool[w].thread, NULL);
+    // Chunks of threads that could not be started are stolen by the others,
+    // so everything has run unless a task failed.
+
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_destroy(&job->queues[w].lock);
+        freePatternCache(vms[w].patterns);
+    }
+    pthread_mutex_destroy(&job->errorLock);
+    free(job->queues);
+    free(pool);
+    free(vms);
+    if (atomic_load(&job->failed)) {
+        free(job->results);
+        error(job->message, job->line);
+    }
+}
+
+// Look up the function named by a built-in argument
+static Function* taskFunction(VM* vm, Value name, int paramCount, const char* builtin, int line) {
+    char message[128];
+    if (!IS_STRING(name)) {
+        snprintf(message, sizeof(message), "%s expects a function name string.", builtin);
+        error(message, line);
+    }
+    Function* fn = vmFindFunction(vm, AS_STRING(name));
+    if (!fn) error("Undefined function.", line);
+    if (fn->paramCount != paramCount) {
+        snprintf(message, sizeof(message), "%s function must take %d argument%s.",
+                 builtin, paramCount, paramCount == 1 ? "" : "s");
+        error(message, line);
+    }
+    return fn;
+}
+
+static void initJob(ParallelJob* job, TaskKind kind, Function* fn, int count) {
+    memset(job, 0, sizeof(*job));
+    job->kind = kind;
+    job->fn = fn;
+    job->count = count;
+    int target = threadCount() * CHUNKS_PER_WORKER;
+    job->chunkSize = (count + target - 1) / target;
+    if (job->chunkSize < 1) job->chunkSize = 1;
+    job->chunkCount = (count + job->chunkSize - 1) / job->chunkSize;
+}
+
+Value parallelMap(VM* vm, Value* args, int argc, int line) {
+    if (argc != 2 || !IS_ARRAY(args[0])) error("parallelMap(arr, fn) expects an array and a function name.", line);
+    Function* fn = taskFunction(vm, args[1], 1, "parallelMap", line);
+    Array* input = AS_ARRAY(args[0]);
+    ParallelJob job;
+    initJob(&job, TASK_MAP, fn, input->count);
+    job.items = input->items;
+    job.results = malloc(sizeof(Value) * (input->count > 0 ? input->count : 1));
+    if (!job.results) error("Memory allocation failed.", line);
+    runJob(vm, &job, line);
+
+    Array* output = malloc(sizeof(Array));
+    if (!output) error("Memory allocation failed.", line);
+    output->items = job.results;
+    output->count = input->count;
+    output->capacity = input->count > 0 ? input->count : 1;
+    return ARRAY_VAL(output);
+}
+
+Value parallelFor(VM* vm, Value* args, int argc, int line) {
+    if (argc != 3 || !IS_INT(args[0]) || !IS_INT(args[1])) {
+        error("parallelFor(start, end, fn) expects two ints and a function name.", line);
+    }
+    Function* fn = taskFunction(vm, args[2], 1, "parallelFor", line);
+    int start = AS_INT(args[0]);
+    int end = AS_INT(args[1]);
+    if (end <= start) return INT_VAL(0);
+    ParallelJob job;
+    initJob(&job, TASK_FOR, fn, end - start);
+    job.start = start;
+    runJob(vm, &job, line);
+    return INT_VAL(0);
+}
+
+Value parallelReduce(VM* vm, Value* args, int argc, int line) {
+    if (argc != 3 || !IS_ARRAY(args[0])) {
+        error("parallelReduce(arr, fn, init) expects an array, a function name and an initial value.", line);
+    }
+    Function* fn = taskFunction(vm, args[1], 2, "parallelReduce", line);
+    Array* input = AS_ARRAY(args[0]);
+    Value acc = args[2];
+    if (input->count == 0) return acc;
+    ParallelJob job;
+    initJob(&job, TASK_REDUCE, fn, input->count);
+    job.items = input->items;
+    job.results = malloc(sizeof(Value) * job.chunkCount);
+    if (!job.results) error("Memory allocation failed.", line);
+    runJob(vm, &job, line);
+
+    // Merge chunk results in order
+    for (int c = 0; c < job.chunkCount; c++) {
+        Value pair[2] = {acc, job.results[c]};
+        acc = vmCallFunction(vm, fn, pair, 2);
+    }
+    free(job.results);
+    return acc;
+}
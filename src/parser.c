@@ -1,11 +1,44 @@
 #include "parser.h"
 
+// Initialize parser
+void initParser(Parser* parser) {
+    parser->tokens = malloc(64 * sizeof(Token));  // Start with 64 tokens
+    if (!parser->tokens) {
+        error("Memory allocation failed.", 0);
+    }
+    parser->current = 0;
+    parser->count = 0;
+    parser->capacity = 64;
+}
+
+// Free parser resources
+void freeParser(Parser* parser) {
+    if (parser->tokens) {
+        free(parser->tokens);
+        parser->tokens = NULL;
+    }
+}
+
+// Add token to parser (grows array as needed)
+void addToken(Parser* parser, Token token) {
+    // Grow array if needed
+    if (parser->count >= parser->capacity) {
+        parser->capacity *= 2;
+        parser->tokens = realloc(parser->tokens, parser->capacity * sizeof(Token));
+        if (!parser->tokens) {
+            error("Memory allocation failed.", token.line);
+        }
+    }
+    
+    parser->tokens[parser->count++] = token;
+}
+
 // Helper to advance parser
 static Token advance(Parser* parser) {
     if (parser->current < parser->count) {
         return parser->tokens[parser->current++];
     }
-    return (Token){TOKEN_EOF, NULL, 0, 0};
+    return (Token){TOKEN_EOF, NULL, 0, 0, 0};
 }
 
 // Check current token type
@@ -27,7 +60,7 @@ static bool match(Parser* parser, TokenType type) {
 static Token consume(Parser* parser, TokenType type, const char* message) {
     if (check(parser, type)) return advance(parser);
     error(message, parser->tokens[parser->current].line);
-    return (Token){TOKEN_EOF, NULL, 0, 0};
+    return (Token){TOKEN_EOF, NULL, 0, 0, 0};
 }
 
 // Forward declarations for recursive parsing
@@ -41,15 +74,31 @@ static Node* finishPostfix(Parser* parser, Node* expr);
 // Parse primary (literals, vars, groups)
 static Node* primary(Parser* parser) {
     if (match(parser, TOKEN_NUMBER) || match(parser, TOKEN_STRING)) {
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
         node->next = NULL;
         node->type = NODE_EXPR_LITERAL;
         node->literal.token = parser->tokens[parser->current - 1];
+        node->literal.isFloat = false;
+        node->literal.intValue = 0;
+        node->literal.floatValue = 0.0;
+        if (node->literal.token.type == TOKEN_NUMBER) {
+            // Parse numbers once here instead of on every evaluation
+            Token t = node->literal.token;
+            char* str = strndup(t.start, t.length);
+            if (!str) error("Memory allocation failed.", t.line);
+            if (memchr(t.start, '.', t.length)) {
+                node->literal.isFloat = true;
+                node->literal.floatValue = atof(str);
+            } else {
+                node->literal.intValue = atoi(str);
+            }
+            free(str);
+        }
         return node;
     }
     if (match(parser, TOKEN_IDENTIFIER)) {
         // Variable reference base
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
         node->next = NULL;
         node->type = NODE_EXPR_VAR;
         node->var.name = parser->tokens[parser->current - 1];
@@ -69,7 +118,7 @@ static Node* unary(Parser* parser) {
     if (match(parser, TOKEN_MINUS) || match(parser, TOKEN_PLUS)) {
         Token op = parser->tokens[parser->current - 1];
         Node* expr = unary(parser);
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
         node->next = NULL;
         node->type = NODE_EXPR_UNARY;
         node->unary.op = op;
@@ -83,12 +132,13 @@ static Node* unary(Parser* parser) {
 static Node* finishPostfix(Parser* parser, Node* expr) {
     for (;;) {
         if (match(parser, TOKEN_LEFT_PAREN)) {
-            Node* call = malloc(sizeof(Node));
+            Node* call = calloc(1, sizeof(Node));
             call->next = NULL;
             call->type = NODE_EXPR_CALL;
             call->call.callee = expr;
             call->call.arguments = NULL;
             call->call.argumentCount = 0;
+            call->call.inlined = false;
 
             if (!check(parser, TOKEN_RIGHT_PAREN)) {
                 Node** currentArg = &call->call.arguments;
@@ -102,7 +152,7 @@ static Node* finishPostfix(Parser* parser, Node* expr) {
             expr = call;
         } else if (match(parser, TOKEN_DOT)) {
             Token name = consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
-            Node* get = malloc(sizeof(Node));
+            Node* get = calloc(1, sizeof(Node));
             get->next = NULL;
             get->type = NODE_EXPR_GET;
             get->get.object = expr;
@@ -110,12 +160,13 @@ static Node* finishPostfix(Parser* parser, Node* expr) {
             expr = get;
         } else if (match(parser, TOKEN_LEFT_BRACKET)) {
             Node* indexExpr = expression(parser);
-            consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index expression.");
-            Node* idx = malloc(sizeof(Node));
+            Token bracket = consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index expression.");
+            Node* idx = calloc(1, sizeof(Node));
             idx->next = NULL;
             idx->type = NODE_EXPR_INDEX;
             idx->index.target = expr;
             idx->index.index = indexExpr;
+            idx->index.bracket = bracket;
             expr = idx;
         } else {
             break;
@@ -130,12 +181,14 @@ static Node* factor(Parser* parser) {
     while (match(parser, TOKEN_STAR) || match(parser, TOKEN_SLASH) || match(parser, TOKEN_PERCENT)) {
         Token op = parser->tokens[parser->current - 1];
         Node* right = unary(parser);
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
         node->next = NULL;
         node->type = NODE_EXPR_BINARY;
         node->binary.left = expr;
         node->binary.op = op;
         node->binary.right = right;
+        node->binary.quick = BIN_UNSEEN;
+        node->binary.deopts = 0;
         expr = node;
     }
     return expr;
@@ -147,11 +200,14 @@ static Node* term(Parser* parser) {
     while (match(parser, TOKEN_PLUS) || match(parser, TOKEN_MINUS)) {
         Token op = parser->tokens[parser->current - 1];
         Node* right = factor(parser);
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
+        node->next = NULL;
         node->type = NODE_EXPR_BINARY;
         node->binary.left = expr;
         node->binary.op = op;
         node->binary.right = right;
+        node->binary.quick = BIN_UNSEEN;
+        node->binary.deopts = 0;
         expr = node;
     }
     return expr;
@@ -164,11 +220,14 @@ static Node* comparison(Parser* parser) {
            match(parser, TOKEN_LESS) || match(parser, TOKEN_LESS_EQUAL)) {
         Token op = parser->tokens[parser->current - 1];
         Node* right = term(parser);
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
+        node->next = NULL;
         node->type = NODE_EXPR_BINARY;
         node->binary.left = expr;
         node->binary.op = op;
         node->binary.right = right;
+        node->binary.quick = BIN_UNSEEN;
+        node->binary.deopts = 0;
         expr = node;
     }
     return expr;
@@ -180,11 +239,14 @@ static Node* equality(Parser* parser) {
     while (match(parser, TOKEN_EQUAL_EQUAL) || match(parser, TOKEN_BANG_EQUAL)) {
         Token op = parser->tokens[parser->current - 1];
         Node* right = comparison(parser);
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
+        node->next = NULL;
         node->type = NODE_EXPR_BINARY;
         node->binary.left = expr;
         node->binary.op = op;
         node->binary.right = right;
+        node->binary.quick = BIN_UNSEEN;
+        node->binary.deopts = 0;
         expr = node;
     }
     return expr;
@@ -197,19 +259,20 @@ static Node* assignment(Parser* parser) {
         Token equals = parser->tokens[parser->current - 1];
         Node* value = assignment(parser); // Right-assoc
         if (expr->type == NODE_EXPR_VAR) {
-            Node* node = malloc(sizeof(Node));
+            Node* node = calloc(1, sizeof(Node));
             node->next = NULL;
             node->type = NODE_STMT_ASSIGN;
             node->assign.name = expr->var.name;
             node->assign.value = value;
             return node;
         } else if (expr->type == NODE_EXPR_INDEX) {
-            Node* node = malloc(sizeof(Node));
+            Node* node = calloc(1, sizeof(Node));
             node->next = NULL;
             node->type = NODE_STMT_INDEX_ASSIGN;
             node->index_assign.target = expr->index.target;
             node->index_assign.index = expr->index.index;
             node->index_assign.value = value;
+            node->index_assign.bracket = expr->index.bracket;
             return node;
         }
         error("Invalid assignment target.", equals.line);
@@ -224,7 +287,7 @@ static Node* expression(Parser* parser) {
 
 // Block { ... }
 static Node* block(Parser* parser) {
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_BLOCK;
     node->block.statements = malloc(8 * sizeof(Node*));
@@ -249,7 +312,7 @@ static Node* function(Parser* parser) {
     Token name = consume(parser, TOKEN_IDENTIFIER, "Expect function name.");
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_FUNCTION;
     node->function.name = name;
@@ -284,7 +347,7 @@ static Node* varDeclaration(Parser* parser) {
 
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_VAR_DECL;
     node->var_decl.name = name;
@@ -297,7 +360,7 @@ static Node* printStatement(Parser* parser) {
     Node* expr = expression(parser);
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after print value.");
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_PRINT;
     node->print.expr = expr;
@@ -312,7 +375,7 @@ static Node* returnStatement(Parser* parser) {
     }
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_RETURN;
     node->return_stmt.value = value;
@@ -331,7 +394,7 @@ static Node* ifStatement(Parser* parser) {
         elseBranch = statement(parser);
     }
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_IF;
     node->if_stmt.condition = condition;
@@ -347,7 +410,7 @@ static Node* whileStatement(Parser* parser) {
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
     Node* body = statement(parser);
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_WHILE;
     node->while_stmt.condition = condition;
@@ -356,8 +419,39 @@ static Node* whileStatement(Parser* parser) {
 }
 
 // For statement
+// Whether the token at index i is the word "in" (contextual: it stays
+// usable as a variable or function name elsewhere)
+static bool isInWord(Parser* parser, int i) {
+    if (i >= parser->count) return false;
+    Token token = parser->tokens[i];
+    return token.type == TOKEN_IDENTIFIER && token.length == 2 && memcmp(token.start, "in", 2) == 0;
+}
+
+// For-in loop after "for (": name [, name] in expression ) statement
+static Node* forInStatement(Parser* parser) {
+    Node* node = calloc(1, sizeof(Node));
+    node->type = NODE_STMT_FOR_IN;
+    node->for_in.key = consume(parser, TOKEN_IDENTIFIER, "Expect loop variable name.");
+    if (match(parser, TOKEN_COMMA)) {
+        node->for_in.value = consume(parser, TOKEN_IDENTIFIER, "Expect loop variable name after ','.");
+    }
+    if (!isInWord(parser, parser->current)) error("Expect 'in' after loop variables.", parser->tokens[parser->current].line);
+    advance(parser);
+    node->for_in.iterable = expression(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for-in clause.");
+    node->for_in.body = statement(parser);
+    return node;
+}
+
 static Node* forStatement(Parser* parser) {
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+
+    // for (x in ...) or for (k, v in ...)
+    if (check(parser, TOKEN_IDENTIFIER) && parser->current + 1 < parser->count) {
+        if (isInWord(parser, parser->current + 1) || parser->tokens[parser->current + 1].type == TOKEN_COMMA) {
+            return forInStatement(parser);
+        }
+    }
     
     Node* initializer = NULL;
     if (match(parser, TOKEN_SEMICOLON)) {
@@ -383,7 +477,7 @@ static Node* forStatement(Parser* parser) {
 
     Node* body = statement(parser);
 
-    Node* node = malloc(sizeof(Node));
+    Node* node = calloc(1, sizeof(Node));
     node->next = NULL;
     node->type = NODE_STMT_FOR;
     node->for_stmt.initializer = initializer;
@@ -417,7 +511,7 @@ static Node* declaration(Parser* parser) {
         Token alias = consume(parser, TOKEN_IDENTIFIER, "Expect alias after 'as'.");
         consume(parser, TOKEN_SEMICOLON, "Expect ';' after import statement.");
 
-        Node* node = malloc(sizeof(Node));
+        Node* node = calloc(1, sizeof(Node));
         node->next = NULL;
         node->type = NODE_STMT_IMPORT;
         node->import_stmt.module = module;
@@ -431,7 +525,7 @@ static Node* declaration(Parser* parser) {
 // Main parse function
 Node* parse(Parser* parser) {
     // Parse top-level declarations into a block
-    Node* root = malloc(sizeof(Node));
+    Node* root = calloc(1, sizeof(Node));
     root->next = NULL;
     root->type = NODE_STMT_BLOCK;
     root->block.statements = malloc(8 * sizeof(Node*));
@@ -448,4 +542,101 @@ Node* parse(Parser* parser) {
     }
 
     return root;
-}
\ No newline at end of file
+}
+
+// Free AST
+void freeAST(Node* node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+            if (node->literal.token.type == TOKEN_STRING) {
+                // No need to free token.start, it's from source
+            }
+            break;
+        case NODE_EXPR_BINARY:
+            freeAST(node->binary.left);
+            freeAST(node->binary.right);
+            break;
+        case NODE_EXPR_UNARY:
+            freeAST(node->unary.expr);
+            break;
+        case NODE_EXPR_VAR:
+        case NODE_EXPR_PARAM:
+            break;
+        case NODE_EXPR_GET:
+            // object.property -> free object
+            freeAST(node->get.object);
+            break;
+        case NODE_EXPR_INDEX:
+            // target[index] -> free both
+            freeAST(node->index.target);
+            freeAST(node->index.index);
+            break;
+        case NODE_EXPR_INVARIANT:
+            // slot name is static text owned by the optimizer
+            freeAST(node->invariant.expr);
+            break;
+        case NODE_EXPR_CALL: {
+            freeAST(node->call.callee);
+            // arguments are a list linked through next
+            Node* arg = node->call.arguments;
+            while (arg) {
+                Node* next = arg->next;
+                freeAST(arg);
+                arg = next;
+            }
+            break;
+        }
+        case NODE_STMT_VAR_DECL:
+            freeAST(node->var_decl.initializer);
+            break;
+        case NODE_STMT_ASSIGN:
+            freeAST(node->assign.value);
+            break;
+        case NODE_STMT_INDEX_ASSIGN:
+            // target[index] = value
+            freeAST(node->index_assign.target);
+            freeAST(node->index_assign.index);
+            freeAST(node->index_assign.value);
+            break;
+        case NODE_STMT_PRINT:
+            freeAST(node->print.expr);
+            break;
+        case NODE_STMT_IF:
+            freeAST(node->if_stmt.condition);
+            freeAST(node->if_stmt.thenBranch);
+            freeAST(node->if_stmt.elseBranch);
+            break;
+        case NODE_STMT_WHILE:
+            freeAST(node->while_stmt.condition);
+            freeAST(node->while_stmt.body);
+            break;
+        case NODE_STMT_FOR_IN:
+            freeAST(node->for_in.iterable);
+            freeAST(node->for_in.body);
+            break;
+        case NODE_STMT_FOR:
+            freeAST(node->for_stmt.initializer);
+            freeAST(node->for_stmt.condition);
+            freeAST(node->for_stmt.increment);
+            freeAST(node->for_stmt.body);
+            break;
+        case NODE_STMT_BLOCK:
+            for (int i = 0; i < node->block.count; i++) {
+                freeAST(node->block.statements[i]);
+            }
+            free(node->block.statements);
+            break;
+        case NODE_STMT_FUNCTION:
+            freeAST(node->function.body);
+            free(node->function.params);
+            break;
+        case NODE_STMT_RETURN:
+            freeAST(node->return_stmt.value);
+            break;
+        case NODE_STMT_IMPORT:
+            // tokens only; nothing to free
+            break;
+    }
+    free(node);
+}
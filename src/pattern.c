@@ -0,0 +1,923 @@
+#include "pattern.h"
+#include <stdint.h>
+
+#define PATTERN_MAX_STATES 10000    // NFA states per compiled pattern
+#define PATTERN_MAX_REPEAT 1000     // largest m or n in {m,n}
+#define PATTERN_PREFIX_MAX 32
+#define PATTERN_CACHE_SIZE 32       // compiled patterns kept per VM
+#define DFA_MAX_STATES 2048         // cached DFA states before the cache is dropped
+#define NO_POSITION ((size_t)-1)
+
+// ---- Syntax tree ----
+
+typedef struct {
+    uint8_t bits[32];
+} ByteSet;
+
+static inline bool setHas(const ByteSet* set, uint8_t c) {
+    return (set->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static inline void setAdd(ByteSet* set, uint8_t c) {
+    set->bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static void setAddRange(ByteSet* set, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) setAdd(set, (uint8_t)c);
+}
+
+typedef enum {
+    RE_EMPTY,
+    RE_BYTES,       // one byte from a set
+    RE_BOL,         // ^
+    RE_EOL,         // $
+    RE_CAT,
+    RE_ALT,
+    RE_REPEAT       // left repeated min..max times (max -1: unbounded)
+} ReKind;
+
+typedef struct ReNode {
+    ReKind kind;
+    int set;                    // RE_BYTES: index into the pattern's sets
+    int min, max;               // RE_REPEAT
+    struct ReNode* left;
+    struct ReNode* right;
+    struct ReNode* allocated;   // every node of the parse, for freeing
+} ReNode;
+
+typedef struct {
+    const char* p;
+    int line;
+    ReNode* nodes;
+    ByteSet* sets;
+    int setCount;
+    int setCapacity;
+} ReParser;
+
+static void syntaxError(ReParser* parser, const char* what) {
+    char message[128];
+    snprintf(message, sizeof(message), "Invalid regular expression: %s.", what);
+    error(message, parser->line);
+}
+
+static ReNode* newNode(ReParser* parser, ReKind kind, ReNode* left, ReNode* right) {
+    ReNode* node = (ReNode*)calloc(1, sizeof(ReNode));
+    if (!node) error("Memory allocation failed.", parser->line);
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    node->allocated = parser->nodes;
+    parser->nodes = node;
+    return node;
+}
+
+static int newSet(ReParser* parser) {
+    if (parser->setCount == parser->setCapacity) {
+        int capacity = parser->setCapacity < 8 ? 8 : parser->setCapacity * 2;
+        ByteSet* sets = (ByteSet*)realloc(parser->sets, sizeof(ByteSet) * (size_t)capacity);
+        if (!sets) error("Memory allocation failed.", parser->line);
+        parser->sets = sets;
+        parser->setCapacity = capacity;
+    }
+    memset(&parser->sets[parser->setCount], 0, sizeof(ByteSet));
+    return parser->setCount++;
+}
+
+static ReNode* bytesNode(ReParser* parser, int set) {
+    ReNode* node = newNode(parser, RE_BYTES, NULL, NULL);
+    node->set = set;
+    return node;
+}
+
+// \d \w \s and their negations; false for any other escape letter
+static bool addClassEscape(ByteSet* set, char c) {
+    ByteSet tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    switch (c | 0x20) {
+        case 'd': setAddRange(&tmp, '0', '9'); break;
+        case 'w': setAddRange(&tmp, '0', '9'); setAddRange(&tmp, 'a', 'z'); setAddRange(&tmp, 'A', 'Z'); setAdd(&tmp, '_'); break;
+        case 's': setAdd(&tmp, ' '); setAddRange(&tmp, '\t', '\r'); break;
+        default: return false;
+    }
+    bool negate = c >= 'A' && c <= 'Z';
+    for (int i = 0; i < 32; i++) set->bits[i] |= negate ? (uint8_t)~tmp.bits[i] : tmp.bits[i];
+    return true;
+}
+
+// Byte written as an escape (after the backslash)
+static uint8_t escapedByte(ReParser* parser, char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case '\0': syntaxError(parser, "trailing backslash"); return 0;
+        default:
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+                syntaxError(parser, "unsupported escape");
+            }
+            return (uint8_t)c;
+    }
+}
+
+static ReNode* parseClass(ReParser* parser) {
+    int index = newSet(parser);
+    ByteSet set;
+    memset(&set, 0, sizeof(set));
+    bool negate = *parser->p == '^';
+    if (negate) parser->p++;
+    bool first = true;
+    while (*parser->p != ']' || first) {
+        first = false;
+        char c = *parser->p++;
+        if (c == '\0') syntaxError(parser, "missing ]");
+        int lo;
+        if (c == '\\') {
+            char e = *parser->p++;
+            if (addClassEscape(&set, e)) continue;
+            lo = escapedByte(parser, e);
+        } else {
+            lo = (uint8_t)c;
+        }
+        if (parser->p[0] == '-' && parser->p[1] != ']' && parser->p[1] != '\0') {
+            parser->p++;
+            char d = *parser->p++;
+            int hi = d == '\\' ? escapedByte(parser, *parser->p++) : (uint8_t)d;
+            if (hi < lo) syntaxError(parser, "bad range in [...]");
+            setAddRange(&set, lo, hi);
+        } else {
+            setAdd(&set, (uint8_t)lo);
+        }
+    }
+    parser->p++;
+    if (negate) for (int i = 0; i < 32; i++) set.bits[i] = (uint8_t)~set.bits[i];
+    parser->sets[index] = set;
+    return bytesNode(parser, index);
+}
+
+static ReNode* parseAlternation(ReParser* parser);
+
+static ReNode* parseAtom(ReParser* parser) {
+    char c = *parser->p++;
+    switch (c) {
+        case '(': {
+            if (parser->p[0] == '?' && parser->p[1] == ':') parser->p += 2;
+            ReNode* inner = parseAlternation(parser);
+            if (*parser->p != ')') syntaxError(parser, "missing )");
+            parser->p++;
+            return inner;
+        }
+        case '[':
+            return parseClass(parser);
+        case '.': {
+            int set = newSet(parser);
+            setAddRange(&parser->sets[set], 0, 255);
+            parser->sets[set].bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+            return bytesNode(parser, set);
+        }
+        case '^':
+            return newNode(parser, RE_BOL, NULL, NULL);
+        case '$':
+            return newNode(parser, RE_EOL, NULL, NULL);
+        case '*': case '+': case '?':
+            syntaxError(parser, "nothing to repeat");
+            return NULL;
+        case '\\': {
+            char e = *parser->p++;
+            int set = newSet(parser);
+            if (!addClassEscape(&parser->sets[set], e)) setAdd(&parser->sets[set], escapedByte(parser, e));
+            return bytesNode(parser, set);
+        }
+        default: {
+            int set = newSet(parser);
+            setAdd(&parser->sets[set], (uint8_t)c);
+            return bytesNode(parser, set);
+        }
+    }
+}
+
+static int parseCount(ReParser* parser) {
+    if (*parser->p < '0' || *parser->p > '9') syntaxError(parser, "bad {m,n} repeat");
+    int n = 0;
+    while (*parser->p >= '0' && *parser->p <= '9') {
+        n = n * 10 + (*parser->p++ - '0');
+        if (n > PATTERN_MAX_REPEAT) syntaxError(parser, "repeat count too large");
+    }
+    return n;
+}
+
+static ReNode* parseRepeat(ReParser* parser) {
+    ReNode* atom = parseAtom(parser);
+    for (;;) {
+        int min, max;
+        char c = *parser->p;
+        if (c == '*') { min = 0; max = -1; }
+        else if (c == '+') { min = 1; max = -1; }
+        else if (c == '?') { min = 0; max = 1; }
+        else if (c == '{' && parser->p[1] >= '0' && parser->p[1] <= '9') {
+            // `{` not followed by a digit is a literal brace
+            parser->p++;
+            min = max = parseCount(parser);
+            if (*parser->p == ',') {
+                parser->p++;
+                max = *parser->p == '}' ? -1 : parseCount(parser);
+            }
+            if (*parser->p != '}') syntaxError(parser, "bad {m,n} repeat");
+            if (max >= 0 && max < min) syntaxError(parser, "bad {m,n} repeat");
+        } else {
+            return atom;
+        }
+        parser->p++;
+        atom = newNode(parser, RE_REPEAT, atom, NULL);
+        atom->min = min;
+        atom->max = max;
+    }
+}
+
+static ReNode* parseConcatenation(ReParser* parser) {
+    ReNode* result = NULL;
+    while (*parser->p && *parser->p != '|' && *parser->p != ')') {
+        ReNode* next = parseRepeat(parser);
+        result = result ? newNode(parser, RE_CAT, result, next) : next;
+    }
+    return result ? result : newNode(parser, RE_EMPTY, NULL, NULL);
+}
+
+static ReNode* parseAlternation(ReParser* parser) {
+    ReNode* result = parseConcatenation(parser);
+    while (*parser->p == '|') {
+        parser->p++;
+        result = newNode(parser, RE_ALT, result, parseConcatenation(parser));
+    }
+    return result;
+}
+
+// ---- NFA ----
+
+typedef enum {
+    NFA_BYTES,      // consume a byte in sets[set], go to out
+    NFA_SPLIT,      // go to out and out1
+    NFA_JUMP,       // go to out
+    NFA_EDGE_START, // only where the scan starts (^ forward, $ reversed)
+    NFA_EDGE_END,   // only where the scan ends ($ forward, ^ reversed)
+    NFA_MATCH
+} NfaOp;
+
+typedef struct {
+    uint8_t op;
+    int set;
+    int out;
+    int out1;
+} NfaState;
+
+typedef struct {
+    NfaState* states;
+    int count;
+    int capacity;
+    int start;
+    bool hasEdgeStart;
+} Nfa;
+
+static int nfaAdd(Nfa* nfa, NfaOp op, int line) {
+    if (nfa->count == PATTERN_MAX_STATES) error("Invalid regular expression: pattern too large.", line);
+    if (nfa->count == nfa->capacity) {
+        int capacity = nfa->capacity < 16 ? 16 : nfa->capacity * 2;
+        NfaState* states = (NfaState*)realloc(nfa->states, sizeof(NfaState) * (size_t)capacity);
+        if (!states) error("Memory allocation failed.", line);
+        nfa->states = states;
+        nfa->capacity = capacity;
+    }
+    if (op == NFA_EDGE_START) nfa->hasEdgeStart = true;
+    NfaState* s = &nfa->states[nfa->count];
+    s->op = (uint8_t)op;
+    s->set = 0;
+    s->out = -1;
+    s->out1 = -1;
+    return nfa->count++;
+}
+
+// Append state s after the fragment built so far (first..*last)
+static void nfaChain(Nfa* nfa, int* first, int* last, int s, int end) {
+    if (*last < 0) *first = s;
+    else nfa->states[*last].out = s;
+    *last = end;
+}
+
+// Build the fragment for node; returns its entry state and stores in *end a
+// jump state whose out is left for the caller. reverse builds the NFA of the
+// reversed pattern: concatenations run right to left and ^/$ swap ends.
+static int nfaBuild(Nfa* nfa, const ReNode* node, bool reverse, int* end, int line) {
+    switch (node->kind) {
+        case RE_EMPTY: {
+            int s = nfaAdd(nfa, NFA_JUMP, line);
+            *end = s;
+            return s;
+        }
+        case RE_BYTES:
+        case RE_BOL:
+        case RE_EOL: {
+            NfaOp op = NFA_BYTES;
+            if (node->kind == RE_BOL) op = reverse ? NFA_EDGE_END : NFA_EDGE_START;
+            if (node->kind == RE_EOL) op = reverse ? NFA_EDGE_START : NFA_EDGE_END;
+            int s = nfaAdd(nfa, op, line);
+            int e = nfaAdd(nfa, NFA_JUMP, line);
+            nfa->states[s].set = node->set;
+            nfa->states[s].out = e;
+            *end = e;
+            return s;
+        }
+        case RE_CAT: {
+            const ReNode* a = reverse ? node->right : node->left;
+            const ReNode* b = reverse ? node->left : node->right;
+            int endA, endB;
+            int s = nfaBuild(nfa, a, reverse, &endA, line);
+            int sb = nfaBuild(nfa, b, reverse, &endB, line);
+            nfa->states[endA].out = sb;
+            *end = endB;
+            return s;
+        }
+        case RE_ALT: {
+            int s = nfaAdd(nfa, NFA_SPLIT, line);
+            int endA, endB;
+            int sa = nfaBuild(nfa, node->left, reverse, &endA, line);
+            int sb = nfaBuild(nfa, node->right, reverse, &endB, line);
+            int e = nfaAdd(nfa, NFA_JUMP, line);
+            nfa->states[s].out = sa;
+            nfa->states[s].out1 = sb;
+            nfa->states[endA].out = e;
+            nfa->states[endB].out = e;
+            *end = e;
+            return s;
+        }
+        case RE_REPEAT: {
+            // min required copies, then either a loop or (max - min) optional copies
+            int first = -1, last = -1, copyEnd;
+            for (int i = 0; i < node->min; i++) {
+                int s = nfaBuild(nfa, node->left, reverse, &copyEnd, line);
+                nfaChain(nfa, &first, &last, s, copyEnd);
+            }
+            if (node->max < 0) {
+                int split = nfaAdd(nfa, NFA_SPLIT, line);
+                int exit = nfaAdd(nfa, NFA_JUMP, line);
+                int s = nfaBuild(nfa, node->left, reverse, &copyEnd, line);
+                nfa->states[split].out = s;
+                nfa->states[split].out1 = exit;
+                nfa->states[copyEnd].out = split;
+                nfaChain(nfa, &first, &last, split, exit);
+            } else if (node->max > node->min) {
+                int exit = nfaAdd(nfa, NFA_JUMP, line);
+                for (int i = node->min; i < node->max; i++) {
+                    int split = nfaAdd(nfa, NFA_SPLIT, line);
+                    int s = nfaBuild(nfa, node->left, reverse, &copyEnd, line);
+                    nfa->states[split].out = s;
+                    nfa->states[split].out1 = exit;
+                    nfaChain(nfa, &first, &last, split, copyEnd);
+                }
+                nfaChain(nfa, &first, &last, exit, exit);
+            }
+            if (first < 0) {
+                first = last = nfaAdd(nfa, NFA_JUMP, line);
+            }
+            *end = last;
+            return first;
+        }
+    }
+    return -1;
+}
+
+static void nfaCompile(Nfa* nfa, const ReNode* root, bool reverse, int line) {
+    memset(nfa, 0, sizeof(*nfa));
+    int end;
+    nfa->start = nfaBuild(nfa, root, reverse, &end, line);
+    int match = nfaAdd(nfa, NFA_MATCH, line);
+    nfa->states[end].out = match;
+}
+
+// ---- Lazily built DFA ----
+//
+// A DFA state is a set of NFA states: the byte-consuming states a match in
+// progress may be in, the match state, and end-edge assertions still waiting
+// for the end of the scan. Transitions are computed the first time they are
+// taken and stored in the state, indexed by byte class (bytes no part of the
+// pattern tells apart share a class).
+
+typedef struct DfaState {
+    struct DfaState* chain;         // next in hash bucket
+    struct DfaState* older;         // every state, for freeing
+    unsigned int hash;
+    bool edge;                      // no input consumed yet, at the scan's start edge
+    bool accept;                    // a match ends here
+    bool acceptAtEnd;               // a match ends here if this is the end of the scan
+    bool stop;                      // scans must look at this state: accept, dead or prefilter start
+    int count;                      // 0: dead, nothing can match any more
+    int* nfaStates;
+    struct DfaState* next[];        // by byte class; NULL: not computed yet
+} DfaState;
+
+typedef struct {
+    const Nfa* nfa;
+    const ByteSet* sets;
+    int classes;
+    bool unanchored;                // a match may start at any position
+    bool prefilter;                 // the scan skips ahead from the start state
+    DfaState** buckets;             // DFA_MAX_STATES * 2 buckets
+    DfaState* all;
+    int stateCount;
+    DfaState* edgeStart;            // start state at the scan's start edge
+    DfaState* start;                // start state anywhere else
+    // Scratch space for building state sets
+    int* set;
+    int* startSet;
+    int* stack;
+    unsigned int* mark;
+    unsigned int generation;
+} Dfa;
+
+#define DFA_BUCKETS (DFA_MAX_STATES * 2)
+
+static void dfaInit(Dfa* dfa, const Nfa* nfa, const ByteSet* sets, int classes, bool unanchored) {
+    memset(dfa, 0, sizeof(*dfa));
+    dfa->nfa = nfa;
+    dfa->sets = sets;
+    dfa->classes = classes;
+    dfa->unanchored = unanchored;
+    dfa->buckets = (DfaState**)calloc(DFA_BUCKETS, sizeof(DfaState*));
+    dfa->set = (int*)malloc(sizeof(int) * (size_t)nfa->count);
+    dfa->startSet = (int*)malloc(sizeof(int) * (size_t)nfa->count);
+    dfa->stack = (int*)malloc(sizeof(int) * (size_t)(nfa->count * 3 + 2));
+    dfa->mark = (unsigned int*)calloc((size_t)nfa->count, sizeof(unsigned int));
+    if (!dfa->buckets || !dfa->set || !dfa->startSet || !dfa->stack || !dfa->mark) error("Memory allocation failed.", 0);
+}
+
+static void dfaClear(Dfa* dfa) {
+    DfaState* s = dfa->all;
+    while (s) {
+        DfaState* older = s->older;
+        free(s);
+        s = older;
+    }
+    dfa->all = NULL;
+    dfa->stateCount = 0;
+    dfa->edgeStart = NULL;
+    dfa->start = NULL;
+    memset(dfa->buckets, 0, sizeof(DfaState*) * DFA_BUCKETS);
+}
+
+static void dfaFree(Dfa* dfa) {
+    if (!dfa->buckets) return;
+    dfaClear(dfa);
+    free(dfa->buckets);
+    free(dfa->set);
+    free(dfa->startSet);
+    free(dfa->stack);
+    free(dfa->mark);
+}
+
+// Add the states reachable from s without consuming input to set (states
+// already marked in this generation are skipped)
+static void dfaClosure(Dfa* dfa, int s, bool atStartEdge, int* set, int* count) {
+    const NfaState* states = dfa->nfa->states;
+    int top = 0;
+    dfa->stack[top++] = s;
+    while (top > 0) {
+        int x = dfa->stack[--top];
+        if (dfa->mark[x] == dfa->generation) continue;
+        dfa->mark[x] = dfa->generation;
+        switch (states[x].op) {
+            case NFA_BYTES:
+            case NFA_MATCH:
+            case NFA_EDGE_END:
+                set[(*count)++] = x;
+                break;
+            case NFA_EDGE_START:
+                if (atStartEdge) dfa->stack[top++] = states[x].out;
+                break;
+            case NFA_JUMP:
+                dfa->stack[top++] = states[x].out;
+                break;
+            case NFA_SPLIT:
+                dfa->stack[top++] = states[x].out1;
+                dfa->stack[top++] = states[x].out;
+                break;
+        }
+    }
+}
+
+// Would the match state be reached if the scan ended here?
+static bool dfaAcceptsAtEnd(Dfa* dfa, const int* set, int count, bool edge) {
+    const NfaState* states = dfa->nfa->states;
+    dfa->generation++;
+    int top = 0;
+    for (int i = 0; i < count; i++) {
+        if (states[set[i]].op == NFA_EDGE_END) dfa->stack[top++] = states[set[i]].out;
+    }
+    while (top > 0) {
+        int x = dfa->stack[--top];
+        if (dfa->mark[x] == dfa->generation) continue;
+        dfa->mark[x] = dfa->generation;
+        switch (states[x].op) {
+            case NFA_MATCH: return true;
+            case NFA_EDGE_END: case NFA_JUMP: dfa->stack[top++] = states[x].out; break;
+            case NFA_EDGE_START: if (edge) dfa->stack[top++] = states[x].out; break;
+            case NFA_SPLIT:
+                dfa->stack[top++] = states[x].out1;
+                dfa->stack[top++] = states[x].out;
+                break;
+            default: break;
+        }
+    }
+    return false;
+}
+
+static void sortStates(int* set, int count) {
+    for (int i = 1; i < count; i++) {
+        int x = set[i], j = i - 1;
+        while (j >= 0 && set[j] > x) { set[j + 1] = set[j]; j--; }
+        set[j + 1] = x;
+    }
+}
+
+static DfaState* dfaIntern(Dfa* dfa, int* set, int count, bool edge);
+
+// Drop every cached state and recreate the common start state, so a scan
+// comparing against dfa->start keeps working
+static void dfaFlush(Dfa* dfa) {
+    dfaClear(dfa);
+    int count = 0;
+    dfa->generation++;
+    dfaClosure(dfa, dfa->nfa->start, false, dfa->startSet, &count);
+    dfa->start = dfaIntern(dfa, dfa->startSet, count, false);
+    if (dfa->prefilter) dfa->start->stop = true;
+}
+
+// Find or create the state for a set (sorted here)
+static DfaState* dfaIntern(Dfa* dfa, int* set, int count, bool edge) {
+    sortStates(set, count);
+    unsigned int h = edge ? 0x9e3779b9u : 2166136261u;
+    for (int i = 0; i < count; i++) h = (h ^ (unsigned int)set[i]) * 16777619u;
+    DfaState* s = dfa->buckets[h % DFA_BUCKETS];
+    while (s) {
+        if (s->hash == h && s->count == count && s->edge == edge && memcmp(s->nfaStates, set, sizeof(int) * (size_t)count) == 0) return s;
+        s = s->chain;
+    }
+    if (dfa->stateCount >= DFA_MAX_STATES) {
+        dfaFlush(dfa);
+        return dfaIntern(dfa, set, count, edge);
+    }
+    size_t size = sizeof(DfaState) + sizeof(DfaState*) * (size_t)dfa->classes;
+    s = (DfaState*)calloc(1, size + sizeof(int) * (size_t)count);
+    if (!s) error("Memory allocation failed.", 0);
+    s->nfaStates = (int*)((char*)s + size);
+    memcpy(s->nfaStates, set, sizeof(int) * (size_t)count);
+    s->count = count;
+    s->hash = h;
+    s->edge = edge;
+    for (int i = 0; i < count; i++) {
+        if (dfa->nfa->states[set[i]].op == NFA_MATCH) s->accept = true;
+    }
+    s->acceptAtEnd = s->accept || dfaAcceptsAtEnd(dfa, set, count, edge);
+    s->stop = s->accept || count == 0;
+    s->chain = dfa->buckets[h % DFA_BUCKETS];
+    dfa->buckets[h % DFA_BUCKETS] = s;
+    s->older = dfa->all;
+    dfa->all = s;
+    dfa->stateCount++;
+    return s;
+}
+
+static DfaState* dfaStartState(Dfa* dfa, bool atStartEdge) {
+    bool edge = atStartEdge && dfa->nfa->hasEdgeStart;
+    DfaState** slot = edge ? &dfa->edgeStart : &dfa->start;
+    if (!*slot) {
+        // Make room first: a flush inside dfaIntern would reuse startSet
+        if (dfa->stateCount >= DFA_MAX_STATES) dfaFlush(dfa);
+        if (*slot) return *slot;
+        int count = 0;
+        dfa->generation++;
+        dfaClosure(dfa, dfa->nfa->start, edge, dfa->startSet, &count);
+        *slot = dfaIntern(dfa, dfa->startSet, count, edge);
+        if (!edge && dfa->prefilter) (*slot)->stop = true;
+    }
+    return *slot;
+}
+
+// Transition of s on byte c (of class cls), computed and stored on first use
+static DfaState* dfaStep(Dfa* dfa, DfaState* s, int cls, uint8_t c) {
+    const NfaState* states = dfa->nfa->states;
+    int count = 0;
+    dfa->generation++;
+    for (int i = 0; i < s->count; i++) {
+        const NfaState* x = &states[s->nfaStates[i]];
+        if (x->op == NFA_BYTES && setHas(&dfa->sets[x->set], c)) dfaClosure(dfa, x->out, false, dfa->set, &count);
+    }
+    if (dfa->unanchored) dfaClosure(dfa, dfa->nfa->start, false, dfa->set, &count);
+    int before = dfa->stateCount;
+    DfaState* t = dfaIntern(dfa, dfa->set, count, false);
+    // After a flush s is gone; the transition is recomputed next time
+    if (dfa->stateCount >= before) s->next[cls] = t;
+    return t;
+}
+
+// ---- Patterns ----
+
+struct Pattern {
+    char* source;
+    unsigned int hash;
+    ByteSet* sets;
+    int setCount;
+    uint8_t classOf[256];           // byte -> byte class
+    int classes;
+    Nfa forward;
+    Nfa reverse;
+    Dfa find;                       // forward, unanchored: is there a match, and by where?
+    Dfa longest;                    // forward, anchored at a known start
+    Dfa starts;                     // reversed, unanchored: where do matches start?
+    char prefix[PATTERN_PREFIX_MAX];    // every match starts with these bytes
+    size_t prefixLength;
+    char required[PATTERN_PREFIX_MAX];  // every match contains these bytes
+    size_t requiredLength;
+};
+
+// Give each byte the class of the bytes that every set treats the same way
+static void computeByteClasses(Pattern* pattern) {
+    memset(pattern->classOf, 0, sizeof(pattern->classOf));
+    int classes = 1;
+    for (int i = 0; i < pattern->setCount; i++) {
+        int remap[512];
+        for (int k = 0; k < classes * 2; k++) remap[k] = -1;
+        int next = 0;
+        for (int c = 0; c < 256; c++) {
+            int key = pattern->classOf[c] * 2 + (setHas(&pattern->sets[i], (uint8_t)c) ? 1 : 0);
+            if (remap[key] < 0) remap[key] = next++;
+            pattern->classOf[c] = (uint8_t)remap[key];
+        }
+        classes = next;
+    }
+    pattern->classes = classes;
+}
+
+// The byte of a one-byte node, or -1
+static int singleByte(const Pattern* pattern, const ReNode* node) {
+    if (node->kind != RE_BYTES) return -1;
+    int only = -1;
+    for (int c = 0; c < 256; c++) {
+        if (!setHas(&pattern->sets[node->set], (uint8_t)c)) continue;
+        if (only >= 0) return -1;
+        only = c;
+    }
+    return only;
+}
+
+// Literal bytes every match begins with; false once the prefix cannot grow
+static bool collectPrefix(Pattern* pattern, const ReNode* node) {
+    switch (node->kind) {
+        case RE_EMPTY:
+            return true;
+        case RE_BYTES: {
+            int only = singleByte(pattern, node);
+            if (only < 0 || pattern->prefixLength == PATTERN_PREFIX_MAX) return false;
+            pattern->prefix[pattern->prefixLength++] = (char)only;
+            return true;
+        }
+        case RE_CAT:
+            return collectPrefix(pattern, node->left) && collectPrefix(pattern, node->right);
+        case RE_REPEAT:
+            if (node->min >= 1) collectPrefix(pattern, node->left);
+            return false;
+        default:
+            return false;
+    }
+}
+
+// Longest run of literal bytes in the top-level concatenation: a text
+// without it cannot match anywhere
+static void collectRequired(Pattern* pattern, const ReNode* node, char* run, size_t* runLength) {
+    if (node->kind == RE_CAT) {
+        collectRequired(pattern, node->left, run, runLength);
+        collectRequired(pattern, node->right, run, runLength);
+        return;
+    }
+    if (node->kind == RE_EMPTY) return;
+    int c = singleByte(pattern, node);
+    if (c < 0 || *runLength == PATTERN_PREFIX_MAX) *runLength = 0;
+    if (c < 0) return;
+    run[(*runLength)++] = (char)c;
+    if (*runLength > pattern->requiredLength) {
+        memcpy(pattern->required, run, *runLength);
+        pattern->requiredLength = *runLength;
+    }
+}
+
+static Pattern* compilePattern(const char* source, unsigned int hash, int line) {
+    ReParser parser;
+    memset(&parser, 0, sizeof(parser));
+    parser.p = source;
+    parser.line = line;
+    ReNode* root = parseAlternation(&parser);
+    if (*parser.p == ')') syntaxError(&parser, "unmatched )");
+
+    Pattern* pattern = (Pattern*)calloc(1, sizeof(Pattern));
+    if (!pattern) error("Memory allocation failed.", line);
+    pattern->source = strdup(source);
+    if (!pattern->source) error("Memory allocation failed.", line);
+    pattern->hash = hash;
+    pattern->sets = parser.sets;
+    pattern->setCount = parser.setCount;
+    computeByteClasses(pattern);
+    nfaCompile(&pattern->forward, root, false, line);
+    nfaCompile(&pattern->reverse, root, true, line);
+    collectPrefix(pattern, root);
+    char run[PATTERN_PREFIX_MAX];
+    size_t runLength = 0;
+    collectRequired(pattern, root, run, &runLength);
+    while (parser.nodes) {
+        ReNode* next = parser.nodes->allocated;
+        free(parser.nodes);
+        parser.nodes = next;
+    }
+    dfaInit(&pattern->find, &pattern->forward, pattern->sets, pattern->classes, true);
+    pattern->find.prefilter = pattern->prefixLength > 0;
+    dfaInit(&pattern->longest, &pattern->forward, pattern->sets, pattern->classes, false);
+    dfaInit(&pattern->starts, &pattern->reverse, pattern->sets, pattern->classes, true);
+    return pattern;
+}
+
+static void freePattern(Pattern* pattern) {
+    dfaFree(&pattern->find);
+    dfaFree(&pattern->longest);
+    dfaFree(&pattern->starts);
+    free(pattern->forward.states);
+    free(pattern->reverse.states);
+    free(pattern->sets);
+    free(pattern->source);
+    free(pattern);
+}
+
+struct PatternCache {
+    Pattern* entries[PATTERN_CACHE_SIZE];   // most recently used first
+    int count;
+};
+
+Pattern* patternLookup(PatternCache** cache, const char* source, int line) {
+    if (!*cache) {
+        *cache = (PatternCache*)calloc(1, sizeof(PatternCache));
+        if (!*cache) error("Memory allocation failed.", line);
+    }
+    PatternCache* c = *cache;
+    unsigned int hash = hashString(source, strlen(source));
+    for (int i = 0; i < c->count; i++) {
+        Pattern* p = c->entries[i];
+        if (p->hash == hash && strcmp(p->source, source) == 0) {
+            memmove(&c->entries[1], &c->entries[0], sizeof(Pattern*) * (size_t)i);
+            c->entries[0] = p;
+            return p;
+        }
+    }
+    Pattern* p = compilePattern(source, hash, line);
+    if (c->count == PATTERN_CACHE_SIZE) freePattern(c->entries[--c->count]);
+    memmove(&c->entries[1], &c->entries[0], sizeof(Pattern*) * (size_t)c->count);
+    c->entries[0] = p;
+    c->count++;
+    return p;
+}
+
+void freePatternCache(PatternCache* cache) {
+    if (!cache) return;
+    for (int i = 0; i < cache->count; i++) freePattern(cache->entries[i]);
+    free(cache);
+}
+
+// ---- Matching ----
+
+// Next position at or after from where a literal occurs
+static const char* findLiteral(const char* from, const char* end, const char* literal, size_t length) {
+    while ((size_t)(end - from) >= length) {
+        const char* hit = (const char*)memchr(from, literal[0], (size_t)(end - from) - length + 1);
+        if (!hit) return NULL;
+        if (memcmp(hit + 1, literal + 1, length - 1) == 0) return hit;
+        from = hit + 1;
+    }
+    return NULL;
+}
+
+bool patternTest(Pattern* pattern, const char* text, size_t length) {
+    Dfa* dfa = &pattern->find;
+    const char* p = text;
+    const char* end = text + length;
+    if (pattern->requiredLength > pattern->prefixLength &&
+        !findLiteral(p, end, pattern->required, pattern->requiredLength)) {
+        return false;
+    }
+    if (dfa->prefilter) dfaStartState(dfa, false);     // flagged for the prefilter
+    DfaState* s = dfaStartState(dfa, true);
+    for (;;) {
+        if (s->count == 0) return false;
+        if (p == end) return s->acceptAtEnd;
+        if (s->accept) return true;
+        if (s == dfa->start && dfa->prefilter) {
+            // Nothing in progress: no match can start before the next prefix
+            p = findLiteral(p, end, pattern->prefix, pattern->prefixLength);
+            if (!p) return false;
+        }
+        // Follow transitions until a state needs a look
+        do {
+            uint8_t c = (uint8_t)*p++;
+            int cls = pattern->classOf[c];
+            DfaState* t = s->next[cls];
+            s = t ? t : dfaStep(dfa, s, cls, c);
+        } while (!s->stop && p < end);
+    }
+}
+
+// Scan the reversed pattern from the end of the text back to the start. A
+// match starts at every position where it accepts; mark them in starts (if
+// given) and return the leftmost one
+static size_t scanStarts(Pattern* pattern, const char* text, size_t length, uint8_t* starts) {
+    Dfa* dfa = &pattern->starts;
+    DfaState* s = dfaStartState(dfa, true);
+    size_t leftmost = NO_POSITION;
+    size_t i = length;
+    for (;;) {
+        if (s->count == 0) break;
+        if (i == 0 ? s->acceptAtEnd : s->accept) {
+            leftmost = i;
+            if (starts) starts[i >> 3] |= (uint8_t)(1u << (i & 7));
+        }
+        if (i == 0) break;
+        do {
+            uint8_t c = (uint8_t)text[--i];
+            int cls = pattern->classOf[c];
+            DfaState* t = s->next[cls];
+            s = t ? t : dfaStep(dfa, s, cls, c);
+        } while (!s->stop && i > 0);
+    }
+    return leftmost;
+}
+
+// End of the longest match starting at start
+static size_t longestFrom(Pattern* pattern, const char* text, size_t length, size_t start) {
+    Dfa* dfa = &pattern->longest;
+    DfaState* s = dfaStartState(dfa, start == 0);
+    size_t last = NO_POSITION;
+    size_t i = start;
+    for (;;) {
+        if (s->count == 0) break;
+        if (i == length ? s->acceptAtEnd : s->accept) last = i;
+        if (i == length) break;
+        do {
+            uint8_t c = (uint8_t)text[i++];
+            int cls = pattern->classOf[c];
+            DfaState* t = s->next[cls];
+            s = t ? t : dfaStep(dfa, s, cls, c);
+        } while (!s->stop && i < length);
+    }
+    return last;
+}
+
+bool patternSearch(Pattern* pattern, const char* text, size_t length, PatternMatch* match) {
+    if (!patternTest(pattern, text, length)) return false;
+    size_t start = scanStarts(pattern, text, length, NULL);
+    if (start == NO_POSITION) return false;
+    size_t end = longestFrom(pattern, text, length, start);
+    if (end == NO_POSITION) return false;
+    match->start = start;
+    match->end = end;
+    return true;
+}
+
+size_t patternFindAll(Pattern* pattern, const char* text, size_t length, PatternMatch** matches) {
+    *matches = NULL;
+    if (!patternTest(pattern, text, length)) return 0;
+    uint8_t* starts = (uint8_t*)calloc(length / 8 + 1, 1);
+    if (!starts) error("Memory allocation failed.", 0);
+    scanStarts(pattern, text, length, starts);
+
+    PatternMatch* found = NULL;
+    size_t count = 0, capacity = 0;
+    size_t i = 0;
+    while (i <= length) {
+        // Next marked start at or after i, skipping empty bitmap bytes
+        if (!(starts[i >> 3] >> (i & 7))) {
+            i = (i | 7) + 1;
+            while (i <= length && !starts[i >> 3]) i += 8;
+            continue;
+        }
+        if (!((starts[i >> 3] >> (i & 7)) & 1)) { i++; continue; }
+        size_t end = longestFrom(pattern, text, length, i);
+        if (end == NO_POSITION) { i++; continue; }
+        if (count == capacity) {
+            capacity = capacity < 8 ? 8 : capacity * 2;
+            PatternMatch* grown = (PatternMatch*)realloc(found, sizeof(PatternMatch) * capacity);
+            if (!grown) { free(found); free(starts); error("Memory allocation failed.", 0); }
+            found = grown;
+        }
+        found[count].start = i;
+        found[count].end = end;
+        count++;
+        i = end > i ? end : i + 1;
+    }
+    free(starts);
+    *matches = found;
+    return count;
+}
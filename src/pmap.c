@@ -0,0 +1,669 @@
+#define _DEFAULT_SOURCE // flock
+#include "pmap.h"
+#include "serialize.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PMAP_VERSION 1
+
+// Index header page; the bucket table starts right after it
+#define PMAP_PAGE 4096
+
+// Smallest bucket table (one page of buckets)
+#define PMAP_MIN_BUCKETS 256
+
+// The log file grows ahead of its used length in steps of at least this
+#define PMAP_LOG_MIN_GROWTH (1024 * 1024)
+
+static const char pmapMagic[8] = "GEMPMAP";
+static const char logMagic[8] = "GEMPLOG";
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t clean;         // 1: buckets match the log (closed cleanly)
+    uint64_t seed;          // key hash seed, chosen when the index is built
+    uint64_t generation;    // log generation the buckets point into
+    uint64_t capacity;      // buckets (power of two)
+    uint64_t count;         // live keys
+    uint64_t tombstones;    // buckets of deleted keys
+    uint64_t logLength;     // bytes of the log in use
+    uint64_t checksum;      // of the fields above
+} PMapHeader;
+
+// Bucket offset 0 is empty (the log header is there); deleted keys leave
+// a tombstone so that probing continues past them
+#define BUCKET_DELETED UINT64_MAX
+
+typedef struct {
+    uint64_t hash;
+    uint64_t offset;        // of the key's latest record in the log
+} PMapBucket;
+
+// Log header: magic, then the generation
+#define LOG_HEADER_SIZE 16
+
+// Record: checksum (4 bytes, of the rest), kind (1), key length (4), value
+// length (4), key, value. The kind's low bit is the key kind.
+#define RECORD_HEADER_SIZE 13
+
+enum { KEY_STRING, KEY_INT };
+enum { RECORD_SET = 0, RECORD_DELETE = 2 };
+
+struct PMap {
+    char* path;             // index file; the log is path + ".log"
+    int fd;                 // index file (holds the lock)
+    int logFd;
+    char* index;            // mapped index file
+    size_t indexSize;
+    char* log;              // mapped log file
+    size_t logSize;         // log file size (grows ahead of logLength)
+    dev_t device;           // identity of the index file
+    ino_t inode;
+    bool dirty;             // clean flag cleared on disk
+    bool closed;
+    PMap* next;             // open pmaps
+};
+
+#define HEADER(pm)  ((PMapHeader*)(pm)->index)
+#define BUCKETS(pm) ((PMapBucket*)((pm)->index + PMAP_PAGE))
+
+// Key bytes: string contents, or the int's 4 bytes
+typedef struct {
+    unsigned char kind;
+    const char* bytes;
+    uint32_t length;
+    char intBytes[4];
+} PKey;
+
+typedef struct {
+    unsigned char kind;
+    const char* key;
+    uint32_t keyLength;
+    const char* value;
+    uint32_t valueLength;
+} Record;
+
+// Process-wide registry of open pmaps (closed at exit)
+static PMap* openPMaps = NULL;
+static bool exitHookInstalled = false;
+static pthread_mutex_t pmapsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// ---- Hashing and checksums ----
+
+static uint64_t hashKey(uint64_t seed, const PKey* k) {
+    uint64_t h = 0xcbf29ce484222325ull ^ seed;
+    h = (h ^ k->kind) * 0x100000001b3ull;
+    for (uint32_t i = 0; i < k->length; i++) {
+        h = (h ^ (unsigned char)k->bytes[i]) * 0x100000001b3ull;
+    }
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ull;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint32_t checksum32(const char* bytes, size_t length) {
+    uint32_t h = 0x811c9dc5u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)bytes[i]) * 0x01000193u;
+    }
+    return h;
+}
+
+static uint64_t headerChecksum(const PMapHeader* h) {
+    const char* bytes = (const char*)h;
+    uint64_t sum = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < offsetof(PMapHeader, checksum); i++) {
+        sum = (sum ^ (unsigned char)bytes[i]) * 0x100000001b3ull;
+    }
+    return sum;
+}
+
+static uint64_t randomSeed(void) {
+    uint64_t seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &seed, sizeof(seed)) != (ssize_t)sizeof(seed)) seed = 0;
+        close(fd);
+    }
+    if (seed == 0) seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    return seed;
+}
+
+static void keyFromValue(Value key, PKey* k, int line) {
+    if (IS_INT(key)) {
+        int i = AS_INT(key);
+        memcpy(k->intBytes, &i, sizeof(i));
+        k->kind = KEY_INT;
+        k->bytes = k->intBytes;
+        k->length = 4;
+        return;
+    }
+    if (!IS_STRING(key)) error("pmap key must be int or string.", line);
+    const char* s = AS_STRING(key) ? AS_STRING(key) : "";
+    size_t length = strlen(s);
+    if (length > UINT32_MAX) error("pmap key is too long.", line);
+    k->kind = KEY_STRING;
+    k->bytes = s;
+    k->length = (uint32_t)length;
+}
+
+// ---- Files ----
+
+static inline uint32_t loadU32(const char* p) {
+    uint32_t u;
+    memcpy(&u, p, sizeof(u));
+    return u;
+}
+
+static inline void storeU32(char* p, uint32_t u) {
+    memcpy(p, &u, sizeof(u));
+}
+
+static char* mapFile(int fd, size_t size, int line) {
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) error("pmap: could not map file.", line);
+    return map;
+}
+
+static void resizeFile(int fd, size_t size, int line) {
+    while (ftruncate(fd, (off_t)size) != 0) {
+        if (errno != EINTR) error("pmap: could not resize file.", line);
+    }
+}
+
+static void remapIndex(PMap* pm, size_t size, int line) {
+    munmap(pm->index, pm->indexSize);
+    resizeFile(pm->fd, size, line);
+    pm->index = mapFile(pm->fd, size, line);
+    pm->indexSize = size;
+}
+
+static void remapLog(PMap* pm, size_t size, int line) {
+    munmap(pm->log, pm->logSize);
+    resizeFile(pm->logFd, size, line);
+    pm->log = mapFile(pm->logFd, size, line);
+    pm->logSize = size;
+}
+
+static uint64_t logGeneration(PMap* pm) {
+    uint64_t generation;
+    memcpy(&generation, pm->log + 8, sizeof(generation));
+    return generation;
+}
+
+// Clear the clean flag on disk before the first change
+static void markDirty(PMap* pm) {
+    if (pm->dirty) return;
+    PMapHeader* h = HEADER(pm);
+    h->clean = 0;
+    h->checksum = headerChecksum(h);
+    msync(pm->index, PMAP_PAGE, MS_SYNC);
+    pm->dirty = true;
+}
+
+// Flush both files and set the clean flag; the log file is trimmed to its
+// used length
+static void syncClean(PMap* pm, int line) {
+    if (!pm->dirty) return;
+    PMapHeader* h = HEADER(pm);
+    msync(pm->log, pm->logSize, MS_SYNC);
+    if (pm->logSize != h->logLength) remapLog(pm, h->logLength, line);
+    msync(pm->index, pm->indexSize, MS_SYNC);
+    h->clean = 1;
+    h->checksum = headerChecksum(h);
+    msync(pm->index, PMAP_PAGE, MS_SYNC);
+    pm->dirty = false;
+}
+
+// ---- Table ----
+
+static void readRecord(PMap* pm, uint64_t offset, Record* r) {
+    const char* p = pm->log + offset;
+    r->kind = (unsigned char)p[4];
+    r->keyLength = loadU32(p + 5);
+    r->valueLength = loadU32(p + 9);
+    r->key = p + RECORD_HEADER_SIZE;
+    r->value = r->key + r->keyLength;
+}
+
+static size_t recordSize(const Record* r) {
+    return RECORD_HEADER_SIZE + (size_t)r->keyLength + r->valueLength;
+}
+
+// Slot holding the key (true), or the slot a new key would take (false)
+static bool findSlot(PMap* pm, const PKey* k, uint64_t hash, uint64_t* slotOut) {
+    PMapBucket* buckets = BUCKETS(pm);
+    uint64_t mask = HEADER(pm)->capacity - 1;
+    uint64_t slot = hash & mask;
+    uint64_t freeSlot = UINT64_MAX;
+    while (true) {
+        PMapBucket* b = &buckets[slot];
+        if (b->offset == 0) {
+            *slotOut = freeSlot != UINT64_MAX ? freeSlot : slot;
+            return false;
+        }
+        if (b->offset == BUCKET_DELETED) {
+            if (freeSlot == UINT64_MAX) freeSlot = slot;
+        } else if (b->hash == hash) {
+            Record r;
+            readRecord(pm, b->offset, &r);
+            if ((r.kind & 1) == k->kind && r.keyLength == k->length && memcmp(r.key, k->bytes, k->length) == 0) {
+                *slotOut = slot;
+                return true;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// Rehash the live buckets into a table of newCapacity. The new table is
+// built in the file after the old one, then moved down over it.
+static void resizeTable(PMap* pm, uint64_t newCapacity, int line) {
+    uint64_t oldCapacity = HEADER(pm)->capacity;
+    size_t oldSize = PMAP_PAGE + (size_t)oldCapacity * sizeof(PMapBucket);
+    remapIndex(pm, oldSize + (size_t)newCapacity * sizeof(PMapBucket), line);
+    PMapBucket* old = BUCKETS(pm);
+    PMapBucket* fresh = (PMapBucket*)(pm->index + oldSize);
+    uint64_t mask = newCapacity - 1;
+    for (uint64_t i = 0; i < oldCapacity; i++) {
+        if (old[i].offset == 0 || old[i].offset == BUCKET_DELETED) continue;
+        uint64_t slot = old[i].hash & mask;
+        while (fresh[slot].offset != 0) slot = (slot + 1) & mask;
+        fresh[slot] = old[i];
+    }
+    memmove(old, fresh, (size_t)newCapacity * sizeof(PMapBucket));
+    remapIndex(pm, PMAP_PAGE + (size_t)newCapacity * sizeof(PMapBucket), line);
+    HEADER(pm)->capacity = newCapacity;
+    HEADER(pm)->tombstones = 0;
+}
+
+// Smallest table keeping count keys at most half full
+static uint64_t capacityFor(uint64_t count) {
+    uint64_t capacity = PMAP_MIN_BUCKETS;
+    while ((count + 1) * 2 > capacity) capacity *= 2;
+    return capacity;
+}
+
+// Keep live keys and tombstones below 70% of the table before an insert
+static void ensureRoom(PMap* pm, int line) {
+    PMapHeader* h = HEADER(pm);
+    if ((h->count + h->tombstones + 1) * 10 <= h->capacity * 7) return;
+    uint64_t capacity = capacityFor(h->count);
+    if (capacity < h->capacity) capacity = h->capacity;
+    resizeTable(pm, capacity, line);
+}
+
+static uint64_t appendRecord(PMap* pm, unsigned char kind, const PKey* k, const char* value, size_t valueLength, int line) {
+    if (valueLength > UINT32_MAX) error("pmap value is too large.", line);
+    PMapHeader* h = HEADER(pm);
+    size_t size = RECORD_HEADER_SIZE + k->length + valueLength;
+    uint64_t offset = h->logLength;
+    if (offset + size > pm->logSize) {
+        size_t grown = pm->logSize * 2;
+        if (grown < pm->logSize + PMAP_LOG_MIN_GROWTH) grown = pm->logSize + PMAP_LOG_MIN_GROWTH;
+        if (grown < offset + size) grown = offset + size;
+        remapLog(pm, grown, line);
+    }
+    char* p = pm->log + offset;
+    p[4] = (char)(kind | k->kind);
+    storeU32(p + 5, k->length);
+    storeU32(p + 9, (uint32_t)valueLength);
+    memcpy(p + RECORD_HEADER_SIZE, k->bytes, k->length);
+    if (valueLength > 0) memcpy(p + RECORD_HEADER_SIZE + k->length, value, valueLength);
+    storeU32(p, checksum32(p + 4, size - 4));
+    h->logLength = offset + size;
+    return offset;
+}
+
+// Point the key's bucket at a set record, or leave a tombstone for a delete
+static void applyRecord(PMap* pm, uint64_t offset, const Record* r, int line) {
+    PKey k = { (unsigned char)(r->kind & 1), r->key, r->keyLength, { 0 } };
+    uint64_t hash = hashKey(HEADER(pm)->seed, &k);
+    if (!(r->kind & RECORD_DELETE)) ensureRoom(pm, line);
+    uint64_t slot;
+    bool found = findSlot(pm, &k, hash, &slot);
+    PMapHeader* h = HEADER(pm);
+    PMapBucket* b = &BUCKETS(pm)[slot];
+    if (r->kind & RECORD_DELETE) {
+        if (!found) return;
+        b->offset = BUCKET_DELETED;
+        h->count--;
+        h->tombstones++;
+        return;
+    }
+    if (!found) {
+        if (b->offset == BUCKET_DELETED) h->tombstones--;
+        h->count++;
+        b->hash = hash;
+    }
+    b->offset = offset;
+}
+
+// Build a fresh index from the log. Replay stops at the first record that
+// is cut short or fails its checksum; the log is truncated there.
+static void rebuildIndex(PMap* pm, int line) {
+    if (pm->index) munmap(pm->index, pm->indexSize);
+    pm->index = NULL;
+    resizeFile(pm->fd, 0, line);
+    size_t size = PMAP_PAGE + PMAP_MIN_BUCKETS * sizeof(PMapBucket);
+    resizeFile(pm->fd, size, line);
+    pm->index = mapFile(pm->fd, size, line);
+    pm->indexSize = size;
+    PMapHeader* h = HEADER(pm);
+    memcpy(h->magic, pmapMagic, sizeof(h->magic));
+    h->version = PMAP_VERSION;
+    h->clean = 0;
+    h->seed = randomSeed();
+    h->generation = logGeneration(pm);
+    h->capacity = PMAP_MIN_BUCKETS;
+    h->count = 0;
+    h->tombstones = 0;
+    h->checksum = headerChecksum(h);
+    msync(pm->index, PMAP_PAGE, MS_SYNC);
+    pm->dirty = true;
+
+    uint64_t offset = LOG_HEADER_SIZE;
+    while (pm->logSize - offset >= RECORD_HEADER_SIZE) {
+        Record r;
+        readRecord(pm, offset, &r);
+        if (r.kind > (RECORD_DELETE | 1)) break;
+        if ((r.kind & 1) == KEY_INT && r.keyLength != 4) break;
+        if ((uint64_t)r.keyLength + r.valueLength > pm->logSize - offset - RECORD_HEADER_SIZE) break;
+        size_t rsize = recordSize(&r);
+        if (checksum32(pm->log + offset + 4, rsize - 4) != loadU32(pm->log + offset)) break;
+        applyRecord(pm, offset, &r, line);
+        offset += rsize;
+    }
+    HEADER(pm)->logLength = offset;
+    if (pm->logSize != offset) remapLog(pm, offset, line);
+}
+
+// Whether a mapped index is a cleanly closed index of the current log
+static bool indexIsCurrent(PMap* pm) {
+    if (pm->indexSize < PMAP_PAGE) return false;
+    const PMapHeader* h = HEADER(pm);
+    if (memcmp(h->magic, pmapMagic, sizeof(h->magic)) != 0 || h->version != PMAP_VERSION) return false;
+    if (h->checksum != headerChecksum(h) || h->clean != 1) return false;
+    if (h->generation != logGeneration(pm) || h->logLength != pm->logSize) return false;
+    if (h->capacity < PMAP_MIN_BUCKETS || (h->capacity & (h->capacity - 1)) != 0) return false;
+    if (pm->indexSize != PMAP_PAGE + h->capacity * sizeof(PMapBucket)) return false;
+    return h->count + h->tombstones < h->capacity;
+}
+
+// ---- Public API ----
+
+void pmapCloseAll(void) {
+    pthread_mutex_lock(&pmapsLock);
+    PMap* list = openPMaps;
+    openPMaps = NULL;
+    pthread_mutex_unlock(&pmapsLock);
+    while (list) {
+        PMap* next = list->next;
+        list->next = NULL;
+        pmapClose(list);
+        list = next;
+    }
+}
+
+PMap* pmapOpen(const char* path, int line) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        error("Could not open pmap file.", line);
+    }
+    pthread_mutex_lock(&pmapsLock);
+    for (PMap* pm = openPMaps; pm; pm = pm->next) {
+        if (pm->device == st.st_dev && pm->inode == st.st_ino) {
+            pthread_mutex_unlock(&pmapsLock);
+            close(fd);
+            return pm;
+        }
+    }
+    pthread_mutex_unlock(&pmapsLock);
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        error("pmap file is in use by another process.", line);
+    }
+    size_t pathLength = strlen(path);
+    char* logPath = malloc(pathLength + 5);
+    if (!logPath) error("Memory allocation failed.", line);
+    snprintf(logPath, pathLength + 5, "%s.log", path);
+    int logFd = open(logPath, O_RDWR | O_CREAT, 0644);
+    free(logPath);
+    struct stat logStat;
+    if (logFd < 0 || fstat(logFd, &logStat) != 0) {
+        close(fd);
+        if (logFd >= 0) close(logFd);
+        error("Could not open pmap log file.", line);
+    }
+
+    PMap* pm = calloc(1, sizeof(PMap));
+    if (!pm) error("Memory allocation failed.", line);
+    pm->path = strdup(path);
+    if (!pm->path) error("Memory allocation failed.", line);
+    pm->fd = fd;
+    pm->logFd = logFd;
+    pm->device = st.st_dev;
+    pm->inode = st.st_ino;
+    if (logStat.st_size == 0) {
+        resizeFile(logFd, LOG_HEADER_SIZE, line);
+        pm->log = mapFile(logFd, LOG_HEADER_SIZE, line);
+        pm->logSize = LOG_HEADER_SIZE;
+        uint64_t generation = 1;
+        memcpy(pm->log, logMagic, sizeof(logMagic));
+        memcpy(pm->log + 8, &generation, sizeof(generation));
+    } else {
+        pm->logSize = (size_t)logStat.st_size;
+        pm->log = mapFile(logFd, pm->logSize, line);
+        if (pm->logSize < LOG_HEADER_SIZE || memcmp(pm->log, logMagic, sizeof(logMagic)) != 0) {
+            munmap(pm->log, pm->logSize);
+            close(fd);
+            close(logFd);
+            free(pm->path);
+            free(pm);
+            error("pmap log file is not a pmap log.", line);
+        }
+    }
+    if (st.st_size >= PMAP_PAGE) {
+        pm->indexSize = (size_t)st.st_size;
+        pm->index = mapFile(fd, pm->indexSize, line);
+    }
+    if (!indexIsCurrent(pm)) rebuildIndex(pm, line);
+
+    pthread_mutex_lock(&pmapsLock);
+    pm->next = openPMaps;
+    openPMaps = pm;
+    if (!exitHookInstalled) {
+        exitHookInstalled = true;
+        atexit(pmapCloseAll);
+    }
+    pthread_mutex_unlock(&pmapsLock);
+    return pm;
+}
+
+static void requireOpen(PMap* pm, int line) {
+    if (pm->closed) error("pmap is closed.", line);
+}
+
+bool pmapGet(PMap* pm, Value key, Value* out, int line) {
+    requireOpen(pm, line);
+    PKey k;
+    keyFromValue(key, &k, line);
+    uint64_t slot;
+    if (!findSlot(pm, &k, hashKey(HEADER(pm)->seed, &k), &slot)) return false;
+    Record r;
+    readRecord(pm, BUCKETS(pm)[slot].offset, &r);
+    *out = deserializeValue(r.value, r.valueLength, line);
+    return true;
+}
+
+void pmapSet(PMap* pm, Value key, Value value, int line) {
+    requireOpen(pm, line);
+    PKey k;
+    keyFromValue(key, &k, line);
+    size_t length;
+    char* bytes = serializeValue(value, &length, line);
+    markDirty(pm);
+    uint64_t offset = appendRecord(pm, RECORD_SET, &k, bytes, length, line);
+    free(bytes);
+    Record r;
+    readRecord(pm, offset, &r);
+    applyRecord(pm, offset, &r, line);
+}
+
+bool pmapHas(PMap* pm, Value key, int line) {
+    requireOpen(pm, line);
+    PKey k;
+    keyFromValue(key, &k, line);
+    uint64_t slot;
+    return findSlot(pm, &k, hashKey(HEADER(pm)->seed, &k), &slot);
+}
+
+bool pmapDelete(PMap* pm, Value key, int line) {
+    requireOpen(pm, line);
+    PKey k;
+    keyFromValue(key, &k, line);
+    uint64_t slot;
+    if (!findSlot(pm, &k, hashKey(HEADER(pm)->seed, &k), &slot)) return false;
+    markDirty(pm);
+    uint64_t offset = appendRecord(pm, RECORD_DELETE, &k, NULL, 0, line);
+    Record r;
+    readRecord(pm, offset, &r);
+    applyRecord(pm, offset, &r, line);
+    return true;
+}
+
+Array* pmapKeys(PMap* pm, bool intKeys, int line) {
+    requireOpen(pm, line);
+    Array* keys = newArray();
+    PMapBucket* buckets = BUCKETS(pm);
+    uint64_t capacity = HEADER(pm)->capacity;
+    for (uint64_t i = 0; i < capacity; i++) {
+        if (buckets[i].offset == 0 || buckets[i].offset == BUCKET_DELETED) continue;
+        Record r;
+        readRecord(pm, buckets[i].offset, &r);
+        char* s;
+        if ((r.kind & 1) == KEY_INT && intKeys) {
+            arrayPush(keys, INT_VAL((int)loadU32(r.key)));
+            continue;
+        } else if ((r.kind & 1) == KEY_INT) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%d", (int)loadU32(r.key));
+            s = strdup(buf);
+        } else {
+            s = malloc((size_t)r.keyLength + 1);
+            if (s) {
+                memcpy(s, r.key, r.keyLength);
+                s[r.keyLength] = '\0';
+            }
+        }
+        if (!s) error("Memory allocation failed.", line);
+        arrayPush(keys, STRING_VAL(s));
+    }
+    return keys;
+}
+
+int pmapCount(PMap* pm) {
+    return pm->closed ? 0 : (int)HEADER(pm)->count;
+}
+
+size_t pmapCompact(PMap* pm, int line) {
+    requireOpen(pm, line);
+    markDirty(pm);
+    PMapHeader* h = HEADER(pm);
+    PMapBucket* buckets = BUCKETS(pm);
+    size_t live = LOG_HEADER_SIZE;
+    for (uint64_t i = 0; i < h->capacity; i++) {
+        if (buckets[i].offset == 0 || buckets[i].offset == BUCKET_DELETED) continue;
+        Record r;
+        readRecord(pm, buckets[i].offset, &r);
+        live += recordSize(&r);
+    }
+
+    // Write the live records to a new log under the next generation. Until
+    // it is renamed into place, a crash leaves the old log and a dirty
+    // index, which reopening rebuilds.
+    size_t pathLength = strlen(pm->path);
+    char* logPath = malloc(pathLength + 5);
+    char* tempPath = malloc(pathLength + 9);
+    if (!logPath || !tempPath) error("Memory allocation failed.", line);
+    snprintf(logPath, pathLength + 5, "%s.log", pm->path);
+    snprintf(tempPath, pathLength + 9, "%s.log.tmp", pm->path);
+    int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(logPath);
+        free(tempPath);
+        error("Could not write pmap log file.", line);
+    }
+    resizeFile(fd, live, line);
+    char* log = mapFile(fd, live, line);
+    uint64_t generation = logGeneration(pm) + 1;
+    memcpy(log, logMagic, sizeof(logMagic));
+    memcpy(log + 8, &generation, sizeof(generation));
+    size_t used = LOG_HEADER_SIZE;
+    for (uint64_t i = 0; i < h->capacity; i++) {
+        if (buckets[i].offset == 0 || buckets[i].offset == BUCKET_DELETED) continue;
+        Record r;
+        readRecord(pm, buckets[i].offset, &r);
+        size_t size = recordSize(&r);
+        memcpy(log + used, pm->log + buckets[i].offset, size);
+        buckets[i].offset = used;
+        used += size;
+    }
+    bool ok = msync(log, live, MS_SYNC) == 0 && fsync(fd) == 0 && rename(tempPath, logPath) == 0;
+    free(logPath);
+    if (!ok) {
+        munmap(log, live);
+        close(fd);
+        unlink(tempPath);
+        free(tempPath);
+        error("Could not write pmap log file.", line);
+    }
+    free(tempPath);
+
+    size_t reclaimed = h->logLength - live;
+    munmap(pm->log, pm->logSize);
+    close(pm->logFd);
+    pm->log = log;
+    pm->logSize = live;
+    pm->logFd = fd;
+    h->generation = generation;
+    h->logLength = live;
+    uint64_t capacity = capacityFor(h->count);
+    if (h->tombstones > 0 || capacity < h->capacity) resizeTable(pm, capacity, line);
+    syncClean(pm, line);
+    return reclaimed;
+}
+
+void pmapClose(PMap* pm) {
+    if (pm->closed) return;
+    syncClean(pm, 0);
+    munmap(pm->index, pm->indexSize);
+    munmap(pm->log, pm->logSize);
+    close(pm->logFd);
+    close(pm->fd); // releases the lock
+    pm->closed = true;
+    pthread_mutex_lock(&pmapsLock);
+    for (PMap** link = &openPMaps; *link; link = &(*link)->next) {
+        if (*link == pm) {
+            *link = pm->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pmapsLock);
+}
+
+bool pmapIsClosed(PMap* pm) {
+    return pm->closed;
+}
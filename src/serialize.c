@@ -0,0 +1,662 @@
+#include "serialize.h"
+#include "fileio.h"
+#include <limits.h>
+#include <stdint.h>
+
+static const char serialMagic[4] = { 'G', 'E', 'M', 'V' };
+
+// Magic, version byte, payload length
+#define SERIAL_HEADER_SIZE 13
+
+// Arrays at least this long that hold only ints (only floats) are written
+// as a block of 4-byte (8-byte) numbers instead of tagged values
+#define SERIAL_BULK_MIN 4
+
+enum {
+    TAG_NULL,               // null string
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INT,                // zigzag varint
+    TAG_FLOAT,              // 8 bytes
+    TAG_STRING,             // varint length, bytes
+    TAG_ARRAY,              // varint count, values
+    TAG_MAP,                // varint count, (key, value) pairs
+    TAG_INTS,               // varint count, 4 bytes each
+    TAG_FLOATS,             // varint count, 8 bytes each
+    TAG_REF                 // varint id of an array or map already read
+};
+
+// Map keys: a kind byte, then a varint length and bytes, or a zigzag varint
+enum { KEY_STRING, KEY_INT };
+
+static inline uint32_t zigzag(int i) {
+    return ((uint32_t)i << 1) ^ (uint32_t)(i >> 31);
+}
+
+static inline int unzigzag(uint32_t u) {
+    return (int)((u >> 1) ^ (0u - (u & 1)));
+}
+
+// ---- Encoding ----
+
+// Open array or map: next element to write
+typedef struct {
+    Value container;
+    int index;              // arrays
+    MapEntry* entry;        // maps
+} EncodeFrame;
+
+typedef struct {
+    char* chars;
+    size_t length;
+    size_t capacity;
+    int line;
+    // Id of each array and map written so far (open addressing by pointer)
+    const void** seen;
+    size_t* seenIds;
+    size_t seenCapacity;    // power of two
+    size_t nextId;
+    EncodeFrame* stack;
+    int depth;
+    int stackCapacity;
+} Encoder;
+
+static void encodeFail(Encoder* e, const char* message) {
+    free(e->chars);
+    free(e->seen);
+    free(e->seenIds);
+    free(e->stack);
+    e->chars = NULL;
+    e->seen = NULL;
+    e->seenIds = NULL;
+    e->stack = NULL;
+    error(message, e->line);
+}
+
+static void encoderReserve(Encoder* e, size_t extra) {
+    if (e->length + extra <= e->capacity) return;
+    size_t cap = e->capacity * 2;
+    if (cap < e->length + extra) cap = e->length + extra;
+    char* grown = realloc(e->chars, cap);
+    if (!grown) encodeFail(e, "Memory allocation failed.");
+    e->chars = grown;
+    e->capacity = cap;
+}
+
+static inline void putByte(Encoder* e, unsigned char b) {
+    encoderReserve(e, 1);
+    e->chars[e->length++] = (char)b;
+}
+
+static inline void putVarint(Encoder* e, uint64_t u) {
+    encoderReserve(e, 10);
+    unsigned char* out = (unsigned char*)e->chars + e->length;
+    size_t n = 0;
+    while (u >= 0x80) {
+        out[n++] = (unsigned char)(u | 0x80);
+        u >>= 7;
+    }
+    out[n++] = (unsigned char)u;
+    e->length += n;
+}
+
+static inline void storeU32(unsigned char* out, uint32_t u) {
+    out[0] = (unsigned char)u;
+    out[1] = (unsigned char)(u >> 8);
+    out[2] = (unsigned char)(u >> 16);
+    out[3] = (unsigned char)(u >> 24);
+}
+
+static inline void storeU64(unsigned char* out, uint64_t u) {
+    storeU32(out, (uint32_t)u);
+    storeU32(out + 4, (uint32_t)(u >> 32));
+}
+
+static inline void storeDouble(unsigned char* out, double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    storeU64(out, bits);
+}
+
+static void putBytes(Encoder* e, const char* bytes, size_t length) {
+    putVarint(e, length);
+    encoderReserve(e, length);
+    memcpy(e->chars + e->length, bytes, length);
+    e->length += length;
+}
+
+static inline size_t hashPointer(const void* p) {
+    uint64_t x = (uint64_t)(uintptr_t)p;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return (size_t)x;
+}
+
+// Id of an array or map seen before; otherwise assigns the next id and
+// returns false
+static bool seenBefore(Encoder* e, const void* p, size_t* id) {
+    if (!p) {
+        // Null containers are written as empty ones but still take an id
+        *id = e->nextId++;
+        return false;
+    }
+    if ((e->nextId + 1) * 2 > e->seenCapacity) {
+        size_t cap = e->seenCapacity ? e->seenCapacity * 2 : 64;
+        const void** keys = calloc(cap, sizeof(void*));
+        size_t* ids = malloc(cap * sizeof(size_t));
+        if (!keys || !ids) {
+            free(keys);
+            free(ids);
+            encodeFail(e, "Memory allocation failed.");
+        }
+        for (size_t i = 0; i < e->seenCapacity; i++) {
+            if (!e->seen[i]) continue;
+            size_t slot = hashPointer(e->seen[i]) & (cap - 1);
+            while (keys[slot]) slot = (slot + 1) & (cap - 1);
+            keys[slot] = e->seen[i];
+            ids[slot] = e->seenIds[i];
+        }
+        free(e->seen);
+        free(e->seenIds);
+        e->seen = keys;
+        e->seenIds = ids;
+        e->seenCapacity = cap;
+    }
+    size_t slot = hashPointer(p) & (e->seenCapacity - 1);
+    while (e->seen[slot]) {
+        if (e->seen[slot] == p) {
+            *id = e->seenIds[slot];
+            return true;
+        }
+        slot = (slot + 1) & (e->seenCapacity - 1);
+    }
+    e->seen[slot] = p;
+    e->seenIds[slot] = e->nextId;
+    *id = e->nextId++;
+    return false;
+}
+
+static void pushEncodeFrame(Encoder* e, Value container, MapEntry* entry) {
+    if (e->depth == e->stackCapacity) {
+        int cap = e->stackCapacity ? e->stackCapacity * 2 : 32;
+        EncodeFrame* grown = realloc(e->stack, (size_t)cap * sizeof(EncodeFrame));
+        if (!grown) encodeFail(e, "Memory allocation failed.");
+        e->stack = grown;
+        e->stackCapacity = cap;
+    }
+    e->stack[e->depth++] = (EncodeFrame){ container, 0, entry };
+}
+
+// Write an int or float array as one block; false if it is mixed
+static bool putNumberBlock(Encoder* e, Array* a) {
+    int count = a->count;
+    if (count < SERIAL_BULK_MIN) return false;
+    bool ints = IS_INT(a->items[0]);
+    if (!ints && !IS_FLOAT(a->items[0])) return false;
+    for (int i = 1; i < count; i++) {
+        if (ints ? !IS_INT(a->items[i]) : !IS_FLOAT(a->items[i])) return false;
+    }
+    size_t width = ints ? 4 : 8;
+    putByte(e, ints ? TAG_INTS : TAG_FLOATS);
+    putVarint(e, (uint64_t)count);
+    encoderReserve(e, (size_t)count * width);
+    unsigned char* out = (unsigned char*)e->chars + e->length;
+    if (ints) {
+        for (int i = 0; i < count; i++) storeU32(out + (size_t)i * 4, (uint32_t)AS_INT(a->items[i]));
+    } else {
+        for (int i = 0; i < count; i++) storeDouble(out + (size_t)i * 8, AS_FLOAT(a->items[i]));
+    }
+    e->length += (size_t)count * width;
+    return true;
+}
+
+// Write a scalar, a reference, or the head of a new array or map (whose
+// elements follow through the frame it pushes)
+static void encodeValue(Encoder* e, Value v) {
+    switch (VALUE_TYPE(v)) {
+        case VAL_INT:
+            putByte(e, TAG_INT);
+            putVarint(e, zigzag(AS_INT(v)));
+            return;
+        case VAL_FLOAT:
+            putByte(e, TAG_FLOAT);
+            encoderReserve(e, 8);
+            storeDouble((unsigned char*)e->chars + e->length, AS_FLOAT(v));
+            e->length += 8;
+            return;
+        case VAL_STRING:
+            if (!AS_STRING(v)) {
+                putByte(e, TAG_NULL);
+                return;
+            }
+            putByte(e, TAG_STRING);
+            putBytes(e, AS_STRING(v), strlen(AS_STRING(v)));
+            return;
+        case VAL_BOOL:
+            putByte(e, AS_BOOL(v) ? TAG_TRUE : TAG_FALSE);
+            return;
+        case VAL_MODULE:
+            encodeFail(e, "serialize() cannot encode a module.");
+            return;
+        case VAL_FILE:
+            encodeFail(e, "serialize() cannot encode a file.");
+            return;
+        case VAL_PMAP:
+            encodeFail(e, "serialize() cannot encode a pmap.");
+            return;
+        case VAL_ARRAY:
+        case VAL_MAP:
+            break;
+    }
+    size_t id;
+    const void* p = IS_ARRAY(v) ? (const void*)AS_ARRAY(v) : (const void*)AS_MAP(v);
+    if (seenBefore(e, p, &id)) {
+        putByte(e, TAG_REF);
+        putVarint(e, id);
+        return;
+    }
+    if (IS_ARRAY(v)) {
+        Array* a = AS_ARRAY(v);
+        if (a && putNumberBlock(e, a)) return;
+        int count = a ? a->count : 0;
+        putByte(e, TAG_ARRAY);
+        putVarint(e, (uint64_t)count);
+        if (count > 0) pushEncodeFrame(e, v, NULL);
+        return;
+    }
+    Map* m = AS_MAP(v);
+    int count = m ? m->count : 0;
+    putByte(e, TAG_MAP);
+    putVarint(e, (uint64_t)count);
+    if (count > 0) pushEncodeFrame(e, v, m->first);
+}
+
+char* serializeValue(Value value, size_t* length, int line) {
+    Encoder e = { 0 };
+    e.line = line;
+    encoderReserve(&e, 256);
+    memcpy(e.chars, serialMagic, sizeof(serialMagic));
+    e.chars[4] = SERIAL_VERSION;
+    e.length = SERIAL_HEADER_SIZE;
+
+    encodeValue(&e, value);
+    while (e.depth > 0) {
+        EncodeFrame* f = &e.stack[e.depth - 1];
+        if (IS_ARRAY(f->container)) {
+            Array* a = AS_ARRAY(f->container);
+            if (f->index == a->count) {
+                e.depth--;
+                continue;
+            }
+            encodeValue(&e, a->items[f->index++]);
+            continue;
+        }
+        MapEntry* entry = f->entry;
+        if (!entry) {
+            e.depth--;
+            continue;
+        }
+        f->entry = entry->after;
+        if (entry->isIntKey) {
+            putByte(&e, KEY_INT);
+            putVarint(&e, zigzag(entry->intKey));
+        } else {
+            putByte(&e, KEY_STRING);
+            putBytes(&e, entry->key, strlen(entry->key));
+        }
+        encodeValue(&e, entry->value);
+    }
+
+    storeU64((unsigned char*)e.chars + 5, (uint64_t)(e.length - SERIAL_HEADER_SIZE));
+    free(e.seen);
+    free(e.seenIds);
+    free(e.stack);
+    *length = e.length;
+    return e.chars;
+}
+
+// ---- Decoding ----
+
+// Open array or map: elements still to read
+typedef struct {
+    Value container;
+    size_t remaining;
+} DecodeFrame;
+
+typedef struct {
+    const unsigned char* start;
+    const unsigned char* p;
+    const unsigned char* end;
+    int line;
+    Value* refs;            // arrays and maps by id
+    size_t refCount;
+    size_t refCapacity;
+    DecodeFrame* stack;
+    int depth;
+    int stackCapacity;
+    FileContents* file;     // mapped input (loadValue), released on failure
+    char* owned;            // decoded base64 (deserialize), freed on failure
+} Decoder;
+
+static void decodeFail(Decoder* d, const char* what) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Invalid serialized data: %s at offset %zu.", what, (size_t)(d->p - d->start));
+    free(d->refs);
+    free(d->stack);
+    free(d->owned);
+    if (d->file) fileReleaseAll(d->file);
+    error(msg, d->line);
+}
+
+static inline void need(Decoder* d, size_t length) {
+    if ((size_t)(d->end - d->p) < length) decodeFail(d, "truncated data");
+}
+
+static inline unsigned char getByte(Decoder* d) {
+    need(d, 1);
+    return *d->p++;
+}
+
+static uint64_t getVarint(Decoder* d) {
+    uint64_t u = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char b = getByte(d);
+        u |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return u;
+    }
+    decodeFail(d, "varint too long");
+    return 0;
+}
+
+static int getZigzag(Decoder* d) {
+    uint64_t u = getVarint(d);
+    if (u > UINT32_MAX) decodeFail(d, "int out of range");
+    return unzigzag((uint32_t)u);
+}
+
+// Element count of a container whose elements take at least width bytes each
+static size_t getCount(Decoder* d, size_t width) {
+    uint64_t count = getVarint(d);
+    if (count > INT_MAX || count > (uint64_t)(d->end - d->p) / width) decodeFail(d, "count exceeds data");
+    return (size_t)count;
+}
+
+static inline uint32_t loadU32(const unsigned char* in) {
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static inline uint64_t loadU64(const unsigned char* in) {
+    return (uint64_t)loadU32(in) | (uint64_t)loadU32(in + 4) << 32;
+}
+
+static inline double loadDouble(const unsigned char* in) {
+    uint64_t bits = loadU64(in);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static void addRef(Decoder* d, Value v) {
+    if (d->refCount == d->refCapacity) {
+        size_t cap = d->refCapacity ? d->refCapacity * 2 : 64;
+        Value* grown = realloc(d->refs, cap * sizeof(Value));
+        if (!grown) decodeFail(d, "out of memory");
+        d->refs = grown;
+        d->refCapacity = cap;
+    }
+    d->refs[d->refCount++] = v;
+}
+
+static void pushDecodeFrame(Decoder* d, Value container, size_t remaining) {
+    if (d->depth == d->stackCapacity) {
+        int cap = d->stackCapacity ? d->stackCapacity * 2 : 32;
+        DecodeFrame* grown = realloc(d->stack, (size_t)cap * sizeof(DecodeFrame));
+        if (!grown) decodeFail(d, "out of memory");
+        d->stack = grown;
+        d->stackCapacity = cap;
+    }
+    d->stack[d->depth++] = (DecodeFrame){ container, remaining };
+}
+
+// Array with room for count elements
+static Array* sizedArray(Decoder* d, size_t count) {
+    Array* a = newArray();
+    if (count > 0) {
+        a->items = malloc(count * sizeof(Value));
+        if (!a->items) decodeFail(d, "out of memory");
+        a->capacity = (int)count;
+    }
+    return a;
+}
+
+// Read a scalar, a reference, or a new array or map (whose elements are
+// read through the frame it pushes)
+static Value decodeValue(Decoder* d) {
+    unsigned char tag = getByte(d);
+    switch (tag) {
+        case TAG_NULL:
+            return STRING_VAL(NULL);
+        case TAG_FALSE:
+        case TAG_TRUE:
+            return BOOL_VAL(tag == TAG_TRUE);
+        case TAG_INT:
+            return INT_VAL(getZigzag(d));
+        case TAG_FLOAT: {
+            need(d, 8);
+            double f = loadDouble(d->p);
+            d->p += 8;
+            return FLOAT_VAL(f);
+        }
+        case TAG_STRING: {
+            size_t length = getCount(d, 1);
+            const char* bytes = (const char*)d->p;
+            d->p += length;
+            if (length <= 1) return STRING_VAL(charStrings[length ? (unsigned char)bytes[0] : 0]);
+            char* s = malloc(length + 1);
+            if (!s) decodeFail(d, "out of memory");
+            memcpy(s, bytes, length);
+            s[length] = '\0';
+            return STRING_VAL(s);
+        }
+        case TAG_INTS:
+        case TAG_FLOATS: {
+            size_t width = tag == TAG_INTS ? 4 : 8;
+            size_t count = getCount(d, width);
+            Array* a = sizedArray(d, count);
+            const unsigned char* in = d->p;
+            if (tag == TAG_INTS) {
+                for (size_t i = 0; i < count; i++) a->items[i] = INT_VAL((int)loadU32(in + i * 4));
+            } else {
+                for (size_t i = 0; i < count; i++) a->items[i] = FLOAT_VAL(loadDouble(in + i * 8));
+            }
+            a->count = (int)count;
+            d->p += count * width;
+            addRef(d, ARRAY_VAL(a));
+            return ARRAY_VAL(a);
+        }
+        case TAG_ARRAY: {
+            size_t count = getCount(d, 1);
+            Value v = ARRAY_VAL(sizedArray(d, count));
+            addRef(d, v);
+            if (count > 0) pushDecodeFrame(d, v, count);
+            return v;
+        }
+        case TAG_MAP: {
+            size_t count = getCount(d, 3);
+            Value v = MAP_VAL(newMap());
+            addRef(d, v);
+            if (count > 0) pushDecodeFrame(d, v, count);
+            return v;
+        }
+        case TAG_REF: {
+            uint64_t id = getVarint(d);
+            if (id >= d->refCount) decodeFail(d, "reference to an unknown id");
+            return d->refs[id];
+        }
+        default:
+            d->p--;
+            decodeFail(d, "unknown tag");
+            return INT_VAL(0);
+    }
+}
+
+static Value decode(Decoder* d) {
+    if (d->end - d->p < SERIAL_HEADER_SIZE || memcmp(d->p, serialMagic, sizeof(serialMagic)) != 0) {
+        decodeFail(d, "not a serialized value");
+    }
+    if (d->p[4] != SERIAL_VERSION) {
+        char what[64];
+        snprintf(what, sizeof(what), "unsupported version %d", d->p[4]);
+        decodeFail(d, what);
+    }
+    if (loadU64(d->p + 5) != (uint64_t)(d->end - d->p - SERIAL_HEADER_SIZE)) {
+        decodeFail(d, "payload length does not match");
+    }
+    d->p += SERIAL_HEADER_SIZE;
+
+    Value root = decodeValue(d);
+    while (d->depth > 0) {
+        DecodeFrame* f = &d->stack[d->depth - 1];
+        if (f->remaining == 0) {
+            d->depth--;
+            continue;
+        }
+        f->remaining--;
+        // decodeValue may push a frame and move the stack
+        Value container = f->container;
+        if (d->file) fileReleaseBefore(d->file, (size_t)(d->p - d->start));
+        if (IS_ARRAY(container)) {
+            Array* a = AS_ARRAY(container);
+            Value item = decodeValue(d);
+            a->items[a->count++] = item;
+            continue;
+        }
+        Map* m = AS_MAP(container);
+        unsigned char kind = getByte(d);
+        if (kind == KEY_INT) {
+            int key = getZigzag(d);
+            mapSetInt(m, key, decodeValue(d));
+        } else {
+            if (kind != KEY_STRING) {
+                d->p--;
+                decodeFail(d, "unknown key kind");
+            }
+            size_t length = getCount(d, 1);
+            const char* key = (const char*)d->p;
+            d->p += length;
+            mapSetStr(m, key, (int)length, decodeValue(d));
+        }
+    }
+    if (d->p != d->end) decodeFail(d, "trailing bytes");
+    free(d->refs);
+    free(d->stack);
+    return root;
+}
+
+Value deserializeValue(const char* data, size_t length, int line) {
+    Decoder d = { 0 };
+    d.start = d.p = (const unsigned char*)data;
+    d.end = d.start + length;
+    d.line = line;
+    return decode(&d);
+}
+
+// ---- Base64 text ----
+
+static const char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+char* serializeText(Value value, int line) {
+    size_t length;
+    unsigned char* bytes = (unsigned char*)serializeValue(value, &length, line);
+    char* text = malloc((length + 2) / 3 * 4 + 1);
+    if (!text) error("Memory allocation failed.", line);
+    char* out = text;
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t group = (uint32_t)bytes[i] << 16 | (uint32_t)bytes[i + 1] << 8 | bytes[i + 2];
+        *out++ = base64Digits[group >> 18];
+        *out++ = base64Digits[(group >> 12) & 63];
+        *out++ = base64Digits[(group >> 6) & 63];
+        *out++ = base64Digits[group & 63];
+    }
+    if (i < length) {
+        uint32_t group = (uint32_t)bytes[i] << 16 | (i + 1 < length ? (uint32_t)bytes[i + 1] << 8 : 0);
+        *out++ = base64Digits[group >> 18];
+        *out++ = base64Digits[(group >> 12) & 63];
+        *out++ = i + 1 < length ? base64Digits[(group >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+    *out = '\0';
+    free(bytes);
+    return text;
+}
+
+static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+Value deserializeText(const char* text, size_t length, int line) {
+    while (length > 0 && text[length - 1] == '=') length--;
+    if (length % 4 == 1) error("deserialize() requires text made by serialize().", line);
+    unsigned char* bytes = malloc(length / 4 * 3 + 3);
+    if (!bytes) error("Memory allocation failed.", line);
+    size_t n = 0;
+    uint32_t group = 0;
+    for (size_t i = 0; i < length; i++) {
+        int digit = base64Value(text[i]);
+        if (digit < 0) {
+            free(bytes);
+            error("deserialize() requires text made by serialize().", line);
+        }
+        group = group << 6 | (uint32_t)digit;
+        if (i % 4 == 3) {
+            bytes[n++] = (unsigned char)(group >> 16);
+            bytes[n++] = (unsigned char)(group >> 8);
+            bytes[n++] = (unsigned char)group;
+        }
+    }
+    if (length % 4 == 2) {
+        bytes[n++] = (unsigned char)(group >> 4);
+    } else if (length % 4 == 3) {
+        bytes[n++] = (unsigned char)(group >> 10);
+        bytes[n++] = (unsigned char)(group >> 2);
+    }
+    Decoder d = { 0 };
+    d.start = d.p = bytes;
+    d.end = bytes + n;
+    d.line = line;
+    d.owned = (char*)bytes;
+    Value v = decode(&d);
+    free(bytes);
+    return v;
+}
+
+// ---- Files ----
+
+size_t saveValueFile(const char* path, Value value, int line) {
+    size_t length;
+    char* bytes = serializeValue(value, &length, line);
+    bool ok = fileSaveAll(path, bytes, length);
+    free(bytes);
+    if (!ok) error("Could not write file.", line);
+    return length;
+}
+
+Value loadValueFile(const char* path, int line) {
+    FileContents contents;
+    if (!fileLoadAll(path, &contents)) error("Could not read file.", line);
+    Decoder d = { 0 };
+    d.start = d.p = (const unsigned char*)contents.data;
+    d.end = d.start + contents.size;
+    d.line = line;
+    d.file = &contents;
+    Value v = decode(&d);
+    fileReleaseAll(&contents);
+    return v;
+}
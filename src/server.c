@@ -0,0 +1,515 @@
+#define _DEFAULT_SOURCE // realpath
+#include "server.h"
+#include "lexer.h"
+#include "parser.h"
+#include "vm.h"
+#include "output.h"
+#include "optimizer.h"
+#include "fileio.h"
+#include "pmap.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------------
+// Framing
+// ---------------------------------------------------------------------------
+
+static bool writeFully(int fd, const void* data, size_t length) {
+    const char* p = data;
+    while (length > 0) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static bool readFully(int fd, void* data, size_t length) {
+    char* p = data;
+    while (length > 0) {
+        ssize_t n = read(fd, p, length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+static bool sendFrame(int fd, char type, const void* payload, uint32_t length) {
+    char header[5];
+    header[0] = type;
+    memcpy(header + 1, &length, sizeof(length));
+    return writeFully(fd, header, sizeof(header)) && writeFully(fd, payload, length);
+}
+
+// Read a frame header; the caller reads the payload
+static bool readFrameHeader(int fd, char* type, uint32_t* length) {
+    char header[5];
+    if (!readFully(fd, header, sizeof(header))) return false;
+    *type = header[0];
+    memcpy(length, header + 1, sizeof(*length));
+    return true;
+}
+
+static bool socketAddress(const char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return false;
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Program cache
+// ---------------------------------------------------------------------------
+
+// A parsed file, valid while the file keeps the same size and mtime
+typedef struct CachedProgram {
+    char* path;
+    off_t size;
+    struct timespec mtime;
+    char* source;               // Tokens point into it
+    Node* ast;
+    int tokenCount;             // For the CLI's "Tokenized ..." banner
+    struct CachedProgram* next;
+} CachedProgram;
+
+// Result of the project-tree search for an imported file
+typedef struct ResolvedModule {
+    char* projectRoot;
+    char* fileName;
+    char* path;
+    struct ResolvedModule* next;
+} ResolvedModule;
+
+static CachedProgram* programs = NULL;
+// Programs replaced during a run; their ASTs may still be referenced by the
+// running VM, so they are freed once it finishes.
+static CachedProgram* retired = NULL;
+static ResolvedModule* resolved = NULL;
+// Optimizer level applied to every cached program (--serve -O)
+static int optLevel = OPT_LEVEL_DEFAULT;
+
+static void freeProgram(CachedProgram* program) {
+    freeAST(program->ast);
+    free(program->source);
+    free(program->path);
+    free(program);
+}
+
+static void freeRetired(void) {
+    while (retired) {
+        CachedProgram* next = retired->next;
+        freeProgram(retired);
+        retired = next;
+    }
+}
+
+// Parsed program for a file, reparsing it if it changed since it was cached.
+// Returns NULL when the file cannot be read; parse errors go through error().
+static CachedProgram* loadProgram(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+
+    CachedProgram** link = &programs;
+    for (; *link; link = &(*link)->next) {
+        if (strcmp((*link)->path, path) == 0) break;
+    }
+    CachedProgram* cached = *link;
+    if (cached && cached->size == st.st_size &&
+        cached->mtime.tv_sec == st.st_mtim.tv_sec && cached->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return cached;
+    }
+
+    char* source = readFileAll(path);
+    if (!source) return NULL;
+    CachedProgram* program = calloc(1, sizeof(CachedProgram));
+    if (!program) error("Memory allocation failed.", 0);
+    program->source = source;
+
+    Lexer lexer;
+    initLexer(&lexer, source);
+    Parser parser;
+    initParser(&parser);
+    while (true) {
+        Token token = scanToken(&lexer);
+        addToken(&parser, token);
+        if (token.type == TOKEN_EOF) break;
+    }
+    program->tokenCount = parser.count;
+    program->ast = parse(&parser);
+    freeParser(&parser);
+    optimize(program->ast, optLevel, false);
+
+    program->path = strdup(path);
+    if (!program->path) error("Memory allocation failed.", 0);
+    program->size = st.st_size;
+    program->mtime = st.st_mtim;
+
+    // Swap in the new version; the old one retires until the run ends
+    if (cached) {
+        *link = cached->next;
+        cached->next = retired;
+        retired = cached;
+    }
+    program->next = programs;
+    programs = program;
+    return program;
+}
+
+// VM module loader: cached resolution and parse of an imported file
+static Node* loadModule(void* user, const char* projectRoot, const char* fileName, int line) {
+    (void)user;
+    ResolvedModule* entry = resolved;
+    while (entry && (strcmp(entry->fileName, fileName) != 0 || strcmp(entry->projectRoot, projectRoot) != 0)) {
+        entry = entry->next;
+    }
+    struct stat st;
+    if (!entry || stat(entry->path, &st) != 0) {
+        // First import, or the file moved: search again
+        char* path = resolveModulePath(projectRoot, fileName);
+        if (!path) return NULL;
+        if (!entry) {
+            entry = malloc(sizeof(ResolvedModule));
+            if (!entry) error("Memory allocation failed.", line);
+            entry->projectRoot = strdup(projectRoot);
+            entry->fileName = strdup(fileName);
+            if (!entry->projectRoot || !entry->fileName) error("Memory allocation failed.", line);
+            entry->next = resolved;
+            resolved = entry;
+        } else {
+            free(entry->path);
+        }
+        entry->path = path;
+    }
+    CachedProgram* program = loadProgram(entry->path);
+    if (!program) error("Failed to read module file.", line);
+    return program->ast;
+}
+
+// ---------------------------------------------------------------------------
+// Server
+// ---------------------------------------------------------------------------
+
+// Most script arguments accepted in one request
+#define RUN_MAX_ARGS 4096
+
+// Output of the run being served, sent to the client in large frames
+typedef struct {
+    int fd;
+    bool unbuffered;
+    bool disconnected;
+    size_t length;
+    char buffer[OUTPUT_BUFFER_SIZE];
+} Connection;
+
+static void flushConnection(Connection* conn) {
+    if (conn->length > 0 && !conn->disconnected) {
+        if (!sendFrame(conn->fd, FRAME_STDOUT, conn->buffer, (uint32_t)conn->length)) {
+            conn->disconnected = true;
+        }
+    }
+    conn->length = 0;
+}
+
+// VM print destination
+static void connectionOutput(void* user, const char* text, size_t length) {
+    Connection* conn = user;
+    if (conn->length + length > sizeof(conn->buffer)) flushConnection(conn);
+    if (length >= sizeof(conn->buffer)) {
+        if (!conn->disconnected && !sendFrame(conn->fd, FRAME_STDOUT, text, (uint32_t)length)) {
+            conn->disconnected = true;
+        }
+    } else {
+        memcpy(conn->buffer + conn->length, text, length);
+        conn->length += length;
+    }
+    if (conn->unbuffered) flushConnection(conn);
+    // Nobody is listening any more: stop the script
+    if (conn->disconnected) error("Client disconnected.", 0);
+}
+
+// Warnings go to the client's stderr, after the output printed before them
+static void connectionWarning(void* user, const char* text, size_t length) {
+    Connection* conn = user;
+    flushConnection(conn);
+    if (!conn->disconnected && !sendFrame(conn->fd, FRAME_STDERR, text, (uint32_t)length)) {
+        conn->disconnected = true;
+    }
+}
+
+static int finishRun(Connection* conn, int status) {
+    flushConnection(conn);
+    uint32_t code = (uint32_t)status;
+    if (!conn->disconnected) sendFrame(conn->fd, FRAME_EXIT, &code, sizeof(code));
+    return status;
+}
+
+static int failRun(Connection* conn, const char* message) {
+    flushConnection(conn);
+    if (!conn->disconnected) sendFrame(conn->fd, FRAME_STDERR, message, (uint32_t)strlen(message));
+    return finishRun(conn, 1);
+}
+
+// Run one request: flags, script, working directory, arguments
+// Files a script leaves open are closed when its run ends, as exit would
+// do for a direct run: buffered output reaches the file and pmap locks are
+// released for the next run. Runs are serialized, so every open handle
+// belongs to the run that just ended.
+static void closeRunFiles(void) {
+    fileCloseAll();
+    pmapCloseAll();
+}
+
+static void serveRequest(Connection* conn, char* payload, uint32_t length) {
+    char* fields[RUN_MAX_ARGS + 2];
+    int fieldCount = 0;
+    if (length < 1 || payload[length - 1] != '\0') {
+        failRun(conn, "Malformed request.\n");
+        return;
+    }
+    int flags = (unsigned char)payload[0];
+    for (uint32_t i = 1; i < length; i += (uint32_t)strlen(payload + i) + 1) {
+        if (fieldCount == RUN_MAX_ARGS + 2) {
+            failRun(conn, "Too many arguments.\n");
+            return;
+        }
+        fields[fieldCount++] = payload + i;
+    }
+    if (fieldCount < 2) {
+        failRun(conn, "Malformed request.\n");
+        return;
+    }
+    const char* script = fields[0];
+    const char* cwd = fields[1];
+    conn->unbuffered = (flags & RUN_FLAG_UNBUFFERED) != 0;
+
+    // Relative file names in the script mean what they would for the client
+    char message[512];
+    if (chdir(cwd) != 0) {
+        snprintf(message, sizeof(message), "Could not enter directory \"%s\".\n", cwd);
+        failRun(conn, message);
+        return;
+    }
+
+    VM* vm = malloc(sizeof(VM));
+    if (!vm) {
+        failRun(conn, "Memory allocation failed.\n");
+        return;
+    }
+    ErrorContext ctx;
+    if (setjmp(ctx.jump) != 0) {
+        popErrorContext(&ctx);
+        closeRunFiles();
+        freeVM(vm);
+        free(vm);
+        freeRetired();
+        snprintf(message, sizeof(message), "[line %d] Error: %s\n", ctx.line, ctx.message);
+        failRun(conn, message);
+        return;
+    }
+    pushErrorContext(&ctx);
+    initVM(vm);
+    snprintf(vm->projectRoot, sizeof(vm->projectRoot), "%s", cwd);
+    vm->jitEnabled = (flags & RUN_FLAG_JIT) && jitAvailable();
+    vm->optLevel = optLevel;
+    vm->output = connectionOutput;
+    vm->warningOutput = connectionWarning;
+    vm->outputUser = conn;
+    vm->moduleLoader = loadModule;
+    vm->scriptArgs = fields + 2;
+    vm->scriptArgCount = fieldCount - 2;
+
+    CachedProgram* program = loadProgram(script);
+    if (!program) {
+        popErrorContext(&ctx);
+        freeVM(vm);
+        free(vm);
+        snprintf(message, sizeof(message), "Could not open file \"%s\".\n", script);
+        failRun(conn, message);
+        return;
+    }
+    char count[FORMAT_NUMBER_MAX];
+    formatInt(count, program->tokenCount);
+    snprintf(message, sizeof(message), "Tokenized %s tokens successfully.\n", count);
+    connectionOutput(conn, message, strlen(message));
+
+    interpret(vm, program->ast);
+    popErrorContext(&ctx);
+    closeRunFiles();
+    freeVM(vm);
+    free(vm);
+    freeRetired();
+    finishRun(conn, 0);
+}
+
+static const char* listeningPath = NULL;
+static volatile sig_atomic_t serving = 0;
+static volatile sig_atomic_t stopRequested = 0;
+
+// SIGINT/SIGTERM: between runs nothing is open, so stop at once. During a
+// run, stop once it has finished and closed its files; a second signal
+// stops at once.
+static void stopServer(int signal) {
+    (void)signal;
+    if (serving && !stopRequested) {
+        stopRequested = 1;
+        return;
+    }
+    if (listeningPath) unlink(listeningPath);
+    _exit(0);
+}
+
+int runServer(const char* socketPath, int level) {
+    optLevel = level;
+    struct sockaddr_un addr;
+    if (!socketAddress(socketPath, &addr)) {
+        fprintf(stderr, "Socket path too long: \"%s\".\n", socketPath);
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+    // Replace a socket left behind by a previous server, but nothing else
+    struct stat st;
+    if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socketPath);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        perror(socketPath);
+        close(listener);
+        return 1;
+    }
+    listeningPath = socketPath;
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    signal(SIGPIPE, SIG_IGN);
+
+    Connection* conn = malloc(sizeof(Connection));
+    char* payload = malloc(FRAME_MAX_REQUEST);
+    if (!conn || !payload) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return 1;
+    }
+    // Requests run one at a time: cached ASTs are shared between runs and
+    // are not safe to execute from two VMs at once (quickened operators
+    // rewrite their nodes).
+    int status = 1;
+    while (true) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        conn->fd = fd;
+        conn->disconnected = false;
+        conn->unbuffered = false;
+        conn->length = 0;
+        char type;
+        uint32_t length;
+        if (readFrameHeader(fd, &type, &length) && type == FRAME_RUN &&
+            length <= FRAME_MAX_REQUEST && readFully(fd, payload, length)) {
+            serving = 1;
+            serveRequest(conn, payload, length);
+            serving = 0;
+        }
+        close(fd);
+        if (stopRequested) {
+            status = 0;
+            break;
+        }
+    }
+    free(payload);
+    free(conn);
+    close(listener);
+    unlink(socketPath);
+    return status;
+}
+
+// ---------------------------------------------------------------------------
+// Client
+// ---------------------------------------------------------------------------
+
+// Append a NUL-terminated field to the request
+static bool appendField(char* request, size_t* length, const char* field) {
+    size_t n = strlen(field) + 1;
+    if (*length + n > FRAME_MAX_REQUEST) return false;
+    memcpy(request + *length, field, n);
+    *length += n;
+    return true;
+}
+
+int runClient(const char* socketPath, const char* script, char** args, int argCount, int flags) {
+    // The server has a different working directory: send absolute paths
+    char scriptPath[4096];
+    char cwd[4096];
+    if (!realpath(script, scriptPath)) {
+        fprintf(stderr, "Could not open file \"%s\".\n", script);
+        return 1;
+    }
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, "/");
+
+    char* request = malloc(FRAME_MAX_REQUEST);
+    if (!request) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return 1;
+    }
+    size_t length = 0;
+    request[length++] = (char)flags;
+    bool fits = appendField(request, &length, scriptPath) && appendField(request, &length, cwd);
+    for (int i = 0; fits && i < argCount; i++) fits = appendField(request, &length, args[i]);
+    if (!fits) {
+        fprintf(stderr, "Arguments too long.\n");
+        free(request);
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || !socketAddress(socketPath, &addr) || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Could not connect to server at \"%s\".\n", socketPath);
+        if (fd >= 0) close(fd);
+        free(request);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    bool sent = sendFrame(fd, FRAME_RUN, request, (uint32_t)length);
+    free(request);
+
+    // Replay frames until the exit status arrives
+    int status = 1;
+    char* chunk = NULL;
+    char type;
+    uint32_t size;
+    while (sent && readFrameHeader(fd, &type, &size)) {
+        chunk = realloc(chunk, size > 0 ? size : 1);
+        if (!chunk || !readFully(fd, chunk, size)) break;
+        if (type == FRAME_STDOUT) {
+            outWrite(chunk, size);
+            if (flags & RUN_FLAG_UNBUFFERED) outFlush();
+        } else if (type == FRAME_STDERR) {
+            outFlush();
+            fwrite(chunk, 1, size, stderr);
+        } else if (type == FRAME_EXIT && size == sizeof(uint32_t)) {
+            uint32_t code;
+            memcpy(&code, chunk, sizeof(code));
+            status = (int)code;
+            break;
+        }
+    }
+    free(chunk);
+    close(fd);
+    outFlush();
+    return status;
+}
@@ -1,33 +1,39 @@
 #include "vm.h"
 #include "lexer.h"
 #include "parser.h"
+#include "output.h"
+#include "parallel.h"
+#include "optimizer.h"
+#include "native.h"
+#include "pattern.h"
+#include "json.h"
+#include "csv.h"
+#include "serialize.h"
+#include "pmap.h"
+#include "runtime.h"
 #include <dirent.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-// Hash function for variables
-static unsigned int hash(const char* key, int length) {
-    unsigned int hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (unsigned char)key[i];
-        hash *= 16777619;
-    }
-    return hash % TABLE_SIZE;
+// Hash of a name; identifier tokens from the lexer carry it precomputed
+static unsigned int tokenHash(Token name) {
+    return name.hash ? name.hash : hashString(name.start, (size_t)name.length);
 }
 
-// Simple integer hash to bucket index
-static unsigned int hashIntKey(int k) {
-    unsigned int x = (unsigned int)k;
-    x ^= x >> 16; x *= 0x7feb352d; x ^= x >> 15; x *= 0x846ca68b; x ^= x >> 16;
-    return x % TABLE_SIZE;
+// Entry key equals name: compare the full hashes first, so a chain walk
+// only compares strings for the entry that matches
+static bool sameKey(const char* key, unsigned int keyHash, const char* name, int length, unsigned int h) {
+    return keyHash == h && strncmp(key, name, (size_t)length) == 0 && key[length] == '\0';
 }
 
 // Module cache lookup/insert by logical module name
 static ModuleEntry* findModuleEntry(VM* vm, const char* name, int length, bool insert) {
-    unsigned int h = hash(name, length);
+    unsigned int hv = hashString(name, (size_t)length);
+    unsigned int h = hv % TABLE_SIZE;
     ModuleEntry* e = vm->moduleBuckets[h];
     while (e) {
-        if (strncmp(e->key, name, length) == 0 && strlen(e->key) == (size_t)length) {
+        if (sameKey(e->key, e->hash, name, length, hv)) {
             return e;
         }
         e = e->next;
@@ -37,6 +43,7 @@ static ModuleEntry* findModuleEntry(VM* vm, const char* name, int length, bool i
     if (!e) error("Memory allocation failed.", 0);
     e->key = strndup(name, length);
     if (!e->key) error("Memory allocation failed.", 0);
+    e->hash = hv;
     e->module = NULL;
     e->next = vm->moduleBuckets[h];
     vm->moduleBuckets[h] = e;
@@ -51,12 +58,13 @@ static bool fileExists(const char* path) {
 
 // Find or insert variable with proper scope resolution
 static VarEntry* findEntry(VM* vm, Token name, bool insert) {
-    unsigned int h = hash(name.start, name.length);
+    unsigned int hv = tokenHash(name);
+    unsigned int h = hv % TABLE_SIZE;
     
     // First, search in current environment
     VarEntry* entry = vm->env->buckets[h];
     while (entry) {
-        if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+        if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
             return entry;
         }
         entry = entry->next;
@@ -66,7 +74,7 @@ static VarEntry* findEntry(VM* vm, Token name, bool insert) {
     if (!insert && vm->defEnv && vm->defEnv != vm->env) {
         entry = vm->defEnv->buckets[h];
         while (entry) {
-            if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+            if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
                 return entry;
             }
             entry = entry->next;
@@ -77,7 +85,7 @@ static VarEntry* findEntry(VM* vm, Token name, bool insert) {
     if (!insert && vm->env != vm->globalEnv) {
         entry = vm->globalEnv->buckets[h];
         while (entry) {
-            if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+            if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
                 return entry;
             }
             entry = entry->next;
@@ -95,20 +103,40 @@ static VarEntry* findEntry(VM* vm, Token name, bool insert) {
             free(entry);
             error("Memory allocation failed.", name.line);
         }
-        entry->value.type = VAL_INT; // Default init
-        entry->value.intVal = 0;
+        entry->hash = hv;
+        entry->value = INT_VAL(0); // Default init
         entry->next = vm->env->buckets[h];
         vm->env->buckets[h] = entry;
     }
     return entry;
 }
 
+// Whether a variable's old string may be freed when it is reassigned. A
+// parallel task cannot tell its own strings from ones it shares with other
+// threads (a global's value copied into a local, array elements), so
+// workers never free them.
+static bool ownsString(VM* vm, Value value) {
+    return IS_STRING(value) && AS_STRING(value) && !isCharString(AS_STRING(value)) && !vm->parallelWorker &&
+           AS_STRING(value) != vm->lentString;
+}
+
+// Whether entry is a variable of the running function itself, not a global
+// or module variable reached through findEntry's fallbacks
+static bool isLocalEntry(VM* vm, VarEntry* entry) {
+    if (vm->env == vm->globalEnv) return false;
+    for (VarEntry* e = vm->env->buckets[entry->hash % TABLE_SIZE]; e; e = e->next) {
+        if (e == entry) return true;
+    }
+    return false;
+}
+
 // Find or insert function in specific environment
 static FuncEntry* findFuncEntry(Environment* env, Token name, bool insert) {
-    unsigned int h = hash(name.start, name.length);
+    unsigned int hv = tokenHash(name);
+    unsigned int h = hv % TABLE_SIZE;
     FuncEntry* entry = env->funcBuckets[h];
     while (entry) {
-        if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+        if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
             return entry;
         }
         entry = entry->next;
@@ -123,6 +151,7 @@ static FuncEntry* findFuncEntry(Environment* env, Token name, bool insert) {
             free(entry);
             error("Memory allocation failed.", name.line);
         }
+        entry->hash = hv;
         entry->function = NULL;
         entry->next = env->funcBuckets[h];
         env->funcBuckets[h] = entry;
@@ -132,10 +161,11 @@ static FuncEntry* findFuncEntry(Environment* env, Token name, bool insert) {
 
 // Find function in global environment (for function calls)
 static Function* findFunction(VM* vm, Token name) {
-    unsigned int h = hash(name.start, name.length);
+    unsigned int hv = tokenHash(name);
+    unsigned int h = hv % TABLE_SIZE;
     FuncEntry* entry = vm->globalEnv->funcBuckets[h];
     while (entry) {
-        if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+        if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
             return entry->function;
         }
         entry = entry->next;
@@ -144,10 +174,11 @@ static Function* findFunction(VM* vm, Token name) {
 }
 
 static Function* findFunctionInEnv(Environment* env, Token name) {
-    unsigned int h = hash(name.start, name.length);
+    unsigned int hv = tokenHash(name);
+    unsigned int h = hv % TABLE_SIZE;
     FuncEntry* entry = env->funcBuckets[h];
     while (entry) {
-        if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+        if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
             return entry->function;
         }
         entry = entry->next;
@@ -157,10 +188,11 @@ static Function* findFunctionInEnv(Environment* env, Token name) {
 
 // Find variable in a specific environment
 static VarEntry* findVarInEnv(Environment* env, Token name) {
-    unsigned int h = hash(name.start, name.length);
+    unsigned int hv = tokenHash(name);
+    unsigned int h = hv % TABLE_SIZE;
     VarEntry* entry = env->buckets[h];
     while (entry) {
-        if (strncmp(entry->key, name.start, name.length) == 0 && strlen(entry->key) == (size_t)name.length) {
+        if (sameKey(entry->key, entry->hash, name.start, name.length, hv)) {
             return entry;
         }
         entry = entry->next;
@@ -169,7 +201,7 @@ static VarEntry* findVarInEnv(Environment* env, Token name) {
 }
 
 // Read whole file
-static char* readFileAll(const char* path) {
+char* readFileAll(const char* path) {
     FILE* file = fopen(path, "rb");
     if (!file) return NULL;
     fseek(file, 0L, SEEK_END);
@@ -211,17 +243,26 @@ static char* searchFileRecursive(const char* root, const char* filename) {
     return NULL;
 }
 
+#define CHAR_STRING(c)      { (char)(c), '\0' }
+#define CHAR_STRINGS4(c)    CHAR_STRING(c), CHAR_STRING((c) + 1), CHAR_STRING((c) + 2), CHAR_STRING((c) + 3)
+#define CHAR_STRINGS16(c)   CHAR_STRINGS4(c), CHAR_STRINGS4((c) + 4), CHAR_STRINGS4((c) + 8), CHAR_STRINGS4((c) + 12)
+#define CHAR_STRINGS64(c)   CHAR_STRINGS16(c), CHAR_STRINGS16((c) + 16), CHAR_STRINGS16((c) + 32), CHAR_STRINGS16((c) + 48)
+
+char charStrings[256][2] = {
+    CHAR_STRINGS64(0), CHAR_STRINGS64(64), CHAR_STRINGS64(128), CHAR_STRINGS64(192)
+};
+
 // Convert 1-char string to int code if applicable
 static bool tryCharCode(Value v, int* out) {
-    if (v.type == VAL_STRING && v.stringVal && strlen(v.stringVal) == 1) {
-        *out = (unsigned char)v.stringVal[0];
+    if (IS_STRING(v) && AS_STRING(v) && strlen(AS_STRING(v)) == 1) {
+        *out = (unsigned char)AS_STRING(v)[0];
         return true;
     }
     return false;
 }
 
 // ---- Array helpers ----
-static Array* newArray(void) {
+Array* newArray(void) {
     Array* a = (Array*)malloc(sizeof(Array));
     if (!a) error("Memory allocation failed.", 0);
     a->items = NULL; a->count = 0; a->capacity = 0;
@@ -235,7 +276,7 @@ static void arrayEnsureCap(Array* a, int cap) {
     if (!ni) error("Memory allocation failed.", 0);
     a->items = ni; a->capacity = nc;
 }
-static void arrayPush(Array* a, Value v) {
+void arrayPush(Array* a, Value v) {
     arrayEnsureCap(a, a->count + 1);
     a->items[a->count++] = v;
 }
@@ -247,82 +288,1709 @@ static bool arrayPop(Array* a, Value* out) {
 }
 
 // ---- Map helpers ----
-static Map* newMap(void) {
+Map* newMap(void) {
     Map* m = (Map*)malloc(sizeof(Map));
     if (!m) error("Memory allocation failed.", 0);
-    for (int i = 0; i < TABLE_SIZE; i++) m->buckets[i] = NULL;
+    m->buckets = (MapEntry**)calloc(MAP_MIN_BUCKETS, sizeof(MapEntry*));
+    if (!m->buckets) error("Memory allocation failed.", 0);
+    m->bucketCount = MAP_MIN_BUCKETS;
+    m->count = 0;
+    m->version = 0;
+    m->first = NULL;
+    m->last = NULL;
     return m;
 }
-static MapEntry* mapFindEntry(Map* m, const char* skey, int slen, int* bucketOut) {
-    unsigned int h = hash(skey, slen);
-    if (bucketOut) *bucketOut = (int)h;
-    MapEntry* e = m->buckets[h];
+// Double the bucket array; entries are rechained by their stored hashes
+static void mapGrow(Map* m) {
+    int nb = m->bucketCount * 2;
+    MapEntry** buckets = (MapEntry**)calloc((size_t)nb, sizeof(MapEntry*));
+    if (!buckets) error("Memory allocation failed.", 0);
+    for (MapEntry* e = m->first; e; e = e->after) {
+        unsigned int b = e->hash & (unsigned int)(nb - 1);
+        e->next = buckets[b];
+        buckets[b] = e;
+    }
+    free(m->buckets);
+    m->buckets = buckets;
+    m->bucketCount = nb;
+}
+// Link a new entry into its bucket and at the end of the insertion order
+static void mapLink(Map* m, MapEntry* e) {
+    if (m->count >= m->bucketCount) mapGrow(m);
+    unsigned int b = e->hash & (unsigned int)(m->bucketCount - 1);
+    e->next = m->buckets[b];
+    m->buckets[b] = e;
+    e->before = m->last;
+    e->after = NULL;
+    if (m->last) m->last->after = e; else m->first = e;
+    m->last = e;
+    m->count++;
+    m->version++;
+}
+static void mapUnlink(Map* m, MapEntry* prev, MapEntry* e) {
+    if (prev) prev->next = e->next; else m->buckets[e->hash & (unsigned int)(m->bucketCount - 1)] = e->next;
+    if (e->before) e->before->after = e->after; else m->first = e->after;
+    if (e->after) e->after->before = e->before; else m->last = e->before;
+    m->count--;
+    m->version++;
+}
+static MapEntry* mapFindEntry(Map* m, const char* skey, int slen, unsigned int* hashOut) {
+    unsigned int h = hashString(skey, (size_t)slen);
+    if (hashOut) *hashOut = h;
+    MapEntry* e = m->buckets[h & (unsigned int)(m->bucketCount - 1)];
     while (e) {
-        if (!e->isIntKey && e->key && (int)strlen(e->key) == slen && strncmp(e->key, skey, slen) == 0) return e;
+        if (!e->isIntKey && sameKey(e->key, e->hash, skey, slen, h)) return e;
         e = e->next;
     }
     return NULL;
 }
-static MapEntry* mapFindEntryInt(Map* m, int ikey, int* bucketOut) {
-    unsigned int h = hashIntKey(ikey);
-    if (bucketOut) *bucketOut = (int)h;
-    MapEntry* e = m->buckets[h];
+static MapEntry* mapFindEntryInt(Map* m, int ikey, unsigned int* hashOut) {
+    unsigned int h = hashInt(ikey);
+    if (hashOut) *hashOut = h;
+    MapEntry* e = m->buckets[h & (unsigned int)(m->bucketCount - 1)];
     while (e) {
         if (e->isIntKey && e->intKey == ikey) return e;
         e = e->next;
     }
-    return NULL;
-}
-static void mapSetStr(Map* m, const char* key, int len, Value v) {
-    int b; MapEntry* e = mapFindEntry(m, key, len, &b);
-    if (e) { e->value = v; return; }
-    e = (MapEntry*)malloc(sizeof(MapEntry)); if (!e) error("Memory allocation failed.", 0);
-    e->isIntKey = false; e->intKey = 0;
-    e->key = strndup(key, len); if (!e->key) { free(e); error("Memory allocation failed.", 0);} 
-    e->value = v; e->next = m->buckets[b]; m->buckets[b] = e;
-}
-static void mapSetInt(Map* m, int ikey, Value v) {
-    int b; MapEntry* e = mapFindEntryInt(m, ikey, &b);
-    if (e) { e->value = v; return; }
-    e = (MapEntry*)malloc(sizeof(MapEntry)); if (!e) error("Memory allocation failed.", 0);
-    e->isIntKey = true; e->intKey = ikey; e->key = NULL; e->value = v; e->next = m->buckets[b]; m->buckets[b] = e;
+    return NULL;
+}
+void mapSetStr(Map* m, const char* key, int len, Value v) {
+    unsigned int h; MapEntry* e = mapFindEntry(m, key, len, &h);
+    if (e) { e->value = v; return; }
+    // One allocation: the key is stored right after the entry
+    e = (MapEntry*)malloc(sizeof(MapEntry) + (size_t)len + 1); if (!e) error("Memory allocation failed.", 0);
+    e->isIntKey = false; e->intKey = 0; e->hash = h;
+    e->key = (char*)(e + 1);
+    memcpy(e->key, key, (size_t)len); e->key[len] = '\0';
+    e->value = v;
+    mapLink(m, e);
+}
+void mapSetInt(Map* m, int ikey, Value v) {
+    unsigned int h; MapEntry* e = mapFindEntryInt(m, ikey, &h);
+    if (e) { e->value = v; return; }
+    e = (MapEntry*)malloc(sizeof(MapEntry)); if (!e) error("Memory allocation failed.", 0);
+    e->isIntKey = true; e->intKey = ikey; e->key = NULL; e->hash = h; e->value = v;
+    mapLink(m, e);
+}
+static bool mapDeleteStr(Map* m, const char* key, int len) {
+    unsigned int h = hashString(key, (size_t)len);
+    MapEntry* prev = NULL; MapEntry* e = m->buckets[h & (unsigned int)(m->bucketCount - 1)];
+    while (e) {
+        if (!e->isIntKey && sameKey(e->key, e->hash, key, len, h)) {
+            mapUnlink(m, prev, e);
+            free(e);
+            return true;
+        }
+        prev = e; e = e->next;
+    }
+    return false;
+}
+static bool mapDeleteInt(Map* m, int ikey) {
+    unsigned int h = hashInt(ikey);
+    MapEntry* prev = NULL; MapEntry* e = m->buckets[h & (unsigned int)(m->bucketCount - 1)];
+    while (e) {
+        if (e->isIntKey && e->intKey == ikey) {
+            mapUnlink(m, prev, e);
+            free(e);
+            return true;
+        }
+        prev = e; e = e->next;
+    }
+    return false;
+}
+
+// ---- Array bulk operations ----
+// slice/concat copy item ranges with memcpy, indexOf scans with the
+// comparison chosen once from the needle's type, and join sizes its result
+// before filling it, so none of them go through the interpreter per element.
+
+static Array* requireArray(Value v, const char* message, int line) {
+    if (!IS_ARRAY(v) || !AS_ARRAY(v)) error(message, line);
+    return AS_ARRAY(v);
+}
+
+// Resolve a slice bound: negative counts from the end, then clamp to [0, count]
+static int sliceIndex(Value v, int count, const char* message, int line) {
+    if (!IS_INT(v)) error(message, line);
+    long long i = AS_INT(v);
+    if (i < 0) i += count;
+    if (i < 0) i = 0;
+    if (i > count) i = count;
+    return (int)i;
+}
+
+static Array* arrayFromItems(const Value* items, int count) {
+    Array* a = newArray();
+    if (count > 0) {
+        arrayEnsureCap(a, count);
+        memcpy(a->items, items, sizeof(Value) * (size_t)count);
+        a->count = count;
+    }
+    return a;
+}
+
+// First index of needle in a (== semantics: same type, strings by content)
+static int arrayIndexOf(const Array* a, Value needle) {
+    const Value* items = a->items;
+    int n = a->count;
+    switch (VALUE_TYPE(needle)) {
+        case VAL_INT: {
+            int x = AS_INT(needle);
+            for (int i = 0; i < n; i++) if (IS_INT(items[i]) && AS_INT(items[i]) == x) return i;
+            return -1;
+        }
+        case VAL_FLOAT: {
+            double x = AS_FLOAT(needle);
+            for (int i = 0; i < n; i++) if (IS_FLOAT(items[i]) && AS_FLOAT(items[i]) == x) return i;
+            return -1;
+        }
+        case VAL_STRING: {
+            const char* s = AS_STRING(needle);
+            for (int i = 0; i < n; i++) {
+                if (!IS_STRING(items[i])) continue;
+                const char* t = AS_STRING(items[i]);
+                if (s && t ? (s[0] == t[0] && strcmp(s, t) == 0) : s == t) return i;
+            }
+            return -1;
+        }
+        case VAL_BOOL: {
+            bool b = AS_BOOL(needle);
+            for (int i = 0; i < n; i++) if (IS_BOOL(items[i]) && AS_BOOL(items[i]) == b) return i;
+            return -1;
+        }
+        case VAL_MODULE:
+            for (int i = 0; i < n; i++) if (IS_MODULE(items[i]) && AS_MODULE(items[i]) == AS_MODULE(needle)) return i;
+            return -1;
+        case VAL_ARRAY:
+            for (int i = 0; i < n; i++) if (IS_ARRAY(items[i]) && AS_ARRAY(items[i]) == AS_ARRAY(needle)) return i;
+            return -1;
+        case VAL_MAP:
+            for (int i = 0; i < n; i++) if (IS_MAP(items[i]) && AS_MAP(items[i]) == AS_MAP(needle)) return i;
+            return -1;
+        case VAL_FILE:
+            for (int i = 0; i < n; i++) if (IS_FILE(items[i]) && AS_FILE(items[i]) == AS_FILE(needle)) return i;
+            return -1;
+        case VAL_PMAP:
+            for (int i = 0; i < n; i++) if (IS_PMAP(items[i]) && AS_PMAP(items[i]) == AS_PMAP(needle)) return i;
+            return -1;
+    }
+    return -1;
+}
+
+// Text of a joined element, as string concatenation renders it. Strings are
+// returned in place; everything else is formatted into buf.
+static const char* joinText(Value v, char* buf, size_t size, size_t* length) {
+    int n = 0;
+    switch (VALUE_TYPE(v)) {
+        case VAL_STRING: {
+            const char* s = AS_STRING(v) ? AS_STRING(v) : "";
+            *length = strlen(s);
+            return s;
+        }
+        case VAL_INT: n = formatInt(buf, AS_INT(v)); break;
+        case VAL_FLOAT: n = formatDouble(buf, AS_FLOAT(v)); break;
+        case VAL_BOOL: n = snprintf(buf, size, "%s", AS_BOOL(v) ? "true" : "false"); break;
+        case VAL_MODULE: n = snprintf(buf, size, "[module]"); break;
+        case VAL_ARRAY: n = snprintf(buf, size, "[array length=%d]", AS_ARRAY(v) ? AS_ARRAY(v)->count : 0); break;
+        case VAL_MAP: n = snprintf(buf, size, "{map size=%d}", AS_MAP(v) ? AS_MAP(v)->count : 0); break;
+        case VAL_FILE: n = snprintf(buf, size, "[file]"); break;
+        case VAL_PMAP: n = snprintf(buf, size, "{pmap size=%d}", pmapCount(AS_PMAP(v))); break;
+    }
+    *length = (size_t)n;
+    return buf;
+}
+
+static char* arrayJoin(const Array* a, const char* sep, int line) {
+    size_t sepLength = strlen(sep);
+    size_t* lengths = (size_t*)malloc(sizeof(size_t) * (size_t)(a->count > 0 ? a->count : 1));
+    if (!lengths) error("Memory allocation failed.", line);
+    char buf[64];
+    size_t total = a->count > 0 ? sepLength * (size_t)(a->count - 1) : 0;
+    for (int i = 0; i < a->count; i++) {
+        joinText(a->items[i], buf, sizeof(buf), &lengths[i]);
+        total += lengths[i];
+    }
+    char* out = (char*)malloc(total + 1);
+    if (!out) { free(lengths); error("Memory allocation failed.", line); }
+    char* p = out;
+    for (int i = 0; i < a->count; i++) {
+        if (i > 0) { memcpy(p, sep, sepLength); p += sepLength; }
+        size_t length;
+        const char* text = joinText(a->items[i], buf, sizeof(buf), &length);
+        memcpy(p, text, lengths[i]);
+        p += lengths[i];
+    }
+    *p = '\0';
+    free(lengths);
+    return out;
+}
+
+// sort(): ints take an LSD radix sort on their bits; mixed numbers and
+// strings take an introsort (median-of-3 quicksort, heapsort past 2*log2(n)
+// levels, insertion sort for short runs). Neither is stable.
+#define SORT_INSERTION_MAX 16
+#define SORT_RADIX_MIN 256
+
+typedef struct {
+    double number;
+    const char* string;
+    Value value;
+} SortItem;
+
+static inline bool sortLess(const SortItem* a, const SortItem* b, bool byString) {
+    return byString ? strcmp(a->string, b->string) < 0 : a->number < b->number;
+}
+
+static inline void sortSwap(SortItem* a, SortItem* b) {
+    SortItem t = *a; *a = *b; *b = t;
+}
+
+static void sortHeapDown(SortItem* a, int root, int n, bool byString) {
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= n) return;
+        if (child + 1 < n && sortLess(&a[child], &a[child + 1], byString)) child++;
+        if (!sortLess(&a[root], &a[child], byString)) return;
+        sortSwap(&a[root], &a[child]);
+        root = child;
+    }
+}
+
+static void sortHeap(SortItem* a, int n, bool byString) {
+    for (int i = n / 2 - 1; i >= 0; i--) sortHeapDown(a, i, n, byString);
+    for (int end = n - 1; end > 0; end--) {
+        sortSwap(&a[0], &a[end]);
+        sortHeapDown(a, 0, end, byString);
+    }
+}
+
+static void sortInsertion(SortItem* a, int n, bool byString) {
+    for (int i = 1; i < n; i++) {
+        SortItem x = a[i];
+        int j = i - 1;
+        while (j >= 0 && sortLess(&x, &a[j], byString)) { a[j + 1] = a[j]; j--; }
+        a[j + 1] = x;
+    }
+}
+
+// Sort a[lo..hi] (inclusive); runs of SORT_INSERTION_MAX or fewer are left
+// for the final insertion pass
+static void sortIntro(SortItem* a, int lo, int hi, int depth, bool byString) {
+    while (hi - lo + 1 > SORT_INSERTION_MAX) {
+        if (depth-- == 0) { sortHeap(a + lo, hi - lo + 1, byString); return; }
+        int mid = lo + (hi - lo) / 2;
+        if (sortLess(&a[mid], &a[lo], byString)) sortSwap(&a[mid], &a[lo]);
+        if (sortLess(&a[hi], &a[mid], byString)) {
+            sortSwap(&a[hi], &a[mid]);
+            if (sortLess(&a[mid], &a[lo], byString)) sortSwap(&a[mid], &a[lo]);
+        }
+        // Hoare partition around the median: scans stop at a[lo] and a[hi]
+        SortItem pivot = a[mid];
+        int i = lo - 1, j = hi + 1;
+        for (;;) {
+            do i++; while (sortLess(&a[i], &pivot, byString));
+            do j--; while (sortLess(&pivot, &a[j], byString));
+            if (i >= j) break;
+            sortSwap(&a[i], &a[j]);
+        }
+        // Recurse into the smaller half, loop on the larger
+        if (j - lo < hi - j) { sortIntro(a, lo, j, depth, byString); lo = j + 1; }
+        else { sortIntro(a, j + 1, hi, depth, byString); hi = j; }
+    }
+}
+
+static void sortItems(SortItem* a, int n, bool byString) {
+    int depth = 0;
+    for (int m = n; m > 1; m >>= 1) depth += 2;
+    if (n > 1) sortIntro(a, 0, n - 1, depth, byString);
+    sortInsertion(a, n, byString);
+}
+
+// LSD radix sort of ints, 8 bits per pass with the sign bit flipped; passes
+// where every key falls in one bucket are skipped
+static void sortInts(Value* items, int n, int line) {
+    uint32_t* buffer = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)n * 2);
+    if (!buffer) error("Memory allocation failed.", line);
+    uint32_t* keys = buffer;
+    uint32_t* tmp = buffer + n;
+    size_t counts[4][256];
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < n; i++) {
+        uint32_t k = (uint32_t)AS_INT(items[i]) ^ 0x80000000u;
+        keys[i] = k;
+        counts[0][k & 0xff]++;
+        counts[1][(k >> 8) & 0xff]++;
+        counts[2][(k >> 16) & 0xff]++;
+        counts[3][k >> 24]++;
+    }
+    for (int pass = 0; pass < 4; pass++) {
+        size_t* c = counts[pass];
+        int shift = pass * 8;
+        if (c[(keys[0] >> shift) & 0xff] == (size_t)n) continue;
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++) { size_t t = c[b]; c[b] = offset; offset += t; }
+        for (int i = 0; i < n; i++) tmp[c[(keys[i] >> shift) & 0xff]++] = keys[i];
+        uint32_t* t = keys; keys = tmp; tmp = t;
+    }
+    for (int i = 0; i < n; i++) items[i] = INT_VAL((int)(keys[i] ^ 0x80000000u));
+    free(buffer);
+}
+
+static void arraySort(Array* a, int line) {
+    int n = a->count;
+    if (n < 2) return;
+    bool allInts = true, allNumbers = true, allStrings = true;
+    for (int i = 0; i < n; i++) {
+        Value v = a->items[i];
+        if (!IS_INT(v)) allInts = false;
+        if (!IS_INT(v) && !IS_FLOAT(v)) allNumbers = false;
+        if (!IS_STRING(v)) allStrings = false;
+    }
+    if (!allNumbers && !allStrings) error("sort() requires an array of numbers or of strings, or a comparator.", line);
+    if (allInts && n >= SORT_RADIX_MIN) { sortInts(a->items, n, line); return; }
+    SortItem* items = (SortItem*)malloc(sizeof(SortItem) * (size_t)n);
+    if (!items) error("Memory allocation failed.", line);
+    for (int i = 0; i < n; i++) {
+        Value v = a->items[i];
+        items[i].value = v;
+        items[i].number = allStrings ? 0.0 : (IS_INT(v) ? (double)AS_INT(v) : AS_FLOAT(v));
+        items[i].string = allStrings && AS_STRING(v) ? AS_STRING(v) : "";
+    }
+    sortItems(items, n, allStrings);
+    for (int i = 0; i < n; i++) a->items[i] = items[i].value;
+    free(items);
+}
+
+// ---- String operations ----
+// Each builtin works on whole strings with the C library (memchr, memcmp,
+// memcpy) and allocates its result once.
+
+static const char* requireString(Value v, const char* message, int line) {
+    if (!IS_STRING(v)) error(message, line);
+    return AS_STRING(v) ? AS_STRING(v) : "";
+}
+
+static char* copyBytes(const char* s, size_t length, int line) {
+    if (length == 1) return charStrings[(unsigned char)s[0]];
+    char* out = (char*)malloc(length + 1);
+    if (!out) error("Memory allocation failed.", line);
+    memcpy(out, s, length);
+    out[length] = '\0';
+    return out;
+}
+
+// First occurrence of needle in hay: memchr finds each candidate first byte,
+// memcmp checks the rest
+static const char* findBytes(const char* hay, size_t hayLength, const char* needle, size_t needleLength) {
+    if (needleLength == 0) return hay;
+    if (needleLength > hayLength) return NULL;
+    const char* end = hay + (hayLength - needleLength) + 1;
+    const char* p = hay;
+    while (p < end) {
+        p = (const char*)memchr(p, needle[0], (size_t)(end - p));
+        if (!p) return NULL;
+        if (memcmp(p + 1, needle + 1, needleLength - 1) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+static Value stringSplit(const char* s, const char* sep, int line) {
+    size_t length = strlen(s), sepLength = strlen(sep);
+    Array* parts = newArray();
+    if (sepLength == 0) {
+        // Split into characters
+        arrayEnsureCap(parts, (int)length);
+        for (size_t i = 0; i < length; i++) parts->items[parts->count++] = STRING_VAL(charStrings[(unsigned char)s[i]]);
+        return ARRAY_VAL(parts);
+    }
+    const char* p = s;
+    const char* end = s + length;
+    for (;;) {
+        const char* hit = findBytes(p, (size_t)(end - p), sep, sepLength);
+        if (!hit) break;
+        arrayPush(parts, STRING_VAL(copyBytes(p, (size_t)(hit - p), line)));
+        p = hit + sepLength;
+    }
+    arrayPush(parts, STRING_VAL(copyBytes(p, (size_t)(end - p), line)));
+    return ARRAY_VAL(parts);
+}
+
+// replace(s, old, new): count the matches, then build the result in one buffer
+static char* stringReplace(const char* s, const char* from, const char* to, int line) {
+    size_t length = strlen(s), fromLength = strlen(from), toLength = strlen(to);
+    if (fromLength == 0) error("replace() pattern must not be empty.", line);
+    size_t matches = 0;
+    for (const char* p = s; (p = findBytes(p, length - (size_t)(p - s), from, fromLength)); p += fromLength) matches++;
+    size_t total = length - matches * fromLength + matches * toLength;
+    char* out = (char*)malloc(total + 1);
+    if (!out) error("Memory allocation failed.", line);
+    char* w = out;
+    const char* p = s;
+    for (size_t i = 0; i < matches; i++) {
+        const char* hit = findBytes(p, length - (size_t)(p - s), from, fromLength);
+        memcpy(w, p, (size_t)(hit - p)); w += hit - p;
+        memcpy(w, to, toLength); w += toLength;
+        p = hit + fromLength;
+    }
+    memcpy(w, p, length - (size_t)(p - s));
+    out[total] = '\0';
+    return out;
+}
+
+static char* stringCase(const char* s, bool upper, int line) {
+    size_t length = strlen(s);
+    char* out = (char*)malloc(length + 1);
+    if (!out) error("Memory allocation failed.", line);
+    char lo = upper ? 'a' : 'A', hi = upper ? 'z' : 'Z';
+    for (size_t i = 0; i < length; i++) {
+        char c = s[i];
+        out[i] = (c >= lo && c <= hi) ? (char)(c ^ 0x20) : c;
+    }
+    out[length] = '\0';
+    return out;
+}
+
+static bool isSpaceChar(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// parseInt(s): optional sign and decimal digits, surrounding whitespace allowed
+static int parseIntString(const char* s, int line) {
+    while (isSpaceChar(*s)) s++;
+    bool negative = *s == '-';
+    if (*s == '-' || *s == '+') s++;
+    if (*s < '0' || *s > '9') error("parseInt() requires a decimal integer string.", line);
+    long long n = 0;
+    while (*s >= '0' && *s <= '9') {
+        n = n * 10 + (*s++ - '0');
+        if (n > (long long)INT_MAX + 1) error("parseInt() value out of int range.", line);
+    }
+    while (isSpaceChar(*s)) s++;
+    if (*s) error("parseInt() requires a decimal integer string.", line);
+    if (negative) n = -n;
+    if (n > INT_MAX) error("parseInt() value out of int range.", line);
+    return (int)n;
+}
+
+// parseFloat(s): plain decimals with up to 15 significant digits and 22
+// fractional digits are exact as one division of two exact doubles; anything
+// else (exponents, long mantissas) goes to strtod
+static double parseFloatString(const char* s, int line) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* p = s;
+    while (isSpaceChar(*p)) p++;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') p++;
+    unsigned long long mantissa = 0;
+    int digits = 0, fraction = 0;
+    bool point = false;
+    for (;; p++) {
+        if (*p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+            if (mantissa) digits++;
+            if (point) fraction++;
+        } else if (*p == '.' && !point) {
+            point = true;
+        } else {
+            break;
+        }
+    }
+    const char* rest = p;
+    while (isSpaceChar(*rest)) rest++;
+    bool sawDigit = p > s && (p[-1] >= '0' && p[-1] <= '9');
+    if (!*rest && sawDigit && digits <= 15 && fraction <= 22) {
+        double v = (double)mantissa / powers[fraction];
+        return negative ? -v : v;
+    }
+    char* end;
+    double v = strtod(s, &end);
+    while (isSpaceChar(*end)) end++;
+    if (end == s || *end) error("parseFloat() requires a number string.", line);
+    return v;
+}
+
+// First GEMINI_PATH entry holding fileName, written to candidate
+static bool findOnGeminiPath(const char* fileName, char* candidate, size_t size) {
+    const char* gp = getenv("GEMINI_PATH");
+    if (!gp || !*gp) return false;
+    const char* p = gp;
+    while (*p) {
+        char dirbuf[1024];
+        int di = 0;
+        while (*p && *p != ':' && di < (int)sizeof(dirbuf) - 1) {
+            dirbuf[di++] = *p++;
+        }
+        dirbuf[di] = '\0';
+        if (*p == ':') p++;
+        if (di == 0) continue;
+        snprintf(candidate, size, "%s/%s", dirbuf, fileName);
+        if (fileExists(candidate)) return true;
+    }
+    return false;
+}
+
+// Resolve a module file: GEMINI_PATH entries first, then a recursive search
+// under projectRoot. Returns malloc'd path or NULL.
+char* resolveModulePath(const char* projectRoot, const char* fileName) {
+    char candidate[2048];
+    // Try GEMINI_PATH first for speed and explicitness
+    if (findOnGeminiPath(fileName, candidate, sizeof(candidate))) return strdup(candidate);
+    // Fallback: search under projectRoot
+    return searchFileRecursive(projectRoot, fileName);
+}
+
+bool findShadowedModule(const char* projectRoot, const char* name, int length, char* path, size_t size) {
+    char fileName[300];
+    snprintf(fileName, sizeof(fileName), "%.*s.gemini", length, name);
+    if (findOnGeminiPath(fileName, path, size)) return true;
+    snprintf(path, size, "%s/%s", projectRoot, fileName);
+    return fileExists(path);
+}
+
+// Report a warning through the VM's warning channel
+static void warn(VM* vm, const char* message, int line) {
+    char text[2300];
+    int n = snprintf(text, sizeof(text), "[line %d] Warning: %s\n", line, message);
+    size_t length = n < (int)sizeof(text) ? (size_t)n : sizeof(text) - 1;
+    if (vm->warningOutput) {
+        vm->warningOutput(vm->outputUser, text, length);
+    } else {
+        fwrite(text, 1, length, stderr);
+    }
+}
+
+// Forward declarations
+static Value evaluate(VM* vm, Node* node);
+static void execute(VM* vm, Node* node);
+
+// Truthiness of a condition value
+static bool isTruthy(Value cond) {
+    switch (VALUE_TYPE(cond)) {
+        case VAL_BOOL: 
+            return AS_BOOL(cond);
+        case VAL_INT: 
+            return AS_INT(cond) != 0;
+        case VAL_FLOAT: 
+            return AS_FLOAT(cond) != 0.0;
+        case VAL_STRING: 
+            return AS_STRING(cond) != NULL && AS_STRING(cond)[0] != '\0';
+        case VAL_MODULE:
+            return true; // treat as truthy
+        case VAL_ARRAY:
+            return AS_ARRAY(cond) && AS_ARRAY(cond)->count > 0;
+        case VAL_MAP:
+            return AS_MAP(cond) && AS_MAP(cond)->count > 0;
+        case VAL_FILE:
+            return !fileIsClosed(AS_FILE(cond));
+        case VAL_PMAP:
+            return pmapCount(AS_PMAP(cond)) > 0;
+    }
+    return false;
+}
+
+// Print a value followed by a newline (print statement). The line is
+// assembled first and handed over in one write, so concurrent VMs never
+// interleave within a line.
+static void printValue(VM* vm, Value value) {
+    char small[256];
+    char* text = small;
+    size_t length = 0;
+    switch (VALUE_TYPE(value)) {
+        case VAL_INT: 
+            length = (size_t)formatInt(small, AS_INT(value));
+            break;
+        case VAL_FLOAT: 
+            length = (size_t)formatDouble(small, AS_FLOAT(value));
+            break;
+        case VAL_STRING: {
+            const char* s = AS_STRING(value) ? AS_STRING(value) : "(null)";
+            length = strlen(s);
+            if (length + 2 > sizeof(small)) {
+                text = malloc(length + 1);
+                if (!text) error("Memory allocation failed.", 0);
+            }
+            memcpy(text, s, length);
+            break;
+        }
+        case VAL_BOOL: 
+            length = (size_t)snprintf(small, sizeof(small), "%s", AS_BOOL(value) ? "true" : "false");
+            break;
+        case VAL_MODULE:
+            length = (size_t)snprintf(small, sizeof(small), "[module %s]", (AS_MODULE(value) && AS_MODULE(value)->name) ? AS_MODULE(value)->name : "<anon>");
+            break;
+        case VAL_ARRAY:
+            length = (size_t)snprintf(small, sizeof(small), "[array length=%d]", AS_ARRAY(value) ? AS_ARRAY(value)->count : 0);
+            break;
+        case VAL_MAP: {
+            // compute size
+            int sz = AS_MAP(value) ? AS_MAP(value)->count : 0;
+            length = (size_t)snprintf(small, sizeof(small), "{map size=%d}", sz);
+            break;
+        }
+        case VAL_FILE:
+            length = (size_t)snprintf(small, sizeof(small), "[file %s]", filePath(AS_FILE(value)));
+            break;
+        case VAL_PMAP:
+            length = (size_t)snprintf(small, sizeof(small), "{pmap size=%d}", pmapCount(AS_PMAP(value)));
+            break;
+    }
+    if (text == small && length + 2 > sizeof(small)) length = sizeof(small) - 2; // truncated descriptor
+    text[length++] = '\n';
+    if (vm && vm->output) {
+        vm->output(vm->outputUser, text, length);
+    } else {
+        outWrite(text, length);
+        outEndPrint();
+    }
+    if (text != small) free(text);
+}
+
+// String concatenation of n values (`+` with a string operand, fused `+`
+// chains). A first pass takes the text of each part, formatting non-strings
+// into scratch space; the result is then copied into one exact-size buffer.
+#define CONCAT_SMALL 16         // parts handled without heap scratch space
+#define CONCAT_TEXT_MAX 64      // longest text of a non-string part
+
+static Value concatValues(const Value* parts, int n, int line) {
+    const char* smallTexts[CONCAT_SMALL];
+    size_t smallLengths[CONCAT_SMALL];
+    char smallScratch[CONCAT_SMALL][CONCAT_TEXT_MAX];
+    const char** texts = smallTexts;
+    size_t* lengths = smallLengths;
+    char (*scratch)[CONCAT_TEXT_MAX] = smallScratch;
+    char* heap = NULL;
+    if (n > CONCAT_SMALL) {
+        heap = (char*)malloc((size_t)n * (sizeof(size_t) + sizeof(char*) + CONCAT_TEXT_MAX));
+        if (!heap) error("Memory allocation failed.", line);
+        lengths = (size_t*)heap;
+        texts = (const char**)(heap + (size_t)n * sizeof(size_t));
+        scratch = (char (*)[CONCAT_TEXT_MAX])(heap + (size_t)n * (sizeof(size_t) + sizeof(char*)));
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        texts[i] = joinText(parts[i], scratch[i], CONCAT_TEXT_MAX, &lengths[i]);
+        total += lengths[i];
+    }
+    char* joined = (char*)malloc(total + 1);
+    if (!joined) { free(heap); error("Memory allocation failed.", line); }
+    char* p = joined;
+    for (int i = 0; i < n; i++) {
+        memcpy(p, texts[i], lengths[i]);
+        p += lengths[i];
+    }
+    *p = '\0';
+    free(heap);
+    return STRING_VAL(joined);
+}
+
+// Generic (unspecialized) binary operation: string concatenation, equality,
+// 1-char string coercion and int/float/mixed arithmetic and comparisons.
+static Value binaryGeneric(Token op, Value left, Value right) {
+    Value result;
+    
+    // Handle string concatenation with +
+    if (op.type == TOKEN_PLUS && (IS_STRING(left) || IS_STRING(right))) {
+        Value parts[2] = {left, right};
+        return concatValues(parts, 2, op.line);
+    }
+    
+    // Handle comparison operations for different types
+    if (op.type == TOKEN_EQUAL_EQUAL || op.type == TOKEN_BANG_EQUAL) {
+        bool isEqual = false;
+        
+        // Same type comparisons
+        if (VALUE_TYPE(left) == VALUE_TYPE(right)) {
+            switch (VALUE_TYPE(left)) {
+                case VAL_INT:
+                    isEqual = AS_INT(left) == AS_INT(right);
+                    break;
+                case VAL_FLOAT:
+                    isEqual = AS_FLOAT(left) == AS_FLOAT(right);
+                    break;
+                case VAL_BOOL:
+                    isEqual = AS_BOOL(left) == AS_BOOL(right);
+                    break;
+                case VAL_STRING:
+                    if (AS_STRING(left) && AS_STRING(right)) {
+                        isEqual = strcmp(AS_STRING(left), AS_STRING(right)) == 0;
+                    } else {
+                        isEqual = (AS_STRING(left) == NULL && AS_STRING(right) == NULL);
+                    }
+                    break;
+                case VAL_MODULE:
+                    // Compare by module identity (pointer equality)
+                    isEqual = AS_MODULE(left) == AS_MODULE(right);
+                    break;
+                case VAL_ARRAY:
+                    // Compare by identity (pointer equality)
+                    isEqual = AS_ARRAY(left) == AS_ARRAY(right);
+                    break;
+                case VAL_MAP:
+                    // Compare by identity (pointer equality)
+                    isEqual = AS_MAP(left) == AS_MAP(right);
+                    break;
+                case VAL_FILE:
+                    isEqual = AS_FILE(left) == AS_FILE(right);
+                    break;
+                case VAL_PMAP:
+                    isEqual = AS_PMAP(left) == AS_PMAP(right);
+                    break;
+            }
+        }
+        
+        result = BOOL_VAL((op.type == TOKEN_EQUAL_EQUAL) ? isEqual : !isEqual);
+        return result;
+    }
+    
+    // Numeric operations
+    // Coerce 1-char strings to ints for arithmetic if needed
+    if ((IS_STRING(left) && !IS_STRING(right)) || (IS_STRING(right) && !IS_STRING(left))) {
+        int code;
+        if (IS_STRING(left) && tryCharCode(left, &code)) { left = INT_VAL(code); }
+        if (IS_STRING(right) && tryCharCode(right, &code)) { right = INT_VAL(code); }
+    } else if (IS_STRING(left) && IS_STRING(right)) {
+        // If both are strings, try to coerce both when operator is not string concatenation
+        int lc, rc;
+        if (tryCharCode(left, &lc) && tryCharCode(right, &rc)) {
+            left = INT_VAL(lc);
+            right = INT_VAL(rc);
+        }
+    }
+
+    if (IS_INT(left) && IS_INT(right)) {
+        switch (op.type) {
+            case TOKEN_PLUS: 
+                result = INT_VAL(AS_INT(left) + AS_INT(right)); 
+                break;
+            case TOKEN_MINUS: 
+                result = INT_VAL(AS_INT(left) - AS_INT(right)); 
+                break;
+            case TOKEN_STAR: 
+                result = INT_VAL(AS_INT(left) * AS_INT(right)); 
+                break;
+            case TOKEN_SLASH: 
+                if (AS_INT(right) == 0) {
+                    error("Division by zero.", op.line);
+                }
+                if (AS_INT(right) == -1 && AS_INT(left) == INT_MIN) {
+                    error("Integer overflow in division.", op.line);
+                }
+                result = INT_VAL(AS_INT(left) / AS_INT(right)); 
+                break;
+            case TOKEN_PERCENT: 
+                if (AS_INT(right) == 0) {
+                    error("Modulo by zero.", op.line);
+                }
+                // x % -1 is always 0; computing INT_MIN % -1 traps
+                result = INT_VAL(AS_INT(right) == -1 ? 0 : AS_INT(left) % AS_INT(right)); 
+                break;
+            case TOKEN_GREATER: 
+                result = BOOL_VAL(AS_INT(left) > AS_INT(right)); 
+                break;
+            case TOKEN_GREATER_EQUAL: 
+                result = BOOL_VAL(AS_INT(left) >= AS_INT(right)); 
+                break;
+            case TOKEN_LESS: 
+                result = BOOL_VAL(AS_INT(left) < AS_INT(right)); 
+                break;
+            case TOKEN_LESS_EQUAL: 
+                result = BOOL_VAL(AS_INT(left) <= AS_INT(right)); 
+                break;
+            default: 
+                error("Invalid binary operator for integers.", op.line);
+        }
+    } else if (IS_FLOAT(left) && IS_FLOAT(right)) {
+        // Handle float operations
+        switch (op.type) {
+            case TOKEN_PLUS: 
+                result = FLOAT_VAL(AS_FLOAT(left) + AS_FLOAT(right)); 
+                break;
+            case TOKEN_MINUS: 
+                result = FLOAT_VAL(AS_FLOAT(left) - AS_FLOAT(right)); 
+                break;
+            case TOKEN_STAR: 
+                result = FLOAT_VAL(AS_FLOAT(left) * AS_FLOAT(right)); 
+                break;
+            case TOKEN_SLASH: 
+                if (AS_FLOAT(right) == 0.0) {
+                    error("Division by zero.", op.line);
+                }
+                result = FLOAT_VAL(AS_FLOAT(left) / AS_FLOAT(right)); 
+                break;
+            case TOKEN_GREATER: 
+                result = BOOL_VAL(AS_FLOAT(left) > AS_FLOAT(right)); 
+                break;
+            case TOKEN_GREATER_EQUAL: 
+                result = BOOL_VAL(AS_FLOAT(left) >= AS_FLOAT(right)); 
+                break;
+            case TOKEN_LESS: 
+                result = BOOL_VAL(AS_FLOAT(left) < AS_FLOAT(right)); 
+                break;
+            case TOKEN_LESS_EQUAL: 
+                result = BOOL_VAL(AS_FLOAT(left) <= AS_FLOAT(right)); 
+                break;
+            default: 
+                error("Invalid binary operator for floats.", op.line);
+        }
+    } else if ((IS_INT(left) && IS_FLOAT(right)) || 
+               (IS_FLOAT(left) && IS_INT(right))) {
+        // Mixed int/float operations - convert to float
+        double leftVal = (IS_INT(left)) ? (double)AS_INT(left) : AS_FLOAT(left);
+        double rightVal = (IS_INT(right)) ? (double)AS_INT(right) : AS_FLOAT(right);
+        
+        switch (op.type) {
+            case TOKEN_PLUS: 
+                result = FLOAT_VAL(leftVal + rightVal); 
+                break;
+            case TOKEN_MINUS: 
+                result = FLOAT_VAL(leftVal - rightVal); 
+                break;
+            case TOKEN_STAR: 
+                result = FLOAT_VAL(leftVal * rightVal); 
+                break;
+            case TOKEN_SLASH: 
+                if (rightVal == 0.0) {
+                    error("Division by zero.", op.line);
+                }
+                result = FLOAT_VAL(leftVal / rightVal); 
+                break;
+            case TOKEN_GREATER: 
+                result = BOOL_VAL(leftVal > rightVal); 
+                break;
+            case TOKEN_GREATER_EQUAL: 
+                result = BOOL_VAL(leftVal >= rightVal); 
+                break;
+            case TOKEN_LESS: 
+                result = BOOL_VAL(leftVal < rightVal); 
+                break;
+            case TOKEN_LESS_EQUAL: 
+                result = BOOL_VAL(leftVal <= rightVal); 
+                break;
+            default: 
+                error("Invalid binary operator for mixed numeric types.", op.line);
+        }
+    } else {
+        error("Type mismatch in binary operation.", op.line);
+    }
+    
+    return result;
+}
+
+// Read target[idx] for strings, arrays and maps
+static Value indexGet(Value target, Value idx, int line) {
+    if (IS_STRING(target) && IS_INT(idx)) {
+        int len = AS_STRING(target) ? (int)strlen(AS_STRING(target)) : 0;
+        if (AS_INT(idx) < 0 || AS_INT(idx) >= len) {
+            error("String index out of range.", line);
+        }
+        return STRING_VAL(charStrings[(unsigned char)AS_STRING(target)[AS_INT(idx)]]);
+    } else if (IS_ARRAY(target) && IS_INT(idx)) {
+        if (!AS_ARRAY(target)) { Value v = INT_VAL(0); return v; }
+        if (AS_INT(idx) < 0 || AS_INT(idx) >= AS_ARRAY(target)->count) error("Array index out of range.", line);
+        return AS_ARRAY(target)->items[AS_INT(idx)];
+    } else if (IS_MAP(target)) {
+        if (!AS_MAP(target)) { Value v = INT_VAL(0); return v; }
+        if (IS_INT(idx)) {
+            MapEntry* e = mapFindEntryInt(AS_MAP(target), AS_INT(idx), NULL);
+            if (!e) error("Map key not found.", line);
+            return e->value;
+        } else if (IS_STRING(idx)) {
+            const char* s = AS_STRING(idx) ? AS_STRING(idx) : "";
+            MapEntry* e = mapFindEntry(AS_MAP(target), s, (int)strlen(s), NULL);
+            if (!e) error("Map key not found.", line);
+            return e->value;
+        } else {
+            error("Map index must be int or string.", line);
+        }
+    } else if (IS_PMAP(target)) {
+        Value v;
+        if (!pmapGet(AS_PMAP(target), idx, &v, line)) error("Map key not found.", line);
+        return v;
+    }
+    error("Indexing not supported for this type.", line);
+    Value nullVal = INT_VAL(0);
+    return nullVal;
+}
+
+// Store target[idx] = val for arrays, maps and pmaps
+static void indexSet(Value target, Value idx, Value val, int line) {
+    if (IS_ARRAY(target)) {
+        if (!IS_INT(idx)) error("Array index must be int.", line);
+        if (AS_INT(idx) < 0 || AS_INT(idx) >= (AS_ARRAY(target) ? AS_ARRAY(target)->count : 0)) {
+            error("Array index out of range.", line);
+        }
+        AS_ARRAY(target)->items[AS_INT(idx)] = val;
+    } else if (IS_MAP(target)) {
+        if (IS_INT(idx)) {
+            mapSetInt(AS_MAP(target), AS_INT(idx), val);
+        } else if (IS_STRING(idx)) {
+            mapSetStr(AS_MAP(target), AS_STRING(idx) ? AS_STRING(idx) : "", (int)strlen(AS_STRING(idx) ? AS_STRING(idx) : ""), val);
+        } else {
+            error("Map key must be int or string.", line);
+        }
+    } else if (IS_PMAP(target)) {
+        pmapSet(AS_PMAP(target), idx, val, line);
+    } else {
+        error("Index assignment not supported for this type.", line);
+    }
+}
+
+// Regular-expression built-ins (match, search, findAll, replaceAll); the
+// compiled patterns live in the caller's cache. Returns false if name is
+// not one of them.
+static bool patternBuiltin(PatternCache** cache, const char* name, Value* args, int argc, int line, Value* out) {
+    bool replacing = strcmp(name, "replaceAll") == 0;
+    if (!replacing && strcmp(name, "match") != 0 && strcmp(name, "search") != 0 && strcmp(name, "findAll") != 0) return false;
+    if (argc != (replacing ? 3 : 2)) {
+        char message[64];
+        snprintf(message, sizeof(message), "%s(re, s%s) takes %d arguments.", name, replacing ? ", rep" : "", replacing ? 3 : 2);
+        error(message, line);
+    }
+    for (int i = 0; i < argc; i++) {
+        if (!IS_STRING(args[i])) {
+            char message[64];
+            snprintf(message, sizeof(message), "%s() requires strings.", name);
+            error(message, line);
+        }
+    }
+    Pattern* pattern = patternLookup(cache, AS_STRING(args[0]) ? AS_STRING(args[0]) : "", line);
+    const char* text = AS_STRING(args[1]) ? AS_STRING(args[1]) : "";
+    size_t length = strlen(text);
+    // match(re, s) -> bool: does re match anywhere in s
+    if (name[0] == 'm') {
+        *out = BOOL_VAL(patternTest(pattern, text, length)); return true;
+    }
+    // search(re, s) -> index of the leftmost match, or -1
+    if (name[0] == 's') {
+        PatternMatch match;
+        *out = INT_VAL(patternSearch(pattern, text, length, &match) ? (int)match.start : -1); return true;
+    }
+    PatternMatch* matches;
+    size_t count = patternFindAll(pattern, text, length, &matches);
+    if (!replacing) {
+        // findAll(re, s) -> array of the matched substrings
+        Array* result = newArray();
+        if (count > 0) arrayEnsureCap(result, (int)count);
+        for (size_t i = 0; i < count; i++) {
+            result->items[result->count++] = STRING_VAL(copyBytes(text + matches[i].start, matches[i].end - matches[i].start, line));
+        }
+        free(matches);
+        *out = ARRAY_VAL(result); return true;
+    }
+    // replaceAll(re, s, rep) -> copy of s with every match replaced by rep
+    const char* rep = AS_STRING(args[2]) ? AS_STRING(args[2]) : "";
+    size_t repLength = strlen(rep);
+    size_t total = length;
+    for (size_t i = 0; i < count; i++) total = total - (matches[i].end - matches[i].start) + repLength;
+    char* result = (char*)malloc(total + 1);
+    if (!result) { free(matches); error("Memory allocation failed.", line); }
+    char* w = result;
+    size_t at = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(w, text + at, matches[i].start - at); w += matches[i].start - at;
+        memcpy(w, rep, repLength); w += repLength;
+        at = matches[i].end;
+    }
+    memcpy(w, text + at, length - at);
+    result[total] = '\0';
+    free(matches);
+    *out = STRING_VAL(result); return true;
+}
+
+// Built-in functions (flush, array, map, length, push, pop, has, delete, keys,
+// slice, concat, indexOf, reverse, fill, sort, join, split, find, contains,
+// replace, trim, upper, lower, startsWith, endsWith, parseInt, parseFloat,
+// jsonParse, jsonStringify, serialize, deserialize, saveValue, loadValue, pmap,
+// compact, open, readLines, csvRead, readAll, hasNext, next, write, writeLine,
+// close).
+// Returns false if name is not a built-in; otherwise stores the result in out.
+// args(): the command-line arguments given after the script name
+static Value argsArray(char** args, int count, int line) {
+    Array* arr = newArray();
+    for (int i = 0; i < count; i++) {
+        char* s = strdup(args[i]);
+        if (!s) error("Memory allocation failed.", line);
+        arrayPush(arr, STRING_VAL(s));
+    }
+    return ARRAY_VAL(arr);
+}
+
+// csvRead options: "sep" (one character, or "\t"), "columns" and "header"
+static void csvOptions(Map* opts, char* separator, bool* columns, bool* header, int line) {
+    for (MapEntry* e = opts->first; e; e = e->after) {
+        const char* key = e->isIntKey ? "" : e->key;
+        if (strcmp(key, "sep") == 0) {
+            const char* sep = IS_STRING(e->value) ? AS_STRING(e->value) : NULL;
+            if (sep && strcmp(sep, "\\t") == 0) *separator = '\t';
+            else if (sep && strlen(sep) == 1 && sep[0] != '"' && sep[0] != '\n' && sep[0] != '\r') *separator = sep[0];
+            else error("csvRead() option \"sep\" must be one character.", line);
+        } else if (strcmp(key, "columns") == 0) {
+            *columns = isTruthy(e->value);
+        } else if (strcmp(key, "header") == 0) {
+            *header = isTruthy(e->value);
+        } else {
+            error("csvRead() options are \"sep\", \"columns\" and \"header\".", line);
+        }
+    }
+}
+
+// next(f) and for-in over a reader: a line, or a CSV record's fields
+static Value readerNext(FileHandle* file, int line) {
+    size_t length;
+    const char* text = fileNextLine(file, &length);
+    if (!text) error("No more lines.", line);
+    if (fileSeparator(file)) return csvSplitRecord(text, length, fileSeparator(file), line);
+    char* s = malloc(length + 1);
+    if (!s) error("Memory allocation failed.", line);
+    memcpy(s, text, length);
+    s[length] = '\0';
+    return STRING_VAL(s);
+}
+
+static bool callBuiltin(const char* name, Value* args, int argc, int line, Value* out) {
+    // flush() -> writes buffered output to stdout
+    if (strcmp(name, "flush") == 0) {
+        if (argc != 0) error("flush() takes 0 arguments.", line);
+        outFlush();
+        *out = INT_VAL(0); return true;
+    }
+    // array()
+    if (strcmp(name, "array") == 0) {
+        if (argc != 0) error("array() takes 0 arguments.", line);
+        *out = ARRAY_VAL(newArray()); return true;
+    }
+    // map()
+    if (strcmp(name, "map") == 0) {
+        if (argc != 0) error("map() takes 0 arguments.", line);
+        *out = MAP_VAL(newMap()); return true;
+    }
+    // length(x)
+    if (strcmp(name, "length") == 0) {
+        if (argc != 1) error("length(x) takes 1 argument.", line);
+        Value v = INT_VAL(0);
+        if (IS_STRING(args[0])) v = INT_VAL(AS_STRING(args[0]) ? (int)strlen(AS_STRING(args[0])) : 0);
+        else if (IS_ARRAY(args[0])) v = INT_VAL(AS_ARRAY(args[0]) ? AS_ARRAY(args[0])->count : 0);
+        else if (IS_MAP(args[0])) {
+            int sz = AS_MAP(args[0]) ? AS_MAP(args[0])->count : 0;
+            v = INT_VAL(sz);
+        } else if (IS_PMAP(args[0])) v = INT_VAL(pmapCount(AS_PMAP(args[0])));
+        else error("length() unsupported type.", line);
+        *out = v; return true;
+    }
+    // push(a, v) -> returns new length
+    if (strcmp(name, "push") == 0) {
+        if (argc != 2) error("push(a, v) takes 2 arguments.", line);
+        if (!IS_ARRAY(args[0]) || !AS_ARRAY(args[0])) error("push() requires array as first arg.", line);
+        arrayPush(AS_ARRAY(args[0]), args[1]);
+        *out = INT_VAL(AS_ARRAY(args[0])->count); return true;
+    }
+    // pop(a) -> returns popped value
+    if (strcmp(name, "pop") == 0) {
+        if (argc != 1) error("pop(a) takes 1 argument.", line);
+        if (!IS_ARRAY(args[0]) || !AS_ARRAY(args[0])) error("pop() requires array.", line);
+        if (!arrayPop(AS_ARRAY(args[0]), out)) error("pop() on empty array.", line);
+        return true;
+    }
+    // has(m, k) -> bool
+    if (strcmp(name, "has") == 0) {
+        if (argc != 2) error("has(m, k) takes 2 arguments.", line);
+        if (IS_PMAP(args[0])) { *out = BOOL_VAL(pmapHas(AS_PMAP(args[0]), args[1], line)); return true; }
+        if (!IS_MAP(args[0]) || !AS_MAP(args[0])) error("has() requires map.", line);
+        bool present = false;
+        if (IS_INT(args[1])) { present = mapFindEntryInt(AS_MAP(args[0]), AS_INT(args[1]), NULL) != NULL; }
+        else if (IS_STRING(args[1])) { const char* s = AS_STRING(args[1]) ? AS_STRING(args[1]) : ""; present = mapFindEntry(AS_MAP(args[0]), s, (int)strlen(s), NULL) != NULL; }
+        else error("has() key must be int or string.", line);
+        *out = BOOL_VAL(present); return true;
+    }
+    // delete(m, k) -> bool (true if removed)
+    if (strcmp(name, "delete") == 0) {
+        if (argc != 2) error("delete(m, k) takes 2 arguments.", line);
+        if (IS_PMAP(args[0])) { *out = BOOL_VAL(pmapDelete(AS_PMAP(args[0]), args[1], line)); return true; }
+        if (!IS_MAP(args[0]) || !AS_MAP(args[0])) error("delete() requires map.", line);
+        bool removed = false;
+        if (IS_INT(args[1])) removed = mapDeleteInt(AS_MAP(args[0]), AS_INT(args[1]));
+        else if (IS_STRING(args[1])) { const char* s = AS_STRING(args[1]) ? AS_STRING(args[1]) : ""; removed = mapDeleteStr(AS_MAP(args[0]), s, (int)strlen(s)); }
+        else error("delete() key must be int or string.", line);
+        *out = BOOL_VAL(removed); return true;
+    }
+    // keys(m) -> array of string keys (int keys converted to decimal strings)
+    if (strcmp(name, "keys") == 0) {
+        if (argc != 1) error("keys(m) takes 1 argument.", line);
+        if (IS_PMAP(args[0])) { *out = ARRAY_VAL(pmapKeys(AS_PMAP(args[0]), false, line)); return true; }
+        if (!IS_MAP(args[0]) || !AS_MAP(args[0])) error("keys() requires map.", line);
+        Array* arr = newArray();
+        for (MapEntry* e = AS_MAP(args[0])->first; e; e = e->after) {
+            char* ks;
+            if (e->isIntKey) {
+                char buf[32]; snprintf(buf, sizeof(buf), "%d", e->intKey);
+                ks = strdup(buf); if (!ks) error("Memory allocation failed.", line);
+            } else {
+                ks = strdup(e->key ? e->key : ""); if (!ks) error("Memory allocation failed.", line);
+            }
+            arrayPush(arr, STRING_VAL(ks));
+        }
+        *out = ARRAY_VAL(arr); return true;
+    }
+    // slice(a, start [, end]) -> new array of a[start..end); negative bounds count from the end
+    if (strcmp(name, "slice") == 0) {
+        if (argc != 2 && argc != 3) error("slice(a, start [, end]) takes 2 or 3 arguments.", line);
+        Array* a = requireArray(args[0], "slice() requires array.", line);
+        int start = sliceIndex(args[1], a->count, "slice() bounds must be ints.", line);
+        int end = argc == 3 ? sliceIndex(args[2], a->count, "slice() bounds must be ints.", line) : a->count;
+        *out = ARRAY_VAL(arrayFromItems(a->items + start, end > start ? end - start : 0)); return true;
+    }
+    // concat(a, b, ...) -> new array with the items of each argument in turn
+    if (strcmp(name, "concat") == 0) {
+        if (argc < 1) error("concat(a, ...) takes at least 1 argument.", line);
+        int total = 0;
+        for (int i = 0; i < argc; i++) {
+            Array* part = requireArray(args[i], "concat() requires arrays.", line);
+            if (part->count > INT_MAX - total) error("concat() result is too large.", line);
+            total += part->count;
+        }
+        Array* result = newArray();
+        if (total > 0) arrayEnsureCap(result, total);
+        for (int i = 0; i < argc; i++) {
+            Array* part = AS_ARRAY(args[i]);
+            if (part->count == 0) continue;
+            memcpy(result->items + result->count, part->items, sizeof(Value) * (size_t)part->count);
+            result->count += part->count;
+        }
+        *out = ARRAY_VAL(result); return true;
+    }
+    // indexOf(a, v) -> index of the first item == v, or -1
+    if (strcmp(name, "indexOf") == 0) {
+        if (argc != 2) error("indexOf(a, v) takes 2 arguments.", line);
+        *out = INT_VAL(arrayIndexOf(requireArray(args[0], "indexOf() requires array.", line), args[1])); return true;
+    }
+    // reverse(a) -> a, reversed in place
+    if (strcmp(name, "reverse") == 0) {
+        if (argc != 1) error("reverse(a) takes 1 argument.", line);
+        Array* a = requireArray(args[0], "reverse() requires array.", line);
+        for (int i = 0, j = a->count - 1; i < j; i++, j--) {
+            Value t = a->items[i]; a->items[i] = a->items[j]; a->items[j] = t;
+        }
+        *out = args[0]; return true;
+    }
+    // fill(a, v [, start, end]) -> a, with a[start..end) set to v
+    if (strcmp(name, "fill") == 0) {
+        if (argc != 2 && argc != 4) error("fill(a, v [, start, end]) takes 2 or 4 arguments.", line);
+        Array* a = requireArray(args[0], "fill() requires array.", line);
+        int start = argc == 4 ? sliceIndex(args[2], a->count, "fill() bounds must be ints.", line) : 0;
+        int end = argc == 4 ? sliceIndex(args[3], a->count, "fill() bounds must be ints.", line) : a->count;
+        for (int i = start; i < end; i++) a->items[i] = args[1];
+        *out = args[0]; return true;
+    }
+    // sort(a) -> a, sorted ascending in place (numbers, or strings by byte order)
+    if (strcmp(name, "sort") == 0) {
+        if (argc != 1) error("sort(a) takes 1 argument.", line);
+        arraySort(requireArray(args[0], "sort() requires array.", line), line);
+        *out = args[0]; return true;
+    }
+    // join(a, sep) -> items rendered as by string + and separated by sep
+    if (strcmp(name, "join") == 0) {
+        if (argc != 2) error("join(a, sep) takes 2 arguments.", line);
+        Array* a = requireArray(args[0], "join() requires array.", line);
+        if (!IS_STRING(args[1])) error("join() separator must be a string.", line);
+        *out = STRING_VAL(arrayJoin(a, AS_STRING(args[1]) ? AS_STRING(args[1]) : "", line)); return true;
+    }
+    // split(s, sep) -> array of the pieces between occurrences of sep (characters if sep is "")
+    if (strcmp(name, "split") == 0) {
+        if (argc != 2) error("split(s, sep) takes 2 arguments.", line);
+        *out = stringSplit(requireString(args[0], "split() requires strings.", line),
+                           requireString(args[1], "split() requires strings.", line), line);
+        return true;
+    }
+    // find(s, sub) -> index of the first occurrence of sub, or -1
+    if (strcmp(name, "find") == 0) {
+        if (argc != 2) error("find(s, sub) takes 2 arguments.", line);
+        const char* text = requireString(args[0], "find() requires strings.", line);
+        const char* sub = requireString(args[1], "find() requires strings.", line);
+        const char* hit = findBytes(text, strlen(text), sub, strlen(sub));
+        *out = INT_VAL(hit ? (int)(hit - text) : -1); return true;
+    }
+    // contains(s, sub) -> bool
+    if (strcmp(name, "contains") == 0) {
+        if (argc != 2) error("contains(s, sub) takes 2 arguments.", line);
+        const char* text = requireString(args[0], "contains() requires strings.", line);
+        const char* sub = requireString(args[1], "contains() requires strings.", line);
+        *out = BOOL_VAL(findBytes(text, strlen(text), sub, strlen(sub)) != NULL); return true;
+    }
+    // replace(s, old, new) -> copy of s with every occurrence of old replaced
+    if (strcmp(name, "replace") == 0) {
+        if (argc != 3) error("replace(s, old, new) takes 3 arguments.", line);
+        *out = STRING_VAL(stringReplace(requireString(args[0], "replace() requires strings.", line),
+                                        requireString(args[1], "replace() requires strings.", line),
+                                        requireString(args[2], "replace() requires strings.", line), line));
+        return true;
+    }
+    // trim(s) -> copy without leading and trailing whitespace
+    if (strcmp(name, "trim") == 0) {
+        if (argc != 1) error("trim(s) takes 1 argument.", line);
+        const char* text = requireString(args[0], "trim() requires string.", line);
+        const char* end = text + strlen(text);
+        while (text < end && isSpaceChar(*text)) text++;
+        while (end > text && isSpaceChar(end[-1])) end--;
+        *out = STRING_VAL(copyBytes(text, (size_t)(end - text), line)); return true;
+    }
+    // upper(s) / lower(s) -> copy with ASCII letters case-converted
+    if (strcmp(name, "upper") == 0) {
+        if (argc != 1) error("upper(s) takes 1 argument.", line);
+        *out = STRING_VAL(stringCase(requireString(args[0], "upper() requires string.", line), true, line)); return true;
+    }
+    if (strcmp(name, "lower") == 0) {
+        if (argc != 1) error("lower(s) takes 1 argument.", line);
+        *out = STRING_VAL(stringCase(requireString(args[0], "lower() requires string.", line), false, line)); return true;
+    }
+    // startsWith(s, prefix) / endsWith(s, suffix) -> bool
+    if (strcmp(name, "startsWith") == 0) {
+        if (argc != 2) error("startsWith(s, prefix) takes 2 arguments.", line);
+        const char* text = requireString(args[0], "startsWith() requires strings.", line);
+        const char* prefix = requireString(args[1], "startsWith() requires strings.", line);
+        size_t length = strlen(prefix);
+        *out = BOOL_VAL(strncmp(text, prefix, length) == 0); return true;
+    }
+    if (strcmp(name, "endsWith") == 0) {
+        if (argc != 2) error("endsWith(s, suffix) takes 2 arguments.", line);
+        const char* text = requireString(args[0], "endsWith() requires strings.", line);
+        const char* suffix = requireString(args[1], "endsWith() requires strings.", line);
+        size_t length = strlen(text), suffixLength = strlen(suffix);
+        *out = BOOL_VAL(suffixLength <= length && memcmp(text + length - suffixLength, suffix, suffixLength) == 0); return true;
+    }
+    // parseInt(s) -> int; parseFloat(s) -> float
+    if (strcmp(name, "parseInt") == 0) {
+        if (argc != 1) error("parseInt(s) takes 1 argument.", line);
+        *out = INT_VAL(parseIntString(requireString(args[0], "parseInt() requires string.", line), line)); return true;
+    }
+    if (strcmp(name, "parseFloat") == 0) {
+        if (argc != 1) error("parseFloat(s) takes 1 argument.", line);
+        *out = FLOAT_VAL(parseFloatString(requireString(args[0], "parseFloat() requires string.", line), line)); return true;
+    }
+    // jsonParse(text) -> value; jsonStringify(value [, indent]) -> text (json.c)
+    if (strcmp(name, "jsonParse") == 0) {
+        if (argc != 1) error("jsonParse(text) takes 1 argument.", line);
+        const char* text = requireString(args[0], "jsonParse() requires string.", line);
+        *out = jsonParse(text, strlen(text), line); return true;
+    }
+    if (strcmp(name, "jsonStringify") == 0) {
+        if (argc != 1 && argc != 2) error("jsonStringify(value [, indent]) takes 1 or 2 arguments.", line);
+        int indent = 0;
+        if (argc == 2) {
+            if (!IS_INT(args[1]) || AS_INT(args[1]) < 0 || AS_INT(args[1]) > 16) error("jsonStringify() indent must be an int from 0 to 16.", line);
+            indent = AS_INT(args[1]);
+        }
+        *out = STRING_VAL(jsonStringify(args[0], indent, line)); return true;
+    }
+    // open(path, mode) -> file; mode "r" (lines), "w" (truncate) or "a" (append)
+    if (strcmp(name, "open") == 0) {
+        if (argc != 2) error("open(path, mode) takes 2 arguments.", line);
+        if (!IS_STRING(args[0]) || !AS_STRING(args[0]) || !IS_STRING(args[1]) || !AS_STRING(args[1])) {
+            error("open() requires path and mode strings.", line);
+        }
+        const char* mode = AS_STRING(args[1]);
+        FileHandle* file = NULL;
+        if (strcmp(mode, "r") == 0) file = fileOpenLines(AS_STRING(args[0]));
+        else if (strcmp(mode, "w") == 0) file = fileOpenWrite(AS_STRING(args[0]), false);
+        else if (strcmp(mode, "a") == 0) file = fileOpenWrite(AS_STRING(args[0]), true);
+        else error("open() mode must be \"r\", \"w\" or \"a\".", line);
+        if (!file) error("Could not open file.", line);
+        *out = FILE_VAL(file); return true;
+    }
+    // readLines(path) -> line iterator (file opened for reading)
+    if (strcmp(name, "readLines") == 0) {
+        if (argc != 1) error("readLines(path) takes 1 argument.", line);
+        if (!IS_STRING(args[0]) || !AS_STRING(args[0])) error("readLines() requires path string.", line);
+        FileHandle* file = fileOpenLines(AS_STRING(args[0]));
+        if (!file) error("Could not open file.", line);
+        *out = FILE_VAL(file); return true;
+    }
+    // csvRead(path [, opts]) -> record reader (next() returns an array of
+    // fields), or with opts["columns"] a map from column name to array (csv.c)
+    if (strcmp(name, "csvRead") == 0) {
+        if (argc != 1 && argc != 2) error("csvRead(path [, opts]) takes 1 or 2 arguments.", line);
+        const char* path = requireString(args[0], "csvRead() requires path string.", line);
+        size_t pathLength = strlen(path);
+        char separator = pathLength >= 4 && strcmp(path + pathLength - 4, ".tsv") == 0 ? '\t' : ',';
+        bool columns = false;
+        bool header = true;
+        if (argc == 2) {
+            if (!IS_MAP(args[1]) || !AS_MAP(args[1])) error("csvRead() options must be a map.", line);
+            csvOptions(AS_MAP(args[1]), &separator, &columns, &header, line);
+        }
+        if (columns) { *out = csvReadColumns(path, separator, header, line); return true; }
+        FileHandle* file = fileOpenCsv(path, separator);
+        if (!file) error("Could not open file.", line);
+        *out = FILE_VAL(file); return true;
+    }
+    // serialize(value) -> text; deserialize(text) -> value (serialize.c)
+    if (strcmp(name, "serialize") == 0) {
+        if (argc != 1) error("serialize(value) takes 1 argument.", line);
+        *out = STRING_VAL(serializeText(args[0], line)); return true;
+    }
+    if (strcmp(name, "deserialize") == 0) {
+        if (argc != 1) error("deserialize(text) takes 1 argument.", line);
+        const char* text = requireString(args[0], "deserialize() requires string.", line);
+        *out = deserializeText(text, strlen(text), line); return true;
+    }
+    // saveValue(path, value) -> bytes written; loadValue(path) -> value
+    if (strcmp(name, "saveValue") == 0) {
+        if (argc != 2) error("saveValue(path, value) takes 2 arguments.", line);
+        const char* path = requireString(args[0], "saveValue() requires path string.", line);
+        size_t written = saveValueFile(path, args[1], line);
+        *out = written <= INT_MAX ? INT_VAL((int)written) : FLOAT_VAL((double)written); return true;
+    }
+    if (strcmp(name, "loadValue") == 0) {
+        if (argc != 1) error("loadValue(path) takes 1 argument.", line);
+        const char* path = requireString(args[0], "loadValue() requires path string.", line);
+        *out = loadValueFile(path, line); return true;
+    }
+    // pmap(path) -> disk-backed map; compact(m) -> bytes reclaimed (pmap.c)
+    if (strcmp(name, "pmap") == 0) {
+        if (argc != 1) error("pmap(path) takes 1 argument.", line);
+        const char* path = requireString(args[0], "pmap() requires path string.", line);
+        *out = PMAP_VAL(pmapOpen(path, line)); return true;
+    }
+    if (strcmp(name, "compact") == 0) {
+        if (argc != 1) error("compact(m) takes 1 argument.", line);
+        if (!IS_PMAP(args[0])) error("compact() requires pmap.", line);
+        size_t reclaimed = pmapCompact(AS_PMAP(args[0]), line);
+        *out = reclaimed <= INT_MAX ? INT_VAL((int)reclaimed) : FLOAT_VAL((double)reclaimed); return true;
+    }
+    // readAll(path) -> whole file as a string
+    if (strcmp(name, "readAll") == 0) {
+        if (argc != 1) error("readAll(path) takes 1 argument.", line);
+        if (!IS_STRING(args[0]) || !AS_STRING(args[0])) error("readAll() requires path string.", line);
+        char* text = readFileAll(AS_STRING(args[0]));
+        if (!text) error("Could not read file.", line);
+        *out = STRING_VAL(text); return true;
+    }
+    // hasNext(f) -> bool
+    if (strcmp(name, "hasNext") == 0) {
+        if (argc != 1) error("hasNext(f) takes 1 argument.", line);
+        if (!IS_FILE(args[0]) || !fileIsReader(AS_FILE(args[0]))) error("hasNext() requires a file opened for reading.", line);
+        *out = BOOL_VAL(fileHasNext(AS_FILE(args[0]))); return true;
+    }
+    // next(f) -> next line (copied: strings are owned by their variables),
+    // or the next record's fields for a CSV reader
+    if (strcmp(name, "next") == 0) {
+        if (argc != 1) error("next(f) takes 1 argument.", line);
+        if (!IS_FILE(args[0]) || !fileIsReader(AS_FILE(args[0]))) error("next() requires a file opened for reading.", line);
+        *out = readerNext(AS_FILE(args[0]), line); return true;
+    }
+    // write(f, v) / writeLine(f, v) -> buffered write of a string, number or bool
+    if (strcmp(name, "write") == 0 || strcmp(name, "writeLine") == 0) {
+        if (argc != 2) error("write(f, v) takes 2 arguments.", line);
+        if (!IS_FILE(args[0]) || fileIsReader(AS_FILE(args[0]))) error("write() requires a file opened for writing.", line);
+        char num[FORMAT_NUMBER_MAX];
+        const char* text = num;
+        size_t length;
+        switch (VALUE_TYPE(args[1])) {
+            case VAL_STRING: text = AS_STRING(args[1]) ? AS_STRING(args[1]) : ""; length = strlen(text); break;
+            case VAL_INT: length = (size_t)formatInt(num, AS_INT(args[1])); break;
+            case VAL_FLOAT: length = (size_t)formatDouble(num, AS_FLOAT(args[1])); break;
+            case VAL_BOOL: text = AS_BOOL(args[1]) ? "true" : "false"; length = strlen(text); break;
+            default: error("write() value must be string, number or bool.", line); length = 0; break;
+        }
+        bool ok = fileWrite(AS_FILE(args[0]), text, length);
+        if (ok && strcmp(name, "writeLine") == 0) ok = fileWrite(AS_FILE(args[0]), "\n", 1);
+        if (!ok) error("Write failed.", line);
+        *out = INT_VAL((int)length); return true;
+    }
+    // close(f): files and pmaps
+    if (strcmp(name, "close") == 0) {
+        if (argc != 1) error("close(f) takes 1 argument.", line);
+        if (IS_PMAP(args[0])) { pmapClose(AS_PMAP(args[0])); *out = INT_VAL(0); return true; }
+        if (!IS_FILE(args[0])) error("close() requires a file.", line);
+        fileClose(AS_FILE(args[0]));
+        *out = INT_VAL(0); return true;
+    }
+    return false;
+}
+
+// Guard failures tolerated before a site is left generic for good
+#define QUICK_MAX_DEOPTS 4
+
+// Pick the specialized form for an operator given the observed operand types
+static BinaryQuick quickenBinary(TokenType op, Value left, Value right) {
+    if (IS_INT(left) && IS_INT(right)) {
+        switch (op) {
+            case TOKEN_PLUS: return BIN_ADD_INT_INT;
+            case TOKEN_MINUS: return BIN_SUB_INT_INT;
+            case TOKEN_STAR: return BIN_MUL_INT_INT;
+            case TOKEN_SLASH: return BIN_DIV_INT_INT;
+            case TOKEN_PERCENT: return BIN_MOD_INT_INT;
+            case TOKEN_LESS: return BIN_LT_INT_INT;
+            case TOKEN_LESS_EQUAL: return BIN_LE_INT_INT;
+            case TOKEN_GREATER: return BIN_GT_INT_INT;
+            case TOKEN_GREATER_EQUAL: return BIN_GE_INT_INT;
+            case TOKEN_EQUAL_EQUAL: return BIN_EQ_INT_INT;
+            case TOKEN_BANG_EQUAL: return BIN_NE_INT_INT;
+            default: return BIN_GENERIC;
+        }
+    }
+    if (IS_FLOAT(left) && IS_FLOAT(right)) {
+        switch (op) {
+            case TOKEN_PLUS: return BIN_ADD_FLOAT_FLOAT;
+            case TOKEN_MINUS: return BIN_SUB_FLOAT_FLOAT;
+            case TOKEN_STAR: return BIN_MUL_FLOAT_FLOAT;
+            case TOKEN_SLASH: return BIN_DIV_FLOAT_FLOAT;
+            case TOKEN_LESS: return BIN_LT_FLOAT_FLOAT;
+            case TOKEN_LESS_EQUAL: return BIN_LE_FLOAT_FLOAT;
+            case TOKEN_GREATER: return BIN_GT_FLOAT_FLOAT;
+            case TOKEN_GREATER_EQUAL: return BIN_GE_FLOAT_FLOAT;
+            case TOKEN_EQUAL_EQUAL: return BIN_EQ_FLOAT_FLOAT;
+            case TOKEN_BANG_EQUAL: return BIN_NE_FLOAT_FLOAT;
+            default: return BIN_GENERIC;
+        }
+    }
+    return BIN_GENERIC;
+}
+
+// Binary operation with self-specialization: run the site's specialized form
+// when its type guard holds, otherwise deoptimize to the generic path and
+// record the observed types for the next evaluation.
+static Value binaryOp(VM* vm, Node* node, Value left, Value right) {
+    BinaryQuick quick = node->binary.quick;
+    if (quick >= BIN_ADD_INT_INT && quick <= BIN_NE_INT_INT) {
+        if (IS_INT(left) && IS_INT(right)) {
+            int a = AS_INT(left), b = AS_INT(right);
+            switch (quick) {
+                case BIN_ADD_INT_INT: return INT_VAL(a + b);
+                case BIN_SUB_INT_INT: return INT_VAL(a - b);
+                case BIN_MUL_INT_INT: return INT_VAL(a * b);
+                case BIN_DIV_INT_INT:
+                    if (b == 0) error("Division by zero.", node->binary.op.line);
+                    if (b == -1 && a == INT_MIN) error("Integer overflow in division.", node->binary.op.line);
+                    return INT_VAL(a / b);
+                case BIN_MOD_INT_INT:
+                    if (b == 0) error("Modulo by zero.", node->binary.op.line);
+                    return INT_VAL(b == -1 ? 0 : a % b);
+                case BIN_LT_INT_INT: return BOOL_VAL(a < b);
+                case BIN_LE_INT_INT: return BOOL_VAL(a <= b);
+                case BIN_GT_INT_INT: return BOOL_VAL(a > b);
+                case BIN_GE_INT_INT: return BOOL_VAL(a >= b);
+                case BIN_EQ_INT_INT: return BOOL_VAL(a == b);
+                case BIN_NE_INT_INT: return BOOL_VAL(a != b);
+                default: break;
+            }
+        }
+    } else if (quick >= BIN_ADD_FLOAT_FLOAT) {
+        if (IS_FLOAT(left) && IS_FLOAT(right)) {
+            double a = AS_FLOAT(left), b = AS_FLOAT(right);
+            switch (quick) {
+                case BIN_ADD_FLOAT_FLOAT: return FLOAT_VAL(a + b);
+                case BIN_SUB_FLOAT_FLOAT: return FLOAT_VAL(a - b);
+                case BIN_MUL_FLOAT_FLOAT: return FLOAT_VAL(a * b);
+                case BIN_DIV_FLOAT_FLOAT:
+                    if (b == 0.0) error("Division by zero.", node->binary.op.line);
+                    return FLOAT_VAL(a / b);
+                case BIN_LT_FLOAT_FLOAT: return BOOL_VAL(a < b);
+                case BIN_LE_FLOAT_FLOAT: return BOOL_VAL(a <= b);
+                case BIN_GT_FLOAT_FLOAT: return BOOL_VAL(a > b);
+                case BIN_GE_FLOAT_FLOAT: return BOOL_VAL(a >= b);
+                case BIN_EQ_FLOAT_FLOAT: return BOOL_VAL(a == b);
+                case BIN_NE_FLOAT_FLOAT: return BOOL_VAL(a != b);
+                default: break;
+            }
+        }
+    }
+
+    if (vm->parallelWorker) {
+        // Code is shared with other threads: run generic, leave the node as is
+    } else if (quick == BIN_UNSEEN) {
+        node->binary.quick = quickenBinary(node->binary.op.type, left, right);
+    } else if (quick != BIN_GENERIC) {
+        // Guard failed: deoptimize this site, re-specialize on the next
+        // evaluation unless it keeps flip-flopping between types.
+        node->binary.quick = (++node->binary.deopts >= QUICK_MAX_DEOPTS) ? BIN_GENERIC : BIN_UNSEEN;
+    }
+    return binaryGeneric(node->binary.op, left, right);
+}
+
+// Fused `+` chain (optimizer.h): operands are evaluated left to right and
+// leading non-strings are added as usual; from the first string on, the
+// remaining operands are concatenated in one pass.
+static Value evalConcat(VM* vm, Node* node) {
+    int n = node->binary.concatCount;
+    Node* smallSpine[CONCAT_SMALL];
+    Value smallParts[CONCAT_SMALL];
+    Node** spine = smallSpine;      // spine[i]: the `+` whose right operand is operand i
+    Value* parts = smallParts;
+    if (n > CONCAT_SMALL) {
+        spine = (Node**)malloc(sizeof(Node*) * (size_t)n);
+        parts = (Value*)malloc(sizeof(Value) * (size_t)n);
+        if (!spine || !parts) error("Memory allocation failed.", node->binary.op.line);
+    }
+    Node* first = node;
+    for (int i = n - 1; i > 0; i--) {
+        spine[i] = first;
+        first = first->binary.left;
+    }
+
+    Value sum = evaluate(vm, first);
+    int count = 0, i = 1;
+    for (; i < n; i++) {
+        Value right = evaluate(vm, spine[i]->binary.right);
+        if (IS_STRING(sum) || IS_STRING(right)) {
+            parts[count++] = sum;
+            parts[count++] = right;
+            i++;
+            break;
+        }
+        sum = binaryOp(vm, spine[i], sum, right);
+    }
+    for (; i < n; i++) parts[count++] = evaluate(vm, spine[i]->binary.right);
+    Value result = count > 0 ? concatValues(parts, count, node->binary.op.line) : sum;
+    if (spine != smallSpine) {
+        free(spine);
+        free(parts);
+    }
+    return result;
+}
+
+// Unboxed evaluation of expressions whose type the optimizer proved
+// (staticType). Operands are computed as C values; only leaves that are not
+// arithmetic go through evaluate(), and their tag is known, so no checks.
+static int evalInt(VM* vm, Node* node);
+static double evalFloat(VM* vm, Node* node);
+
+// Typed variables are locals the optimizer proved declared in the current
+// function environment: look only there
+static Value localValue(VM* vm, Node* node) {
+    Token name = node->var.name;
+    unsigned int hv = tokenHash(name);
+    for (VarEntry* e = vm->env->buckets[hv % TABLE_SIZE]; e; e = e->next) {
+        if (sameKey(e->key, e->hash, name.start, name.length, hv)) return e->value;
+    }
+    return evaluate(vm, node);
+}
+
+static int evalInt(VM* vm, Node* node) {
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+            return node->literal.intValue;
+        case NODE_EXPR_VAR:
+            return AS_INT(localValue(vm, node));
+        case NODE_EXPR_UNARY:
+            if (node->unary.op.type == TOKEN_MINUS) return -evalInt(vm, node->unary.expr);
+            return evalInt(vm, node->unary.expr);
+        case NODE_EXPR_BINARY: {
+            int a = evalInt(vm, node->binary.left);
+            int b = evalInt(vm, node->binary.right);
+            switch (node->binary.op.type) {
+                case TOKEN_PLUS: return a + b;
+                case TOKEN_MINUS: return a - b;
+                case TOKEN_STAR: return a * b;
+                case TOKEN_SLASH:
+                    if (b == 0) error("Division by zero.", node->binary.op.line);
+                    if (b == -1 && a == INT_MIN) error("Integer overflow in division.", node->binary.op.line);
+                    return a / b;
+                case TOKEN_PERCENT:
+                    if (b == 0) error("Modulo by zero.", node->binary.op.line);
+                    return b == -1 ? 0 : a % b;
+                default: break;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return AS_INT(evaluate(vm, node));
 }
-static bool mapDeleteStr(Map* m, const char* key, int len) {
-    unsigned int b = hash(key, len);
-    MapEntry* prev = NULL; MapEntry* e = m->buckets[b];
-    while (e) {
-        if (!e->isIntKey && e->key && (int)strlen(e->key) == len && strncmp(e->key, key, len) == 0) {
-            if (prev) prev->next = e->next; else m->buckets[b] = e->next;
-            free(e->key); free(e);
-            return true;
+
+static double evalFloat(VM* vm, Node* node) {
+    if (node->staticType == TYPE_INT) return (double)evalInt(vm, node);
+    switch (node->type) {
+        case NODE_EXPR_LITERAL:
+            return node->literal.floatValue;
+        case NODE_EXPR_VAR:
+            return AS_FLOAT(localValue(vm, node));
+        case NODE_EXPR_UNARY:
+            if (node->unary.op.type == TOKEN_MINUS) return -evalFloat(vm, node->unary.expr);
+            return evalFloat(vm, node->unary.expr);
+        case NODE_EXPR_BINARY: {
+            double a = evalFloat(vm, node->binary.left);
+            double b = evalFloat(vm, node->binary.right);
+            switch (node->binary.op.type) {
+                case TOKEN_PLUS: return a + b;
+                case TOKEN_MINUS: return a - b;
+                case TOKEN_STAR: return a * b;
+                case TOKEN_SLASH:
+                    if (b == 0.0) error("Division by zero.", node->binary.op.line);
+                    return a / b;
+                default: break;
+            }
+            break;
         }
-        prev = e; e = e->next;
+        default:
+            break;
     }
-    return false;
+    return AS_FLOAT(evaluate(vm, node));
 }
-static bool mapDeleteInt(Map* m, int ikey) {
-    unsigned int b = hashIntKey(ikey);
-    MapEntry* prev = NULL; MapEntry* e = m->buckets[b];
-    while (e) {
-        if (e->isIntKey && e->intKey == ikey) {
-            if (prev) prev->next = e->next; else m->buckets[b] = e->next;
-            free(e);
-            return true;
+
+// Numeric comparison (staticType TYPE_BOOL binary)
+static bool evalCompare(VM* vm, Node* node) {
+    Node* l = node->binary.left;
+    Node* r = node->binary.right;
+    if (l->staticType == TYPE_INT && r->staticType == TYPE_INT) {
+        int a = evalInt(vm, l), b = evalInt(vm, r);
+        switch (node->binary.op.type) {
+            case TOKEN_LESS: return a < b;
+            case TOKEN_LESS_EQUAL: return a <= b;
+            case TOKEN_GREATER: return a > b;
+            case TOKEN_GREATER_EQUAL: return a >= b;
+            case TOKEN_EQUAL_EQUAL: return a == b;
+            default: return a != b;
         }
-        prev = e; e = e->next;
     }
-    return false;
+    double a = evalFloat(vm, l), b = evalFloat(vm, r);
+    switch (node->binary.op.type) {
+        case TOKEN_LESS: return a < b;
+        case TOKEN_LESS_EQUAL: return a <= b;
+        case TOKEN_GREATER: return a > b;
+        case TOKEN_GREATER_EQUAL: return a >= b;
+        case TOKEN_EQUAL_EQUAL: return a == b;
+        default: return a != b;
+    }
 }
 
-// Forward declarations
-static Value evaluate(VM* vm, Node* node);
-static void execute(VM* vm, Node* node);
+// Truth value of a branch or loop condition
+static bool evalCondition(VM* vm, Node* cond) {
+    if (cond->staticType == TYPE_BOOL && cond->type == NODE_EXPR_BINARY) return evalCompare(vm, cond);
+    return isTruthy(evaluate(vm, cond));
+}
 
 // Execute function call
 static Value callFunction(VM* vm, Function* func, Value* args, int argCount) {
     if (vm->callStackTop >= CALL_STACK_MAX) {
         error("Call stack overflow.", 0);
     }
+
+    // Baseline JIT: compile once hot, run native code while arguments are ints
+    if ((vm->jitEnabled || func->jit) && argCount == func->paramCount) {
+        if (vm->jitEnabled && !func->jit && !func->jitFailed && ++func->hotness >= JIT_HOT_THRESHOLD) {
+            func->jit = jitCompile(func->name, func->params, func->paramCount, func->body);
+            if (!func->jit) func->jitFailed = true;
+        }
+        if (func->jit) {
+            int intArgs[JIT_MAX_LOCALS];
+            bool allInts = true;
+            for (int i = 0; i < argCount; i++) {
+                if (!IS_INT(args[i])) { allInts = false; break; }
+                intArgs[i] = AS_INT(args[i]);
+            }
+            int result;
+            if (allInts && func->jit->entry(intArgs, &result, vm->callStackTop) == 0) {
+                return INT_VAL(result);
+            }
+            // Guard failed or deoptimized: fall back to the interpreter
+        }
+    }
     
     // Create new environment for function execution
     Environment* funcEnv = malloc(sizeof(Environment));
@@ -349,17 +2017,18 @@ static Value callFunction(VM* vm, Function* func, Value* args, int argCount) {
         }
         
         paramEntry->value = args[i];
-        unsigned int hashVal = hash(paramEntry->key, strlen(paramEntry->key));
-        paramEntry->next = funcEnv->buckets[hashVal];
-        funcEnv->buckets[hashVal] = paramEntry;
+        paramEntry->hash = tokenHash(func->params[i]);
+        unsigned int h = paramEntry->hash % TABLE_SIZE;
+        paramEntry->next = funcEnv->buckets[h];
+        funcEnv->buckets[h] = paramEntry;
     }
     
     // Push call frame
     CallFrame* frame = &vm->callStack[vm->callStackTop++];
+    frame->function = func;
     frame->env = vm->env;
     frame->hasReturned = false;
-    frame->returnValue.type = VAL_INT;
-    frame->returnValue.intVal = 0;
+    frame->returnValue = INT_VAL(0);
     
     // Switch to function environment and set definition env to function's closure
     Environment* oldEnv = vm->env;
@@ -384,7 +2053,7 @@ static Value callFunction(VM* vm, Function* func, Value* args, int argCount) {
         while (entry) {
             VarEntry* next = entry->next;
             free(entry->key);
-            // Do NOT free entry->value.stringVal here.
+            // Do NOT free the string payload of entry->value here.
             // String values passed as arguments or assigned to locals may alias
             // memory owned by outer scopes; freeing here can cause double-free
             // or use-after-free when returning strings.
@@ -406,6 +2075,128 @@ static Value callFunction(VM* vm, Function* func, Value* args, int argCount) {
     return returnValue;
 }
 
+// sort(a, "cmp"): merge sort calling cmp(x, y); a negative result puts x
+// first. Merging keeps equal items in order and bounds the calls to
+// n*log2(n) even for an inconsistent comparator.
+static bool sortCompareLess(VM* vm, Function* cmp, Value x, Value y, int line) {
+    Value pair[2] = { x, y };
+    Value r = callFunction(vm, cmp, pair, 2);
+    if (IS_INT(r)) return AS_INT(r) < 0;
+    if (IS_FLOAT(r)) return AS_FLOAT(r) < 0;
+    error("sort() comparator must return a number.", line);
+    return false;
+}
+
+static Value sortWithComparator(VM* vm, Value* args, int argc, int line) {
+    if (argc != 2 || !IS_ARRAY(args[0]) || !AS_ARRAY(args[0])) error("sort(a, cmp) expects an array and a function name.", line);
+    if (!IS_STRING(args[1])) error("sort expects a function name string.", line);
+    Function* cmp = vmFindFunction(vm, AS_STRING(args[1]));
+    if (!cmp) error("Undefined function.", line);
+    if (cmp->paramCount != 2) error("sort function must take 2 arguments.", line);
+
+    Array* a = AS_ARRAY(args[0]);
+    int n = a->count;
+    if (n < 2) return args[0];
+    // The comparator may push to or pop from a, so sort a copy
+    Value* src = (Value*)malloc(sizeof(Value) * (size_t)n * 2);
+    if (!src) error("Memory allocation failed.", line);
+    memcpy(src, a->items, sizeof(Value) * (size_t)n);
+    Value* dst = src + n;
+    Value* buffer = src;
+    for (int width = 1; width < n; width *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                dst[k++] = sortCompareLess(vm, cmp, src[j], src[i], line) ? src[j++] : src[i++];
+            }
+            while (i < mid) dst[k++] = src[i++];
+            while (j < hi) dst[k++] = src[j++];
+        }
+        Value* t = src; src = dst; dst = t;
+    }
+    if (a->count != n) { free(buffer); error("Array modified during sort().", line); }
+    memcpy(a->items, src, sizeof(Value) * (size_t)n);
+    free(buffer);
+    return args[0];
+}
+
+// jsonEach(path, selector, fn): calls fn(item) for each element of the
+// array the selector names, parsing the file one element at a time
+typedef struct {
+    VM* vm;
+    Function* fn;
+} JsonEachCall;
+
+static void jsonEachItem(void* user, Value item) {
+    JsonEachCall* call = (JsonEachCall*)user;
+    callFunction(call->vm, call->fn, &item, 1);
+}
+
+static Value jsonEach(VM* vm, Value* args, int argc, int line) {
+    if (argc != 3) error("jsonEach(path, selector, fn) takes 3 arguments.", line);
+    const char* path = requireString(args[0], "jsonEach() requires path string.", line);
+    const char* selector = requireString(args[1], "jsonEach() requires selector string.", line);
+    const char* name = requireString(args[2], "jsonEach expects a function name string.", line);
+    JsonEachCall call = { vm, vmFindFunction(vm, name) };
+    if (!call.fn) error("Undefined function.", line);
+    if (call.fn->paramCount != 1) error("jsonEach function must take 1 argument.", line);
+    return INT_VAL(jsonEachFile(path, selector, jsonEachItem, &call, line));
+}
+
+// Counted loop (for_stmt.counted, see optimizer.c): the counter lives in a
+// C int and is stored to the variable once per iteration; the bound is
+// computed once. Returns false, before running anything, when the counter
+// or bound is not an int (or is a global in a parallel task) so the generic
+// loop runs instead.
+static bool runCountedLoop(VM* vm, Node* node) {
+    Node* cond = node->for_stmt.condition;
+    VarEntry* entry = findEntry(vm, cond->binary.left->var.name, false);
+    if (!entry || !IS_INT(entry->value)) return false;
+    if (vm->parallelWorker && !isLocalEntry(vm, entry)) return false;   // the increment reports it
+    Value bound = evaluate(vm, cond->binary.right);
+    if (!IS_INT(bound)) return false;
+
+    Node* step = node->for_stmt.increment->assign.value;
+    unsigned int delta = (unsigned int)step->binary.right->literal.intValue;
+    if (step->binary.op.type == TOKEN_MINUS) delta = 0u - delta;
+    int limit = AS_INT(bound);
+    int counter = AS_INT(entry->value);
+    TokenType op = cond->binary.op.type;
+    while (op == TOKEN_LESS ? counter < limit :
+           op == TOKEN_LESS_EQUAL ? counter <= limit :
+           op == TOKEN_GREATER ? counter > limit : counter >= limit) {
+        execute(vm, node->for_stmt.body);
+        if (vm->callStackTop > 0 && vm->callStack[vm->callStackTop - 1].hasReturned) break;
+        counter = (int)((unsigned int)counter + delta);   // wraps like the VM's int add
+        entry->value = INT_VAL(counter);
+        if (vm->jitEnabled && vm->callStackTop > 0) vm->callStack[vm->callStackTop - 1].function->hotness++;
+    }
+    return true;
+}
+
+// for (x in coll) / for (k, v in coll) over an array or map, without
+// building a keys array. Array elements and map values are bound as they
+// are stored (like a[i] / m[k]); maps are visited in insertion order. Int
+// map keys are bound as ints and string
+// keys as copies, since the variable may later be reassigned (which frees
+// its string). Arrays are walked by index against the live count; a map
+// gaining or losing entries during the loop is an error.
+static void runForIn(VM* vm, Node* node) {
+    Value coll = evaluate(vm, node->for_in.iterable);
+    GemForIn it;
+    gemForInStart(&it, coll, node->for_in.key.line);
+    bool pair = node->for_in.value.length > 0;
+    VarEntry* key = findEntry(vm, node->for_in.key, true);
+    VarEntry* value = pair ? findEntry(vm, node->for_in.value, true) : NULL;
+    while (gemForInNext(&it, &key->value, pair ? &value->value : NULL)) {
+        execute(vm, node->for_in.body);
+        if (vm->callStackTop > 0 && vm->callStack[vm->callStackTop - 1].hasReturned) return;
+        if (vm->jitEnabled && vm->callStackTop > 0) vm->callStack[vm->callStackTop - 1].function->hotness++;
+    }
+}
+
 // Execute statement
 static void execute(VM* vm, Node* node) {
     if (!node) {
@@ -415,16 +2206,14 @@ static void execute(VM* vm, Node* node) {
     
     switch (node->type) {
         case NODE_STMT_VAR_DECL: {
-            Value init = {VAL_INT, .intVal = 0}; // Default 0
+            Value init = INT_VAL(0); // Default 0
             if (node->var_decl.initializer) {
                 init = evaluate(vm, node->var_decl.initializer);
             }
             VarEntry* entry = findEntry(vm, node->var_decl.name, true);
             if (entry) {
                 // Free old string value if exists
-                if (entry->value.type == VAL_STRING && entry->value.stringVal) {
-                    free(entry->value.stringVal);
-                }
+                if (ownsString(vm, entry->value)) free(AS_STRING(entry->value));
                 entry->value = init;
             }
             break;
@@ -432,11 +2221,13 @@ static void execute(VM* vm, Node* node) {
         case NODE_STMT_ASSIGN: {
             Value value = evaluate(vm, node->assign.value);
             VarEntry* entry = findEntry(vm, node->assign.name, false);
+            if (entry && vm->parallelWorker && !isLocalEntry(vm, entry)) {
+                // Globals are shared by every worker thread
+                error("Cannot assign to global variables in a parallel task.", node->assign.name.line);
+            }
             if (entry) {
                 // Free old string value if exists
-                if (entry->value.type == VAL_STRING && entry->value.stringVal) {
-                    free(entry->value.stringVal);
-                }
+                if (ownsString(vm, entry->value)) free(AS_STRING(entry->value));
                 entry->value = value;
             } else {
                 error("Undefined variable.", node->assign.name.line);
@@ -445,93 +2236,18 @@ static void execute(VM* vm, Node* node) {
         }
         case NODE_STMT_PRINT: {
             Value value = evaluate(vm, node->print.expr);
-            switch (value.type) {
-                case VAL_INT: 
-                    printf("%d\n", value.intVal); 
-                    break;
-                case VAL_FLOAT: 
-                    printf("%.6g\n", value.floatVal); 
-                    break;
-                case VAL_STRING: 
-                    printf("%s\n", value.stringVal ? value.stringVal : "(null)"); 
-                    break;
-                case VAL_BOOL: 
-                    printf("%s\n", value.boolVal ? "true" : "false"); 
-                    break;
-                case VAL_MODULE:
-                    printf("[module %s]\n", (value.moduleVal && value.moduleVal->name) ? value.moduleVal->name : "<anon>");
-                    break;
-                case VAL_ARRAY:
-                    printf("[array length=%d]\n", value.arrayVal ? value.arrayVal->count : 0);
-                    break;
-                case VAL_MAP: {
-                    // compute size
-                    int sz = 0; if (value.mapVal) { for (int i = 0; i < TABLE_SIZE; i++) { MapEntry* e = value.mapVal->buckets[i]; while (e) { sz++; e = e->next; } } }
-                    printf("{map size=%d}\n", sz);
-                    break;
-                }
-            }
+            printValue(vm, value);
             break;
         }
         case NODE_STMT_INDEX_ASSIGN: {
             Value target = evaluate(vm, node->index_assign.target);
             Value idx = evaluate(vm, node->index_assign.index);
             Value val = evaluate(vm, node->index_assign.value);
-            if (target.type == VAL_ARRAY) {
-                if (idx.type != VAL_INT) error("Array index must be int.", 0);
-                if (idx.intVal < 0 || idx.intVal >= (target.arrayVal ? target.arrayVal->count : 0)) {
-                    error("Array index out of range.", 0);
-                }
-                target.arrayVal->items[idx.intVal] = val;
-            } else if (target.type == VAL_MAP) {
-                if (idx.type == VAL_INT) {
-                    mapSetInt(target.mapVal, idx.intVal, val);
-                } else if (idx.type == VAL_STRING) {
-                    mapSetStr(target.mapVal, idx.stringVal ? idx.stringVal : "", (int)strlen(idx.stringVal ? idx.stringVal : ""), val);
-                } else {
-                    error("Map key must be int or string.", 0);
-                }
-            } else {
-                error("Index assignment not supported for this type.", 0);
-            }
+            indexSet(target, idx, val, node->index_assign.bracket.line);
             break;
         }
         case NODE_STMT_IF: {
-            Value cond = evaluate(vm, node->if_stmt.condition);
-            bool isTrue = false;
-            switch (cond.type) {
-                case VAL_BOOL: 
-                    isTrue = cond.boolVal; 
-                    break;
-                case VAL_INT: 
-                    isTrue = cond.intVal != 0; 
-                    break;
-                case VAL_FLOAT: 
-                    isTrue = cond.floatVal != 0.0; 
-                    break;
-                case VAL_STRING: 
-                    isTrue = cond.stringVal != NULL && strlen(cond.stringVal) > 0; 
-                    break;
-                case VAL_MODULE:
-                    isTrue = true; // treat as truthy
-                    break;
-                case VAL_ARRAY:
-                    isTrue = cond.arrayVal && cond.arrayVal->count > 0;
-                    break;
-                case VAL_MAP: {
-                    int sz = 0;
-                    if (cond.mapVal) {
-                        for (int i = 0; i < TABLE_SIZE; i++) {
-                            MapEntry* e = cond.mapVal->buckets[i];
-                            while (e) { sz++; e = e->next; }
-                        }
-                    }
-                    isTrue = sz > 0;
-                    break;
-                }
-            }
-            
-            if (isTrue) {
+            if (evalCondition(vm, node->if_stmt.condition)) {
                 execute(vm, node->if_stmt.thenBranch);
             } else if (node->if_stmt.elseBranch) {
                 execute(vm, node->if_stmt.elseBranch);
@@ -540,92 +2256,37 @@ static void execute(VM* vm, Node* node) {
         }
         case NODE_STMT_WHILE: {
             while (true) {
-                Value cond = evaluate(vm, node->while_stmt.condition);
-                bool isTrue = false;
-                switch (cond.type) {
-                    case VAL_BOOL: 
-                        isTrue = cond.boolVal; 
-                        break;
-                    case VAL_INT: 
-                        isTrue = cond.intVal != 0; 
-                        break;
-                    case VAL_FLOAT: 
-                        isTrue = cond.floatVal != 0.0; 
-                        break;
-                    case VAL_STRING: 
-                        isTrue = cond.stringVal != NULL && strlen(cond.stringVal) > 0; 
-                        break;
-                    case VAL_MODULE:
-                        isTrue = true;
-                        break;
-                    case VAL_ARRAY:
-                        isTrue = cond.arrayVal && cond.arrayVal->count > 0;
-                        break;
-                    case VAL_MAP: {
-                        int sz = 0;
-                        if (cond.mapVal) {
-                            for (int i = 0; i < TABLE_SIZE; i++) {
-                                MapEntry* e = cond.mapVal->buckets[i];
-                                while (e) { sz++; e = e->next; }
-                            }
-                        }
-                        isTrue = sz > 0;
-                        break;
-                    }
-                }
-                if (!isTrue) break;
+                if (!evalCondition(vm, node->while_stmt.condition)) break;
                 execute(vm, node->while_stmt.body);
+                if (vm->callStackTop > 0 && vm->callStack[vm->callStackTop - 1].hasReturned) break;
+                // Count the back-edge towards the enclosing function's hotness
+                if (vm->jitEnabled && vm->callStackTop > 0) vm->callStack[vm->callStackTop - 1].function->hotness++;
             }
             break;
         }
+        case NODE_STMT_FOR_IN:
+            runForIn(vm, node);
+            break;
         case NODE_STMT_FOR: {
             if (node->for_stmt.initializer) {
                 execute(vm, node->for_stmt.initializer);
             }
+            if (node->for_stmt.counted && runCountedLoop(vm, node)) break;
             
             while (true) {
                 bool condTrue = true;
                 if (node->for_stmt.condition) {
-                    Value cond = evaluate(vm, node->for_stmt.condition);
-                    switch (cond.type) {
-                        case VAL_BOOL: 
-                            condTrue = cond.boolVal; 
-                            break;
-                        case VAL_INT: 
-                            condTrue = cond.intVal != 0; 
-                            break;
-                        case VAL_FLOAT: 
-                            condTrue = cond.floatVal != 0.0; 
-                            break;
-                        case VAL_STRING: 
-                            condTrue = cond.stringVal != NULL && strlen(cond.stringVal) > 0; 
-                            break;
-                        case VAL_MODULE:
-                            condTrue = true;
-                            break;
-                        case VAL_ARRAY:
-                            condTrue = cond.arrayVal && cond.arrayVal->count > 0;
-                            break;
-                        case VAL_MAP: {
-                            int sz = 0;
-                            if (cond.mapVal) {
-                                for (int i = 0; i < TABLE_SIZE; i++) {
-                                    MapEntry* e = cond.mapVal->buckets[i];
-                                    while (e) { sz++; e = e->next; }
-                                }
-                            }
-                            condTrue = sz > 0;
-                            break;
-                        }
-                    }
+                    condTrue = evalCondition(vm, node->for_stmt.condition);
                 }
                 if (!condTrue) break;
                 
                 execute(vm, node->for_stmt.body);
+                if (vm->callStackTop > 0 && vm->callStack[vm->callStackTop - 1].hasReturned) break;
                 
                 if (node->for_stmt.increment) {
                     execute(vm, node->for_stmt.increment);
                 }
+                if (vm->jitEnabled && vm->callStackTop > 0) vm->callStack[vm->callStackTop - 1].function->hotness++;
             }
             break;
         }
@@ -641,6 +2302,9 @@ static void execute(VM* vm, Node* node) {
             break;
         }
         case NODE_STMT_FUNCTION: {
+            if (vm->parallelWorker) {
+                error("Cannot define functions in a parallel task.", node->function.name.line);
+            }
             // Register function in current definition environment (global or module)
             Environment* target = vm->defEnv ? vm->defEnv : vm->globalEnv;
             FuncEntry* entry = findFuncEntry(target, node->function.name, true);
@@ -654,6 +2318,10 @@ static void execute(VM* vm, Node* node) {
                 func->body = node->function.body;
                 // Capture the environment where the function is defined (for module/global lookup)
                 func->closure = target;
+                func->hotness = 0;
+                func->jitFailed = false;
+                func->jit = NULL;
+                func->inlineExpr = vm->optLevel >= 1 ? inlineBody(node, vm->optDump) : NULL;
                 entry->function = func;
             } else {
                 error("Function already defined.", node->function.name.line);
@@ -661,6 +2329,9 @@ static void execute(VM* vm, Node* node) {
             break;
         }
         case NODE_STMT_IMPORT: {
+            if (vm->parallelWorker) {
+                error("Cannot import modules in a parallel task.", node->import_stmt.module.line);
+            }
             // Build filename <module>.gemini and resolve via cache, GEMINI_PATH, then projectRoot
             char modName[256];
             snprintf(modName, sizeof(modName), "%.*s.gemini", node->import_stmt.module.length, node->import_stmt.module.start);
@@ -668,41 +2339,63 @@ static void execute(VM* vm, Node* node) {
             ModuleEntry* mentry = findModuleEntry(vm, node->import_stmt.module.start, node->import_stmt.module.length, false);
             if (mentry && mentry->module) {
                 VarEntry* aliasEntry = findEntry(vm, node->import_stmt.alias, true);
-                aliasEntry->value.type = VAL_MODULE;
-                aliasEntry->value.moduleVal = mentry->module;
+                aliasEntry->value = MODULE_VAL(mentry->module);
                 break;
             }
 
-            char* fullPath = NULL;
-            char candidate[2048];
-            // Try GEMINI_PATH first for speed and explicitness
-            const char* gp = getenv("GEMINI_PATH");
-            if (gp && *gp) {
-                const char* p = gp;
-                while (*p) {
-                    char dirbuf[1024];
-                    int di = 0;
-                    while (*p && *p != ':' && di < (int)sizeof(dirbuf) - 1) {
-                        dirbuf[di++] = *p++;
-                    }
-                    dirbuf[di] = '\0';
-                    if (*p == ':') p++;
-                    if (di == 0) continue;
-                    snprintf(candidate, sizeof(candidate), "%s/%s", dirbuf, modName);
-                    if (fileExists(candidate)) { fullPath = strdup(candidate); break; }
+            // Native modules (math, stats) take precedence over files
+            const NativeModule* native = findNativeModule(node->import_stmt.module.start, node->import_stmt.module.length);
+            if (native) {
+                char hidden[2048];
+                if (findShadowedModule(vm->projectRoot, node->import_stmt.module.start, node->import_stmt.module.length,
+                                       hidden, sizeof(hidden))) {
+                    char message[2200];
+                    snprintf(message, sizeof(message), "native module '%.*s' is imported instead of %s.",
+                             node->import_stmt.module.length, node->import_stmt.module.start, hidden);
+                    warn(vm, message, node->import_stmt.module.line);
                 }
+                Module* module = malloc(sizeof(Module));
+                if (!module) error("Memory allocation failed.", node->import_stmt.module.line);
+                module->name = strndup(node->import_stmt.alias.start, node->import_stmt.alias.length);
+                module->env = calloc(1, sizeof(Environment));     // no variables or script functions
+                if (!module->name || !module->env) error("Memory allocation failed.", node->import_stmt.module.line);
+                module->source = NULL;
+                module->ast = NULL;
+                module->native = native;
+                VarEntry* aliasEntry = findEntry(vm, node->import_stmt.alias, true);
+                aliasEntry->value = MODULE_VAL(module);
+                ModuleEntry* store = findModuleEntry(vm, node->import_stmt.module.start, node->import_stmt.module.length, true);
+                store->module = module;
+                break;
             }
-            // Fallback: search under projectRoot
-            if (!fullPath) {
-                fullPath = searchFileRecursive(vm->projectRoot, modName);
-            }
-            if (!fullPath) {
-                error("Module file not found in project.", node->import_stmt.module.line);
-            }
-            char* source = readFileAll(fullPath);
-            if (!source) {
-                free(fullPath);
-                error("Failed to read module file.", node->import_stmt.module.line);
+
+            char* fullPath = NULL;
+            char* source = NULL;
+            Node* ast = NULL;
+            Parser ps;
+            if (vm->moduleLoader) {
+                // Parsed elsewhere; the loader keeps source and AST alive
+                ast = vm->moduleLoader(vm->moduleLoaderUser, vm->projectRoot, modName, node->import_stmt.module.line);
+                if (!ast) error("Module file not found in project.", node->import_stmt.module.line);
+            } else {
+                fullPath = resolveModulePath(vm->projectRoot, modName);
+                if (!fullPath) {
+                    error("Module file not found in project.", node->import_stmt.module.line);
+                }
+                source = readFileAll(fullPath);
+                if (!source) {
+                    free(fullPath);
+                    error("Failed to read module file.", node->import_stmt.module.line);
+                }
+                Lexer lx; initLexer(&lx, source);
+                initParser(&ps);
+                while (1) {
+                    Token tk = scanToken(&lx);
+                    addToken(&ps, tk);
+                    if (tk.type == TOKEN_EOF) break;
+                }
+                ast = parse(&ps);
+                optimize(ast, vm->optLevel, vm->optDump);
             }
 
             // Prepare module environment
@@ -711,16 +2404,7 @@ static void execute(VM* vm, Node* node) {
             memset(moduleEnv->buckets, 0, sizeof(moduleEnv->buckets));
             memset(moduleEnv->funcBuckets, 0, sizeof(moduleEnv->funcBuckets));
 
-            // Parse and execute module in its env
-            Lexer lx; initLexer(&lx, source);
-            Parser ps; initParser(&ps);
-            while (1) {
-                Token tk = scanToken(&lx);
-                addToken(&ps, tk);
-                if (tk.type == TOKEN_EOF) break;
-            }
-            Node* ast = parse(&ps);
-
+            // Execute module in its env
             // Save current env/defEnv
             Environment* oldEnv = vm->env;
             Environment* oldDef = vm->defEnv;
@@ -736,23 +2420,22 @@ static void execute(VM* vm, Node* node) {
             if (!module) error("Memory allocation failed.", node->import_stmt.module.line);
             module->name = strndup(node->import_stmt.alias.start, node->import_stmt.alias.length);
             module->env = moduleEnv;
-            module->source = source; // keep source alive for token/text lifetime
+            // Keep source alive for token/text lifetime (loader-owned otherwise)
+            module->source = source;
+            module->ast = vm->moduleLoader ? NULL : ast;
+            module->native = NULL;
 
             VarEntry* aliasEntry = findEntry(vm, node->import_stmt.alias, true);
-            aliasEntry->value.type = VAL_MODULE;
-            aliasEntry->value.moduleVal = module;
+            aliasEntry->value = MODULE_VAL(module);
 
             // Store in cache by logical module name (not alias)
             ModuleEntry* store = findModuleEntry(vm, node->import_stmt.module.start, node->import_stmt.module.length, true);
             store->module = module;
 
-            // Cleanup parser/ast (keep moduleEnv and source for module lifetime)
-            // Free AST and parser tokens
-            // We don't have freeAST here; import inside VM uses execute recursively, assume main frees AST of top-level only.
-            // Minimal cleanup for module parsing structures:
-            freeParser(&ps);
+            // Parser tokens are no longer needed; the AST stays with the module
+            // because its functions' bodies point into it (freed by freeVM).
+            if (!vm->moduleLoader) freeParser(&ps);
             free(fullPath);
-            // Note: ast nodes are part of module functions' bodies, not executed again; freeing here would invalidate. So we intentionally leak small AST of module or could store for module lifetime.
             break;
         }
         case NODE_STMT_RETURN: {
@@ -767,8 +2450,7 @@ static void execute(VM* vm, Node* node) {
             if (node->return_stmt.value) {
                 frame->returnValue = evaluate(vm, node->return_stmt.value);
             } else {
-                frame->returnValue.type = VAL_INT;
-                frame->returnValue.intVal = 0;
+                frame->returnValue = INT_VAL(0);
             }
             break;
         }
@@ -783,7 +2465,7 @@ static void execute(VM* vm, Node* node) {
 static Value evaluate(VM* vm, Node* node) {
     if (!node) {
         error("Null expression.", 0);
-        Value nullVal = {VAL_INT, .intVal = 0};
+        Value nullVal = INT_VAL(0);
         return nullVal;
     }
     
@@ -793,30 +2475,25 @@ static Value evaluate(VM* vm, Node* node) {
             Value val;
             
             if (t.type == TOKEN_NUMBER) {
-                char* str = strndup(t.start, t.length);
-                if (!str) error("Memory allocation failed.", t.line);
-                
-                if (strchr(str, '.')) {
-                    val.type = VAL_FLOAT;
-                    val.floatVal = atof(str);
+                // Number literals are pre-parsed by the parser
+                if (node->literal.isFloat) {
+                    val = FLOAT_VAL(node->literal.floatValue);
                 } else {
-                    val.type = VAL_INT;
-                    val.intVal = atoi(str);
+                    val = INT_VAL(node->literal.intValue);
                 }
-                free(str);
             } else if (t.type == TOKEN_STRING) {
-                val.type = VAL_STRING;
                 // Skip quotes in string (start + 1, length - 2)
+                char* s;
                 if (t.length >= 2) {
-                    val.stringVal = strndup(t.start + 1, t.length - 2);
+                    s = strndup(t.start + 1, t.length - 2);
                 } else {
-                    val.stringVal = strdup("");
+                    s = strdup("");
                 }
-                if (!val.stringVal) error("Memory allocation failed.", t.line);
+                if (!s) error("Memory allocation failed.", t.line);
+                val = STRING_VAL(s);
             } else {
                 error("Invalid literal type.", t.line);
-                val.type = VAL_INT;
-                val.intVal = 0;
+                val = INT_VAL(0);
             }
             return val;
         }
@@ -827,17 +2504,17 @@ static Value evaluate(VM* vm, Node* node) {
                 return entry->value;
             }
             error("Undefined variable.", node->var.name.line);
-            Value nullVal = {VAL_INT, .intVal = 0};
+            Value nullVal = INT_VAL(0);
             return nullVal;
         }
         
         case NODE_EXPR_UNARY: {
             Value expr = evaluate(vm, node->unary.expr);
             if (node->unary.op.type == TOKEN_MINUS) {
-                if (expr.type == VAL_INT) {
-                    expr.intVal = -expr.intVal;
-                } else if (expr.type == VAL_FLOAT) {
-                    expr.floatVal = -expr.floatVal;
+                if (IS_INT(expr)) {
+                    expr = INT_VAL(-AS_INT(expr));
+                } else if (IS_FLOAT(expr)) {
+                    expr = FLOAT_VAL(-AS_FLOAT(expr));
                 } else {
                     error("Cannot negate non-numeric value.", node->unary.op.line);
                 }
@@ -846,282 +2523,22 @@ static Value evaluate(VM* vm, Node* node) {
         }
         
         case NODE_EXPR_BINARY: {
+            switch (node->staticType) {
+                case TYPE_INT: return INT_VAL(evalInt(vm, node));
+                case TYPE_FLOAT: return FLOAT_VAL(evalFloat(vm, node));
+                case TYPE_BOOL: return BOOL_VAL(evalCompare(vm, node));
+                default: break;
+            }
+            if (node->binary.concatCount > 0) return evalConcat(vm, node);
             Value left = evaluate(vm, node->binary.left);
             Value right = evaluate(vm, node->binary.right);
-            Value result;
-            
-            // Handle string concatenation with +
-            if (node->binary.op.type == TOKEN_PLUS && (left.type == VAL_STRING || right.type == VAL_STRING)) {
-                char leftStr[256], rightStr[256];
-                
-                // Convert left operand to string
-                switch (left.type) {
-                    case VAL_INT: 
-                        snprintf(leftStr, sizeof(leftStr), "%d", left.intVal); 
-                        break;
-                    case VAL_FLOAT: 
-                        snprintf(leftStr, sizeof(leftStr), "%.6g", left.floatVal); 
-                        break;
-                    case VAL_BOOL: 
-                        strcpy(leftStr, left.boolVal ? "true" : "false"); 
-                        break;
-                    case VAL_STRING: 
-                        strncpy(leftStr, left.stringVal ? left.stringVal : "", sizeof(leftStr) - 1); 
-                        leftStr[sizeof(leftStr) - 1] = '\0';
-                        break;
-                    case VAL_MODULE:
-                        strncpy(leftStr, "[module]", sizeof(leftStr) - 1);
-                        leftStr[sizeof(leftStr) - 1] = '\0';
-                        break;
-                    case VAL_ARRAY: {
-                        int l = (left.arrayVal ? left.arrayVal->count : 0);
-                        snprintf(leftStr, sizeof(leftStr), "[array length=%d]", l);
-                        break;
-                    }
-                    case VAL_MAP: {
-                        int sz = 0; if (left.mapVal) { for (int i = 0; i < TABLE_SIZE; i++) { MapEntry* e = left.mapVal->buckets[i]; while (e) { sz++; e = e->next; } } }
-                        snprintf(leftStr, sizeof(leftStr), "{map size=%d}", sz);
-                        break;
-                    }
-                }
-                
-                // Convert right operand to string
-                switch (right.type) {
-                    case VAL_INT: 
-                        snprintf(rightStr, sizeof(rightStr), "%d", right.intVal); 
-                        break;
-                    case VAL_FLOAT: 
-                        snprintf(rightStr, sizeof(rightStr), "%.6g", right.floatVal); 
-                        break;
-                    case VAL_BOOL: 
-                        strcpy(rightStr, right.boolVal ? "true" : "false"); 
-                        break;
-                    case VAL_STRING: 
-                        strncpy(rightStr, right.stringVal ? right.stringVal : "", sizeof(rightStr) - 1); 
-                        rightStr[sizeof(rightStr) - 1] = '\0';
-                        break;
-                    case VAL_MODULE:
-                        strncpy(rightStr, "[module]", sizeof(rightStr) - 1);
-                        rightStr[sizeof(rightStr) - 1] = '\0';
-                        break;
-                    case VAL_ARRAY: {
-                        int l = (right.arrayVal ? right.arrayVal->count : 0);
-                        snprintf(rightStr, sizeof(rightStr), "[array length=%d]", l);
-                        break;
-                    }
-                    case VAL_MAP: {
-                        int sz = 0; if (right.mapVal) { for (int i = 0; i < TABLE_SIZE; i++) { MapEntry* e = right.mapVal->buckets[i]; while (e) { sz++; e = e->next; } } }
-                        snprintf(rightStr, sizeof(rightStr), "{map size=%d}", sz);
-                        break;
-                    }
-                }
-                
-                result.type = VAL_STRING;
-                result.stringVal = malloc(strlen(leftStr) + strlen(rightStr) + 1);
-                if (!result.stringVal) error("Memory allocation failed.", node->binary.op.line);
-                strcpy(result.stringVal, leftStr);
-                strcat(result.stringVal, rightStr);
-                
-                return result;
-            }
-            
-            // Handle comparison operations for different types
-            if (node->binary.op.type == TOKEN_EQUAL_EQUAL || node->binary.op.type == TOKEN_BANG_EQUAL) {
-                result.type = VAL_BOOL;
-                bool isEqual = false;
-                
-                // Same type comparisons
-                if (left.type == right.type) {
-                    switch (left.type) {
-                        case VAL_INT:
-                            isEqual = left.intVal == right.intVal;
-                            break;
-                        case VAL_FLOAT:
-                            isEqual = left.floatVal == right.floatVal;
-                            break;
-                        case VAL_BOOL:
-                            isEqual = left.boolVal == right.boolVal;
-                            break;
-                        case VAL_STRING:
-                            if (left.stringVal && right.stringVal) {
-                                isEqual = strcmp(left.stringVal, right.stringVal) == 0;
-                            } else {
-                                isEqual = (left.stringVal == NULL && right.stringVal == NULL);
-                            }
-                            break;
-                        case VAL_MODULE:
-                            // Compare by module identity (pointer equality)
-                            isEqual = left.moduleVal == right.moduleVal;
-                            break;
-                        case VAL_ARRAY:
-                            // Compare by identity (pointer equality)
-                            isEqual = left.arrayVal == right.arrayVal;
-                            break;
-                        case VAL_MAP:
-                            // Compare by identity (pointer equality)
-                            isEqual = left.mapVal == right.mapVal;
-                            break;
-                    }
-                }
-                
-                result.boolVal = (node->binary.op.type == TOKEN_EQUAL_EQUAL) ? isEqual : !isEqual;
-                return result;
-            }
-            
-            // Numeric operations
-            // Coerce 1-char strings to ints for arithmetic if needed
-            if ((left.type == VAL_STRING && right.type != VAL_STRING) || (right.type == VAL_STRING && left.type != VAL_STRING)) {
-                int code;
-                if (left.type == VAL_STRING && tryCharCode(left, &code)) { left.type = VAL_INT; left.intVal = code; }
-                if (right.type == VAL_STRING && tryCharCode(right, &code)) { right.type = VAL_INT; right.intVal = code; }
-            } else if (left.type == VAL_STRING && right.type == VAL_STRING) {
-                // If both are strings, try to coerce both when operator is not string concatenation
-                int lc, rc;
-                if (tryCharCode(left, &lc) && tryCharCode(right, &rc)) {
-                    left.type = VAL_INT; left.intVal = lc;
-                    right.type = VAL_INT; right.intVal = rc;
-                }
-            }
-
-            if (left.type == VAL_INT && right.type == VAL_INT) {
-                result.type = VAL_INT;
-                switch (node->binary.op.type) {
-                    case TOKEN_PLUS: 
-                        result.intVal = left.intVal + right.intVal; 
-                        break;
-                    case TOKEN_MINUS: 
-                        result.intVal = left.intVal - right.intVal; 
-                        break;
-                    case TOKEN_STAR: 
-                        result.intVal = left.intVal * right.intVal; 
-                        break;
-                    case TOKEN_SLASH: 
-                        if (right.intVal == 0) {
-                            error("Division by zero.", node->binary.op.line);
-                        }
-                        result.intVal = left.intVal / right.intVal; 
-                        break;
-                    case TOKEN_PERCENT: 
-                        if (right.intVal == 0) {
-                            error("Modulo by zero.", node->binary.op.line);
-                        }
-                        result.intVal = left.intVal % right.intVal; 
-                        break;
-                    case TOKEN_GREATER: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.intVal > right.intVal; 
-                        break;
-                    case TOKEN_GREATER_EQUAL: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.intVal >= right.intVal; 
-                        break;
-                    case TOKEN_LESS: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.intVal < right.intVal; 
-                        break;
-                    case TOKEN_LESS_EQUAL: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.intVal <= right.intVal; 
-                        break;
-                    default: 
-                        error("Invalid binary operator for integers.", node->binary.op.line);
-                }
-            } else if (left.type == VAL_FLOAT && right.type == VAL_FLOAT) {
-                // Handle float operations
-                switch (node->binary.op.type) {
-                    case TOKEN_PLUS: 
-                        result.type = VAL_FLOAT;
-                        result.floatVal = left.floatVal + right.floatVal; 
-                        break;
-                    case TOKEN_MINUS: 
-                        result.type = VAL_FLOAT;
-                        result.floatVal = left.floatVal - right.floatVal; 
-                        break;
-                    case TOKEN_STAR: 
-                        result.type = VAL_FLOAT;
-                        result.floatVal = left.floatVal * right.floatVal; 
-                        break;
-                    case TOKEN_SLASH: 
-                        if (right.floatVal == 0.0) {
-                            error("Division by zero.", node->binary.op.line);
-                        }
-                        result.type = VAL_FLOAT;
-                        result.floatVal = left.floatVal / right.floatVal; 
-                        break;
-                    case TOKEN_GREATER: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.floatVal > right.floatVal; 
-                        break;
-                    case TOKEN_GREATER_EQUAL: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.floatVal >= right.floatVal; 
-                        break;
-                    case TOKEN_LESS: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.floatVal < right.floatVal; 
-                        break;
-                    case TOKEN_LESS_EQUAL: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = left.floatVal <= right.floatVal; 
-                        break;
-                    default: 
-                        error("Invalid binary operator for floats.", node->binary.op.line);
-                }
-            } else if ((left.type == VAL_INT && right.type == VAL_FLOAT) || 
-                       (left.type == VAL_FLOAT && right.type == VAL_INT)) {
-                // Mixed int/float operations - convert to float
-                double leftVal = (left.type == VAL_INT) ? (double)left.intVal : left.floatVal;
-                double rightVal = (right.type == VAL_INT) ? (double)right.intVal : right.floatVal;
-                
-                switch (node->binary.op.type) {
-                    case TOKEN_PLUS: 
-                        result.type = VAL_FLOAT;
-                        result.floatVal = leftVal + rightVal; 
-                        break;
-                    case TOKEN_MINUS: 
-                        result.type = VAL_FLOAT;
-                        result.floatVal = leftVal - rightVal; 
-                        break;
-                    case TOKEN_STAR: 
-                        result.type = VAL_FLOAT;
-                        result.floatVal = leftVal * rightVal; 
-                        break;
-                    case TOKEN_SLASH: 
-                        if (rightVal == 0.0) {
-                            error("Division by zero.", node->binary.op.line);
-                        }
-                        result.type = VAL_FLOAT;
-                        result.floatVal = leftVal / rightVal; 
-                        break;
-                    case TOKEN_GREATER: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = leftVal > rightVal; 
-                        break;
-                    case TOKEN_GREATER_EQUAL: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = leftVal >= rightVal; 
-                        break;
-                    case TOKEN_LESS: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = leftVal < rightVal; 
-                        break;
-                    case TOKEN_LESS_EQUAL: 
-                        result.type = VAL_BOOL;
-                        result.boolVal = leftVal <= rightVal; 
-                        break;
-                    default: 
-                        error("Invalid binary operator for mixed numeric types.", node->binary.op.line);
-                }
-            } else {
-                error("Type mismatch in binary operation.", node->binary.op.line);
-            }
-            
-            return result;
+            return binaryOp(vm, node, left, right);
         }
         
         case NODE_EXPR_CALL: {
             // Resolve function from callee expression
             Function* func = NULL;
+            NativeFn native = NULL;
             int errLine = 0;
             if (node->call.callee->type == NODE_EXPR_VAR) {
                 // Try global functions first
@@ -1143,98 +2560,39 @@ static Value evaluate(VM* vm, Node* node) {
                     while (argN && argCount < 16) { args[argCount++] = evaluate(vm, argN); argN = argN->next; }
                     if (argCount >= 16 && argN) { error("Too many arguments (max 16).", errLine); }
 
-                    // array()
-                    if (strcmp(fname, "array") == 0) {
-                        if (argCount != 0) error("array() takes 0 arguments.", errLine);
-                        Value v; v.type = VAL_ARRAY; v.arrayVal = newArray(); return v;
-                    }
-                    // map()
-                    if (strcmp(fname, "map") == 0) {
-                        if (argCount != 0) error("map() takes 0 arguments.", errLine);
-                        Value v; v.type = VAL_MAP; v.mapVal = newMap(); return v;
-                    }
-                    // length(x)
-                    if (strcmp(fname, "length") == 0) {
-                        if (argCount != 1) error("length(x) takes 1 argument.", errLine);
-                        Value v; v.type = VAL_INT; v.intVal = 0;
-                        if (args[0].type == VAL_STRING) v.intVal = args[0].stringVal ? (int)strlen(args[0].stringVal) : 0;
-                        else if (args[0].type == VAL_ARRAY) v.intVal = args[0].arrayVal ? args[0].arrayVal->count : 0;
-                        else if (args[0].type == VAL_MAP) {
-                            int sz = 0; if (args[0].mapVal) { for (int i = 0; i < TABLE_SIZE; i++) { MapEntry* e = args[0].mapVal->buckets[i]; while (e) { sz++; e = e->next; } } }
-                            v.intVal = sz;
-                        } else error("length() unsupported type.", errLine);
-                        return v;
-                    }
-                    // push(a, v) -> returns new length
-                    if (strcmp(fname, "push") == 0) {
-                        if (argCount != 2) error("push(a, v) takes 2 arguments.", errLine);
-                        if (args[0].type != VAL_ARRAY || !args[0].arrayVal) error("push() requires array as first arg.", errLine);
-                        arrayPush(args[0].arrayVal, args[1]);
-                        Value v; v.type = VAL_INT; v.intVal = args[0].arrayVal->count; return v;
-                    }
-                    // pop(a) -> returns popped value
-                    if (strcmp(fname, "pop") == 0) {
-                        if (argCount != 1) error("pop(a) takes 1 argument.", errLine);
-                        if (args[0].type != VAL_ARRAY || !args[0].arrayVal) error("pop() requires array.", errLine);
-                        Value out; if (!arrayPop(args[0].arrayVal, &out)) error("pop() on empty array.", errLine);
-                        return out;
-                    }
-                    // has(m, k) -> bool
-                    if (strcmp(fname, "has") == 0) {
-                        if (argCount != 2) error("has(m, k) takes 2 arguments.", errLine);
-                        if (args[0].type != VAL_MAP || !args[0].mapVal) error("has() requires map.", errLine);
-                        bool present = false;
-                        if (args[1].type == VAL_INT) { present = mapFindEntryInt(args[0].mapVal, args[1].intVal, NULL) != NULL; }
-                        else if (args[1].type == VAL_STRING) { const char* s = args[1].stringVal ? args[1].stringVal : ""; present = mapFindEntry(args[0].mapVal, s, (int)strlen(s), NULL) != NULL; }
-                        else error("has() key must be int or string.", errLine);
-                        Value v; v.type = VAL_BOOL; v.boolVal = present; return v;
-                    }
-                    // delete(m, k) -> bool (true if removed)
-                    if (strcmp(fname, "delete") == 0) {
-                        if (argCount != 2) error("delete(m, k) takes 2 arguments.", errLine);
-                        if (args[0].type != VAL_MAP || !args[0].mapVal) error("delete() requires map.", errLine);
-                        bool removed = false;
-                        if (args[1].type == VAL_INT) removed = mapDeleteInt(args[0].mapVal, args[1].intVal);
-                        else if (args[1].type == VAL_STRING) { const char* s = args[1].stringVal ? args[1].stringVal : ""; removed = mapDeleteStr(args[0].mapVal, s, (int)strlen(s)); }
-                        else error("delete() key must be int or string.", errLine);
-                        Value v; v.type = VAL_BOOL; v.boolVal = removed; return v;
-                    }
-                    // keys(m) -> array of string keys (int keys converted to decimal strings)
-                    if (strcmp(fname, "keys") == 0) {
-                        if (argCount != 1) error("keys(m) takes 1 argument.", errLine);
-                        if (args[0].type != VAL_MAP || !args[0].mapVal) error("keys() requires map.", errLine);
-                        Array* arr = newArray();
-                        for (int i = 0; i < TABLE_SIZE; i++) {
-                            MapEntry* e = args[0].mapVal->buckets[i];
-                            while (e) {
-                                Value sv; sv.type = VAL_STRING;
-                                if (e->isIntKey) {
-                                    char buf[32]; snprintf(buf, sizeof(buf), "%d", e->intKey);
-                                    sv.stringVal = strdup(buf); if (!sv.stringVal) error("Memory allocation failed.", errLine);
-                                } else {
-                                    sv.stringVal = strdup(e->key ? e->key : ""); if (!sv.stringVal) error("Memory allocation failed.", errLine);
-                                }
-                                arrayPush(arr, sv);
-                                e = e->next;
-                            }
-                        }
-                        Value v; v.type = VAL_ARRAY; v.arrayVal = arr; return v;
+                    Value result;
+                    if (strcmp(fname, "args") == 0) {
+                        if (argCount != 0) error("args() takes no arguments.", errLine);
+                        return argsArray(vm->scriptArgs, vm->scriptArgCount, errLine);
                     }
+                    // Data-parallel built-ins run functions on worker VMs (parallel.c)
+                    if (strcmp(fname, "parallelMap") == 0) return parallelMap(vm, args, argCount, errLine);
+                    if (strcmp(fname, "parallelFor") == 0) return parallelFor(vm, args, argCount, errLine);
+                    if (strcmp(fname, "parallelReduce") == 0) return parallelReduce(vm, args, argCount, errLine);
+                    // A comparator is user code, so sort(a, cmp) needs the VM
+                    if (strcmp(fname, "sort") == 0 && argCount == 2) return sortWithComparator(vm, args, argCount, errLine);
+                    // So does jsonEach(path, selector, fn) for each element
+                    if (strcmp(fname, "jsonEach") == 0) return jsonEach(vm, args, argCount, errLine);
+                    if (patternBuiltin(&vm->patterns, fname, args, argCount, errLine, &result)) return result;
+                    if (callBuiltin(fname, args, argCount, errLine, &result)) return result;
                 }
             } else if (node->call.callee->type == NODE_EXPR_GET) {
                 Value obj = evaluate(vm, node->call.callee->get.object);
-                if (obj.type == VAL_MODULE) {
-                    func = findFunctionInEnv(obj.moduleVal->env, node->call.callee->get.name);
-                    errLine = node->call.callee->get.name.line;
+                if (IS_MODULE(obj)) {
+                    Module* module = AS_MODULE(obj);
+                    Token name = node->call.callee->get.name;
+                    if (module->native) native = findNativeFunction(module->native, name.start, name.length);
+                    else func = findFunctionInEnv(module->env, name);
+                    errLine = name.line;
                 } else {
                     error("Only modules support method calls.", node->call.callee->get.name.line);
                 }
             } else {
                 error("Invalid call target.", 0);
             }
-            if (!func) {
+            if (!func && !native) {
                 error("Undefined function.", errLine);
-                Value nullVal = {VAL_INT, .intVal = 0};
+                Value nullVal = INT_VAL(0);
                 return nullVal;
             }
 
@@ -1249,68 +2607,73 @@ static Value evaluate(VM* vm, Node* node) {
             if (argCount >= 16 && arg) {
                 error("Too many arguments (max 16).", errLine);
             }
+            if (native) return native(args, argCount, errLine);
+            // Inlined leaf function: evaluate its body with the arguments,
+            // no environment or call frame
+            if (func->inlineExpr && !func->jit && argCount == func->paramCount &&
+                vm->callStackTop < CALL_STACK_MAX) {
+                if (vm->optDump && !node->call.inlined && !vm->parallelWorker) {
+                    node->call.inlined = true;
+                    fprintf(stderr, "[opt] line %d: inlined call to %.*s()\n", errLine,
+                            func->name.length, func->name.start);
+                }
+                Value* saved = vm->inlineArgs;
+                vm->inlineArgs = args;
+                Value result = evaluate(vm, func->inlineExpr);
+                vm->inlineArgs = saved;
+                return result;
+            }
             return callFunction(vm, func, args, argCount);
         }
         case NODE_EXPR_GET: {
             Value obj = evaluate(vm, node->get.object);
             // String property: length
-            if (obj.type == VAL_STRING) {
+            if (IS_STRING(obj)) {
                 if (strncmp(node->get.name.start, "length", node->get.name.length) == 0 && strlen("length") == (size_t)node->get.name.length) {
-                    Value v; v.type = VAL_INT; v.intVal = obj.stringVal ? (int)strlen(obj.stringVal) : 0; return v;
+                    Value v = INT_VAL(AS_STRING(obj) ? (int)strlen(AS_STRING(obj)) : 0); return v;
                 }
                 error("Unknown string property.", node->get.name.line);
-            } else if (obj.type == VAL_MODULE) {
+            } else if (IS_MODULE(obj)) {
                 // module constant/variable or function name as value isn't supported; only variables returned.
-                VarEntry* ve = findVarInEnv(obj.moduleVal->env, node->get.name);
+                VarEntry* ve = findVarInEnv(AS_MODULE(obj)->env, node->get.name);
                 if (ve) return ve->value;
                 // If not a variable, allow chained call to resolve function. Here return int 0 to keep flow if used wrongly.
                 error("Unknown module member.", node->get.name.line);
             } else {
                 error("Property access not supported on this type.", node->get.name.line);
             }
-            Value nullVal = {VAL_INT, .intVal = 0};
+            Value nullVal = INT_VAL(0);
             return nullVal;
         }
         case NODE_EXPR_INDEX: {
             Value target = evaluate(vm, node->index.target);
             Value idx = evaluate(vm, node->index.index);
-            if (target.type == VAL_STRING && idx.type == VAL_INT) {
-                int len = target.stringVal ? (int)strlen(target.stringVal) : 0;
-                if (idx.intVal < 0 || idx.intVal >= len) {
-                    error("String index out of range.", 0);
-                }
-                char* s = malloc(2);
-                if (!s) error("Memory allocation failed.", 0);
-                s[0] = target.stringVal[idx.intVal];
-                s[1] = '\0';
-                Value v; v.type = VAL_STRING; v.stringVal = s; return v;
-            } else if (target.type == VAL_ARRAY && idx.type == VAL_INT) {
-                if (!target.arrayVal) { Value v; v.type = VAL_INT; v.intVal = 0; return v; }
-                if (idx.intVal < 0 || idx.intVal >= target.arrayVal->count) error("Array index out of range.", 0);
-                return target.arrayVal->items[idx.intVal];
-            } else if (target.type == VAL_MAP) {
-                if (!target.mapVal) { Value v; v.type = VAL_INT; v.intVal = 0; return v; }
-                if (idx.type == VAL_INT) {
-                    MapEntry* e = mapFindEntryInt(target.mapVal, idx.intVal, NULL);
-                    if (!e) error("Map key not found.", 0);
-                    return e->value;
-                } else if (idx.type == VAL_STRING) {
-                    const char* s = idx.stringVal ? idx.stringVal : "";
-                    MapEntry* e = mapFindEntry(target.mapVal, s, (int)strlen(s), NULL);
-                    if (!e) error("Map key not found.", 0);
-                    return e->value;
-                } else {
-                    error("Map index must be int or string.", 0);
-                }
+            // Proven 0 <= idx < count when the target is an array
+            if (node->index.inBounds && IS_ARRAY(target) && AS_ARRAY(target)) {
+                return AS_ARRAY(target)->items[AS_INT(idx)];
             }
-            error("Indexing not supported for this type.", 0);
-            Value nullVal = {VAL_INT, .intVal = 0};
-            return nullVal;
+            return indexGet(target, idx, node->index.bracket.line);
+        }
+        case NODE_EXPR_PARAM:
+            return vm->inlineArgs[node->param.index];
+        case NODE_EXPR_INVARIANT: {
+            // Hoisted length: valid while the object is still a string. The
+            // pre-header form (empty slot) yields 0 for other types and lets
+            // the loop condition raise any error.
+            Value object = evaluate(vm, node->invariant.expr->get.object);
+            if (IS_STRING(object)) {
+                if (node->invariant.slot.length == 0) return evaluate(vm, node->invariant.expr);
+                VarEntry* entry = findEntry(vm, node->invariant.slot, false);
+                if (entry) return entry->value;
+                return evaluate(vm, node->invariant.expr);
+            }
+            if (node->invariant.slot.length == 0) return INT_VAL(0);
+            return evaluate(vm, node->invariant.expr);
         }
         
         default:
             error("Invalid expression type.", 0);
-            Value nullVal = {VAL_INT, .intVal = 0};
+            Value nullVal = INT_VAL(0);
             return nullVal;
     }
 }
@@ -1319,6 +2682,21 @@ static Value evaluate(VM* vm, Node* node) {
 void initVM(VM* vm) {
     vm->stackTop = 0;
     vm->callStackTop = 0;
+    vm->jitEnabled = false;
+    vm->optLevel = OPT_LEVEL_DEFAULT;
+    vm->optDump = false;
+    vm->inlineArgs = NULL;
+    vm->scripts = NULL;
+    vm->output = NULL;
+    vm->outputUser = NULL;
+    vm->warningOutput = NULL;
+    vm->moduleLoader = NULL;
+    vm->moduleLoaderUser = NULL;
+    vm->scriptArgs = NULL;
+    vm->scriptArgCount = 0;
+    vm->parallelWorker = false;
+    vm->lentString = NULL;
+    vm->patterns = NULL;
     
     // Create global environment
     vm->globalEnv = malloc(sizeof(Environment));
@@ -1336,14 +2714,317 @@ void initVM(VM* vm) {
     }
 }
 
-// Free VM memory
+// Free an environment with its variable and function entries. Variable
+// values are not freed: strings, arrays and maps may be shared between
+// variables, so only the table structure is owned here.
+static void freeEnvironment(Environment* env) {
+    if (!env) return;
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        VarEntry* entry = env->buckets[i];
+        while (entry) {
+            VarEntry* next = entry->next;
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+        FuncEntry* funcEntry = env->funcBuckets[i];
+        while (funcEntry) {
+            FuncEntry* next = funcEntry->next;
+            if (funcEntry->function) {
+                if (funcEntry->function->jit) jitFree(funcEntry->function->jit);
+                freeAST(funcEntry->function->inlineExpr);
+                free(funcEntry->function);
+            }
+            free(funcEntry->key);
+            free(funcEntry);
+            funcEntry = next;
+        }
+    }
+    free(env);
+}
+
+// Free VM memory: environments, functions, modules and loaded programs
 void freeVM(VM* vm) {
-    // TODO: Re-enable structured cleanup after memory ownership is clarified.
-    // Temporarily disabled to avoid post-run crash while validating modularity feature.
-    (void)vm;
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        ModuleEntry* entry = vm->moduleBuckets[i];
+        while (entry) {
+            ModuleEntry* next = entry->next;
+            Module* module = entry->module;
+            if (module) {
+                freeEnvironment(module->env);
+                freeAST(module->ast);
+                free(module->source);
+                free(module->name);
+                free(module);
+            }
+            free(entry->key);
+            free(entry);
+            entry = next;
+        }
+        vm->moduleBuckets[i] = NULL;
+    }
+    freeEnvironment(vm->globalEnv);
+    vm->globalEnv = NULL;
+    vm->env = NULL;
+    vm->defEnv = NULL;
+
+    ScriptEntry* script = vm->scripts;
+    while (script) {
+        ScriptEntry* next = script->next;
+        freeAST(script->ast);
+        free(script->source);
+        free(script);
+        script = next;
+    }
+    vm->scripts = NULL;
+    freePatternCache(vm->patterns);
+    vm->patterns = NULL;
 }
 
 // Interpret AST
 void interpret(VM* vm, Node* ast) {
     execute(vm, ast);
-}
\ No newline at end of file
+}
+
+void vmLoad(VM* vm, const char* source) {
+    // Register first so the script is freed with the VM even if parsing fails
+    ScriptEntry* script = malloc(sizeof(ScriptEntry));
+    if (!script) error("Memory allocation failed.", 0);
+    script->source = strdup(source);
+    script->ast = NULL;
+    script->next = vm->scripts;
+    vm->scripts = script;
+    if (!script->source) error("Memory allocation failed.", 0);
+
+    Lexer lexer;
+    initLexer(&lexer, script->source);
+    Parser parser;
+    initParser(&parser);
+    while (true) {
+        Token token = scanToken(&lexer);
+        addToken(&parser, token);
+        if (token.type == TOKEN_EOF) break;
+    }
+    script->ast = parse(&parser);
+    freeParser(&parser);
+    optimize(script->ast, vm->optLevel, vm->optDump);
+
+    execute(vm, script->ast);
+}
+
+// Look up a function defined by the main program
+static Function* findGlobalFunction(VM* vm, const char* name) {
+    Token token = {.type = TOKEN_IDENTIFIER, .start = name, .length = (int)strlen(name), .line = 0};
+    return findFunction(vm, token);
+}
+
+bool vmHasFunction(VM* vm, const char* name) {
+    return findGlobalFunction(vm, name) != NULL;
+}
+
+Function* vmFindFunction(VM* vm, const char* name) {
+    const char* dot = strchr(name, '.');
+    if (dot) {
+        Token alias = {.type = TOKEN_IDENTIFIER, .start = name, .length = (int)(dot - name), .line = 0};
+        VarEntry* entry = findEntry(vm, alias, false);
+        if (!entry || !IS_MODULE(entry->value) || !AS_MODULE(entry->value)->env) return NULL;
+        Token member = {.type = TOKEN_IDENTIFIER, .start = dot + 1, .length = (int)strlen(dot + 1), .line = 0};
+        return findFunctionInEnv(AS_MODULE(entry->value)->env, member);
+    }
+    Token token = {.type = TOKEN_IDENTIFIER, .start = name, .length = (int)strlen(name), .line = 0};
+    Function* func = findFunction(vm, token);
+    if (!func && vm->defEnv) func = findFunctionInEnv(vm->defEnv, token);
+    return func;
+}
+
+Value vmCallFunction(VM* vm, Function* func, Value* args, int argCount) {
+    return callFunction(vm, func, args, argCount);
+}
+
+void vmInitWorker(VM* worker, VM* parent) {
+    *worker = *parent;
+    worker->stackTop = 0;
+    worker->callStackTop = 0;
+    worker->env = parent->globalEnv;
+    worker->jitEnabled = false;     // existing native code is still used
+    worker->scripts = NULL;
+    worker->parallelWorker = true;
+    worker->patterns = NULL;        // DFA caches are filled in as they are used
+}
+
+bool vmCall(VM* vm, const char* name, Value* args, int argCount, Value* result) {
+    Function* func = findGlobalFunction(vm, name);
+    if (!func) return false;
+    *result = callFunction(vm, func, args, argCount);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Runtime API for ahead-of-time compiled scripts (see runtime.h)
+// ---------------------------------------------------------------------------
+
+int gemCallDepth = 0;
+char** gemArgs = NULL;
+int gemArgCount = 0;
+static PatternCache* gemPatterns = NULL;   // compiled programs run a single VM-less thread
+
+Value gemString(const char* chars, int length) {
+    char* s = strndup(chars, length);
+    if (!s) error("Memory allocation failed.", 0);
+    return STRING_VAL(s);
+}
+
+Value gemModule(const char* name) {
+    Module* module = malloc(sizeof(Module));
+    if (!module) error("Memory allocation failed.", 0);
+    module->name = strdup(name);
+    module->env = NULL;     // members are resolved at compile time
+    module->source = NULL;
+    module->ast = NULL;
+    module->native = NULL;
+    return MODULE_VAL(module);
+}
+
+Value gemBinary(TokenType op, Value left, Value right, int line) {
+    Token token = {.type = op, .start = "", .length = 0, .line = line};
+    return binaryGeneric(token, left, right);
+}
+
+Value gemNegate(Value value, int line) {
+    if (IS_INT(value)) return INT_VAL(-AS_INT(value));
+    if (IS_FLOAT(value)) return FLOAT_VAL(-AS_FLOAT(value));
+    error("Cannot negate non-numeric value.", line);
+    return value;
+}
+
+bool gemTruthy(Value value) {
+    return isTruthy(value);
+}
+
+void gemPrint(Value value) {
+    printValue(NULL, value);
+}
+
+Value gemCallBuiltin(const char* name, Value* args, int argc, int line) {
+    Value result = INT_VAL(0);
+    if (strcmp(name, "args") == 0 && argc == 0) return argsArray(gemArgs, gemArgCount, line);
+    if (patternBuiltin(&gemPatterns, name, args, argc, line, &result)) return result;
+    if (!callBuiltin(name, args, argc, line, &result)) {
+        error("Undefined function.", line);
+    }
+    return result;
+}
+
+Value gemCallNative(const char* module, const char* name, Value* args, int argc, int line) {
+    const NativeModule* native = findNativeModule(module, (int)strlen(module));
+    NativeFn fn = native ? findNativeFunction(native, name, (int)strlen(name)) : NULL;
+    if (!fn) error("Undefined function.", line);
+    return fn(args, argc, line);
+}
+
+Value gemIndex(Value target, Value idx, int line) {
+    return indexGet(target, idx, line);
+}
+
+void gemIndexAssign(Value target, Value idx, Value value, int line) {
+    indexSet(target, idx, value, line);
+}
+
+Value gemGet(Value object, const char* name, int line) {
+    if (IS_STRING(object)) {
+        if (strcmp(name, "length") == 0) {
+            return INT_VAL(AS_STRING(object) ? (int)strlen(AS_STRING(object)) : 0);
+        }
+        error("Unknown string property.", line);
+    } else if (IS_MODULE(object)) {
+        error("Unknown module member.", line);
+    } else {
+        error("Property access not supported on this type.", line);
+    }
+    return INT_VAL(0);
+}
+
+void gemFail(const char* message, int line) {
+    error(message, line);
+}
+
+void gemForInStart(GemForIn* it, Value collection, int line) {
+    bool reader = IS_FILE(collection) && fileIsReader(AS_FILE(collection));
+    if (!(IS_ARRAY(collection) && AS_ARRAY(collection)) && !(IS_MAP(collection) && AS_MAP(collection)) &&
+        !IS_PMAP(collection) && !reader) {
+        error("for-in expects an array, map, pmap or reader.", line);
+    }
+    it->collection = collection;
+    it->index = 0;
+    it->entry = IS_MAP(collection) ? AS_MAP(collection)->first : NULL;
+    it->keys = IS_PMAP(collection) ? pmapKeys(AS_PMAP(collection), true, line) : NULL;
+    it->version = IS_MAP(collection) ? AS_MAP(collection)->version : 0;
+    it->ownedKey = NULL;
+    it->ownedValue = NULL;
+    it->line = line;
+}
+
+// Store a loop variable. Strings the loop made itself (reader lines, map
+// keys, pmap copies) belong to the variable, so the previous one is freed
+// as assignment does, unless the body has replaced it since; elements of
+// arrays and map values stay owned by the collection (owned is NULL).
+static void forInStore(Value* slot, Value v, char** owned) {
+    if (!owned) {
+        *slot = v;
+        return;
+    }
+    if (*owned && IS_STRING(*slot) && AS_STRING(*slot) == *owned) free(*owned);
+    *slot = v;
+    *owned = IS_STRING(v) && AS_STRING(v) && !isCharString(AS_STRING(v)) ? AS_STRING(v) : NULL;
+}
+
+bool gemForInNext(GemForIn* it, Value* key, Value* value) {
+    Value coll = it->collection;
+    int i = it->index;
+    Value item;
+    if (IS_ARRAY(coll)) {
+        if (i >= AS_ARRAY(coll)->count) return false;
+        item = AS_ARRAY(coll)->items[i];
+    } else if (IS_MAP(coll)) {
+        Map* m = AS_MAP(coll);
+        if (i > 0 && m->version != it->version) error("Map modified during for-in loop.", it->line);
+        MapEntry* e = it->entry;
+        if (!e) return false;
+        it->entry = e->after;
+        it->index++;
+        if (e->isIntKey) {
+            forInStore(key, INT_VAL(e->intKey), &it->ownedKey);
+        } else {
+            char* copy = strdup(e->key ? e->key : "");
+            if (!copy) error("Memory allocation failed.", it->line);
+            forInStore(key, STRING_VAL(copy), &it->ownedKey);
+        }
+        if (value) forInStore(value, e->value, NULL);
+        return true;
+    } else if (IS_PMAP(coll)) {
+        // Keys come from the snapshot, which hands its strings over
+        while (i < it->keys->count) {
+            Value k = it->keys->items[i];
+            it->index = ++i;
+            Value v;
+            if (value && !pmapGet(AS_PMAP(coll), k, &v, it->line)) continue;
+            if (!value && !pmapHas(AS_PMAP(coll), k, it->line)) continue;
+            forInStore(key, k, &it->ownedKey);
+            if (value) forInStore(value, v, &it->ownedValue);
+            return true;
+        }
+        return false;
+    } else {
+        if (!fileHasNext(AS_FILE(coll))) return false;
+        item = readerNext(AS_FILE(coll), it->line);
+    }
+    it->index++;
+    bool fresh = !IS_ARRAY(coll);
+    if (value) {
+        forInStore(key, INT_VAL(i), NULL);
+        forInStore(value, item, fresh ? &it->ownedValue : NULL);
+    } else {
+        forInStore(key, item, fresh ? &it->ownedKey : NULL);
+    }
+    return true;
+}
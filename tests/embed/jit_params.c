@@ -0,0 +1,40 @@
+// Calls through the embedding API may pass more arguments than a script
+// call can; a compiled function with many int parameters must still run.
+
+#include <stdio.h>
+#include "gemini.h"
+
+static const char* SOURCE =
+    "function sum20(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9,\n"
+    "               b0, b1, b2, b3, b4, b5, b6, b7, b8, b9) {\n"
+    "    return a0 + a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9 +\n"
+    "           b0 + b1 + b2 + b3 + b4 + b5 + b6 + b7 + b8 + b9;\n"
+    "}\n";
+
+int main(void) {
+    GeminiVM* vm = geminiNewVM();
+    if (!vm) return 1;
+    geminiEnableJit(vm, true);
+    if (geminiLoad(vm, SOURCE) != GEMINI_OK) {
+        printf("load: %s\n", geminiErrorMessage(vm));
+        return 1;
+    }
+    Value args[20];
+    for (int i = 0; i < 20; i++) args[i] = INT_VAL(i + 1);
+    // Past JIT_HOT_THRESHOLD, so later calls run compiled code
+    long total = 0;
+    int last = 0;
+    for (int call = 0; call < 2 * JIT_HOT_THRESHOLD; call++) {
+        Value result;
+        if (geminiCall(vm, "sum20", args, 20, &result) != GEMINI_OK || !IS_INT(result)) {
+            printf("call %d: %s\n", call, geminiErrorMessage(vm));
+            return 1;
+        }
+        last = AS_INT(result);
+        total += last;
+    }
+    printf("%d\n", last);
+    printf("%ld\n", total);
+    geminiFreeVM(vm);
+    return 0;
+}
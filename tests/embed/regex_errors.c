@@ -0,0 +1,46 @@
+// Malformed regular expressions are reported as errors at the call's line,
+// and the VM stays usable afterwards. A "{" that does not start a count is
+// an ordinary character.
+
+#include <stdio.h>
+#include "gemini.h"
+
+static const char* PATTERNS[] = {
+    "(ab",
+    "ab)",
+    "[a-",
+    "[z-a]",
+    "*a",
+    "a|+",
+    "a{",
+    "a{2",
+    "a{2,1}",
+    "a{x}",
+    "a{99999}",
+    "ab\\",
+    "\\q",
+};
+
+int main(void) {
+    GeminiVM* vm = geminiNewVM();
+    if (!vm) return 1;
+    int count = (int)(sizeof(PATTERNS) / sizeof(PATTERNS[0]));
+    for (int i = 0; i < count; i++) {
+        char source[256];
+        snprintf(source, sizeof(source), "var ok = 1;\nvar found = match(\"%s\", \"abc\");\n", PATTERNS[i]);
+        if (geminiLoad(vm, source) == GEMINI_OK) {
+            printf("%s: accepted\n", PATTERNS[i]);
+        } else {
+            printf("%s: [line %d] %s\n", PATTERNS[i], geminiErrorLine(vm), geminiErrorMessage(vm));
+        }
+    }
+    Value result;
+    if (geminiLoad(vm, "function twoAs(s) { return match(\"^a{2}$\", s); }\n") != GEMINI_OK ||
+        geminiCall(vm, "twoAs", (Value[]){geminiString("aa")}, 1, &result) != GEMINI_OK) {
+        printf("%s\n", geminiErrorMessage(vm));
+        return 1;
+    }
+    printf("still usable: %s\n", IS_BOOL(result) && AS_BOOL(result) ? "yes" : "no");
+    geminiFreeVM(vm);
+    return 0;
+}
@@ -0,0 +1,124 @@
+// deserialize() rejects text that is not base64, bytes with a bad header,
+// values cut short anywhere in the payload, trailing bytes and unknown tags
+// with an error at the call's line, and the VM stays usable afterwards.
+// Corrupt inputs are built from real serialize() output: decoded, edited,
+// given a matching header length, and re-encoded.
+
+#include <stdio.h>
+#include <string.h>
+#include "gemini.h"
+
+#define HEADER_SIZE 13
+
+static const char* SCRIPT =
+    "function make() {\n"
+    "    var m = map();\n"
+    "    var a = array();\n"
+    "    push(a, 1);\n"
+    "    push(a, 2.5);\n"
+    "    push(a, \"three\");\n"
+    "    m[\"list\"] = a;\n"
+    "    m[\"again\"] = a;\n"
+    "    m[4] = map();\n"
+    "    return serialize(m);\n"
+    "}\n"
+    "function load(text) {\n"
+    "    return jsonStringify(deserialize(text));\n"
+    "}\n";
+
+static const char DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t decode64(const char* text, unsigned char* out) {
+    size_t n = 0;
+    uint32_t group = 0;
+    int bits = 0;
+    for (; *text && *text != '='; text++) {
+        group = group << 6 | (uint32_t)(strchr(DIGITS, *text) - DIGITS);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[n++] = (unsigned char)(group >> bits);
+        }
+    }
+    return n;
+}
+
+static void encode64(const unsigned char* bytes, size_t length, char* out) {
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t)bytes[i] << 16;
+        if (i + 1 < length) group |= (uint32_t)bytes[i + 1] << 8;
+        if (i + 2 < length) group |= bytes[i + 2];
+        *out++ = DIGITS[group >> 18 & 63];
+        *out++ = DIGITS[group >> 12 & 63];
+        *out++ = i + 1 < length ? DIGITS[group >> 6 & 63] : '=';
+        *out++ = i + 2 < length ? DIGITS[group & 63] : '=';
+    }
+    *out = '\0';
+}
+
+static void setPayloadLength(unsigned char* bytes, size_t length) {
+    uint64_t payload = length - HEADER_SIZE;
+    for (int i = 0; i < 8; i++) bytes[5 + i] = (unsigned char)(payload >> (8 * i));
+}
+
+static void tryLoad(GeminiVM* vm, const char* label, const char* text) {
+    Value result;
+    if (geminiCall(vm, "load", (Value[]){geminiString(text)}, 1, &result) == GEMINI_OK) {
+        printf("%s: %s\n", label, AS_STRING(result));
+    } else {
+        printf("%s: [line %d] %s\n", label, geminiErrorLine(vm), geminiErrorMessage(vm));
+    }
+}
+
+static void tryBytes(GeminiVM* vm, const char* label, const unsigned char* bytes, size_t length) {
+    char text[512];
+    encode64(bytes, length, text);
+    tryLoad(vm, label, text);
+}
+
+int main(void) {
+    GeminiVM* vm = geminiNewVM();
+    if (!vm) return 1;
+    Value made;
+    if (geminiLoad(vm, SCRIPT) != GEMINI_OK || geminiCall(vm, "make", NULL, 0, &made) != GEMINI_OK) {
+        printf("%s\n", geminiErrorMessage(vm));
+        return 1;
+    }
+    unsigned char good[256], bytes[256];
+    size_t length = decode64(AS_STRING(made), good);
+
+    tryLoad(vm, "intact", AS_STRING(made));
+    tryBytes(vm, "re-encoded", good, length);
+    tryLoad(vm, "not base64", "not serialized!");
+    tryLoad(vm, "one stray digit", "AAAAA");
+    tryLoad(vm, "empty", "");
+
+    memcpy(bytes, good, length);
+    bytes[0] = 'X';
+    tryBytes(vm, "bad magic", bytes, length);
+    memcpy(bytes, good, length);
+    bytes[4] = 99;
+    tryBytes(vm, "bad version", bytes, length);
+    tryBytes(vm, "header length not updated", good, length - 1);
+
+    // Every cut inside the payload, with the header describing the cut.
+    for (size_t cut = HEADER_SIZE; cut < length; cut++) {
+        char label[32];
+        memcpy(bytes, good, cut);
+        setPayloadLength(bytes, cut);
+        snprintf(label, sizeof(label), "cut at %zu", cut);
+        tryBytes(vm, label, bytes, cut);
+    }
+
+    memcpy(bytes, good, length);
+    bytes[length] = 0;
+    setPayloadLength(bytes, length + 1);
+    tryBytes(vm, "trailing byte", bytes, length + 1);
+    memcpy(bytes, good, length);
+    bytes[HEADER_SIZE] = 0xff;
+    tryBytes(vm, "unknown tag", bytes, length);
+
+    tryLoad(vm, "still usable", AS_STRING(made));
+    geminiFreeVM(vm);
+    return 0;
+}